@@ -191,6 +191,15 @@ typedef struct Context
 #if SUPPORT_PROFILE_GLSLES
     int profile_supports_glsles;
 #endif
+#if SUPPORT_PROFILE_GLSLUBO
+    int profile_supports_glslubo;
+#endif
+#if SUPPORT_PROFILE_GLSL330
+    int profile_supports_glsl330;
+#endif
+#if SUPPORT_PROFILE_GLSL420
+    int profile_supports_glsl420;
+#endif
 
 #if SUPPORT_PROFILE_METAL
     int metal_need_header_common;
@@ -226,6 +235,24 @@ typedef struct Context
 #define support_glsles(ctx) (0)
 #endif
 
+#if SUPPORT_PROFILE_GLSLUBO
+#define support_glslubo(ctx) ((ctx)->profile_supports_glslubo)
+#else
+#define support_glslubo(ctx) (0)
+#endif
+
+#if SUPPORT_PROFILE_GLSL330
+#define support_glsl330(ctx) ((ctx)->profile_supports_glsl330)
+#else
+#define support_glsl330(ctx) (0)
+#endif
+
+#if SUPPORT_PROFILE_GLSL420
+#define support_glsl420(ctx) ((ctx)->profile_supports_glsl420)
+#else
+#define support_glsl420(ctx) (0)
+#endif
+
 
 // Profile entry points...
 
@@ -2187,6 +2214,35 @@ static const char *get_GLSL_comparison_string_vector(Context *ctx)
 } // get_GLSL_comparison_string_vector
 
 
+#if SUPPORT_PROFILE_GLSL330
+static void output_GLSL_core_preflight(Context *ctx, const int version)
+{
+    // Same language as glsl120, written for a core profile context.
+    ctx->profile_supports_glsl120 = 1;
+    ctx->profile_supports_glsl330 = 1;
+    push_output(ctx, &ctx->preflight);
+    output_line(ctx, "#version %d", version);
+    output_line(ctx, "#ifdef GL_ARB_explicit_uniform_location");
+    output_line(ctx, "#extension GL_ARB_explicit_uniform_location : enable");
+    output_line(ctx, "#define UNIFORM_LOCATION(x) layout(location = x)");
+    output_line(ctx, "#else");
+    output_line(ctx, "#define UNIFORM_LOCATION(x)");
+    output_line(ctx, "#endif");
+    // Core GLSL overloads texture() instead of naming each variant.
+    output_line(ctx, "#define texture2D texture");
+    output_line(ctx, "#define texture2DProj textureProj");
+    output_line(ctx, "#define texture2DGrad textureGrad");
+    output_line(ctx, "#define texture2DProjGrad textureProjGrad");
+    output_line(ctx, "#define textureCube texture");
+    output_line(ctx, "#define textureCubeGrad textureGrad");
+    output_line(ctx, "#define texture3D texture");
+    output_line(ctx, "#define texture3DProj textureProj");
+    output_line(ctx, "#define texture3DGrad textureGrad");
+    output_line(ctx, "#define texture3DProjGrad textureProjGrad");
+    pop_output(ctx);
+} // output_GLSL_core_preflight
+#endif
+
 static void emit_GLSL_start(Context *ctx, const char *profilestr)
 {
     if (!shader_is_vertex(ctx) && !shader_is_pixel(ctx))
@@ -2214,6 +2270,35 @@ static void emit_GLSL_start(Context *ctx, const char *profilestr)
     } // else if
     #endif
 
+    #if SUPPORT_PROFILE_GLSLUBO
+    else if (strcmp(profilestr, MOJOSHADER_PROFILE_GLSLUBO) == 0)
+    {
+        // Same language as glsl120, the register files just move into
+        //  std140 uniform blocks. See emit_GLSL_finalize().
+        ctx->profile_supports_glsl120 = 1;
+        ctx->profile_supports_glslubo = 1;
+        push_output(ctx, &ctx->preflight);
+        output_line(ctx, "#version 120");
+        output_line(ctx, "#extension GL_ARB_uniform_buffer_object : require");
+        pop_output(ctx);
+    } // else if
+    #endif
+
+    #if SUPPORT_PROFILE_GLSL330
+    else if (strcmp(profilestr, MOJOSHADER_PROFILE_GLSL330) == 0)
+    {
+        output_GLSL_core_preflight(ctx, 330);
+    } // else if
+    #endif
+
+    #if SUPPORT_PROFILE_GLSL420
+    else if (strcmp(profilestr, MOJOSHADER_PROFILE_GLSL420) == 0)
+    {
+        ctx->profile_supports_glsl420 = 1;
+        output_GLSL_core_preflight(ctx, 420);
+    } // else if
+    #endif
+
     #if SUPPORT_PROFILE_GLSLES
     else if (strcmp(profilestr, MOJOSHADER_PROFILE_GLSLES) == 0)
     {
@@ -2281,6 +2366,9 @@ static void output_GLSL_uniform_array(Context *ctx, const RegisterType regtype,
 {
     if (size > 0)
     {
+        // Inside a uniform block, these are block members, not uniforms.
+        const char *qualifier = support_glslubo(ctx) ? "" : "uniform ";
+        char location[64] = { '\0' };
         char buf[64];
         get_GLSL_uniform_array_varname(ctx, regtype, buf, sizeof (buf));
         const char *typ;
@@ -2295,10 +2383,70 @@ static void output_GLSL_uniform_array(Context *ctx, const RegisterType regtype,
                 return;
             } // default
         } // switch
-        output_line(ctx, "uniform %s %s[%d];", typ, buf, size);
+
+        if (support_glsl330(ctx))
+        {
+            const int vs = shader_is_vertex(ctx);
+            int loc = 0;
+            int max = 0;
+            switch (regtype)
+            {
+                case REG_TYPE_CONST:
+                    loc = vs ? GLSL_LOCATION_VS_FLOAT4 : GLSL_LOCATION_PS_FLOAT4;
+                    max = vs ? GLSL_LOCATION_VS_INT4 : GLSL_LOCATION_PS_INT4;
+                    break;
+                case REG_TYPE_CONSTINT:
+                    loc = vs ? GLSL_LOCATION_VS_INT4 : GLSL_LOCATION_PS_INT4;
+                    max = vs ? GLSL_LOCATION_VS_BOOL : GLSL_LOCATION_PS_BOOL;
+                    break;
+                default:
+                    loc = vs ? GLSL_LOCATION_VS_BOOL : GLSL_LOCATION_PS_BOOL;
+                    max = vs ? GLSL_LOCATION_PS_FLOAT4 : GLSL_LOCATION_VPFLIP;
+                    break;
+            } // switch
+
+            if (size > (max - loc))
+            {
+                failf(ctx, "Too many %s registers for %s profile", typ,
+                      ctx->profile->name);
+                return;
+            } // if
+            snprintf(location, sizeof (location), "UNIFORM_LOCATION(%d) ", loc);
+        } // if
+
+        output_line(ctx, "%s%s%s %s[%d];", location, qualifier, typ, buf, size);
     } // if
 } // output_GLSL_uniform_array
 
+static void output_GLSL_uniform_arrays(Context *ctx)
+{
+    const int blocked = support_glslubo(ctx) &&
+                        ( (ctx->uniform_float4_count > 0) ||
+                          (ctx->uniform_int4_count > 0) ||
+                          (ctx->uniform_bool_count > 0) );
+
+    // The glslubo profile puts all three register files in one std140
+    //  block per stage, in this order, so the GL glue can find each array
+    //  at 16 bytes per element (bools included) without asking the driver.
+    if (blocked)
+    {
+        output_line(ctx, "layout(std140) uniform %s_uniforms",
+                    ctx->shader_type_str);
+        output_line(ctx, "{");
+        ctx->indent++;
+    } // if
+
+    output_GLSL_uniform_array(ctx, REG_TYPE_CONST, ctx->uniform_float4_count);
+    output_GLSL_uniform_array(ctx, REG_TYPE_CONSTINT, ctx->uniform_int4_count);
+    output_GLSL_uniform_array(ctx, REG_TYPE_CONSTBOOL, ctx->uniform_bool_count);
+
+    if (blocked)
+    {
+        ctx->indent--;
+        output_line(ctx, "};");
+    } // if
+} // output_GLSL_uniform_arrays
+
 static void emit_GLSL_finalize(Context *ctx)
 {
     // throw some blank lines around to make source more readable.
@@ -2314,12 +2462,18 @@ static void emit_GLSL_finalize(Context *ctx)
         fail(ctx, "Relative addressing of input registers not supported.");
 
     push_output(ctx, &ctx->preflight);
-    output_GLSL_uniform_array(ctx, REG_TYPE_CONST, ctx->uniform_float4_count);
-    output_GLSL_uniform_array(ctx, REG_TYPE_CONSTINT, ctx->uniform_int4_count);
-    output_GLSL_uniform_array(ctx, REG_TYPE_CONSTBOOL, ctx->uniform_bool_count);
+    output_GLSL_uniform_arrays(ctx);
 #ifdef MOJOSHADER_FLIP_RENDERTARGET
     if (shader_is_vertex(ctx))
-        output_line(ctx, "uniform float vpFlip;");
+    {
+        if (support_glsl330(ctx))
+        {
+            output_line(ctx, "UNIFORM_LOCATION(%d) uniform float vpFlip;",
+                        GLSL_LOCATION_VPFLIP);
+        } // if
+        else
+            output_line(ctx, "uniform float vpFlip;");
+    } // if
 #endif
     pop_output(ctx);
 } // emit_GLSL_finalize
@@ -2342,13 +2496,11 @@ static void emit_GLSL_global(Context *ctx, RegisterType regtype, int regnum)
                 //  ps_1_1 TEX opcode expects to overwrite it.
                 if (!shader_version_atleast(ctx, 1, 4))
                 {
-#if SUPPORT_PROFILE_GLSLES
-                    // GLSL ES does not have gl_TexCoord
-                    if (support_glsles(ctx))
+                    // GLSL ES and core GLSL do not have gl_TexCoord
+                    if (support_glsles(ctx) || support_glsl330(ctx))
                         output_line(ctx, "vec4 %s = io_%i_%i;",
                                     varname, MOJOSHADER_USAGE_TEXCOORD, regnum);
                     else
-#endif
                     output_line(ctx, "vec4 %s = gl_TexCoord[%d];",
                                 varname, regnum);
                 } // if
@@ -2511,7 +2663,12 @@ static void emit_GLSL_sampler(Context *ctx,int stage,TextureType ttype,int tb)
     get_GLSL_varname_in_buf(ctx, REG_TYPE_SAMPLER, stage, var, sizeof (var));
 
     push_output(ctx, &ctx->globals);
-    output_line(ctx, "uniform %s %s;", type, var);
+    // Vertex samplers' texture units depend on the GL context's setup, so
+    //  only pixel shaders can name theirs here.
+    if (support_glsl420(ctx) && shader_is_pixel(ctx))
+        output_line(ctx, "layout(binding = %d) uniform %s %s;", stage, type, var);
+    else
+        output_line(ctx, "uniform %s %s;", type, var);
     if (tb)  // This sampler used a ps_1_1 TEXBEM opcode?
     {
         char name[64];
@@ -2594,7 +2751,16 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
         if (regtype == REG_TYPE_INPUT)
         {
             push_output(ctx, &ctx->globals);
-            output_line(ctx, "attribute vec4 %s;", var);
+            if (support_glsl330(ctx))
+            {
+                const int loc = glsl_attribute_location(usage, index);
+                if (loc >= 0)
+                    output_line(ctx, "layout(location = %d) in vec4 %s;", loc, var);
+                else
+                    output_line(ctx, "in vec4 %s;", var);
+            } // if
+            else
+                output_line(ctx, "attribute vec4 %s;", var);
             pop_output(ctx);
         } // if
 
@@ -2613,6 +2779,8 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                     if (support_glsles(ctx))
                         break; // GLSL ES does not have gl_FrontColor
 #endif
+                    if (support_glsl330(ctx))
+                        break; // ...and neither does core GLSL.
                     index_str[0] = '\0';  // no explicit number.
                     if (index == 0)
                     {
@@ -2624,6 +2792,8 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                     } // else if
                     break;
                 case MOJOSHADER_USAGE_FOG:
+                    if (support_glsl330(ctx))
+                        break; // core GLSL does not have gl_FogFragCoord
                     usage_str = "gl_FogFragCoord";
                     break;
                 case MOJOSHADER_USAGE_TEXCOORD:
@@ -2631,6 +2801,8 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                     if (support_glsles(ctx))
                         break; // GLSL ES does not have gl_TexCoord
 #endif
+                    if (support_glsl330(ctx))
+                        break; // ...and neither does core GLSL.
                     snprintf(index_str, sizeof (index_str), "%u", (uint) index);
                     usage_str = "gl_TexCoord";
                     arrayleft = "[";
@@ -2652,7 +2824,10 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                     output_line(ctx, "varying highp vec4 io_%i_%i;", usage, index);
                 else
 #endif
-                output_line(ctx, "varying vec4 io_%i_%i;", usage, index);
+                if (support_glsl330(ctx))
+                    output_line(ctx, "out vec4 io_%i_%i;", usage, index);
+                else
+                    output_line(ctx, "varying vec4 io_%i_%i;", usage, index);
                 output_line(ctx, "#define %s io_%i_%i", var, usage, index);
             } // if
             else
@@ -2681,7 +2856,16 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
 
         if (regtype == REG_TYPE_COLOROUT)
         {
-            if (!ctx->have_multi_color_outputs)
+            if (support_glsl330(ctx))
+            {
+                // No gl_FragData in core GLSL; declare the output directly.
+                push_output(ctx, &ctx->globals);
+                output_line(ctx, "layout(location = %d) out vec4 %s;",
+                            regnum, var);
+                pop_output(ctx);
+                return;
+            } // if
+            else if (!ctx->have_multi_color_outputs)
                 usage_str = "gl_FragColor";  // maybe faster?
             else
             {
@@ -2698,8 +2882,12 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
         // !!! FIXME: can you actualy have a texture register with COLOR usage?
         else if ((regtype == REG_TYPE_TEXTURE) || (regtype == REG_TYPE_INPUT))
         {
+            // GLSL ES and core GLSL don't have the fixed-function varyings.
 #if SUPPORT_PROFILE_GLSLES
-            if (!support_glsles(ctx))
+            if (!support_glsles(ctx) && !support_glsl330(ctx))
+            {
+#else
+            if (!support_glsl330(ctx))
             {
 #endif
             if (usage == MOJOSHADER_USAGE_TEXCOORD)
@@ -2730,9 +2918,7 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                 // else
                 //    fail(ctx, "unsupported color index");
             } // else if
-#if SUPPORT_PROFILE_GLSLES
             } // if
-#endif
         } // else if
 
         else if (regtype == REG_TYPE_MISCTYPE)
@@ -2769,7 +2955,10 @@ static void emit_GLSL_attribute(Context *ctx, RegisterType regtype, int regnum,
                 output_line(ctx, "varying highp vec4 io_%i_%i;", usage, index);
             else
 #endif
-            output_line(ctx, "varying vec4 io_%i_%i;", usage, index);
+            if (support_glsl330(ctx))
+                output_line(ctx, "in vec4 io_%i_%i;", usage, index);
+            else
+                output_line(ctx, "varying vec4 io_%i_%i;", usage, index);
             output_line(ctx, "#define %s io_%i_%i", var, usage, index);
         } // if
         else
@@ -3953,7 +4142,8 @@ static void emit_GLSL_TEXLDD(Context *ctx)
     //  so we'll use them if available. Failing that, we'll just fallback
     //  to a regular texture2D call and hope the mipmap it chooses is close
     //  enough.
-    if (!ctx->glsl_generated_texldd_setup)
+    // Core GLSL has textureGrad(); see output_GLSL_core_preflight().
+    if ((!ctx->glsl_generated_texldd_setup) && (!support_glsl330(ctx)))
     {
         ctx->glsl_generated_texldd_setup = 1;
         push_output(ctx, &ctx->preflight);
@@ -8583,6 +8773,9 @@ static const struct { const char *from; const char *to; } profileMap[] =
 {
     { MOJOSHADER_PROFILE_GLSLES, MOJOSHADER_PROFILE_GLSL },
     { MOJOSHADER_PROFILE_GLSL120, MOJOSHADER_PROFILE_GLSL },
+    { MOJOSHADER_PROFILE_GLSLUBO, MOJOSHADER_PROFILE_GLSL },
+    { MOJOSHADER_PROFILE_GLSL330, MOJOSHADER_PROFILE_GLSL },
+    { MOJOSHADER_PROFILE_GLSL420, MOJOSHADER_PROFILE_GLSL },
     { MOJOSHADER_PROFILE_NV2, MOJOSHADER_PROFILE_ARB1 },
     { MOJOSHADER_PROFILE_NV3, MOJOSHADER_PROFILE_ARB1 },
     { MOJOSHADER_PROFILE_NV4, MOJOSHADER_PROFILE_ARB1 },
@@ -12106,6 +12299,9 @@ int MOJOSHADER_maxShaderModel(const char *profile)
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSL, 3);
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSL120, 3);
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSLES, 3);
+    PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSLUBO, 3);
+    PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSL330, 3);
+    PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_GLSL420, 3);
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_ARB1, 2);
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_NV2, 2);
     PROFILE_SHADER_MODEL(MOJOSHADER_PROFILE_NV3, 2);
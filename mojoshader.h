@@ -691,6 +691,32 @@ typedef struct MOJOSHADER_parseData
  */
 #define MOJOSHADER_PROFILE_GLSLES "glsles"
 
+/*
+ * Profile string for GLSL 1.20 with the constant register files in std140
+ *  uniform blocks (GL_ARB_uniform_buffer_object). Each stage gets one block,
+ *  named "vs_uniforms" or "ps_uniforms", holding the float4, int4 and bool
+ *  arrays in that order, every element padded to 16 bytes.
+ */
+#define MOJOSHADER_PROFILE_GLSLUBO "glslubo"
+
+/*
+ * Profile string for GLSL 3.30: core profile GLSL with explicit locations.
+ *  Vertex inputs are bound by usage, not by name: POSITION0 is location 0,
+ *  BLENDWEIGHT0 1, NORMAL0 2, COLOR0 3, COLOR1 4, BLENDINDICES0 5,
+ *  TANGENT0 6, BINORMAL0 7, and TEXCOORD0-7 are locations 8-15. Other
+ *  inputs are left for the linker to place. Varyings do not use the
+ *  fixed-function built-ins (gl_TexCoord, gl_FrontColor, etc).
+ *  If the GLSL compiler has GL_ARB_explicit_uniform_location, the register
+ *  file arrays get fixed locations, too.
+ */
+#define MOJOSHADER_PROFILE_GLSL330 "glsl330"
+
+/*
+ * Profile string for GLSL 4.20: the glsl330 profile, plus pixel shader
+ *  samplers use layout(binding) to name their texture unit directly.
+ */
+#define MOJOSHADER_PROFILE_GLSL420 "glsl420"
+
 /*
  * Profile string for OpenGL ARB 1.0 shaders: GL_ARB_(vertex|fragment)_program.
  */
@@ -2592,6 +2618,35 @@ DECLSPEC MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
                                         MOJOSHADER_malloc m, MOJOSHADER_free f,
                                         void *malloc_d);
 
+/*
+ * Prepare MojoShader to manage a GL context that shares objects with the
+ *  one (share) was made for, like a context for a second render thread or a
+ *  background loading thread.
+ *
+ * This works like MOJOSHADER_glCreateContext(), but the new context uses
+ *  (share)'s profile and allocator, and shaders compiled in either context
+ *  can be bound in the other, or in any other context made from either of
+ *  them. You must have actually created the GL contexts as sharing objects,
+ *  or the GL will reject the shaders. MojoShader can't check that for you.
+ *  Binding a shader in a context outside its share group fails, and
+ *  MOJOSHADER_glGetError() says why.
+ *
+ * Linked programs and uniforms still belong to each context. A shader can
+ *  be deleted from any context in its share group, but the GL shader isn't
+ *  freed until every context that linked it has deleted it or dropped the
+ *  program from its linker cache.
+ *
+ * (share) must stay alive at least until this returns, but contexts in a
+ *  share group can be destroyed in any order after that.
+ *
+ * This call is NOT thread safe with respect to (share)! Make sure nobody is
+ *  using it while this runs.
+ */
+DECLSPEC MOJOSHADER_glContext *MOJOSHADER_glCreateSharedContext(
+                                        MOJOSHADER_glContext *share,
+                                        MOJOSHADER_glGetProcAddress lookup,
+                                        void *lookup_d);
+
 /*
  * You must call this before using the context that you got from
  *  MOJOSHADER_glCreateContext(), and must use it when you switch to a new GL
@@ -2600,6 +2655,10 @@ DECLSPEC MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
  * You can only have one MOJOSHADER_glContext per actual GL context, or
  *  undefined behaviour will result.
  *
+ * The current context is per-thread, like the GL's, so each thread that
+ *  uses MojoShader needs to make its own context current. Two threads
+ *  should never use the same context at the same time.
+ *
  * It is legal to call this with a NULL pointer to make no context current,
  *  but you need a valid context to be current to use most of MojoShader.
  */
@@ -2628,7 +2687,9 @@ DECLSPEC void MOJOSHADER_glMakeContextCurrent(MOJOSHADER_glContext *ctx);
  *
  * This call does NOT require a valid MOJOSHADER_glContext to have been made
  *  current. The error buffer is shared between contexts, so you can get
- *  error results from a failed MOJOSHADER_glCreateContext().
+ *  error results from a failed MOJOSHADER_glCreateContext(). Each thread
+ *  has its own error buffer, though, so you only see errors from calls
+ *  this thread made.
  */
 DECLSPEC const char *MOJOSHADER_glGetError(void);
 
@@ -2660,6 +2721,12 @@ DECLSPEC int MOJOSHADER_glMaxUniforms(MOJOSHADER_shaderType shader_type);
  *
  * Returns NULL on error, or a shader handle on success.
  *
+ * Shaders are interned: if this context already compiled the same bytecode,
+ *  or bytecode that translates to the same source with the same uniforms,
+ *  samplers and attributes, you get that shader back instead of a new GL
+ *  object. Programs linked from it are shared, too. Each handle you get
+ *  still needs its own MOJOSHADER_glDeleteShader().
+ *
  * This call is NOT thread safe! As most OpenGL implementations are not thread
  *  safe, you should probably only call this from the same thread that created
  *  the GL context.
@@ -2667,7 +2734,8 @@ DECLSPEC int MOJOSHADER_glMaxUniforms(MOJOSHADER_shaderType shader_type);
  * This call requires a valid MOJOSHADER_glContext to have been made current,
  *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
  *
- * Compiled shaders from this function may not be shared between contexts.
+ * Compiled shaders from this function may only be shared between contexts
+ *  in the same share group. See MOJOSHADER_glCreateSharedContext().
  */
 DECLSPEC MOJOSHADER_glShader *MOJOSHADER_glCompileShader(const unsigned char *tokenbuf,
                                                          const unsigned int bufsize,
@@ -2682,10 +2750,90 @@ DECLSPEC MOJOSHADER_glShader *MOJOSHADER_glCompileShader(const unsigned char *to
  *  call to MOJOSHADER_glCompileShader().
  *
  * This data is read-only, and you should NOT attempt to free it. This
- *  pointer remains valid until the shader is deleted.
+ *  pointer remains valid until the shader is deleted. For an interned
+ *  shader, this may be the parse data of an earlier, equivalent compile.
+ *
+ * Shaders from MOJOSHADER_glQueueShader() return NULL here until they've
+ *  reached the GL (see MOJOSHADER_glShaderStatus()).
  */
 DECLSPEC const MOJOSHADER_parseData *MOJOSHADER_glGetShaderParseData(
                                                 MOJOSHADER_glShader *shader);
+
+/*
+ * Queue a buffer of Direct3D shader bytecode to be compiled later, so the
+ *  expensive translation can happen on other threads.
+ *
+ * This takes the same arguments as MOJOSHADER_glCompileShader(), plus the
+ *  context to queue it on, and copies all of them, so you can free your
+ *  buffers right away. Loading then goes through three steps:
+ *
+ *  - Any thread calls this to queue the bytecode.
+ *  - Your worker threads call MOJOSHADER_glTranslateQueuedShaders() to run
+ *    MOJOSHADER_parse() on it. MojoShader doesn't start threads itself.
+ *  - The GL thread calls MOJOSHADER_glCompileQueuedShaders() once a frame
+ *    to hand the results to the GL, within a time budget.
+ *
+ * The returned shader can be used right away, like a future.
+ *  MOJOSHADER_glShaderStatus() and MOJOSHADER_glBindShadersAsync() report
+ *  MOJOSHADER_GLSTATUS_PENDING until it reaches the GL. Everything else
+ *  that needs the shader finishes loading it on the spot: it gets translated
+ *  on the GL thread if no worker has started on it yet. If translation or
+ *  compilation fails, the shader's status is MOJOSHADER_GLSTATUS_FAILED
+ *  and MOJOSHADER_glGetShaderParseData() has any translation errors. Delete
+ *  it with MOJOSHADER_glDeleteShader(), as usual, even if it's still queued.
+ *
+ * Returns NULL if out of memory, or a shader handle on success. This doesn't
+ *  set the error string, since it might not be on the GL thread.
+ *
+ * This call is thread safe, so long as the context's allocator is. It does
+ *  not require a current context. The context must outlive the call.
+ */
+DECLSPEC MOJOSHADER_glShader *MOJOSHADER_glQueueShader(MOJOSHADER_glContext *ctx,
+                                                       const unsigned char *tokenbuf,
+                                                       const unsigned int bufsize,
+                                                       const MOJOSHADER_swizzle *swiz,
+                                                       const unsigned int swizcount,
+                                                       const MOJOSHADER_samplerMap *smap,
+                                                       const unsigned int smapcount);
+
+/*
+ * Translate shaders queued on (ctx) by MOJOSHADER_glQueueShader(), to be
+ *  handed to the GL later by MOJOSHADER_glCompileQueuedShaders(). This is
+ *  the worker thread half of the loading pipeline; it never touches the GL.
+ *
+ * Translates up to (max) shaders, or until the queue is empty if (max) is
+ *  zero or less. Returns the number of shaders translated, so zero means
+ *  the queue was empty and the worker can go back to sleep.
+ *
+ * This call is thread safe, so long as the context's allocator is. Any
+ *  number of threads may call it at once. It does not require a current
+ *  context. MOJOSHADER_glDestroyContext() waits for calls that are already
+ *  running to return, but you must not start any once it's been called.
+ */
+DECLSPEC int MOJOSHADER_glTranslateQueuedShaders(MOJOSHADER_glContext *ctx,
+                                                 int max);
+
+/*
+ * Hand shaders translated by MOJOSHADER_glTranslateQueuedShaders() to the
+ *  GL, in the order they finished translating. This is the GL thread half
+ *  of the loading pipeline; call it once per frame.
+ *
+ * This keeps compiling until (budget_usecs) microseconds have passed, so
+ *  loading doesn't hitch the frame. It always compiles at least one shader
+ *  if one is waiting. Zero means no budget: compile everything that's ready.
+ *
+ * Returns the number of queued shaders that still haven't reached the GL,
+ *  whether they're translated yet or not. Zero means loading is done.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC int MOJOSHADER_glCompileQueuedShaders(unsigned int budget_usecs);
+
 /*
  * Link a vertex and pixel shader into an OpenGL program.
  *  (vshader) or (pshader) can be NULL, to specify that the GL should use the
@@ -2698,6 +2846,12 @@ DECLSPEC const MOJOSHADER_parseData *MOJOSHADER_glGetShaderParseData(
  *
  * Once you have successfully linked a program, you may render with it.
  *
+ * If the GL has OpenGL 4.1 or GL_ARB_separate_shader_objects, the "glsl" and
+ *  "glsl120" profiles link each shader once, as its own separable program,
+ *  and a "program" here is just a pipeline object pairing them up. Relinking
+ *  a shader in a new combination is then nearly free. Other profiles, and
+ *  GLs without the extension, link every pair the classic way.
+ *
  * Returns NULL on error, or a program handle on success.
  *
  * This call is NOT thread safe! As most OpenGL implementations are not thread
@@ -2745,6 +2899,7 @@ DECLSPEC void MOJOSHADER_glBindProgram(MOJOSHADER_glProgram *program);
  *  invidual shaders in it is deleted, otherwise they remain cached so future
  *  calls to this function don't need to relink a previously-used shader
  *  grouping.
+ *  MOJOSHADER_glSetLinkerCacheBudget() can put a limit on this cache.
  *
  * This function is for convenience, as the API is closer to how Direct3D
  *  works, and retrofitting linking into your app can be difficult;
@@ -2763,6 +2918,105 @@ DECLSPEC void MOJOSHADER_glBindProgram(MOJOSHADER_glProgram *program);
 DECLSPEC void MOJOSHADER_glBindShaders(MOJOSHADER_glShader *vshader,
                                        MOJOSHADER_glShader *pshader);
 
+/*
+ * Where an asynchronous compile or link is. See
+ *  MOJOSHADER_glSetAsyncCompile().
+ */
+typedef enum MOJOSHADER_glStatus
+{
+    MOJOSHADER_GLSTATUS_FAILED = -1,
+    MOJOSHADER_GLSTATUS_PENDING = 0,
+    MOJOSHADER_GLSTATUS_READY = 1
+} MOJOSHADER_glStatus;
+
+/*
+ * Stop waiting on the driver after every compile and link.
+ *
+ * Normally MOJOSHADER_glCompileShader(), MOJOSHADER_glLinkProgram() and
+ *  friends ask the GL whether the compile or link worked as soon as they
+ *  submit it, which makes the calling thread wait for the driver. With this
+ *  enabled, they submit the work and return; errors are reported later, by
+ *  MOJOSHADER_glShaderStatus(), MOJOSHADER_glProgramStatus() and
+ *  MOJOSHADER_glBindShadersAsync(). A program that isn't finished yet
+ *  still works with MOJOSHADER_glBindProgram() and
+ *  MOJOSHADER_glBindShaders(), which wait for it, and a program that failed
+ *  is never bound by them.
+ *
+ * With GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile, the
+ *  driver compiles on its own threads and status checks that don't wait
+ *  really don't block. Without it, the first status check waits.
+ *
+ * This only works for the GLSL profiles on GL 2.0 or later. Returns non-zero
+ *  if async compiles are now enabled. Passing zero turns them off again; work
+ *  that was already submitted still finishes the async way.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC int MOJOSHADER_glSetAsyncCompile(int enable);
+
+/*
+ * Check on a shader compiled while MOJOSHADER_glSetAsyncCompile() was on.
+ *
+ * If (wait) is non-zero, this blocks until the driver is done. Otherwise it
+ *  may return MOJOSHADER_GLSTATUS_PENDING. On MOJOSHADER_GLSTATUS_FAILED,
+ *  MOJOSHADER_glGetError() has the compiler's log. Shaders compiled
+ *  synchronously are always MOJOSHADER_GLSTATUS_READY.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC MOJOSHADER_glStatus MOJOSHADER_glShaderStatus(
+                                                MOJOSHADER_glShader *shader,
+                                                int wait);
+
+/*
+ * Check on a program linked while MOJOSHADER_glSetAsyncCompile() was on.
+ *  This works like MOJOSHADER_glShaderStatus(). When a link finishes, this
+ *  also does the uniform and attribute lookups that a synchronous link does
+ *  right away.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC MOJOSHADER_glStatus MOJOSHADER_glProgramStatus(
+                                                MOJOSHADER_glProgram *program,
+                                                int wait);
+
+/*
+ * Like MOJOSHADER_glBindShaders(), but it never waits on the driver.
+ *
+ * If the linked program for this pair is ready, it is bound and this returns
+ *  MOJOSHADER_GLSTATUS_READY. If the program is still compiling or linking,
+ *  the current binding is left alone and this returns
+ *  MOJOSHADER_GLSTATUS_PENDING, so you can skip the draw (or draw with
+ *  something else) and try again next frame. MOJOSHADER_GLSTATUS_FAILED
+ *  means the pair will never link; MOJOSHADER_glGetError() says why, the
+ *  first time.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC MOJOSHADER_glStatus MOJOSHADER_glBindShadersAsync(
+                                                MOJOSHADER_glShader *vshader,
+                                                MOJOSHADER_glShader *pshader);
+
 /*
  * Set a floating-point uniform value (what Direct3D calls a "constant").
  *
@@ -3110,7 +3364,11 @@ DECLSPEC int MOJOSHADER_glGetVertexAttribLocation(MOJOSHADER_usage usage, int in
  *
  * (size), (type), (normalized), (stride), and (ptr) correspond to
  *  glVertexAttribPointer()'s parameters (in most cases, these get passed
- *  unmolested to that very entry point during this function).
+ *  unmolested to that very entry point during this function). Once you've
+ *  called MOJOSHADER_glSetVertexBuffer(), or while a cached vertex array from
+ *  MOJOSHADER_glSetVertexArrayCache() is bound, the GL call is skipped if
+ *  they and the buffer match what this array already has. Otherwise every
+ *  call reaches the GL, as it always did.
  *
  * This call is NOT thread safe! As most OpenGL implementations are not thread
  *  safe, you should probably only call this from the same thread that created
@@ -3148,6 +3406,77 @@ DECLSPEC void MOJOSHADER_glSetVertexAttribute(MOJOSHADER_usage usage,
 DECLSPEC void MOJOSHADER_glSetVertexAttribDivisor(MOJOSHADER_usage usage,
                                                   int index, unsigned int divisor);
 
+/*
+ * Tell MojoShader what you have bound to GL_ARRAY_BUFFER, before the
+ *  MOJOSHADER_glSetVertexAttribute() calls that use it. Pass zero for client
+ *  memory arrays.
+ *
+ * This is optional, and opts you in to redundant glVertexAttribPointer()
+ *  calls being skipped in your own vertex array. MojoShader can't ask the GL
+ *  which buffer is bound without stalling threaded drivers, so it takes
+ *  your word for it. From your first call on, MojoShader assumes it's the
+ *  only thing changing vertex attribute pointers, so don't call
+ *  glVertexAttribPointer() yourself, and call this again whenever you bind
+ *  a different GL_ARRAY_BUFFER.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ *
+ * Vertex attributes are not shared between contexts.
+ */
+DECLSPEC void MOJOSHADER_glSetVertexBuffer(unsigned int buffer);
+
+/*
+ * Keep a vertex array object for each combination of program attribute
+ *  layout and vertex declaration, so switching back to one we've seen is a
+ *  single glBindVertexArray() instead of resetting every attribute.
+ *
+ * Programs whose attributes landed in the same locations share a layout.
+ *  The vertex declaration is whatever you last passed to
+ *  MOJOSHADER_glSetVertexDeclaration(). While that is zero, MojoShader uses
+ *  the vertex array you had bound when you turned the cache on, exactly as
+ *  it would without the cache.
+ *
+ * The cached vertex arrays are bound by MOJOSHADER_glSetVertexAttribute(),
+ *  MOJOSHADER_glSetVertexAttribDivisor() and MOJOSHADER_glProgramReady().
+ *  Remember that the GL_ELEMENT_ARRAY_BUFFER binding belongs to the vertex
+ *  array, so bind your index buffer after MOJOSHADER_glProgramReady().
+ *
+ * Returns nonzero if the cache is enabled. This needs OpenGL 3.0 or
+ *  GL_ARB_vertex_array_object. Disabling it deletes the cached vertex
+ *  arrays and rebinds your original one.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC int MOJOSHADER_glSetVertexArrayCache(int enable);
+
+/*
+ * Tell MojoShader which vertex declaration you're about to draw with, for
+ *  MOJOSHADER_glSetVertexArrayCache().
+ *
+ * (decl) is any nonzero value that identifies the declaration's formats,
+ *  strides and the buffers feeding it. A hash of your declaration and buffer
+ *  handles works well. Pass zero for draws that shouldn't use the cache.
+ *  This does nothing when the cache is disabled.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC void MOJOSHADER_glSetVertexDeclaration(unsigned long long decl);
+
 /*
  * Inform MojoShader that it should commit any pending state to the GL. This
  *  must be called after you bind a program and update any inputs, right
@@ -3163,6 +3492,62 @@ DECLSPEC void MOJOSHADER_glSetVertexAttribDivisor(MOJOSHADER_usage usage,
  */
 DECLSPEC void MOJOSHADER_glProgramReady(void);
 
+/*
+ * These are the equivalents of MOJOSHADER_glCompileShader(),
+ *  MOJOSHADER_glBindProgram(), MOJOSHADER_glBindShaders(),
+ *  MOJOSHADER_glSet*ShaderUniform*() and MOJOSHADER_glProgramReady() for
+ *  an explicit context (ctx), instead of the current one. They're meant for
+ *  renderers that drive several contexts and would rather not switch the
+ *  current one back and forth. (ctx)'s GL context must still be current on
+ *  this thread.
+ *
+ * For the length of the call, (ctx) is made this thread's current MojoShader
+ *  context, and the previous one is put back when it returns. Other threads
+ *  never see this, but anything the call itself runs does: if your allocator
+ *  or other callbacks call back into MojoShader, they'll be using (ctx).
+ *
+ * This call is NOT thread safe with respect to (ctx)! Only one thread may use
+ *  a context at a time.
+ */
+DECLSPEC MOJOSHADER_glShader *MOJOSHADER_glContextCompileShader(
+                                        MOJOSHADER_glContext *ctx,
+                                        const unsigned char *tokenbuf,
+                                        const unsigned int bufsize,
+                                        const MOJOSHADER_swizzle *swiz,
+                                        const unsigned int swizcount,
+                                        const MOJOSHADER_samplerMap *smap,
+                                        const unsigned int smapcount);
+DECLSPEC void MOJOSHADER_glContextBindProgram(MOJOSHADER_glContext *ctx,
+                                              MOJOSHADER_glProgram *program);
+DECLSPEC void MOJOSHADER_glContextBindShaders(MOJOSHADER_glContext *ctx,
+                                              MOJOSHADER_glShader *vshader,
+                                              MOJOSHADER_glShader *pshader);
+DECLSPEC void MOJOSHADER_glContextSetVertexShaderUniformF(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const float *data,
+                                        unsigned int vec4count);
+DECLSPEC void MOJOSHADER_glContextSetVertexShaderUniformI(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const int *data,
+                                        unsigned int ivec4count);
+DECLSPEC void MOJOSHADER_glContextSetVertexShaderUniformB(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const int *data,
+                                        unsigned int bcount);
+DECLSPEC void MOJOSHADER_glContextSetPixelShaderUniformF(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const float *data,
+                                        unsigned int vec4count);
+DECLSPEC void MOJOSHADER_glContextSetPixelShaderUniformI(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const int *data,
+                                        unsigned int ivec4count);
+DECLSPEC void MOJOSHADER_glContextSetPixelShaderUniformB(
+                                        MOJOSHADER_glContext *ctx,
+                                        unsigned int idx, const int *data,
+                                        unsigned int bcount);
+DECLSPEC void MOJOSHADER_glContextProgramReady(MOJOSHADER_glContext *ctx);
+
 #ifdef MOJOSHADER_FLIP_RENDERTARGET
 // !!! FIXME: Document me.
 DECLSPEC void MOJOSHADER_glProgramViewportFlip(int flip);
@@ -3192,6 +3577,10 @@ DECLSPEC void MOJOSHADER_glDeleteProgram(MOJOSHADER_glProgram *program);
  *  bound with MOJOSHADER_glBindShaders()), it will be deleted as soon as all
  *  referencing programs are deleted and it is no longer bound, too.
  *
+ * If MOJOSHADER_glCompileShader() handed this shader out more than once (see
+ *  there), this only drops one reference; the shader and the programs it
+ *  was linked into stay until the last one is deleted.
+ *
  * This call is NOT thread safe! As most OpenGL implementations are not thread
  *  safe, you should probably only call this from the same thread that created
  *  the GL context.
@@ -3201,6 +3590,394 @@ DECLSPEC void MOJOSHADER_glDeleteProgram(MOJOSHADER_glProgram *program);
  */
 DECLSPEC void MOJOSHADER_glDeleteShader(MOJOSHADER_glShader *shader);
 
+/*
+ * Counters collected by the current MOJOSHADER_glContext, so you can see
+ *  how much work the runtime is doing (and how much it is avoiding).
+ *
+ * This structure may grow in future revisions; always fill it in with
+ *  MOJOSHADER_glGetStats() rather than building one yourself.
+ */
+typedef struct MOJOSHADER_glStats
+{
+    /*
+     * Effect render states reported by MOJOSHADER_glEffectGetStateDelta(),
+     *  and the ones it dropped because they were already applied.
+     */
+    unsigned long long render_states_applied;
+    unsigned long long render_states_elided;
+
+    /*
+     * Effect sampler states reported by MOJOSHADER_glEffectGetStateDelta(),
+     *  and the ones it dropped because they were already applied.
+     */
+    unsigned long long sampler_states_applied;
+    unsigned long long sampler_states_elided;
+
+    /*
+     * Programs linked from a cached binary, and links that had to compile
+     *  from scratch (no cached binary, or the driver rejected it). These stay
+     *  zero unless MOJOSHADER_glSetProgramBinaryCache() is enabled.
+     */
+    unsigned long long program_binaries_loaded;
+    unsigned long long program_binaries_missed;
+
+    /*
+     * Bytes currently allocated for this context's constant register files.
+     *  These grow to the highest register your shaders and
+     *  MOJOSHADER_gl*ShaderUniform*() calls have touched, instead of the
+     *  full shader model 3 range up front.
+     */
+    unsigned long long register_file_bytes;
+
+    /*
+     * Full GLSL program links done by the driver, and program pipelines
+     *  created to pair separable shaders (see MOJOSHADER_glLinkProgram()).
+     *  With pipelines, links should track the number of shaders you use,
+     *  not the number of vertex/pixel combinations.
+     */
+    unsigned long long program_links;
+    unsigned long long program_pipelines;
+
+    /*
+     * MOJOSHADER_glBindShaders() lookups that found an already-linked
+     *  program, lookups that had to link one, and programs dropped to stay
+     *  inside the budget from MOJOSHADER_glSetLinkerCacheBudget().
+     */
+    unsigned long long linker_cache_hits;
+    unsigned long long linker_cache_misses;
+    unsigned long long linker_cache_evictions;
+
+    /*
+     * Programs currently in the linker cache, and the memory MojoShader has
+     *  allocated for them. The GL's own copies aren't included, since we
+     *  can't see them.
+     */
+    unsigned long long linker_cache_programs;
+    unsigned long long linker_cache_bytes;
+
+    /*
+     * Shaders queued with MOJOSHADER_glQueueShader(), how many of those have
+     *  been translated, and how many have reached the GL. The time spent
+     *  translating (on whichever thread did it) is in microseconds. The GL
+     *  compile time covers every shader, queued or not; divide it by
+     *  shaders_compiled, below, for an average.
+     */
+    unsigned long long shaders_queued;
+    unsigned long long shaders_translated;
+    unsigned long long shaders_loaded;
+    unsigned long long shader_translate_usecs;
+    unsigned long long shader_compile_usecs;
+
+    /*
+     * Microseconds from MOJOSHADER_glQueueShader() to a shader reaching the
+     *  GL: the total over all loaded shaders, and the worst one.
+     */
+    unsigned long long shader_load_latency_usecs;
+    unsigned long long shader_load_latency_max_usecs;
+
+    /*
+     * glVertexAttribPointer() and glVertexAttribDivisor() calls made by
+     *  MOJOSHADER_glSetVertexAttribute() and
+     *  MOJOSHADER_glSetVertexAttribDivisor(), and the ones skipped because
+     *  that array already had that exact state.
+     */
+    unsigned long long vertex_attribs_applied;
+    unsigned long long vertex_attribs_elided;
+
+    /*
+     * glBindVertexArray() calls made to switch between cached vertex arrays,
+     *  and how many vertex array objects are in the cache right now. These
+     *  stay zero unless MOJOSHADER_glSetVertexArrayCache() is enabled.
+     */
+    unsigned long long vertex_array_binds;
+    unsigned long long vertex_array_objects;
+
+    /*
+     * GL calls MOJOSHADER_glProgramReady() made to upload uniform registers,
+     *  and how many bytes they sent. Only registers that changed are sent,
+     *  in a few runs per array, so bytes should track how much you actually
+     *  change between draws, not how many uniforms your shaders declare.
+     */
+    unsigned long long uniform_uploads;
+    unsigned long long uniform_bytes_uploaded;
+
+    /*
+     * Shaders handed to the GL's compiler, from any source: direct
+     *  compiles, queued loads and effects. Their compile time is in
+     *  shader_compile_usecs, above.
+     */
+    unsigned long long shaders_compiled;
+
+    /*
+     * Microseconds spent linking programs, cache misses included. With
+     *  MOJOSHADER_glSetAsyncCompile(), this only covers starting the link.
+     */
+    unsigned long long program_link_usecs;
+
+    /*
+     * MOJOSHADER_glBindProgram() calls (direct, or through
+     *  MOJOSHADER_glBindShaders() and effects) that changed the program.
+     */
+    unsigned long long program_binds;
+
+    /*
+     * MOJOSHADER_glProgramReady() calls, and how many of them had to push
+     *  uniforms to the GL. The rest found nothing had changed.
+     */
+    unsigned long long program_ready_calls;
+    unsigned long long program_ready_pushes;
+
+    /*
+     * Preshaders run by effects, to compute constants or to select shaders
+     *  from an array, and MOJOSHADER_glEffectCommitChanges() calls,
+     *  including the ones made by MOJOSHADER_glEffectBeginPass().
+     */
+    unsigned long long preshader_runs;
+    unsigned long long effect_commits;
+
+    /*
+     * Shader compiles (direct or from effects) that got an existing shader
+     *  back, because the same bytecode or the same translated source was
+     *  already compiled in this context. These don't count toward
+     *  shaders_compiled.
+     */
+    unsigned long long shaders_interned;
+} MOJOSHADER_glStats;
+
+/*
+ * One GL call recorded by MOJOSHADER_glSetTrace().
+ *
+ * (function) is a number you can pass to MOJOSHADER_glTraceFunctionName(),
+ *  or MOJOSHADER_GLTRACE_FRAME for a MOJOSHADER_glTraceFrame() marker.
+ *  (args) are the call's arguments in order, widened to 64 bits, with floats
+ *  stored as their bit patterns and unused slots set to zero. Pointers to
+ *  data MojoShader passed in (uniform arrays, shader source, names) are
+ *  recorded as zero; (payload_bytes) is how much data they pointed to and
+ *  (payload_hash) is a hash of it, so identical uploads have identical
+ *  hashes. Other pointers, like glVertexAttribPointer() offsets, are kept.
+ *
+ * (usecs) is when the call started, in microseconds since tracing was
+ *  enabled, and (duration_usecs) is how long the GL took to return.
+ */
+#define MOJOSHADER_GLTRACE_FRAME 0
+#define MOJOSHADER_GLTRACE_MAX_ARGS 6
+
+typedef struct MOJOSHADER_glTraceCall
+{
+    unsigned long long usecs;
+    unsigned long long payload_hash;
+    unsigned long long args[MOJOSHADER_GLTRACE_MAX_ARGS];
+    unsigned int payload_bytes;
+    unsigned int duration_usecs;
+    unsigned int function;
+} MOJOSHADER_glTraceCall;
+
+/*
+ * Record every GL call the current context makes into a ring buffer that
+ *  holds the last (max_calls) calls. Zero turns recording off and frees the
+ *  buffer, which is the default. Enabling it again starts a new, empty trace.
+ *
+ * This only works if MojoShader was built with MOJOSHADER_GL_TRACE defined
+ *  (the MS_GL_TRACE CMake option). That build wraps every GL entry point
+ *  MojoShader loads, so it's meant for debugging and profiling, not release
+ *  builds. It doesn't need a real GL; a stub MOJOSHADER_glGetProcAddress
+ *  works fine.
+ *
+ * Returns nonzero on success, zero if tracing isn't built in or we ran out
+ *  of memory. MOJOSHADER_glGetError() will say which.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC int MOJOSHADER_glSetTrace(unsigned int max_calls);
+
+/*
+ * Mark the end of a frame in the current context's trace, so
+ *  MOJOSHADER_glAnalyzeTrace() can report per-frame numbers. Call it once
+ *  per frame, around your SwapBuffers. This does nothing if tracing is off.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC void MOJOSHADER_glTraceFrame(void);
+
+/*
+ * Copy the most recent (max_calls) calls from the current context's trace
+ *  into (calls), oldest first. Returns the number copied. If (calls) is NULL,
+ *  returns how many calls the trace holds right now instead. Either way,
+ *  this returns zero if tracing is off.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC unsigned int MOJOSHADER_glGetTrace(MOJOSHADER_glTraceCall *calls,
+                                            unsigned int max_calls);
+
+/*
+ * Get the name of a GL function in a MOJOSHADER_glTraceCall, like
+ *  "glUniform4fv". Returns "frame" for MOJOSHADER_GLTRACE_FRAME, and NULL
+ *  for numbers MojoShader doesn't know.
+ *
+ * This call is thread safe and doesn't need a context.
+ */
+DECLSPEC const char *MOJOSHADER_glTraceFunctionName(unsigned int function);
+
+/*
+ * What MOJOSHADER_glAnalyzeTrace() found.
+ *
+ * A call is redundant if it set a piece of GL state to the value it already
+ *  had, as far as the trace shows: glUseProgram() of the current program,
+ *  glUniform*() with the same data for the same location of the same
+ *  program, glVertexAttribPointer() with the same arguments, and so on.
+ *  Queries, creates, deletes and compiles are never redundant. The state
+ *  before the first call in the trace is unknown, so the first call that
+ *  sets any given state is never redundant. The analyzer can only see calls
+ *  MojoShader made, so if your app changes the same state (binding buffers,
+ *  say), take the attribute numbers with a grain of salt.
+ *
+ * Per-frame numbers only count frames between two MOJOSHADER_glTraceFrame()
+ *  markers. (functions) lists every function that was called, busiest
+ *  first.
+ */
+#define MOJOSHADER_GLTRACE_MAX_FUNCTIONS 128
+
+typedef struct MOJOSHADER_glTraceFunctionReport
+{
+    const char *name;
+    unsigned int calls;
+    unsigned int redundant;
+    double redundant_percent;
+    unsigned long long usecs;  /* total time spent in the GL. */
+} MOJOSHADER_glTraceFunctionReport;
+
+typedef struct MOJOSHADER_glTraceReport
+{
+    unsigned int calls;
+    unsigned int redundant;
+    double redundant_percent;
+    unsigned int frames;
+    double calls_per_frame;
+    double redundant_per_frame;
+    unsigned int max_frame_calls;
+    unsigned int function_count;
+    MOJOSHADER_glTraceFunctionReport functions[MOJOSHADER_GLTRACE_MAX_FUNCTIONS];
+} MOJOSHADER_glTraceReport;
+
+/*
+ * Count calls and find redundant ones in (count) calls from
+ *  MOJOSHADER_glGetTrace(), and fill in (report).
+ *
+ * (m), (f) and (d) are an allocator for the analyzer's scratch memory, like
+ *  MOJOSHADER_parse() takes. They may be NULL to use malloc() and free().
+ *
+ * Returns nonzero on success, zero if out of memory.
+ *
+ * This call is thread safe, so long as (m) and (f) are too. It doesn't need
+ *  a context, so you can save traces and analyze them elsewhere.
+ */
+DECLSPEC int MOJOSHADER_glAnalyzeTrace(const MOJOSHADER_glTraceCall *calls,
+                                       unsigned int count,
+                                       MOJOSHADER_glTraceReport *report,
+                                       MOJOSHADER_malloc m,
+                                       MOJOSHADER_free f, void *d);
+
+/*
+ * Limit how many programs MOJOSHADER_glBindShaders() keeps linked.
+ *
+ * By default, every vertex/pixel shader pair you bind stays linked until one
+ *  of its shaders is deleted. With a budget, the least recently bound
+ *  programs are deleted once the cache holds more than (max_programs)
+ *  programs, or more than (max_bytes) of MojoShader's own memory for them
+ *  (see linker_cache_bytes in MOJOSHADER_glStats). Zero means no limit for
+ *  either value. A program is never evicted while it is bound, and binding
+ *  that pair again later just relinks it.
+ *
+ * Lowering the budget evicts programs right away, if it can.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC void MOJOSHADER_glSetLinkerCacheBudget(unsigned long long max_programs,
+                                               unsigned long long max_bytes);
+
+/*
+ * Cache linked GLSL programs on disk between runs.
+ *
+ * (dirname) is an existing, writable directory; MojoShader will not create
+ *  it. Pass NULL to turn caching off again, which is the default. Once set,
+ *  MOJOSHADER_glLinkProgram() (and the implicit links done by
+ *  MOJOSHADER_glBindShaders()) will try to load a program binary for the
+ *  pair of shaders before linking, and save the driver's binary after a
+ *  successful full link.
+ *
+ * Cached binaries are keyed by a hash of both shaders' generated source and
+ *  the GL_RENDERER and GL_VERSION strings, so a new driver or GPU just misses
+ *  the cache. If the driver rejects a binary anyhow, the program is linked
+ *  normally and the cached file is replaced.
+ *
+ * This needs OpenGL 4.1 or GL_ARB_get_program_binary, and only applies to
+ *  the GLSL profiles. Returns non-zero if binaries will be cached, zero if
+ *  (dirname) is NULL, the GL can't do it, or we ran out of memory. The
+ *  directory is remembered even when this returns zero.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC int MOJOSHADER_glSetProgramBinaryCache(const char *dirname);
+
+/*
+ * Copy the current context's counters into (stats).
+ *
+ * The counters are cheap enough to leave on in shipping builds: each one is
+ *  a plain relaxed store, with no locking on the rendering path.
+ *
+ * This call is safe to make from another thread while the GL thread is
+ *  rendering, if that thread has made the same context current. Each
+ *  counter is read whole, but they aren't read all at the same instant.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC void MOJOSHADER_glGetStats(MOJOSHADER_glStats *stats);
+
+/*
+ * Set the current context's counters back to zero.
+ *
+ * Fields that describe what exists right now, rather than what has
+ *  happened, are kept: register_file_bytes, linker_cache_programs,
+ *  linker_cache_bytes and vertex_array_objects. Call this once per frame
+ *  (or per level) to get per-frame numbers out of MOJOSHADER_glGetStats().
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ *  safe, you should probably only call this from the same thread that created
+ *  the GL context. Counts made by shader translation threads while this runs
+ *  may or may not be cleared.
+ *
+ * This call requires a valid MOJOSHADER_glContext to have been made current,
+ *  or it will crash your program. See MOJOSHADER_glMakeContextCurrent().
+ */
+DECLSPEC void MOJOSHADER_glResetStats(void);
+
 /*
  * Deinitialize MojoShader's OpenGL shader management.
  *
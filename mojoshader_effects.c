@@ -834,6 +834,64 @@ static void readlargeobjects(const uint32 numlargeobjects,
     } // for
 } // readobjects
 
+static inline int isnumericparam(const MOJOSHADER_effectParam *param)
+{
+    return (param->value.type.parameter_class != MOJOSHADER_SYMCLASS_OBJECT);
+} // isnumericparam
+
+static inline int isinparamstorage(const MOJOSHADER_effect *effect,
+                                   const MOJOSHADER_effectParam *param)
+{
+    const char *values = (const char *) param->value.values;
+    const char *storage = (const char *) effect->param_storage;
+    return ((storage != NULL) && isnumericparam(param) && (values >= storage)
+         && (values < storage + effect->param_storage_size));
+} // isinparamstorage
+
+/* Move every numeric parameter value into one 16-byte aligned block, so that
+ * parameter blocks can copy and diff them wholesale. If we can't get the
+ * memory, the values just stay where they were and param blocks are
+ * unavailable for this effect.
+ */
+static void layoutparamstorage(MOJOSHADER_effect *effect)
+{
+    MOJOSHADER_malloc m = effect->malloc;
+    MOJOSHADER_free f = effect->free;
+    void *d = effect->malloc_data;
+    uint32 siz = 0;
+    char *storage;
+    int i;
+
+    for (i = 0; i < effect->param_count; i++)
+        if (isnumericparam(&effect->params[i]))
+            siz = ((siz + 15) & ~15) + (effect->params[i].value.value_count * 4);
+    siz = (siz + 15) & ~15;
+    if (siz == 0)
+        return;
+
+    storage = (char *) m(siz, d);
+    if (storage == NULL)
+        return;
+    memset(storage, '\0', siz);
+
+    siz = 0;
+    for (i = 0; i < effect->param_count; i++)
+    {
+        MOJOSHADER_effectValue *value = &effect->params[i].value;
+        if (!isnumericparam(&effect->params[i]))
+            continue;
+        siz = (siz + 15) & ~15;
+        memcpy(storage + siz, value->values, value->value_count * 4);
+        f(value->values, d);
+        value->values = storage + siz;
+        siz += value->value_count * 4;
+    } // for
+
+    effect->param_storage = storage;
+    effect->param_storage_size = (siz + 15) & ~15;
+} // layoutparamstorage
+
+
 MOJOSHADER_effect *MOJOSHADER_parseEffect(const char *profile,
                                           const unsigned char *buf,
                                           const unsigned int _len,
@@ -954,6 +1012,8 @@ MOJOSHADER_effect *MOJOSHADER_parseEffect(const char *profile,
         goto parseEffect_outOfMemory;
     strcpy((char *) retval->profile, profile);
 
+    layoutparamstorage(retval);
+
     return retval;
 
 // !!! FIXME: do something with this.
@@ -1020,6 +1080,8 @@ void MOJOSHADER_freeEffect(const MOJOSHADER_effect *_effect)
     for (i = 0; i < effect->param_count; i++)
     {
         MOJOSHADER_effectParam *param = &effect->params[i];
+        if (isinparamstorage(effect, param))
+            param->value.values = NULL;  // freed with param_storage below.
         freevalue(&param->value, f, d);
         for (j = 0; j < param->annotation_count; j++)
         {
@@ -1028,6 +1090,7 @@ void MOJOSHADER_freeEffect(const MOJOSHADER_effect *_effect)
         f((void *) param->annotations, d);
     } // for
     f((void *) effect->params, d);
+    f(effect->param_storage, d);
 
     /* Free techniques, including passes and all annotations */
     for (i = 0; i < effect->technique_count; i++)
@@ -1411,7 +1474,8 @@ MOJOSHADER_parseData *copyparsedata(const MOJOSHADER_parseData *src,
     retval->swizzle_count = src->swizzle_count;
     retval->swizzles = (MOJOSHADER_swizzle *) m(siz, d);
     // !!! FIXME: Out of memory check!
-    memcpy(retval->swizzles, src->swizzles, siz);
+    if (siz > 0)  // (src->swizzles) is NULL when there aren't any.
+        memcpy(retval->swizzles, src->swizzles, siz);
 
     /* Copy symbols */
     siz = sizeof (MOJOSHADER_symbol) * src->symbol_count;
@@ -1647,6 +1711,8 @@ MOJOSHADER_effect *MOJOSHADER_cloneEffect(const MOJOSHADER_effect *effect)
 
     #undef COPY_STRING
 
+    layoutparamstorage(clone);
+
     return clone;
 
 cloneEffect_outOfMemory:
@@ -1655,6 +1721,16 @@ cloneEffect_outOfMemory:
 } // MOJOSHADER_cloneEffect
 
 
+// Shared by effect params and param blocks, which version the same way.
+static inline void bump_param_version(unsigned int *version)
+{
+    // Zero means "never set", which is compared on every commit instead of
+    //  trusted, so skip it on wrap.
+    if (++(*version) == 0)
+        *version = 1;
+} // bump_param_version
+
+
 void MOJOSHADER_effectSetRawValueHandle(const MOJOSHADER_effectParam *parameter,
                                         const void *data,
                                         const unsigned int offset,
@@ -1662,6 +1738,7 @@ void MOJOSHADER_effectSetRawValueHandle(const MOJOSHADER_effectParam *parameter,
 {
     // !!! FIXME: char* case is arbitary, for Win32 -flibit
     memcpy((char *) parameter->value.values + offset, data, len);
+    bump_param_version(&((MOJOSHADER_effectParam *) parameter)->version);
 } // MOJOSHADER_effectSetRawValueHandle
 
 
@@ -1678,6 +1755,7 @@ void MOJOSHADER_effectSetRawValueName(const MOJOSHADER_effect *effect,
         {
             // !!! FIXME: char* case is arbitary, for Win32 -flibit
             memcpy((char *) effect->params[i].value.values + offset, data, len);
+            bump_param_version(&effect->params[i].version);
             return;
         } // if
     } // for
@@ -1685,6 +1763,67 @@ void MOJOSHADER_effectSetRawValueName(const MOJOSHADER_effect *effect,
 } // MOJOSHADER_effectSetRawValueName
 
 
+// Blocks can be made on any thread, so serials are handed out atomically.
+static volatile long paramblockserial = 0;
+
+MOJOSHADER_effectParamBlock *MOJOSHADER_effectCreateParamBlock(const MOJOSHADER_effect *effect)
+{
+    MOJOSHADER_effectParamBlock *retval;
+    uint32 siz;
+
+    if (effect->param_storage == NULL)
+        return NULL;
+
+    /* One allocation: the header, the versions, then the aligned storage.
+     * We over-allocate by 15 bytes since the allocator may not align to 16.
+     */
+    siz = sizeof (MOJOSHADER_effectParamBlock)
+        + (effect->param_count * sizeof (unsigned int))
+        + 15 + effect->param_storage_size;
+    retval = (MOJOSHADER_effectParamBlock *) effect->malloc(siz, effect->malloc_data);
+    if (retval == NULL)
+        return NULL;
+
+    retval->effect = effect;
+    retval->serial = (uint32) atomic_increment(&paramblockserial);
+    retval->versions = (unsigned int *) (retval + 1);
+    memset(retval->versions, '\0', effect->param_count * sizeof (unsigned int));
+    retval->storage = (void *) ((((size_t) (retval->versions + effect->param_count)) + 15) & ~((size_t) 15));
+    memcpy(retval->storage, effect->param_storage, effect->param_storage_size);
+    return retval;
+} // MOJOSHADER_effectCreateParamBlock
+
+
+void MOJOSHADER_effectDeleteParamBlock(MOJOSHADER_effectParamBlock *block)
+{
+    if (block != NULL)
+        block->effect->free(block, block->effect->malloc_data);
+} // MOJOSHADER_effectDeleteParamBlock
+
+
+void *MOJOSHADER_effectParamBlockGetRawValue(MOJOSHADER_effectParamBlock *block,
+                                             const MOJOSHADER_effectParam *parameter)
+{
+    if (!isinparamstorage(block->effect, parameter))
+        return NULL;
+    return (char *) block->storage + ((const char *) parameter->value.values
+                                    - (const char *) block->effect->param_storage);
+} // MOJOSHADER_effectParamBlockGetRawValue
+
+
+void MOJOSHADER_effectParamBlockSetRawValueHandle(MOJOSHADER_effectParamBlock *block,
+                                                  const MOJOSHADER_effectParam *parameter,
+                                                  const void *data,
+                                                  const unsigned int offset,
+                                                  const unsigned int len)
+{
+    char *values = (char *) MOJOSHADER_effectParamBlockGetRawValue(block, parameter);
+    assert(values != NULL && "Parameter is not in this block!");
+    memcpy(values + offset, data, len);
+    bump_param_version(&block->versions[parameter - block->effect->params]);
+} // MOJOSHADER_effectParamBlockSetRawValueHandle
+
+
 const MOJOSHADER_effectTechnique *MOJOSHADER_effectGetCurrentTechnique(const MOJOSHADER_effect *effect)
 {
     return effect->current_technique;
@@ -369,6 +369,14 @@ typedef struct MOJOSHADER_effectParam
     MOJOSHADER_effectValue value;
     unsigned int annotation_count;
     MOJOSHADER_effectAnnotation *annotations;
+    /* Bumped by the SetRawValue functions, so the GL glue can skip copying
+     *  parameters that haven't changed. Zero means the parameter has never
+     *  been set through the API, and it will be compared and copied every
+     *  time, so writing to value.values directly keeps working.
+     *  If you write to value.values directly after using SetRawValue,
+     *  increment this yourself or the change will not be uploaded!
+     */
+    unsigned int version;
 } MOJOSHADER_effectParam;
 
 typedef struct MOJOSHADER_effectPass
@@ -570,6 +578,20 @@ typedef struct MOJOSHADER_effect
      * This is the pointer you passed as opaque data for your allocator.
      */
     void *malloc_data;
+
+    /*
+     * The size, in bytes, of (param_storage).
+     */
+    unsigned int param_storage_size;
+
+    /*
+     * The values of every non-object parameter, laid out in one block with
+     *  each parameter aligned to 16 bytes. The (values) of those parameters
+     *  point into this block. Parameter blocks are copies of this layout.
+     * This can be NULL if there are no such parameters, or if we ran out of
+     *  memory; parameter blocks are unavailable in that case.
+     */
+    void *param_storage;
 } MOJOSHADER_effect;
 
 
@@ -635,6 +657,75 @@ DECLSPEC void MOJOSHADER_effectSetRawValueName(const MOJOSHADER_effect *effect,
                                                const unsigned int len);
 
 
+/* Effect parameter block interface... */
+
+/* A parameter block holds its own copy of an effect's parameter values, so
+ *  many materials can share one effect (and one MOJOSHADER_glEffect) and
+ *  only differ in the block bound before rendering. Only non-object
+ *  parameters live in blocks; samplers, textures and shaders still come from
+ *  the effect itself.
+ */
+typedef struct MOJOSHADER_effectParamBlock MOJOSHADER_effectParamBlock;
+
+/* Create a parameter block for an effect.
+ *
+ * The block starts out as a copy of the effect's current parameter values.
+ *  It is a single allocation made with the effect's allocator.
+ *
+ * (effect) is a MOJOSHADER_effect* obtained from MOJOSHADER_parseEffect().
+ *
+ * This function returns the new block, or NULL on error. You must free the
+ *  block with MOJOSHADER_effectDeleteParamBlock() before freeing the effect.
+ *
+ * This function is thread safe.
+ */
+DECLSPEC MOJOSHADER_effectParamBlock *MOJOSHADER_effectCreateParamBlock(const MOJOSHADER_effect *effect);
+
+/* Free a parameter block.
+ *
+ * (block) is a block obtained from MOJOSHADER_effectCreateParamBlock(). It
+ *  must not be bound to a MOJOSHADER_glEffect when it is deleted.
+ *
+ * This function is thread safe.
+ */
+DECLSPEC void MOJOSHADER_effectDeleteParamBlock(MOJOSHADER_effectParamBlock *block);
+
+/* Get a pointer to a parameter's values inside of a parameter block.
+ *
+ * The layout of the data is identical to the parameter's (values).
+ *  If you write through this pointer, you must use
+ *  MOJOSHADER_effectParamBlockSetRawValueHandle() instead, or the change may
+ *  not be uploaded!
+ *
+ * (block) is a block obtained from MOJOSHADER_effectCreateParamBlock().
+ * (parameter) is a parameter obtained from the block's MOJOSHADER_effect*.
+ *
+ * This function returns NULL if the parameter is not stored in blocks.
+ *
+ * This function is thread safe.
+ */
+DECLSPEC void *MOJOSHADER_effectParamBlockGetRawValue(MOJOSHADER_effectParamBlock *block,
+                                                      const MOJOSHADER_effectParam *parameter);
+
+/* Set the constant value for the specified parameter in a parameter block.
+ *
+ * This is MOJOSHADER_effectSetRawValueHandle() for parameter blocks.
+ *
+ * (block) is a block obtained from MOJOSHADER_effectCreateParamBlock().
+ * (parameter) is a parameter obtained from the block's MOJOSHADER_effect*.
+ * (data) is the constant values to be applied to the parameter.
+ * (offset) is the offset, in bytes, of the parameter data being modified.
+ * (len) is the size, in bytes, of the data buffer being applied.
+ *
+ * This function is thread safe.
+ */
+DECLSPEC void MOJOSHADER_effectParamBlockSetRawValueHandle(MOJOSHADER_effectParamBlock *block,
+                                                           const MOJOSHADER_effectParam *parameter,
+                                                           const void *data,
+                                                           const unsigned int offset,
+                                                           const unsigned int len);
+
+
 /* Effect technique interface... */
 
 /* Get the current technique in use by an effect.
@@ -695,6 +786,10 @@ typedef struct MOJOSHADER_glEffect MOJOSHADER_glEffect;
  * This function returns a MOJOSHADER_glEffect*, containing OpenGL-specific
  *  data for an accompanying MOJOSHADER_effect*.
  *
+ * Shaders that translate to the same source as one this context already
+ *  compiled (from this effect, another effect, or
+ *  MOJOSHADER_glCompileShader()) reuse that GL shader object.
+ *
  * This call is NOT thread safe! As most OpenGL implementations are not thread
  * safe, you should probably only call this from the same thread that created
  * the GL context.
@@ -712,6 +807,56 @@ DECLSPEC MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effe
  */
 DECLSPEC void MOJOSHADER_glDeleteEffect(MOJOSHADER_glEffect *glEffect);
 
+/* Progress reported by MOJOSHADER_glEffectPrewarm(). */
+typedef struct MOJOSHADER_glEffectPrewarmProgress
+{
+    /* Distinct vertex/pixel shader pairings the effect's passes can bind. */
+    unsigned int programs_total;
+    /* Pairings linked so far, including ones that were already linked. */
+    unsigned int programs_linked;
+    /* Pairings that failed to link. See MOJOSHADER_glGetError(). */
+    unsigned int programs_failed;
+    /* Total time spent in MOJOSHADER_glEffectPrewarm() for this effect. */
+    unsigned long long usecs;
+} MOJOSHADER_glEffectPrewarmProgress;
+
+/* Link the effect's programs ahead of time, instead of on first draw.
+ *
+ * MOJOSHADER_glCompileEffect() compiles every shader, but programs are only
+ *  linked when a pass first binds them, which can hitch in the middle of a
+ *  frame. This enumerates every vertex/pixel pairing of every technique's
+ *  passes, including every shader a preshader can select from a shader
+ *  array, and links them into the linker cache.
+ *
+ * Passes are walked in order, as MOJOSHADER_glEffectBeginPass() would, so a
+ *  pass that only sets one shader is paired with the previous pass's other
+ *  shader. Pairings that depend on whatever the application had bound
+ *  before MOJOSHADER_glEffectBegin() can't be known here, and are skipped.
+ *
+ * This keeps linking until (budget_usecs) microseconds have passed, so you
+ *  can spread the work across frames by calling this once per frame until
+ *  it returns zero. It always links at least one program if any are left.
+ *  Zero means no budget: link everything now. With
+ *  MOJOSHADER_glSetAsyncCompile() enabled, the links are only started here.
+ *
+ * Note that programs can be evicted from the linker cache again, if you set
+ *  a budget with MOJOSHADER_glSetLinkerCacheBudget().
+ *
+ * (glEffect) is a MOJOSHADER_glEffect* obtained from
+ *  MOJOSHADER_glCompileEffect().
+ * (progress), if not NULL, is filled in with the totals so far.
+ *
+ * Returns the number of pairings left to link, zero when done, or -1 if we
+ *  ran out of memory.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ * safe, you should probably only call this from the same thread that created
+ * the GL context.
+ */
+DECLSPEC int MOJOSHADER_glEffectPrewarm(MOJOSHADER_glEffect *glEffect,
+                                        unsigned int budget_usecs,
+                                        MOJOSHADER_glEffectPrewarmProgress *progress);
+
 /* Prepare the effect for rendering with the currently applied technique.
  *
  * This function maps to ID3DXEffect::Begin.
@@ -746,6 +891,24 @@ DECLSPEC void MOJOSHADER_glEffectBegin(MOJOSHADER_glEffect *glEffect,
                                        int saveShaderState,
                                        MOJOSHADER_effectStateChanges *stateChanges);
 
+/* Use a parameter block's values instead of the effect's own parameters.
+ *
+ * Switching blocks only uploads the values that differ between them. This
+ *  may be called between passes, followed by
+ *  MOJOSHADER_glEffectCommitChanges() if a pass is already active.
+ *
+ * (glEffect) is a MOJOSHADER_glEffect* obtained from
+ *  MOJOSHADER_glCompileEffect().
+ * (block) is a block created from the same MOJOSHADER_effect*, or NULL to go
+ *  back to the effect's own parameters.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ * safe, you should probably only call this from the same thread that created
+ * the GL context.
+ */
+DECLSPEC void MOJOSHADER_glEffectBindParamBlock(MOJOSHADER_glEffect *glEffect,
+                                                MOJOSHADER_effectParamBlock *block);
+
 /* Begin an effect pass from the currently applied technique.
  *
  * This function maps to ID3DXEffect::BeginPass.
@@ -774,6 +937,44 @@ DECLSPEC void MOJOSHADER_glEffectBeginPass(MOJOSHADER_glEffect *glEffect,
  */
 DECLSPEC void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect);
 
+/* Reduce the current pass's state changes to the ones you haven't applied yet.
+ *
+ * The render and sampler state blocks of every pass are interned into IDs
+ *  when the effect is compiled, and the GL context remembers the last value
+ *  it reported for each render state and sampler state, across all effects.
+ *  Call this after MOJOSHADER_glEffectBeginPass (or after
+ *  MOJOSHADER_glEffectCommitChanges, if the pass uses a shader array), and
+ *  apply the contents of (delta) instead of the full state changes.
+ *
+ * Texture sampler states are always reported, as the texture bound to a
+ *  sampler parameter can change at any time. The VERTEXSHADER and
+ *  PIXELSHADER states are never reported, as MojoShader applies those itself.
+ *  State values are read when the effect is compiled, so changes to them
+ *  after MOJOSHADER_glCompileEffect() will not be seen here.
+ *
+ * (glEffect) is a MOJOSHADER_glEffect* obtained from
+ *  MOJOSHADER_glCompileEffect().
+ * (delta) will be filled with the state changes to apply. Its arrays point
+ *  into context memory and are valid until the next call to this function.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ * safe, you should probably only call this from the same thread that created
+ * the GL context.
+ */
+DECLSPEC void MOJOSHADER_glEffectGetStateDelta(MOJOSHADER_glEffect *glEffect,
+                                               MOJOSHADER_effectStateChanges *delta);
+
+/* Forget which render and sampler states have been applied.
+ *
+ * Call this if you changed render or sampler state without going through
+ *  MOJOSHADER_glEffectGetStateDelta(), so the next delta reports everything.
+ *
+ * This call is NOT thread safe! As most OpenGL implementations are not thread
+ * safe, you should probably only call this from the same thread that created
+ * the GL context.
+ */
+DECLSPEC void MOJOSHADER_glEffectResetStateDelta(void);
+
 /* End an effect pass from the currently applied technique.
  *
  * This function maps to ID3DXEffect::EndPass.
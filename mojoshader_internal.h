@@ -56,6 +56,18 @@
 #define SUPPORT_PROFILE_GLSLES 1
 #endif
 
+#ifndef SUPPORT_PROFILE_GLSLUBO
+#define SUPPORT_PROFILE_GLSLUBO 1
+#endif
+
+#ifndef SUPPORT_PROFILE_GLSL330
+#define SUPPORT_PROFILE_GLSL330 1
+#endif
+
+#ifndef SUPPORT_PROFILE_GLSL420
+#define SUPPORT_PROFILE_GLSL420 1
+#endif
+
 #ifndef SUPPORT_PROFILE_ARB1
 #define SUPPORT_PROFILE_ARB1 1
 #endif
@@ -80,6 +92,18 @@
 #error glsles profile requires glsl profile. Fix your build.
 #endif
 
+#if SUPPORT_PROFILE_GLSLUBO && !SUPPORT_PROFILE_GLSL120
+#error glslubo profile requires glsl120 profile. Fix your build.
+#endif
+
+#if SUPPORT_PROFILE_GLSL330 && !SUPPORT_PROFILE_GLSL120
+#error glsl330 profile requires glsl120 profile. Fix your build.
+#endif
+
+#if SUPPORT_PROFILE_GLSL420 && !SUPPORT_PROFILE_GLSL330
+#error glsl420 profile requires glsl330 profile. Fix your build.
+#endif
+
 // Microsoft's preprocessor has some quirks. In some ways, it doesn't work
 //  like you'd expect a C preprocessor to function.
 #ifndef MATCH_MICROSOFT_PREPROCESSOR
@@ -90,6 +114,20 @@
 
 #ifdef MOJOSHADER_EFFECT_SUPPORT
 void MOJOSHADER_runPreshader(const MOJOSHADER_preshader*, float*);
+
+// Deep copy of an effect's parse data, allocated with (m). It keeps the
+//  original's free function.
+MOJOSHADER_parseData *copyparsedata(const MOJOSHADER_parseData *src,
+                                    MOJOSHADER_malloc m, void *d);
+
+// This is allocated as one block; (versions) and (storage) point into it.
+struct MOJOSHADER_effectParamBlock
+{
+    const MOJOSHADER_effect *effect;
+    unsigned int serial;  // unique per block, so reused addresses don't match.
+    unsigned int *versions;  // one per effect parameter, like param->version.
+    void *storage;  // effect->param_storage_size bytes, 16-byte aligned.
+};
 #endif
 
 
@@ -151,6 +189,17 @@ typedef uint64_t uint64;
 
 #define STATICARRAYLEN(x) ( (sizeof ((x))) / (sizeof ((x)[0])) )
 
+// Refcounts and serials can be touched from any thread. These take a
+//  (volatile long *) and return the new value.
+#ifdef _MSC_VER
+#include <intrin.h>
+#define atomic_increment(ptr) _InterlockedIncrement(ptr)
+#define atomic_decrement(ptr) _InterlockedDecrement(ptr)
+#else
+#define atomic_increment(ptr) __sync_add_and_fetch((ptr), 1)
+#define atomic_decrement(ptr) __sync_sub_and_fetch((ptr), 1)
+#endif
+
 
 // Byteswap magic...
 
@@ -445,6 +494,39 @@ static inline int scalar_register(const MOJOSHADER_shaderType shader_type,
     return 0;
 } // scalar_register
 
+// The glsl330 and glsl420 profiles hardcode these, so the GL glue can use
+//  them without asking the driver after link. Keep both sides in sync!
+// Vertex inputs get a location from their usage, or -1 to let GL pick.
+static inline int glsl_attribute_location(const MOJOSHADER_usage usage,
+                                          const int index)
+{
+    switch (usage)
+    {
+        case MOJOSHADER_USAGE_POSITION: return (index == 0) ? 0 : -1;
+        case MOJOSHADER_USAGE_BLENDWEIGHT: return (index == 0) ? 1 : -1;
+        case MOJOSHADER_USAGE_NORMAL: return (index == 0) ? 2 : -1;
+        case MOJOSHADER_USAGE_COLOR: return (index < 2) ? 3 + index : -1;
+        case MOJOSHADER_USAGE_BLENDINDICES: return (index == 0) ? 5 : -1;
+        case MOJOSHADER_USAGE_TANGENT: return (index == 0) ? 6 : -1;
+        case MOJOSHADER_USAGE_BINORMAL: return (index == 0) ? 7 : -1;
+        case MOJOSHADER_USAGE_TEXCOORD: return (index < 8) ? 8 + index : -1;
+        default: break;
+    } // switch
+
+    return -1;
+} // glsl_attribute_location
+
+// Uniform locations, if GL_ARB_explicit_uniform_location is available.
+//  Each register file gets room for the most a shader model 3 shader can
+//  use, plus the texbem registers we tack onto the pixel shader's floats.
+#define GLSL_LOCATION_VS_FLOAT4 0
+#define GLSL_LOCATION_VS_INT4 256
+#define GLSL_LOCATION_VS_BOOL 272
+#define GLSL_LOCATION_PS_FLOAT4 288
+#define GLSL_LOCATION_PS_INT4 544
+#define GLSL_LOCATION_PS_BOOL 560
+#define GLSL_LOCATION_VPFLIP 576
+
 
 extern MOJOSHADER_error MOJOSHADER_out_of_mem_error;
 extern MOJOSHADER_parseData MOJOSHADER_out_of_mem_data;
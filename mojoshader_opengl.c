@@ -27,6 +27,19 @@
 #include <Carbon/Carbon.h>
 #endif
 
+#ifndef _MSC_VER
+#include <time.h>
+#include <sched.h>
+#endif
+
+// ProgramReady compares and copies uniform registers with SSE2 when the
+//  compiler promises it's there.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define HAVE_SSE2_INTRINSICS 1
+#include <emmintrin.h>
+#endif
+
 #define __MOJOSHADER_INTERNAL__ 1
 #include "mojoshader_internal.h"
 
@@ -51,11 +64,109 @@
 #define GL_PROGRAM_POINT_SIZE 0x8642
 #endif
 
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef struct ShaderLoad ShaderLoad;
+
+// Shaders are interned by the bytecode they came from, and by their
+//  translation, so different bytecode with the same output shares a GL
+//  object, too. The hash only finds candidates: bytecode keys compare a
+//  copy of the bytecode (see bytecode_key()), and translation keys compare
+//  (pd) in full, output included (see same_interface()).
+typedef enum ShaderInternKind
+{
+    SHADERINTERN_BYTECODE,
+    SHADERINTERN_OUTPUT,
+    SHADERINTERN_TOTAL
+} ShaderInternKind;
+
+typedef struct ShaderInternKey
+{
+    ShaderInternKind kind;
+    uint64 hash;
+    const MOJOSHADER_parseData *pd;  // only for SHADERINTERN_OUTPUT.
+    const uint8 *bytes;  // only for SHADERINTERN_BYTECODE. The shader owns it.
+    size_t len;
+    int interned;  // nonzero if this key is in a context's table.
+} ShaderInternKey;
+
 struct MOJOSHADER_glShader
 {
     const MOJOSHADER_parseData *parseData;
     GLuint handle;
-    uint32 refcount;
+    volatile long refcount;  // contexts on other threads can share this.
+    long share_group;  // usable in any context with the same share_group.
+    uint64 output_hash;  // identifies the generated source for binary caches.
+    int status;  // MOJOSHADER_glStatus of the compile.
+
+    // With program pipelines, this shader linked alone as a separable
+    //  program, and the pipeline whose uniforms were last pushed to it.
+    GLuint program;
+    int program_status;  // MOJOSHADER_glStatus of that link.
+    MOJOSHADER_glProgram *pipeline;
+
+    // Non-NULL until a shader from MOJOSHADER_glQueueShader() reaches the GL.
+    ShaderLoad *load;
+
+    // Callers that got this shader from a compile; interned shaders can have
+    //  several, in any context of the share group. (intern_ctx) is the
+    //  context whose table holds our keys, and its intern_lock is held
+    //  while an owner is added, or the last one takes us out of the table.
+    volatile long owners;
+    MOJOSHADER_glContext *intern_ctx;
+    ShaderInternKey keys[SHADERINTERN_TOTAL];
+
+    // Effect shaders borrow the effect's parse data, so we don't free it.
+    //  This is the MOJOSHADER_glEffect it came from, or NULL if we own it.
+    const void *parse_owner;
+};
+
+// A shader from MOJOSHADER_glQueueShader() on its way to the GL. Workers
+//  translate it and the GL thread compiles it; (state) says how far it got.
+//  Copies of the caller's buffers follow this struct in the same allocation.
+typedef enum
+{
+    SHADERLOAD_QUEUED,
+    SHADERLOAD_TRANSLATING,
+    SHADERLOAD_TRANSLATED
+} ShaderLoadState;
+
+struct ShaderLoad
+{
+    MOJOSHADER_glShader *shader;
+    MOJOSHADER_glContext *ctx;  // whose queue this is on.
+    ShaderLoadState state;
+    const unsigned char *tokenbuf;
+    unsigned int bufsize;
+    const MOJOSHADER_swizzle *swiz;
+    unsigned int swizcount;
+    const MOJOSHADER_samplerMap *smap;
+    unsigned int smapcount;
+    const MOJOSHADER_parseData *parseData;
+    uint64 queued_usecs;
+    ShaderLoad *next;
 };
 
 typedef struct
@@ -65,21 +176,244 @@ typedef struct
     GLint location;
 } UniformMap;
 
+// ProgramReady's copy from the register files to a program's uniform arrays,
+//  flattened at link time so it doesn't have to walk the UniformMaps. Each op
+//  covers (count) registers of one stage and type, with neighbouring
+//  registers merged into one op. The first three kinds line up with
+//  MOJOSHADER_uniformType.
+typedef enum UniformCopyKind
+{
+    UNIFORM_COPY_FLOAT4 = MOJOSHADER_UNIFORM_FLOAT,
+    UNIFORM_COPY_INT4 = MOJOSHADER_UNIFORM_INT,
+    UNIFORM_COPY_BOOL = MOJOSHADER_UNIFORM_BOOL,
+    UNIFORM_COPY_TEXBEM  // 6 floats of texbem state, padded to 2 registers.
+} UniformCopyKind;
+
+typedef struct UniformCopy
+{
+    UniformCopyKind kind;
+    uint32 stage;  // 0 is vertex, 1 is pixel.
+    uint32 src;    // register in that stage's file; texbem state for TEXBEM.
+    uint32 dst;    // element of the program's array of that type.
+    uint32 count;  // registers; always 1 for TEXBEM.
+} UniformCopy;
+
 typedef struct
 {
     const MOJOSHADER_attribute *attribute;
     GLint location;
 } AttributeMap;
 
+// The key for implicitly linked programs. Only vertex and fragment are
+//  compared; the rest is the linker cache's bookkeeping.
+typedef struct BoundShaders
+{
+    MOJOSHADER_glShader *vertex;
+    MOJOSHADER_glShader *fragment;
+    MOJOSHADER_glProgram *program;
+    size_t bytes;
+    struct BoundShaders *prev;  // used more recently.
+    struct BoundShaders *next;  // used less recently.
+} BoundShaders;
+
+// We can't have more vertex attribute arrays than bits in a uint32.
+#define MAX_VERTEX_ATTRIBS 32
+
+// What we last told the GL about a vertex attribute array.
+typedef struct VertexAttribState
+{
+    GLuint buffer;  // from MOJOSHADER_glSetVertexBuffer() at the time.
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    const void *ptr;
+} VertexAttribState;
+
+// A vertex array object and the state we've put in it. The context's default
+//  one has (vao) set to whatever the app had bound; cached ones are keyed by
+//  (layout, decl); see MOJOSHADER_glSetVertexArrayCache().
+typedef struct VertexArrayState
+{
+    uint64 layout;
+    uint64 decl;
+    GLuint vao;
+    uint32 have_attr;  // arrays enabled.
+    uint32 known_attr;  // arrays whose (attr) entry is valid.
+    VertexAttribState attr[MAX_VERTEX_ATTRIBS];
+    GLuint attr_divisor[MAX_VERTEX_ATTRIBS];
+} VertexArrayState;
+
+// Every GL entry point we load, for the call tracer and its analyzer, and
+//  which piece of GL state each one sets (so the analyzer can spot calls
+//  that didn't change anything). Don't reorder these; the indices are the
+//  function numbers in MOJOSHADER_glTraceCall.
+typedef enum
+{
+    TRACESTATE_NONE,  // never redundant: creates, deletes, queries, etc.
+    TRACESTATE_ENABLE,  // glEnable(cap) and glDisable(cap).
+    TRACESTATE_DISABLE,
+    TRACESTATE_ENABLE_ARRAY,  // gl*VertexAttribArray(index).
+    TRACESTATE_DISABLE_ARRAY,
+    TRACESTATE_PROGRAM,  // glUseProgram(program).
+    TRACESTATE_UNIFORM,  // glUniform*(location, ...) on the current program.
+    TRACESTATE_PROGRAM_UNIFORM,  // glProgramUniform*(program, location, ...).
+    TRACESTATE_VERTEX_ARRAY,  // glBindVertexArray(array).
+    TRACESTATE_ATTRIB_POINTER,  // glVertexAttribPointer(index, ...).
+    TRACESTATE_ATTRIB_DIVISOR,  // glVertexAttribDivisor(index, divisor).
+    TRACESTATE_GLOBAL,  // state of its own, with no key.
+    TRACESTATE_KEY1,  // state of its own, keyed by the first argument.
+    TRACESTATE_KEY2  // state of its own, keyed by the first two arguments.
+} TraceStateType;
+
+#define TRACE_FUNCTIONS \
+    TRACE_FUNCTION(glGetString, NONE) \
+    TRACE_FUNCTION(glGetError, NONE) \
+    TRACE_FUNCTION(glGetIntegerv, NONE) \
+    TRACE_FUNCTION(glEnable, ENABLE) \
+    TRACE_FUNCTION(glDisable, DISABLE) \
+    TRACE_FUNCTION(glGetStringi, NONE) \
+    TRACE_FUNCTION(glDeleteShader, NONE) \
+    TRACE_FUNCTION(glDeleteProgram, NONE) \
+    TRACE_FUNCTION(glAttachShader, NONE) \
+    TRACE_FUNCTION(glCompileShader, NONE) \
+    TRACE_FUNCTION(glCreateShader, NONE) \
+    TRACE_FUNCTION(glCreateProgram, NONE) \
+    TRACE_FUNCTION(glDisableVertexAttribArray, DISABLE_ARRAY) \
+    TRACE_FUNCTION(glEnableVertexAttribArray, ENABLE_ARRAY) \
+    TRACE_FUNCTION(glGetAttribLocation, NONE) \
+    TRACE_FUNCTION(glGetProgramInfoLog, NONE) \
+    TRACE_FUNCTION(glGetShaderInfoLog, NONE) \
+    TRACE_FUNCTION(glGetShaderiv, NONE) \
+    TRACE_FUNCTION(glGetProgramiv, NONE) \
+    TRACE_FUNCTION(glGetUniformLocation, NONE) \
+    TRACE_FUNCTION(glLinkProgram, NONE) \
+    TRACE_FUNCTION(glShaderSource, NONE) \
+    TRACE_FUNCTION(glUniform1i, UNIFORM) \
+    TRACE_FUNCTION(glUniform1iv, UNIFORM) \
+    TRACE_FUNCTION(glUniform1f, UNIFORM) \
+    TRACE_FUNCTION(glUniform4fv, UNIFORM) \
+    TRACE_FUNCTION(glUniform4iv, UNIFORM) \
+    TRACE_FUNCTION(glUseProgram, PROGRAM) \
+    TRACE_FUNCTION(glVertexAttribPointer, ATTRIB_POINTER) \
+    TRACE_FUNCTION(glDeleteObjectARB, NONE) \
+    TRACE_FUNCTION(glAttachObjectARB, NONE) \
+    TRACE_FUNCTION(glCompileShaderARB, NONE) \
+    TRACE_FUNCTION(glCreateProgramObjectARB, NONE) \
+    TRACE_FUNCTION(glCreateShaderObjectARB, NONE) \
+    TRACE_FUNCTION(glGetInfoLogARB, NONE) \
+    TRACE_FUNCTION(glGetObjectParameterivARB, NONE) \
+    TRACE_FUNCTION(glGetUniformLocationARB, NONE) \
+    TRACE_FUNCTION(glLinkProgramARB, NONE) \
+    TRACE_FUNCTION(glShaderSourceARB, NONE) \
+    TRACE_FUNCTION(glUniform1iARB, UNIFORM) \
+    TRACE_FUNCTION(glUniform1ivARB, UNIFORM) \
+    TRACE_FUNCTION(glUniform4fvARB, UNIFORM) \
+    TRACE_FUNCTION(glUniform4ivARB, UNIFORM) \
+    TRACE_FUNCTION(glUseProgramObjectARB, PROGRAM) \
+    TRACE_FUNCTION(glDisableVertexAttribArrayARB, DISABLE_ARRAY) \
+    TRACE_FUNCTION(glEnableVertexAttribArrayARB, ENABLE_ARRAY) \
+    TRACE_FUNCTION(glGetAttribLocationARB, NONE) \
+    TRACE_FUNCTION(glVertexAttribPointerARB, ATTRIB_POINTER) \
+    TRACE_FUNCTION(glGetProgramivARB, NONE) \
+    TRACE_FUNCTION(glProgramLocalParameter4fvARB, KEY2) \
+    TRACE_FUNCTION(glDeleteProgramsARB, NONE) \
+    TRACE_FUNCTION(glGenProgramsARB, NONE) \
+    TRACE_FUNCTION(glBindProgramARB, KEY1) \
+    TRACE_FUNCTION(glProgramStringARB, NONE) \
+    TRACE_FUNCTION(glProgramLocalParameterI4ivNV, KEY2) \
+    TRACE_FUNCTION(glProgramLocalParameters4fvEXT, KEY2) \
+    TRACE_FUNCTION(glProgramLocalParametersI4ivNV, KEY2) \
+    TRACE_FUNCTION(glVertexAttribDivisorARB, ATTRIB_DIVISOR) \
+    TRACE_FUNCTION(glGetProgramBinary, NONE) \
+    TRACE_FUNCTION(glProgramBinary, NONE) \
+    TRACE_FUNCTION(glProgramParameteri, KEY2) \
+    TRACE_FUNCTION(glGenBuffers, NONE) \
+    TRACE_FUNCTION(glDeleteBuffers, NONE) \
+    TRACE_FUNCTION(glBindBuffer, KEY1) \
+    TRACE_FUNCTION(glBindBufferRange, KEY2) \
+    TRACE_FUNCTION(glGetUniformBlockIndex, NONE) \
+    TRACE_FUNCTION(glUniformBlockBinding, KEY2) \
+    TRACE_FUNCTION(glMapBufferRange, NONE) \
+    TRACE_FUNCTION(glBufferStorage, NONE) \
+    TRACE_FUNCTION(glBufferSubData, NONE) \
+    TRACE_FUNCTION(glCopyBufferSubData, NONE) \
+    TRACE_FUNCTION(glFenceSync, NONE) \
+    TRACE_FUNCTION(glClientWaitSync, NONE) \
+    TRACE_FUNCTION(glDeleteSync, NONE) \
+    TRACE_FUNCTION(glGenProgramPipelines, NONE) \
+    TRACE_FUNCTION(glDeleteProgramPipelines, NONE) \
+    TRACE_FUNCTION(glBindProgramPipeline, GLOBAL) \
+    TRACE_FUNCTION(glUseProgramStages, KEY2) \
+    TRACE_FUNCTION(glProgramUniform1i, PROGRAM_UNIFORM) \
+    TRACE_FUNCTION(glProgramUniform1iv, PROGRAM_UNIFORM) \
+    TRACE_FUNCTION(glProgramUniform4fv, PROGRAM_UNIFORM) \
+    TRACE_FUNCTION(glProgramUniform4iv, PROGRAM_UNIFORM) \
+    TRACE_FUNCTION(glProgramUniform1f, PROGRAM_UNIFORM) \
+    TRACE_FUNCTION(glMaxShaderCompilerThreadsKHR, GLOBAL) \
+    TRACE_FUNCTION(glMaxShaderCompilerThreadsARB, GLOBAL) \
+    TRACE_FUNCTION(glGenVertexArrays, NONE) \
+    TRACE_FUNCTION(glDeleteVertexArrays, NONE) \
+    TRACE_FUNCTION(glBindVertexArray, VERTEX_ARRAY)
+
+typedef enum
+{
+    TRACE_FRAME = MOJOSHADER_GLTRACE_FRAME,
+    #define TRACE_FUNCTION(fn, state) TRACE_##fn,
+    TRACE_FUNCTIONS
+    #undef TRACE_FUNCTION
+    TRACE_TOTAL
+} TraceFunction;
+
+// Runs of elements [lo, hi) of a program's uniform array that changed since
+//  the last push, sorted and disjoint. Runs less than DIRTY_SPAN_GAP elements
+//  apart get merged, since re-sending a few unchanged registers is cheaper
+//  than another GL call. Past MAX_DIRTY_SPANS runs, new changes grow the
+//  nearest one. Empty when count == 0.
+#define MAX_DIRTY_SPANS 4
+#define DIRTY_SPAN_GAP 8
+typedef struct
+{
+    uint32 count;
+    uint32 lo[MAX_DIRTY_SPANS];
+    uint32 hi[MAX_DIRTY_SPANS];
+} DirtyRange;
+
+static inline int in_dirty_range(const DirtyRange *range, const uint32 pos)
+{
+    uint32 i;
+    for (i = 0; i < range->count; i++)
+    {
+        if (pos < range->lo[i])
+            return 0;  // they're sorted, so it's not in a later one, either.
+        else if (pos < range->hi[i])
+            return 1;
+    } // for
+    return 0;
+} // in_dirty_range
+
+// When parts of a register file were last written, in ctx->generation
+//  terms, so ProgramReady can skip registers a program has already seen.
+#define REG_STAMP_SHIFT 2  // one stamp per 4 registers.
+typedef struct
+{
+    uint32 latest;   // newest write anywhere in the file.
+    uint32 all;      // newest write that may have touched any register.
+    uint32 *blocks;  // newest write to each group of registers.
+} RegisterStamps;
+
 struct MOJOSHADER_glProgram
 {
     MOJOSHADER_glShader *vertex;
     MOJOSHADER_glShader *fragment;
     GLuint handle;
+    int status;  // MOJOSHADER_glStatus; pending async links aren't set up.
     uint32 generation;
     uint32 uniform_count;
     uint32 texbem_count;
     UniformMap *uniforms;
+    uint32 uniform_copy_count;
+    UniformCopy *uniform_copies;
     uint32 attribute_count;
     AttributeMap *attributes;
     size_t vs_uniforms_float4_count;
@@ -101,6 +435,7 @@ struct MOJOSHADER_glProgram
 
     // 10 is apparently the resource limit according to SM3 -flibit
     GLint vertex_attrib_loc[MOJOSHADER_USAGE_TOTAL][10];
+    uint64 attrib_layout;  // hash of vertex_attrib_loc, for vertex arrays.
 
     // GLSL uses these...location of uniform arrays.
     GLint vs_float4_loc;
@@ -109,6 +444,17 @@ struct MOJOSHADER_glProgram
     GLint ps_float4_loc;
     GLint ps_int4_loc;
     GLint ps_bool_loc;
+
+    // glslubo uses these...size of each stage's uniform block, 0 if unused.
+    GLsizeiptr vs_block_size;
+    GLsizeiptr ps_block_size;
+
+    // What changed in the uniform arrays since the last push, indexed by
+    //  stage (0 is vertex, 1 is pixel) and MOJOSHADER_uniformType.
+    DirtyRange dirty[2][3];
+    int uniforms_synced;  // zero until ProgramReady has compared everything.
+    int consecutive_locs;  // GLSL: can we push part of an array?
+    int stages_stale;  // pipelines: another pipeline pushed to our stages.
 #ifdef MOJOSHADER_FLIP_RENDERTARGET
     GLint vs_flip_loc;
     int current_flip;
@@ -126,12 +472,32 @@ typedef WINGDIAPI GLenum (APIENTRYP PFNGLGETERRORPROC) (void);
 typedef WINGDIAPI void (APIENTRYP PFNGLENABLEPROC) (GLenum cap);
 typedef WINGDIAPI void (APIENTRYP PFNGLDISABLEPROC) (GLenum cap);
 
+// ...and ones newer than our copy of glext.h.
+typedef void (APIENTRYP MOJO_PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC) (GLuint count);
+
 // Max entries for each register file type...
 #define MAX_REG_FILE_F 8192
 #define MAX_REG_FILE_I 2047
 #define MAX_REG_FILE_B 2047
 #define MAX_TEXBEMS 3  // ps_1_1 allows 4 texture stages, texbem can't use t0.
 
+// The glslubo profile's uniform ring: one fenced segment per frame in flight.
+#define UBO_RING_SEGMENTS 3
+#define UBO_RING_SEGMENT_SIZE (256 * 1024)
+
+// Blocks at least this big that only changed in a few places are copied
+//  forward in the ring by the GL, and only the changes are sent. Below
+//  this, a fresh copy is cheaper than the extra GL calls.
+#define UBO_PARTIAL_PUSH_MIN 512
+
+#ifdef MOJOSHADER_EFFECT_SUPPORT
+// Max entries for each effect state shadow...
+#define MAX_RENDER_STATES (MOJOSHADER_RS_PIXELSHADER + 1)
+#define MAX_SAMPLER_STATES (MOJOSHADER_SAMP_DMAPOFFSET + 1)
+#define MAX_SAMPLER_REGS 16
+#endif
+
 struct MOJOSHADER_glContext
 {
     // Allocators...
@@ -139,31 +505,113 @@ struct MOJOSHADER_glContext
     MOJOSHADER_free free_fn;
     void *malloc_data;
 
+    // Contexts from MOJOSHADER_glCreateSharedContext() get the same number
+    //  as the context they share with, and can use each other's shaders.
+    long share_group;
+
     // The constant register files...
-    // !!! FIXME: Man, it kills me how much memory this takes...
-    // !!! FIXME:  ... make this dynamically allocated on demand.
-    GLfloat vs_reg_file_f[MAX_REG_FILE_F * 4];
-    GLint vs_reg_file_i[MAX_REG_FILE_I * 4];
-    uint8 vs_reg_file_b[MAX_REG_FILE_B];
-    GLfloat ps_reg_file_f[MAX_REG_FILE_F * 4];
-    GLint ps_reg_file_i[MAX_REG_FILE_I * 4];
-    uint8 ps_reg_file_b[MAX_REG_FILE_B];
+    // These start out empty and grow to the highest register any compiled
+    //  shader or Set*Uniform call has used, see reserve_registers(). The
+    //  sizes are in registers, indexed by MOJOSHADER_uniformType.
+    GLfloat *vs_reg_file_f;
+    GLint *vs_reg_file_i;
+    uint8 *vs_reg_file_b;
+    GLfloat *ps_reg_file_f;
+    GLint *ps_reg_file_i;
+    uint8 *ps_reg_file_b;
+    uint vs_reg_file_size[3];
+    uint ps_reg_file_size[3];
     GLuint sampler_reg_file[16];
     GLfloat texbem_state[MAX_TEXBEMS * 6];
 
     // This increments every time we change the register files.
     uint32 generation;
 
-    // This keeps track of implicitly linked programs.
-    HashTable *linker_cache;
+    // These increment every time a specific register file is written, so
+    //  effects can tell if someone else touched it since their last copy.
+    uint32 vs_reg_file_stamp;
+    uint32 ps_reg_file_stamp;
 
-    // This tells us which vertex attribute arrays we have enabled.
-    GLint max_attrs;
-    uint8 want_attr[32];
-    uint8 have_attr[32];
+    // Which registers changed, and when. Indexed by MOJOSHADER_uniformType.
+    RegisterStamps vs_reg_stamps[3];
+    RegisterStamps ps_reg_stamps[3];
 
-    // This shadows vertex attribute and divisor states.
-    GLuint attr_divisor[32];
+    // This keeps track of implicitly linked programs, most recently used
+    //  first, and how big we let it get (zero means no limit).
+    HashTable *linker_cache;
+    BoundShaders *linker_lru_head;
+    BoundShaders *linker_lru_tail;
+    unsigned long long linker_cache_max_programs;
+    unsigned long long linker_cache_max_bytes;
+
+    // Compiled shaders, by bytecode and by translation. See ShaderInternKey.
+    //  Shared contexts drop their shaders from here on their own threads, so
+    //  lookups and changes happen under intern_lock.
+    HashTable *shader_intern;
+    volatile long intern_lock;
+
+    // Nonzero if programs are pipelines of separable shader programs.
+    int use_pipelines;
+
+    // Nonzero if link-time state goes in with glProgramUniform*(), without
+    //  binding the program.
+    int program_dsa;
+
+    // glsl330/glsl420 place these in the shader source, so we don't have to
+    //  ask for them after linking. See glsl_attribute_location().
+    int known_attrib_locs;
+    int known_uniform_locs;  // ...if GL_ARB_explicit_uniform_location, too.
+    int known_pixel_samplers;  // glsl420's layout(binding) in pixel shaders.
+
+    // Nonzero if compiles and links are checked later, not when submitted.
+    //  Only GL2-style GLSL can do that.
+    int async_capable;
+    int async_compile;
+
+    // Shaders from MOJOSHADER_glQueueShader() waiting for a worker thread,
+    //  and translated ones waiting for the GL thread. Workers touch these
+    //  (and the load counters in (stats)), so they're guarded by load_lock.
+    volatile long load_lock;
+    ShaderLoad *load_queue_head;
+    ShaderLoad *load_queue_tail;
+    ShaderLoad *load_done_head;
+    ShaderLoad *load_done_tail;
+    int loads_in_flight;
+    int load_workers;  // threads in MOJOSHADER_glTranslateQueuedShaders().
+
+    // Where linked program binaries are kept between runs. NULL if disabled.
+    char *program_binary_dir;
+
+    // The glslubo profile streams register files through this buffer, which
+    //  stays mapped for the life of the context. Binding point 0 is the
+    //  vertex shader's block, 1 is the pixel shader's.
+    GLuint ubo_ring;
+    uint8 *ubo_ring_ptr;
+    GLsizeiptr ubo_segment_size;
+    GLintptr ubo_ring_offset;
+    GLint ubo_alignment;
+    int ubo_segment;
+    GLsync ubo_fences[UBO_RING_SEGMENTS];
+    MOJOSHADER_glProgram *ubo_program;  // whose data the bound ranges hold.
+    GLintptr ubo_vs_offset;  // where ubo_program's blocks are in the ring.
+    GLintptr ubo_ps_offset;
+
+    // Vertex attribute arrays the bound program wants for the next draw
+    //  (one bit per array), and the vertex array whose state we shadow.
+    uint32 want_attr;
+    VertexArrayState *vertex_array;
+    VertexArrayState default_vertex_array;
+
+    // Cached vertex array objects, if enabled, and the app's current vertex
+    //  declaration, from MOJOSHADER_glSetVertexDeclaration().
+    HashTable *vertex_array_cache;
+    uint64 vertex_decl;
+
+    // The GL_ARRAY_BUFFER the app says is bound. Until it tells us with
+    //  MOJOSHADER_glSetVertexBuffer(), attribute pointers in the app's own
+    //  vertex array aren't shadowed, since we can't know what else set them.
+    GLuint vertex_buffer;
+    int vertex_buffer_known;
 
     // rarely used, so we don't touch when we don't have to.
     int pointsize_enabled;
@@ -181,6 +629,40 @@ struct MOJOSHADER_glContext
     int vertex_sampler_offset;
 #endif
 
+    // Runtime counters, see MOJOSHADER_glGetStats().
+    MOJOSHADER_glStats stats;
+
+#ifdef MOJOSHADER_GL_TRACE
+    // The real entry points behind our tracing wrappers, and the ring buffer
+    //  of recorded calls (NULL unless MOJOSHADER_glSetTrace() enabled it).
+    void *trace_real[TRACE_TOTAL];
+    MOJOSHADER_glTraceCall *trace_calls;
+    uint32 trace_size;
+    uint32 trace_next;
+    uint32 trace_count;
+    uint64 trace_start;
+#endif
+
+#ifdef MOJOSHADER_EFFECT_SUPPORT
+    // Interned effect render/sampler state blocks, shared by all effects.
+    HashTable *state_blocks;
+    uint32 state_block_count;
+
+    // The state blocks and values last reported by GetStateDelta.
+    // Index 0 is the pixel shader samplers, 1 is the vertex shader samplers.
+    uint32 applied_render_block;
+    uint32 applied_sampler_block[2];
+    uint8 render_state_known[MAX_RENDER_STATES];
+    uint32 render_state_shadow[MAX_RENDER_STATES];
+    uint8 sampler_state_known[2][MAX_SAMPLER_REGS][MAX_SAMPLER_STATES];
+    uint32 sampler_state_shadow[2][MAX_SAMPLER_REGS][MAX_SAMPLER_STATES];
+
+    // Scratch space for the arrays GetStateDelta hands back.
+    MOJOSHADER_effectState render_state_delta[MAX_RENDER_STATES];
+    MOJOSHADER_samplerStateRegister sampler_register_delta[2][MAX_SAMPLER_REGS];
+    MOJOSHADER_effectSamplerState sampler_state_delta[2][MAX_SAMPLER_REGS][MAX_SAMPLER_STATES];
+#endif
+
     // Extensions...
     int have_core_opengl;
     int have_opengl_2;  // different entry points than ARB extensions.
@@ -192,6 +674,7 @@ struct MOJOSHADER_glContext
     int have_GL_NV_fragment_program2;
     int have_GL_NV_vertex_program3;
     int have_GL_NV_gpu_program4;
+    int have_GL_EXT_gpu_program_parameters;
     int have_GL_ARB_shader_objects;
     int have_GL_ARB_vertex_shader;
     int have_GL_ARB_fragment_shader;
@@ -200,6 +683,17 @@ struct MOJOSHADER_glContext
     int have_GL_ARB_half_float_vertex;
     int have_GL_OES_vertex_half_float;
     int have_GL_ARB_instanced_arrays;
+    int have_GL_ARB_get_program_binary;
+    int have_GL_ARB_uniform_buffer_object;
+    int have_GL_ARB_map_buffer_range;
+    int have_GL_ARB_buffer_storage;
+    int have_GL_ARB_copy_buffer;
+    int have_GL_ARB_sync;
+    int have_GL_ARB_separate_shader_objects;
+    int have_GL_KHR_parallel_shader_compile;
+    int have_GL_ARB_parallel_shader_compile;
+    int have_GL_ARB_vertex_array_object;
+    int have_GL_ARB_explicit_uniform_location;
 
     // Entry points...
     PFNGLGETSTRINGPROC glGetString;
@@ -255,11 +749,45 @@ struct MOJOSHADER_glContext
     PFNGLGETPROGRAMIVARBPROC glGetProgramivARB;
     PFNGLPROGRAMLOCALPARAMETER4FVARBPROC glProgramLocalParameter4fvARB;
     PFNGLPROGRAMLOCALPARAMETERI4IVNVPROC glProgramLocalParameterI4ivNV;
+    PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC glProgramLocalParameters4fvEXT;
+    PFNGLPROGRAMLOCALPARAMETERSI4IVNVPROC glProgramLocalParametersI4ivNV;
     PFNGLDELETEPROGRAMSARBPROC glDeleteProgramsARB;
     PFNGLGENPROGRAMSARBPROC glGenProgramsARB;
     PFNGLBINDPROGRAMARBPROC glBindProgramARB;
     PFNGLPROGRAMSTRINGARBPROC glProgramStringARB;
     PFNGLVERTEXATTRIBDIVISORARBPROC glVertexAttribDivisorARB;
+    PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+    PFNGLPROGRAMBINARYPROC glProgramBinary;
+    PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+    PFNGLGENBUFFERSPROC glGenBuffers;
+    PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+    PFNGLBINDBUFFERPROC glBindBuffer;
+    PFNGLBINDBUFFERRANGEPROC glBindBufferRange;
+    PFNGLGETUNIFORMBLOCKINDEXPROC glGetUniformBlockIndex;
+    PFNGLUNIFORMBLOCKBINDINGPROC glUniformBlockBinding;
+    PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+    MOJO_PFNGLBUFFERSTORAGEPROC glBufferStorage;
+    PFNGLBUFFERSUBDATAPROC glBufferSubData;
+    PFNGLCOPYBUFFERSUBDATAPROC glCopyBufferSubData;
+    PFNGLFENCESYNCPROC glFenceSync;
+    PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+    PFNGLDELETESYNCPROC glDeleteSync;
+    PFNGLGENPROGRAMPIPELINESPROC glGenProgramPipelines;
+    PFNGLDELETEPROGRAMPIPELINESPROC glDeleteProgramPipelines;
+    PFNGLBINDPROGRAMPIPELINEPROC glBindProgramPipeline;
+    PFNGLUSEPROGRAMSTAGESPROC glUseProgramStages;
+    PFNGLPROGRAMUNIFORM1IPROC glProgramUniform1i;
+    PFNGLPROGRAMUNIFORM1IVPROC glProgramUniform1iv;
+    PFNGLPROGRAMUNIFORM4FVPROC glProgramUniform4fv;
+    PFNGLPROGRAMUNIFORM4IVPROC glProgramUniform4iv;
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+    PFNGLPROGRAMUNIFORM1FPROC glProgramUniform1f;
+#endif
+    MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC glMaxShaderCompilerThreadsKHR;
+    MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC glMaxShaderCompilerThreadsARB;
+    PFNGLGENVERTEXARRAYSPROC glGenVertexArrays;
+    PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays;
+    PFNGLBINDVERTEXARRAYPROC glBindVertexArray;
 
     // interface for profile-specific things.
     int (*profileMaxUniforms)(MOJOSHADER_shaderType shader_type);
@@ -269,27 +797,69 @@ struct MOJOSHADER_glContext
     GLint (*profileGetAttribLocation)(MOJOSHADER_glProgram *program, int idx);
     GLint (*profileGetUniformLocation)(MOJOSHADER_glProgram *program, MOJOSHADER_glShader *shader, int idx);
     GLint (*profileGetSamplerLocation)(MOJOSHADER_glProgram *, MOJOSHADER_glShader *, int);
-    GLuint (*profileLinkProgram)(MOJOSHADER_glShader *, MOJOSHADER_glShader *);
+    GLuint (*profileLinkProgram)(MOJOSHADER_glShader *, MOJOSHADER_glShader *, int *pending);
+    MOJOSHADER_glStatus (*profileShaderStatus)(MOJOSHADER_glShader *shader, int wait);
+    MOJOSHADER_glStatus (*profileLinkStatus)(MOJOSHADER_glProgram *program, int wait);
     void (*profileFinalInitProgram)(MOJOSHADER_glProgram *program);
     void (*profileUseProgram)(MOJOSHADER_glProgram *program);
     void (*profilePushConstantArray)(MOJOSHADER_glProgram *, const MOJOSHADER_uniform *, const GLfloat *);
     void (*profilePushUniforms)(void);
-    void (*profilePushSampler)(GLint loc, GLuint sampler);
+    void (*profilePushSampler)(MOJOSHADER_glProgram *, GLint, GLuint);
     int (*profileMustPushConstantArrays)(void);
     int (*profileMustPushSamplers)(void);
 };
 
 
-static MOJOSHADER_glContext *ctx = NULL;
+// Each thread has its own current context and error state, so threads with
+//  their own GL contexts can use MojoShader at the same time.
+#ifdef _MSC_VER
+#define THREADLOCAL __declspec(thread)
+#else
+#define THREADLOCAL __thread
+#endif
+
+static THREADLOCAL MOJOSHADER_glContext *ctx = NULL;
 
 // Error state...
-static char error_buffer[1024] = { '\0' };
+static THREADLOCAL char error_buffer[1024] = { '\0' };
 
 static void set_error(const char *str)
 {
     snprintf(error_buffer, sizeof (error_buffer), "%s", str);
 } // set_error
 
+// Each stat only has one writer at a time (the GL thread, or a worker
+//  holding load_lock), so they don't need a locked add, but
+//  MOJOSHADER_glGetStats() may read them from another thread. Relaxed
+//  loads and stores keep it from seeing torn values; on 64-bit targets
+//  they're just plain moves.
+#if defined(_MSC_VER) && defined(_M_IX86)
+#define stat_load(ptr) ((uint64) InterlockedCompareExchange64((volatile LONG64 *) (ptr), 0, 0))
+#define stat_store(ptr, val) InterlockedExchange64((volatile LONG64 *) (ptr), (LONG64) (val))
+#elif defined(_MSC_VER)
+#define stat_load(ptr) (*((volatile const uint64 *) (ptr)))
+#define stat_store(ptr, val) (*((volatile uint64 *) (ptr)) = (val))
+#else
+#define stat_load(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define stat_store(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+#endif
+
+static inline void stat_add(unsigned long long *stat, const uint64 amount)
+{
+    stat_store(stat, *stat + amount);
+} // stat_add
+
+static inline void stat_sub(unsigned long long *stat, const uint64 amount)
+{
+    stat_store(stat, *stat - amount);
+} // stat_sub
+
+static inline void count_uniform_upload(const size_t bytes)
+{
+    stat_add(&ctx->stats.uniform_uploads, 1);
+    stat_add(&ctx->stats.uniform_bytes_uploaded, bytes);
+} // count_uniform_upload
+
 #if PLATFORM_MACOSX
 static inline int macosx_version_atleast(int x, int y, int z)
 {
@@ -362,6 +932,79 @@ static inline void Free(void *ptr)
 } // Free
 
 
+// The shader load queue is fed and drained from other threads. Its lock is
+//  only ever held for a few pointer updates, so a spinlock is plenty.
+#ifdef _MSC_VER
+#define spinlock_trylock(lock) (InterlockedExchange((lock), 1) == 0)
+#define spinlock_unlock(lock) InterlockedExchange((lock), 0)
+#define spinlock_yield() SwitchToThread()
+#else
+#define spinlock_trylock(lock) (__sync_lock_test_and_set((lock), 1) == 0)
+#define spinlock_unlock(lock) __sync_lock_release(lock)
+#define spinlock_yield() sched_yield()
+#endif
+
+// Hands out share group numbers to new contexts.
+static volatile long share_group_serial = 0;
+
+static void spinlock_lock(volatile long *lock)
+{
+    while (!spinlock_trylock(lock))
+        spinlock_yield();
+} // spinlock_lock
+
+
+// Monotonic microseconds, for our timing counters.
+static uint64 ticks_usecs(void)
+{
+#ifdef _MSC_VER
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (((uint64) (now.QuadPart / freq.QuadPart)) * 1000000) +
+           (((uint64) (now.QuadPart % freq.QuadPart)) * 1000000 /
+             ((uint64) freq.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64) ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000);
+#endif
+} // ticks_usecs
+
+
+// 64-bit FNV-1a. Program binary cache keys outlive the process, so they
+//  need to be stable between runs and a lot less likely to collide than
+//  the 32-bit hashes we use for in-memory tables.
+#define HASH64_INIT 0xCBF29CE484222325ULL
+
+static uint64 hash64(uint64 hash, const void *data, size_t len)
+{
+    const uint8 *ptr = (const uint8 *) data;
+    while (len--)
+    {
+        hash ^= (uint64) *(ptr++);
+        hash *= 0x100000001B3ULL;
+    } // while
+    return hash;
+} // hash64
+
+
+// ARB1 programs aren't linked, so only impl_GLSL_LinkProgram checks this.
+static inline int use_program_binary_cache(void)
+{
+    return ( (ctx->program_binary_dir != NULL) &&
+             (ctx->have_opengl_2) &&
+             (ctx->have_GL_ARB_get_program_binary) );
+} // use_program_binary_cache
+
+
+static inline int have_parallel_shader_compile(void)
+{
+    return ( (ctx->have_GL_KHR_parallel_shader_compile) ||
+             (ctx->have_GL_ARB_parallel_shader_compile) );
+} // have_parallel_shader_compile
+
+
 static inline void toggle_gl_state(GLenum state, int val)
 {
     if (val)
@@ -418,6 +1061,15 @@ static int impl_GLSL_CompileShader(const MOJOSHADER_parseData *pd, GLuint *s)
         const GLuint shader = ctx->glCreateShader(shader_type);
         ctx->glShaderSource(shader, 1, (const GLchar**) &pd->output, &codelen);
         ctx->glCompileShader(shader);
+
+        // Asking now would make us wait for the driver, so async compiles
+        //  are checked later, by impl_GLSL_ShaderStatus().
+        if (ctx->async_compile)
+        {
+            *s = shader;
+            return 1;
+        } // if
+
         ctx->glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
         if (!ok)
         {
@@ -456,6 +1108,43 @@ static int impl_GLSL_CompileShader(const MOJOSHADER_parseData *pd, GLuint *s)
 } // impl_GLSL_CompileShader
 
 
+// Is the driver still working on (obj)? Without parallel shader compile,
+//  there's no way to ask without waiting, so we always say no.
+static int glsl_busy(const GLuint obj, const int is_program, const int wait)
+{
+    GLint done = GL_TRUE;
+    if ((!wait) && (have_parallel_shader_compile()))
+    {
+        if (is_program)
+            ctx->glGetProgramiv(obj, GL_COMPLETION_STATUS_KHR, &done);
+        else
+            ctx->glGetShaderiv(obj, GL_COMPLETION_STATUS_KHR, &done);
+    } // if
+    return !done;
+} // glsl_busy
+
+
+static MOJOSHADER_glStatus impl_GLSL_ShaderStatus(MOJOSHADER_glShader *shader,
+                                                  int wait)
+{
+    GLint ok = 0;
+
+    if (glsl_busy(shader->handle, 0, wait))
+        return MOJOSHADER_GLSTATUS_PENDING;
+
+    ctx->glGetShaderiv(shader->handle, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        GLsizei len = 0;
+        ctx->glGetShaderInfoLog(shader->handle, sizeof (error_buffer), &len,
+                                (GLchar *) error_buffer);
+        return MOJOSHADER_GLSTATUS_FAILED;
+    } // if
+
+    return MOJOSHADER_GLSTATUS_READY;
+} // impl_GLSL_ShaderStatus
+
+
 static void impl_GLSL_DeleteShader(const GLuint shader)
 {
     if (ctx->have_opengl_2)
@@ -481,12 +1170,19 @@ static GLint impl_GLSL_GetUniformLocation(MOJOSHADER_glProgram *program,
 } // impl_GLSL_GetUniformLocation
 
 
+static inline GLint glsl_handle_uniform_loc(const GLuint handle,
+                                            const char *name)
+{
+    return ctx->have_opengl_2 ?
+        ctx->glGetUniformLocation(handle, name) :
+        ctx->glGetUniformLocationARB((GLhandleARB) handle, name);
+} // glsl_handle_uniform_loc
+
+
 static inline GLint glsl_uniform_loc(MOJOSHADER_glProgram *program,
                                           const char *name)
 {
-    return ctx->have_opengl_2 ?
-        ctx->glGetUniformLocation(program->handle, name) :
-        ctx->glGetUniformLocationARB((GLhandleARB) program->handle, name);
+    return glsl_handle_uniform_loc(program->handle, name);
 } // glsl_uniform_loc
 
 
@@ -502,6 +1198,13 @@ static GLint impl_GLSL_GetAttribLocation(MOJOSHADER_glProgram *program, int idx)
     const MOJOSHADER_parseData *pd = program->vertex->parseData;
     const MOJOSHADER_attribute *a = pd->attributes;
 
+    if (ctx->known_attrib_locs)
+    {
+        const GLint loc = glsl_attribute_location(a[idx].usage, a[idx].index);
+        if (loc >= 0)
+            return loc;
+    } // if
+
     if (ctx->have_opengl_2)
     {
         return ctx->glGetAttribLocation(program->handle,
@@ -513,32 +1216,234 @@ static GLint impl_GLSL_GetAttribLocation(MOJOSHADER_glProgram *program, int idx)
 } // impl_GLSL_GetAttribLocation
 
 
-static GLuint impl_GLSL_LinkProgram(MOJOSHADER_glShader *vshader,
-                                    MOJOSHADER_glShader *pshader)
+// Linked program binaries are cached on disk as this header plus the blob
+//  from glGetProgramBinary, in a file named after the key.
+typedef struct ProgramBinaryHeader
+{
+    char magic[8];
+    uint64 key;
+    uint32 format;
+    uint32 length;
+} ProgramBinaryHeader;
+
+static const char program_binary_magic[8] = {'M','O','J','O','P','B','I','N'};
+
+static uint64 program_binary_key(const MOJOSHADER_glShader *vshader,
+                                 const MOJOSHADER_glShader *pshader,
+                                 const int separable)
+{
+    // A driver upgrade or a different GPU invalidates every binary, so the
+    //  renderer and version strings are part of the key.
+    const uint64 vhash = (vshader != NULL) ? vshader->output_hash : 0;
+    const uint64 phash = (pshader != NULL) ? pshader->output_hash : 0;
+    const char *renderer = (const char *) ctx->glGetString(GL_RENDERER);
+    const char *version = (const char *) ctx->glGetString(GL_VERSION);
+    uint64 retval = HASH64_INIT;
+
+    if (renderer == NULL) renderer = "";
+    if (version == NULL) version = "";
+
+    retval = hash64(retval, &vhash, sizeof (vhash));
+    retval = hash64(retval, &phash, sizeof (phash));
+    retval = hash64(retval, renderer, strlen(renderer) + 1);
+    retval = hash64(retval, version, strlen(version) + 1);
+    if (separable)
+        retval = hash64(retval, "separable", 9);
+    return retval;
+} // program_binary_key
+
+
+static int program_binary_path(char *buf, const size_t buflen,
+                               const uint64 key, const char *ext)
+{
+    const int len = snprintf(buf, buflen, "%s/%016llx.%s",
+                             ctx->program_binary_dir,
+                             (unsigned long long) key, ext);
+    return ((len > 0) && (((size_t) len) < buflen));
+} // program_binary_path
+
+
+static int load_program_binary(const GLuint program, const uint64 key)
 {
+    ProgramBinaryHeader header;
+    char path[1024];
+    void *data = NULL;
+    long filelen = -1;
+    int corrupt = 0;
     GLint ok = 0;
+    FILE *io = NULL;
 
-    if (ctx->have_opengl_2)
+    if (!program_binary_path(path, sizeof (path), key, "bin"))
+        return 0;
+    else if ((io = fopen(path, "rb")) == NULL)
+        return 0;
+
+    if (fseek(io, 0, SEEK_END) == 0)
+        filelen = ftell(io);
+    rewind(io);
+
+    // The length comes from disk, so it has to match the rest of the file
+    //  before we allocate anything. A file that doesn't add up is a miss,
+    //  and we delete it so the next link writes a good one.
+    if ( (filelen < (long) sizeof (header)) ||
+         (fread(&header, sizeof (header), 1, io) != 1) ||
+         (memcmp(header.magic, program_binary_magic, sizeof (header.magic)) != 0) ||
+         (header.key != key) || (header.length == 0) ||
+         (header.length > 0x7FFFFFFF) ||
+         (((unsigned long) filelen) - sizeof (header) != header.length) )
+        corrupt = 1;
+    else
     {
-        const GLuint program = ctx->glCreateProgram();
+        // Running out of memory here is just a miss.
+        data = ctx->malloc_fn((int) header.length, ctx->malloc_data);
+        if ((data != NULL) && (fread(data, header.length, 1, io) != 1))
+            corrupt = 1;
+        else if (data != NULL)
+        {
+            ctx->glProgramBinary(program, (GLenum) header.format, data,
+                                 (GLsizei) header.length);
+            ctx->glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        } // else
+    } // else
 
-        if (vshader != NULL) ctx->glAttachShader(program, vshader->handle);
-        if (pshader != NULL) ctx->glAttachShader(program, pshader->handle);
+    fclose(io);
+    if (data != NULL)
+        ctx->free_fn(data, ctx->malloc_data);
+    if (corrupt)
+        remove(path);
 
-        ctx->glLinkProgram(program);
+    return (int) ok;
+} // load_program_binary
 
-        ctx->glGetProgramiv(program, GL_LINK_STATUS, &ok);
-        if (!ok)
+
+static void save_program_binary(const GLuint program, const uint64 key)
+{
+    ProgramBinaryHeader header;
+    char path[1024];
+    char tmppath[1024];
+    GLint len = 0;
+    GLsizei written = 0;
+    GLenum format = GL_NONE;
+    void *data = NULL;
+    FILE *io = NULL;
+    int ok = 0;
+
+    ctx->glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &len);
+    if (len <= 0)
+        return;
+    else if (!program_binary_path(path, sizeof (path), key, "bin"))
+        return;
+    else if (!program_binary_path(tmppath, sizeof (tmppath), key, "tmp"))
+        return;
+
+    // We don't use Malloc() here, failing to cache isn't an error.
+    data = ctx->malloc_fn((int) len, ctx->malloc_data);
+    if (data == NULL)
+        return;
+
+    ctx->glGetProgramBinary(program, len, &written, &format, data);
+    if (written > 0)
+    {
+        memcpy(header.magic, program_binary_magic, sizeof (header.magic));
+        header.key = key;
+        header.format = (uint32) format;
+        header.length = (uint32) written;
+
+        // Write to the side and rename, so a crash or another process
+        //  never sees a half-written binary.
+        io = fopen(tmppath, "wb");
+        if (io != NULL)
         {
-            GLsizei len = 0;
-            ctx->glGetProgramInfoLog(program, sizeof (error_buffer),
-                                     &len, (GLchar *) error_buffer);
-            ctx->glDeleteProgram(program);
-            return 0;
+            ok = ( (fwrite(&header, sizeof (header), 1, io) == 1) &&
+                   (fwrite(data, written, 1, io) == 1) );
+            ok = (fclose(io) == 0) && ok;
+            if ((!ok) || (rename(tmppath, path) != 0))
+                remove(tmppath);
+        } // if
+    } // if
+
+    ctx->free_fn(data, ctx->malloc_data);
+} // save_program_binary
+
+
+// Check a GL2 link that has finished, and cache its binary if it worked.
+static int glsl_link_finished(const GLuint program,
+                              MOJOSHADER_glShader *vshader,
+                              MOJOSHADER_glShader *pshader,
+                              const int separable)
+{
+    GLint ok = 0;
+    ctx->glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        GLsizei len = 0;
+        ctx->glGetProgramInfoLog(program, sizeof (error_buffer),
+                                 &len, (GLchar *) error_buffer);
+        return 0;
+    } // if
+
+    if (use_program_binary_cache())
+        save_program_binary(program, program_binary_key(vshader, pshader,
+                                                        separable));
+    return 1;
+} // glsl_link_finished
+
+
+// Link a GL2 program object, going through the binary cache if enabled.
+//  Separable programs are a single shader, for use in program pipelines.
+//  Async links set (*pending) and are checked with glsl_link_finished().
+static GLuint glsl_link_program(MOJOSHADER_glShader *vshader,
+                                MOJOSHADER_glShader *pshader,
+                                const int separable, int *pending)
+{
+    const GLuint program = ctx->glCreateProgram();
+
+    if (vshader != NULL) ctx->glAttachShader(program, vshader->handle);
+    if (pshader != NULL) ctx->glAttachShader(program, pshader->handle);
+
+    if (separable)
+        ctx->glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+
+    if (use_program_binary_cache())
+    {
+        // The shaders stay attached, so if the driver rejects the
+        //  binary we can still do a full link on the same program.
+        const uint64 key = program_binary_key(vshader, pshader, separable);
+        if (load_program_binary(program, key))
+        {
+            stat_add(&ctx->stats.program_binaries_loaded, 1);
+            return program;
         } // if
 
-        return program;
+        stat_add(&ctx->stats.program_binaries_missed, 1);
+        ctx->glProgramParameteri(program,
+                                 GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                 GL_TRUE);
     } // if
+
+    ctx->glLinkProgram(program);
+    stat_add(&ctx->stats.program_links, 1);
+
+    if (ctx->async_compile)
+        *pending = 1;
+    else if (!glsl_link_finished(program, vshader, pshader, separable))
+    {
+        ctx->glDeleteProgram(program);
+        return 0;
+    } // else if
+
+    return program;
+} // glsl_link_program
+
+
+static GLuint impl_GLSL_LinkProgram(MOJOSHADER_glShader *vshader,
+                                    MOJOSHADER_glShader *pshader,
+                                    int *pending)
+{
+    GLint ok = 0;
+
+    if (ctx->have_opengl_2)
+        return glsl_link_program(vshader, pshader, 0, pending);
     else
     {
         const GLhandleARB program = ctx->glCreateProgramObjectARB();
@@ -551,6 +1456,7 @@ static GLuint impl_GLSL_LinkProgram(MOJOSHADER_glShader *vshader,
             ctx->glAttachObjectARB(program, (GLhandleARB) pshader->handle);
 
         ctx->glLinkProgramARB(program);
+        stat_add(&ctx->stats.program_links, 1);
 
         ctx->glGetObjectParameterivARB(program, GL_OBJECT_LINK_STATUS_ARB, &ok);
         if (!ok)
@@ -566,18 +1472,95 @@ static GLuint impl_GLSL_LinkProgram(MOJOSHADER_glShader *vshader,
     } // else
 } // impl_GLSL_LinkProgram
 
-static void impl_GLSL_FinalInitProgram(MOJOSHADER_glProgram *program)
+
+static MOJOSHADER_glStatus impl_GLSL_LinkStatus(MOJOSHADER_glProgram *program,
+                                                int wait)
 {
-    
-    program->vs_float4_loc = glsl_uniform_loc(program, "vs_uniforms_vec4");
-    program->vs_int4_loc = glsl_uniform_loc(program, "vs_uniforms_ivec4");
-    program->vs_bool_loc = glsl_uniform_loc(program, "vs_uniforms_bool");
-    program->ps_float4_loc = glsl_uniform_loc(program, "ps_uniforms_vec4");
-    program->ps_int4_loc = glsl_uniform_loc(program, "ps_uniforms_ivec4");
-    program->ps_bool_loc = glsl_uniform_loc(program, "ps_uniforms_bool");
+    if (glsl_busy(program->handle, 1, wait))
+        return MOJOSHADER_GLSTATUS_PENDING;
+    else if (!glsl_link_finished(program->handle, program->vertex,
+                                 program->fragment, 0))
+        return MOJOSHADER_GLSTATUS_FAILED;
+    return MOJOSHADER_GLSTATUS_READY;
+} // impl_GLSL_LinkStatus
+
+static int glsl_locs_consecutive(const GLuint handle,
+                                 const char *name, const GLint loc,
+                                 const size_t count)
+{
+    // GL only promises consecutive element locations for explicit ones, so
+    //  check the last element before pushing partial arrays.
+    char buf[64];
+    if ((loc == -1) || (count < 2))
+        return 1;
+    snprintf(buf, sizeof (buf), "%s[%u]", name, (uint) (count - 1));
+    return (glsl_handle_uniform_loc(handle, buf) == (loc + (GLint) (count - 1)));
+} // glsl_locs_consecutive
+
+
+// Find the uniform arrays. (vs) and (ps) are the GL programs holding each
+//  stage, which are both the linked program unless we use pipelines.
+static void glsl_init_locations(MOJOSHADER_glProgram *program,
+                                const GLuint vs, const GLuint ps)
+{
+    if (ctx->known_uniform_locs)
+    {
+        // The arrays have explicit locations, so we don't have to ask.
+        #define KNOWN_LOC(h, count, loc) \
+            (((h) && (program->count)) ? GLSL_LOCATION_##loc : -1)
+        program->vs_float4_loc = KNOWN_LOC(vs, vs_uniforms_float4_count, VS_FLOAT4);
+        program->vs_int4_loc = KNOWN_LOC(vs, vs_uniforms_int4_count, VS_INT4);
+        program->vs_bool_loc = KNOWN_LOC(vs, vs_uniforms_bool_count, VS_BOOL);
+        program->ps_float4_loc = KNOWN_LOC(ps, ps_uniforms_float4_count, PS_FLOAT4);
+        program->ps_int4_loc = KNOWN_LOC(ps, ps_uniforms_int4_count, PS_INT4);
+        program->ps_bool_loc = KNOWN_LOC(ps, ps_uniforms_bool_count, PS_BOOL);
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+        program->vs_flip_loc = vs ? GLSL_LOCATION_VPFLIP : -1;
+#endif
+        #undef KNOWN_LOC
+    } // if
+    else
+    {
+        #define STAGE_LOC(h, name) ((h) ? glsl_handle_uniform_loc(h, name) : -1)
+        program->vs_float4_loc = STAGE_LOC(vs, "vs_uniforms_vec4");
+        program->vs_int4_loc = STAGE_LOC(vs, "vs_uniforms_ivec4");
+        program->vs_bool_loc = STAGE_LOC(vs, "vs_uniforms_bool");
+        program->ps_float4_loc = STAGE_LOC(ps, "ps_uniforms_vec4");
+        program->ps_int4_loc = STAGE_LOC(ps, "ps_uniforms_ivec4");
+        program->ps_bool_loc = STAGE_LOC(ps, "ps_uniforms_bool");
 #ifdef MOJOSHADER_FLIP_RENDERTARGET
-    program->vs_flip_loc = glsl_uniform_loc(program, "vpFlip");
+        program->vs_flip_loc = STAGE_LOC(vs, "vpFlip");
 #endif
+        #undef STAGE_LOC
+    } // else
+
+    // Even explicit locations can lose their tail: drivers may trim array
+    //  elements the shader never reads. So check the last element either way.
+    program->consecutive_locs =
+        glsl_locs_consecutive(vs, "vs_uniforms_vec4",
+                              program->vs_float4_loc,
+                              program->vs_uniforms_float4_count) &&
+        glsl_locs_consecutive(vs, "vs_uniforms_ivec4",
+                              program->vs_int4_loc,
+                              program->vs_uniforms_int4_count) &&
+        glsl_locs_consecutive(vs, "vs_uniforms_bool",
+                              program->vs_bool_loc,
+                              program->vs_uniforms_bool_count) &&
+        glsl_locs_consecutive(ps, "ps_uniforms_vec4",
+                              program->ps_float4_loc,
+                              program->ps_uniforms_float4_count) &&
+        glsl_locs_consecutive(ps, "ps_uniforms_ivec4",
+                              program->ps_int4_loc,
+                              program->ps_uniforms_int4_count) &&
+        glsl_locs_consecutive(ps, "ps_uniforms_bool",
+                              program->ps_bool_loc,
+                              program->ps_uniforms_bool_count);
+} // glsl_init_locations
+
+
+static void impl_GLSL_FinalInitProgram(MOJOSHADER_glProgram *program)
+{
+    glsl_init_locations(program, program->handle, program->handle);
 } // impl_GLSL_FinalInitProgram
 
 
@@ -600,72 +1583,607 @@ static void impl_GLSL_PushConstantArray(MOJOSHADER_glProgram *program,
 } // impl_GLSL_PushConstantArray
 
 
-static void impl_GLSL_PushUniforms(void)
+// Only upload the parts of each array ProgramReady saw change, unless the
+//  driver didn't give the array elements consecutive locations.
+//  (stage) is 0 for the vertex shader's arrays, 1 for the pixel shader's.
+//  If (handle) isn't zero, the arrays go straight to that GL program with
+//  glProgramUniform*(), otherwise to whatever program is current.
+static void glsl_push_stage_uniforms(MOJOSHADER_glProgram *program,
+                                     const int stage, const GLuint handle)
 {
-    const MOJOSHADER_glProgram *program = ctx->bound_program;
-
-    assert(program->uniform_count > 0);  // don't call with nothing to do!
+    #define PUSH_UNIFORM_ARRAY(stage, idx, kind, type, fn, width) { \
+        DirtyRange *r = &program->dirty[idx][MOJOSHADER_UNIFORM_##type]; \
+        if ((program->stage##_##kind##_loc != -1) && (r->count > 0)) \
+        { \
+            uint32 i; \
+            if (!program->consecutive_locs) \
+            { \
+                r->count = 1; \
+                r->lo[0] = 0; \
+                r->hi[0] = (uint32) program->stage##_uniforms_##kind##_count; \
+            } \
+            for (i = 0; i < r->count; i++) \
+            { \
+                const uint32 n = r->hi[i] - r->lo[i]; \
+                const GLint loc = program->stage##_##kind##_loc + r->lo[i]; \
+                if (handle != 0) \
+                { \
+                    ctx->glProgram##fn(handle, loc, n, \
+                        program->stage##_uniforms_##kind + (r->lo[i] * width)); \
+                } \
+                else \
+                { \
+                    ctx->gl##fn(loc, n, \
+                        program->stage##_uniforms_##kind + (r->lo[i] * width)); \
+                } \
+                count_uniform_upload(n * width * \
+                            sizeof (*program->stage##_uniforms_##kind)); \
+            } \
+        } \
+        r->count = 0; \
+    }
 
-    if (program->vs_float4_loc != -1)
+    if (stage == 0)
     {
-        ctx->glUniform4fv(program->vs_float4_loc,
-                          program->vs_uniforms_float4_count,
-                          program->vs_uniforms_float4);
+        PUSH_UNIFORM_ARRAY(vs, 0, float4, FLOAT, Uniform4fv, 4);
+        PUSH_UNIFORM_ARRAY(vs, 0, int4, INT, Uniform4iv, 4);
+        PUSH_UNIFORM_ARRAY(vs, 0, bool, BOOL, Uniform1iv, 1);
     } // if
-
-    if (program->vs_int4_loc != -1)
+    else
     {
-        ctx->glUniform4iv(program->vs_int4_loc,
-                          program->vs_uniforms_int4_count,
-                          program->vs_uniforms_int4);
-    } // if
+        PUSH_UNIFORM_ARRAY(ps, 1, float4, FLOAT, Uniform4fv, 4);
+        PUSH_UNIFORM_ARRAY(ps, 1, int4, INT, Uniform4iv, 4);
+        PUSH_UNIFORM_ARRAY(ps, 1, bool, BOOL, Uniform1iv, 1);
+    } // else
 
-    if (program->vs_bool_loc != -1)
-    {
-        ctx->glUniform1iv(program->vs_bool_loc,
-                          program->vs_uniforms_bool_count,
-                          program->vs_uniforms_bool);
-    } // if
+    #undef PUSH_UNIFORM_ARRAY
+} // glsl_push_stage_uniforms
 
-    if (program->ps_float4_loc != -1)
-    {
-        ctx->glUniform4fv(program->ps_float4_loc,
-                          program->ps_uniforms_float4_count,
-                          program->ps_uniforms_float4);
-    } // if
 
-    if (program->ps_int4_loc != -1)
-    {
-        ctx->glUniform4iv(program->ps_int4_loc,
-                          program->ps_uniforms_int4_count,
-                          program->ps_uniforms_int4);
-    } // if
+static void impl_GLSL_PushUniforms(void)
+{
+    MOJOSHADER_glProgram *program = ctx->bound_program;
 
-    if (program->ps_bool_loc != -1)
-    {
-        ctx->glUniform1iv(program->ps_bool_loc,
-                          program->ps_uniforms_bool_count,
-                          program->ps_uniforms_bool);
-    } // if
+    assert(program->uniform_count > 0);  // don't call with nothing to do!
+
+    glsl_push_stage_uniforms(program, 0, 0);
+    glsl_push_stage_uniforms(program, 1, 0);
 } // impl_GLSL_PushUniforms
 
 
-static void impl_GLSL_PushSampler(GLint loc, GLuint sampler)
+static void impl_GLSL_PushSampler(MOJOSHADER_glProgram *program,
+                                  GLint loc, GLuint sampler)
 {
     ctx->glUniform1i(loc, sampler);
 } // impl_GLSL_PushSampler
 
-#endif  // SUPPORT_PROFILE_GLSL
 
+// Without pipelines, GL 4.1's glProgramUniform*() still lets us set a linked
+//  program's constant arrays and samplers without making it current, so
+//  linking (or prewarming) doesn't have to disturb the bound program.
 
-#if SUPPORT_PROFILE_ARB1
-static inline GLenum arb1_shader_type(const MOJOSHADER_shaderType t)
+static void impl_GLSLDSA_PushConstantArray(MOJOSHADER_glProgram *program,
+                                           const MOJOSHADER_uniform *u,
+                                           const GLfloat *f)
 {
-    if (t == MOJOSHADER_TYPE_VERTEX)
-        return GL_VERTEX_PROGRAM_ARB;
-    else if (t == MOJOSHADER_TYPE_PIXEL)
-        return GL_FRAGMENT_PROGRAM_ARB;
-
+    const GLint loc = glsl_uniform_loc(program, u->name);
+    if (loc >= 0)   // not optimized out?
+        ctx->glProgramUniform4fv(program->handle, loc, u->array_count, f);
+} // impl_GLSLDSA_PushConstantArray
+
+
+static void impl_GLSLDSA_PushSampler(MOJOSHADER_glProgram *program,
+                                     GLint loc, GLuint sampler)
+{
+    ctx->glProgramUniform1i(program->handle, loc, sampler);
+} // impl_GLSLDSA_PushSampler
+
+
+// With GL_ARB_separate_shader_objects, each shader links once as its own
+//  separable program, and a MOJOSHADER_glProgram is a pipeline object
+//  (program->handle) that pairs up the stages. Uniforms go to each stage's
+//  program; samplers and constant arrays are set once, when it is linked.
+
+static int impl_GLSLSSO_MustPushConstantArrays(void) { return 0; }
+static int impl_GLSLSSO_MustPushSamplers(void) { return 0; }
+
+static void fill_constant_array(GLfloat *f, const int base, const int size,
+                                const MOJOSHADER_parseData *pd);
+
+// Set the things that never change on a freshly linked separable program.
+static void glsl_init_separable(MOJOSHADER_glShader *shader)
+{
+    const MOJOSHADER_parseData *pd = shader->parseData;
+    const GLuint program = shader->program;
+    int i;
+
+    for (i = 0; i < pd->uniform_count; i++)
+    {
+        const MOJOSHADER_uniform *u = &pd->uniforms[i];
+        if (u->constant)
+        {
+            const GLint loc = ctx->glGetUniformLocation(program, u->name);
+            if (loc >= 0)   // not optimized out?
+            {
+                const int base = u->index;
+                const int size = u->array_count;
+                GLfloat *f = (GLfloat *) alloca(sizeof (GLfloat) * (size * 4));
+                fill_constant_array(f, base, size, pd);
+                ctx->glProgramUniform4fv(program, loc, size, f);
+            } // if
+        } // if
+    } // for
+
+    if ((pd->shader_type == MOJOSHADER_TYPE_PIXEL) && (ctx->known_pixel_samplers))
+        return;  // the shader already named its texture units.
+
+    for (i = 0; i < pd->sampler_count; i++)
+    {
+        const MOJOSHADER_sampler *samp = &pd->samplers[i];
+        const GLint loc = ctx->glGetUniformLocation(program, samp->name);
+        if (loc >= 0)  // maybe the Sampler was optimized out?
+        {
+#ifdef MOJOSHADER_XNA4_VERTEX_TEXTURES
+            if (pd->shader_type == MOJOSHADER_TYPE_VERTEX)
+                ctx->glProgramUniform1i(program, loc, samp->index + ctx->vertex_sampler_offset);
+            else
+#endif
+                ctx->glProgramUniform1i(program, loc, samp->index);
+        } // if
+    } // for
+} // glsl_init_separable
+
+
+static int glsl_separable_program(MOJOSHADER_glShader *shader)
+{
+    const int vertex = (shader->parseData->shader_type == MOJOSHADER_TYPE_VERTEX);
+    int pending = 0;
+    GLuint program;
+
+    if (shader->program != 0)
+        return 1;  // already linked (or linking).
+
+    program = glsl_link_program(vertex ? shader : NULL,
+                                vertex ? NULL : shader, 1, &pending);
+    if (program == 0)
+        return 0;
+
+    shader->program = program;
+    if (pending)
+        shader->program_status = MOJOSHADER_GLSTATUS_PENDING;
+    else
+    {
+        shader->program_status = MOJOSHADER_GLSTATUS_READY;
+        glsl_init_separable(shader);
+    } // else
+
+    return 1;
+} // glsl_separable_program
+
+
+static MOJOSHADER_glStatus glsl_separable_status(MOJOSHADER_glShader *shader,
+                                                 const int wait)
+{
+    if (shader->program_status == MOJOSHADER_GLSTATUS_PENDING)
+    {
+        const int vertex = (shader->parseData->shader_type == MOJOSHADER_TYPE_VERTEX);
+        if (glsl_busy(shader->program, 1, wait))
+            return MOJOSHADER_GLSTATUS_PENDING;
+        else if (!glsl_link_finished(shader->program, vertex ? shader : NULL,
+                                     vertex ? NULL : shader, 1))
+            shader->program_status = MOJOSHADER_GLSTATUS_FAILED;
+        else
+        {
+            shader->program_status = MOJOSHADER_GLSTATUS_READY;
+            glsl_init_separable(shader);
+        } // else
+    } // if
+
+    return (MOJOSHADER_glStatus) shader->program_status;
+} // glsl_separable_status
+
+
+static void impl_GLSLSSO_DeleteProgram(const GLuint program)
+{
+    ctx->glDeleteProgramPipelines(1, &program);
+} // impl_GLSLSSO_DeleteProgram
+
+
+static GLint impl_GLSLSSO_GetAttribLocation(MOJOSHADER_glProgram *program,
+                                            int idx)
+{
+    const MOJOSHADER_parseData *pd = program->vertex->parseData;
+    const MOJOSHADER_attribute *a = pd->attributes;
+
+    if (ctx->known_attrib_locs)
+    {
+        const GLint loc = glsl_attribute_location(a[idx].usage, a[idx].index);
+        if (loc >= 0)
+            return loc;
+    } // if
+
+    return ctx->glGetAttribLocation(program->vertex->program,
+                                    (const GLchar *) a[idx].name);
+} // impl_GLSLSSO_GetAttribLocation
+
+
+static void glsl_use_program_stages(const GLuint pipeline,
+                                    MOJOSHADER_glShader *vshader,
+                                    MOJOSHADER_glShader *pshader)
+{
+    if (vshader != NULL)
+        ctx->glUseProgramStages(pipeline, GL_VERTEX_SHADER_BIT, vshader->program);
+    if (pshader != NULL)
+        ctx->glUseProgramStages(pipeline, GL_FRAGMENT_SHADER_BIT, pshader->program);
+} // glsl_use_program_stages
+
+
+static GLuint impl_GLSLSSO_LinkProgram(MOJOSHADER_glShader *vshader,
+                                       MOJOSHADER_glShader *pshader,
+                                       int *pending)
+{
+    GLuint pipeline = 0;
+
+    if ((vshader != NULL) && (!glsl_separable_program(vshader)))
+        return 0;
+    else if ((pshader != NULL) && (!glsl_separable_program(pshader)))
+        return 0;
+
+    ctx->glGenProgramPipelines(1, &pipeline);
+    if (pipeline == 0)
+    {
+        set_error("glGenProgramPipelines failed");
+        return 0;
+    } // if
+
+    stat_add(&ctx->stats.program_pipelines, 1);
+
+    // Stages have to be linked before they go in a pipeline, so if either
+    //  is still linking, impl_GLSLSSO_LinkStatus() adds them later.
+    if ( ((vshader != NULL) && (vshader->program_status != MOJOSHADER_GLSTATUS_READY)) ||
+         ((pshader != NULL) && (pshader->program_status != MOJOSHADER_GLSTATUS_READY)) )
+        *pending = 1;
+    else
+        glsl_use_program_stages(pipeline, vshader, pshader);
+
+    return pipeline;
+} // impl_GLSLSSO_LinkProgram
+
+
+static MOJOSHADER_glStatus impl_GLSLSSO_LinkStatus(MOJOSHADER_glProgram *program,
+                                                   int wait)
+{
+    MOJOSHADER_glStatus status;
+
+    if (program->vertex != NULL)
+    {
+        status = glsl_separable_status(program->vertex, wait);
+        if (status != MOJOSHADER_GLSTATUS_READY)
+            return status;
+    } // if
+
+    if (program->fragment != NULL)
+    {
+        status = glsl_separable_status(program->fragment, wait);
+        if (status != MOJOSHADER_GLSTATUS_READY)
+            return status;
+    } // if
+
+    glsl_use_program_stages(program->handle, program->vertex, program->fragment);
+    return MOJOSHADER_GLSTATUS_READY;
+} // impl_GLSLSSO_LinkStatus
+
+
+static void impl_GLSLSSO_FinalInitProgram(MOJOSHADER_glProgram *program)
+{
+    glsl_init_locations(program,
+                        program->vertex ? program->vertex->program : 0,
+                        program->fragment ? program->fragment->program : 0);
+} // impl_GLSLSSO_FinalInitProgram
+
+
+static void impl_GLSLSSO_UseProgram(MOJOSHADER_glProgram *program)
+{
+    ctx->glBindProgramPipeline(program ? program->handle : 0);
+} // impl_GLSLSSO_UseProgram
+
+
+static void impl_GLSLSSO_PushUniforms(void)
+{
+    MOJOSHADER_glProgram *program = ctx->bound_program;
+
+    // Each stage's uniforms live in its own separable program.
+    if (program->vertex != NULL)
+        glsl_push_stage_uniforms(program, 0, program->vertex->program);
+    if (program->fragment != NULL)
+        glsl_push_stage_uniforms(program, 1, program->fragment->program);
+} // impl_GLSLSSO_PushUniforms
+
+
+#if SUPPORT_PROFILE_GLSLUBO
+static int ubo_ring_create(void)
+{
+    // Dynamic storage is for glBufferSubData() in glslubo_push_changes().
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                             GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT;
+    GLint maxblock = 0;
+    GLsizeiptr minsegment = 0;
+    GLsizeiptr len = 0;
+
+    ctx->glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ctx->ubo_alignment);
+    ctx->glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxblock);
+    if (ctx->ubo_alignment <= 0)
+        ctx->ubo_alignment = 256;
+
+    // A segment must fit the biggest possible pair of blocks, since each
+    //  push lives entirely inside one segment. See ubo_ring_alloc().
+    minsegment = 2 * ((GLsizeiptr) maxblock + ctx->ubo_alignment);
+    ctx->ubo_segment_size = UBO_RING_SEGMENT_SIZE;
+    if (ctx->ubo_segment_size < minsegment)
+        ctx->ubo_segment_size = minsegment;
+    len = ctx->ubo_segment_size * UBO_RING_SEGMENTS;
+
+    ctx->glGenBuffers(1, &ctx->ubo_ring);
+    ctx->glBindBuffer(GL_UNIFORM_BUFFER, ctx->ubo_ring);
+    ctx->glBufferStorage(GL_UNIFORM_BUFFER, len, NULL, flags);
+    ctx->ubo_ring_ptr = (uint8 *) ctx->glMapBufferRange(GL_UNIFORM_BUFFER,
+                                                        0, len, flags);
+    ctx->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if (ctx->ubo_ring_ptr == NULL)
+    {
+        set_error("couldn't map uniform buffer ring");
+        ctx->glDeleteBuffers(1, &ctx->ubo_ring);
+        ctx->ubo_ring = 0;
+        return 0;
+    } // if
+
+    ctx->ubo_ring_offset = 0;
+    ctx->ubo_segment = 0;
+    return 1;
+} // ubo_ring_create
+
+
+static uint8 *ubo_ring_alloc(const GLsizeiptr len, GLintptr *offset)
+{
+    const GLintptr align = (GLintptr) ctx->ubo_alignment;
+    const GLintptr segment_end = (ctx->ubo_segment + 1) * ctx->ubo_segment_size;
+    GLintptr pos = ((ctx->ubo_ring_offset + align - 1) / align) * align;
+
+    assert(len <= ctx->ubo_segment_size);
+
+    if ((pos + len) > segment_end)
+    {
+        // Every draw that read this segment was issued before this push, so
+        //  one fence here covers them all. Then wait until the GPU is done
+        //  with the segment we're about to overwrite.
+        GLsync fence;
+        ctx->ubo_fences[ctx->ubo_segment] =
+            ctx->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ctx->ubo_segment = (ctx->ubo_segment + 1) % UBO_RING_SEGMENTS;
+
+        fence = ctx->ubo_fences[ctx->ubo_segment];
+        if (fence != NULL)
+        {
+            GLenum rc;
+            do
+            {
+                rc = ctx->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                           1000000000);  // 1 second.
+            } while (rc == GL_TIMEOUT_EXPIRED);
+            ctx->glDeleteSync(fence);
+            ctx->ubo_fences[ctx->ubo_segment] = NULL;
+        } // if
+
+        pos = ctx->ubo_segment * ctx->ubo_segment_size;
+    } // if
+
+    ctx->ubo_ring_offset = pos + len;
+    *offset = pos;
+    return ctx->ubo_ring_ptr + pos;
+} // ubo_ring_alloc
+
+
+static GLsizeiptr glslubo_bind_block(MOJOSHADER_glProgram *program,
+                                     const char *name, const GLuint binding,
+                                     const size_t regcount)
+{
+    const GLuint idx = ctx->glGetUniformBlockIndex(program->handle, name);
+    if (idx == GL_INVALID_INDEX)
+        return 0;  // shader has no uniforms.
+    ctx->glUniformBlockBinding(program->handle, idx, binding);
+    return (GLsizeiptr) (regcount * 16);  // std140: 16 bytes per element.
+} // glslubo_bind_block
+
+
+static void glslubo_fill_block(uint8 *dst,
+                               const GLfloat *f, const size_t fcount,
+                               const GLint *i, const size_t icount,
+                               const GLint *b, const size_t bcount)
+{
+    size_t j;
+    if (fcount > 0)  // f and i are NULL when the shader has none.
+        memcpy(dst, f, fcount * 16);
+    dst += fcount * 16;
+    if (icount > 0)
+        memcpy(dst, i, icount * 16);
+    dst += icount * 16;
+    for (j = 0; j < bcount; j++, dst += 16)  // std140 pads bools to a vec4.
+        memcpy(dst, &b[j], sizeof (GLint));
+} // glslubo_fill_block
+
+
+/* Push just what changed in one stage's block: the GL copies the block
+ * forward from where it was last pushed (from) to its new slot (to), then
+ * the dirty spans go over it. Both are GL commands, so they happen in order,
+ * and after the draws that still read the old slot; writing the new slot
+ * through the mapping would land before the copy did. Returns zero, having
+ * done nothing, if a fresh copy would be cheaper.
+ */
+static int glslubo_push_changes(const DirtyRange *dirty,
+                                const GLintptr from, const GLintptr to,
+                                const GLsizeiptr len,
+                                const GLfloat *f, const size_t fcount,
+                                const GLint *i, const size_t icount,
+                                const GLint *b, const size_t bcount)
+{
+    const DirtyRange *fdirty = &dirty[MOJOSHADER_UNIFORM_FLOAT];
+    const DirtyRange *idirty = &dirty[MOJOSHADER_UNIFORM_INT];
+    const DirtyRange *bdirty = &dirty[MOJOSHADER_UNIFORM_BOOL];
+    const GLintptr ibase = to + (GLintptr) (fcount * 16);
+    const GLintptr bbase = ibase + (GLintptr) (icount * 16);
+    GLsizeiptr changed = 0;
+    uint32 j, k;
+
+    if ((!ctx->have_GL_ARB_copy_buffer) || (len < UBO_PARTIAL_PUSH_MIN))
+        return 0;
+
+    for (j = 0; j < fdirty->count; j++)
+        changed += (fdirty->hi[j] - fdirty->lo[j]) * 16;
+    for (j = 0; j < idirty->count; j++)
+        changed += (idirty->hi[j] - idirty->lo[j]) * 16;
+    for (j = 0; j < bdirty->count; j++)
+        changed += (bdirty->hi[j] - bdirty->lo[j]) * sizeof (GLint);
+    if ((changed * 4) > len)
+        return 0;
+
+    ctx->glBindBuffer(GL_UNIFORM_BUFFER, ctx->ubo_ring);
+    ctx->glCopyBufferSubData(GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER,
+                             from, to, len);
+
+    for (j = 0; (j < fdirty->count) && (fcount > 0); j++)
+    {
+        const GLsizeiptr n = (fdirty->hi[j] - fdirty->lo[j]) * 16;
+        ctx->glBufferSubData(GL_UNIFORM_BUFFER, to + (fdirty->lo[j] * 16),
+                             n, f + (fdirty->lo[j] * 4));
+        count_uniform_upload((size_t) n);
+    } // for
+
+    for (j = 0; (j < idirty->count) && (icount > 0); j++)
+    {
+        const GLsizeiptr n = (idirty->hi[j] - idirty->lo[j]) * 16;
+        ctx->glBufferSubData(GL_UNIFORM_BUFFER, ibase + (idirty->lo[j] * 16),
+                             n, i + (idirty->lo[j] * 4));
+        count_uniform_upload((size_t) n);
+    } // for
+
+    // std140 pads each bool to a vec4, so they go one at a time.
+    for (j = 0; (j < bdirty->count) && (bcount > 0); j++)
+    {
+        for (k = bdirty->lo[j]; k < bdirty->hi[j]; k++)
+        {
+            ctx->glBufferSubData(GL_UNIFORM_BUFFER, bbase + (k * 16),
+                                 sizeof (GLint), &b[k]);
+            count_uniform_upload(sizeof (GLint));
+        } // for
+    } // for
+
+    return 1;
+} // glslubo_push_changes
+
+
+static void impl_GLSLUBO_FinalInitProgram(MOJOSHADER_glProgram *program)
+{
+    impl_GLSL_FinalInitProgram(program);  // still want vpFlip, etc.
+
+    program->vs_block_size = glslubo_bind_block(program, "vs_uniforms", 0,
+                                    program->vs_uniforms_float4_count +
+                                    program->vs_uniforms_int4_count +
+                                    program->vs_uniforms_bool_count);
+    program->ps_block_size = glslubo_bind_block(program, "ps_uniforms", 1,
+                                    program->ps_uniforms_float4_count +
+                                    program->ps_uniforms_int4_count +
+                                    program->ps_uniforms_bool_count);
+} // impl_GLSLUBO_FinalInitProgram
+
+
+static void impl_GLSLUBO_PushUniforms(void)
+{
+    MOJOSHADER_glProgram *program = ctx->bound_program;
+    const GLintptr align = (GLintptr) ctx->ubo_alignment;
+    const GLsizeiptr vslen = program->vs_block_size;
+    const GLsizeiptr pslen = program->ps_block_size;
+    const GLintptr psoffset = ((vslen + align - 1) / align) * align;
+    // Our last push is only still in the ring if nobody pushed since.
+    const int carry = (ctx->ubo_program == program);
+    GLintptr offset = 0;
+    uint8 *dst = NULL;
+
+    // Both blocks go in one allocation, so they never straddle a segment.
+    dst = ubo_ring_alloc(psoffset + pslen, &offset);
+
+    #define PUSH_BLOCK(stage, binding, blockoffset, len) \
+        if (len > 0) \
+        { \
+            if ( (!carry) || \
+                 (!glslubo_push_changes(program->dirty[binding], \
+                                        ctx->ubo_##stage##_offset, \
+                                        offset + blockoffset, len, \
+                                        program->stage##_uniforms_float4, \
+                                        program->stage##_uniforms_float4_count, \
+                                        program->stage##_uniforms_int4, \
+                                        program->stage##_uniforms_int4_count, \
+                                        program->stage##_uniforms_bool, \
+                                        program->stage##_uniforms_bool_count)) ) \
+            { \
+                glslubo_fill_block(dst + blockoffset, \
+                                   program->stage##_uniforms_float4, \
+                                   program->stage##_uniforms_float4_count, \
+                                   program->stage##_uniforms_int4, \
+                                   program->stage##_uniforms_int4_count, \
+                                   program->stage##_uniforms_bool, \
+                                   program->stage##_uniforms_bool_count); \
+                count_uniform_upload((size_t) len); \
+            } \
+            ctx->glBindBufferRange(GL_UNIFORM_BUFFER, binding, ctx->ubo_ring, \
+                                   offset + blockoffset, len); \
+            ctx->ubo_##stage##_offset = offset + blockoffset; \
+        }
+
+    PUSH_BLOCK(vs, 0, 0, vslen)
+    PUSH_BLOCK(ps, 1, psoffset, pslen)
+
+    #undef PUSH_BLOCK
+
+    // Every block in the ring is whole now, however it got there.
+    memset(program->dirty, '\0', sizeof (program->dirty));
+    ctx->ubo_program = program;
+} // impl_GLSLUBO_PushUniforms
+#endif  // SUPPORT_PROFILE_GLSLUBO
+
+#endif  // SUPPORT_PROFILE_GLSL
+
+
+static void ubo_ring_destroy(void)
+{
+    int i;
+
+    if (ctx->ubo_ring == 0)
+        return;
+
+    for (i = 0; i < UBO_RING_SEGMENTS; i++)
+    {
+        if (ctx->ubo_fences[i] != NULL)
+            ctx->glDeleteSync(ctx->ubo_fences[i]);
+        ctx->ubo_fences[i] = NULL;
+    } // for
+
+    // Deleting a persistently-mapped buffer unmaps it, too.
+    ctx->glDeleteBuffers(1, &ctx->ubo_ring);
+    ctx->ubo_ring = 0;
+    ctx->ubo_ring_ptr = NULL;
+    ctx->ubo_program = NULL;
+} // ubo_ring_destroy
+
+
+#if SUPPORT_PROFILE_ARB1
+static inline GLenum arb1_shader_type(const MOJOSHADER_shaderType t)
+{
+    if (t == MOJOSHADER_TYPE_VERTEX)
+        return GL_VERTEX_PROGRAM_ARB;
+    else if (t == MOJOSHADER_TYPE_PIXEL)
+        return GL_FRAGMENT_PROGRAM_ARB;
+
     // !!! FIXME: geometry shaders?
     return GL_NONE;
 } // arb1_shader_type
@@ -748,7 +2266,8 @@ static GLint impl_ARB1_GetAttribLocation(MOJOSHADER_glProgram *program, int idx)
 
 
 static GLuint impl_ARB1_LinkProgram(MOJOSHADER_glShader *vshader,
-                                    MOJOSHADER_glShader *pshader)
+                                    MOJOSHADER_glShader *pshader,
+                                    int *pending)
 {
     // there is no formal linking in ARB1...just return a unique value.
     static GLuint retval = 1;
@@ -756,6 +2275,21 @@ static GLuint impl_ARB1_LinkProgram(MOJOSHADER_glShader *vshader,
 } // impl_ARB1_LinkProgram
 
 
+// ARB1 compiles are checked right away, so nothing is ever pending.
+static MOJOSHADER_glStatus impl_ARB1_ShaderStatus(MOJOSHADER_glShader *shader,
+                                                  int wait)
+{
+    return MOJOSHADER_GLSTATUS_READY;
+} // impl_ARB1_ShaderStatus
+
+
+static MOJOSHADER_glStatus impl_ARB1_LinkStatus(MOJOSHADER_glProgram *program,
+                                                int wait)
+{
+    return MOJOSHADER_GLSTATUS_READY;
+} // impl_ARB1_LinkStatus
+
+
 static void impl_ARB1_FinalInitProgram(MOJOSHADER_glProgram *program)
 {
     // no-op.
@@ -790,22 +2324,104 @@ static void impl_ARB1_PushConstantArray(MOJOSHADER_glProgram *program,
 } // impl_ARB1_PushConstantArray
 
 
+// Dirty registers are staged here and flushed as one
+//  glProgramLocalParameters4fvEXT (or glProgramLocalParametersI4ivNV) call
+//  per run of consecutive local parameters, instead of one call each.
+#define ARB1_BATCH_MAX 64
+
+typedef struct Arb1Batch
+{
+    GLenum target;
+    GLuint first;  // local parameter index of the first staged register.
+    uint32 count;
+    int ints;  // staged as GLint for GL_NV_gpu_program4, GLfloat otherwise.
+    union
+    {
+        GLfloat f[ARB1_BATCH_MAX * 4];
+        GLint i[ARB1_BATCH_MAX * 4];
+    } data;
+} Arb1Batch;
+
+static void arb1_flush_batch(Arb1Batch *batch)
+{
+    const uint32 count = batch->count;
+    uint32 i;
+
+    if (count == 0)
+        return;
+
+    batch->count = 0;
+
+    if (batch->ints)
+    {
+        // GL_NV_gpu_program4 always has the batched integer entry point.
+        ctx->glProgramLocalParametersI4ivNV(batch->target, batch->first,
+                                            (GLsizei) count, batch->data.i);
+        count_uniform_upload(sizeof (GLint) * 4 * count);
+    } // if
+    else if (ctx->have_GL_EXT_gpu_program_parameters)
+    {
+        ctx->glProgramLocalParameters4fvEXT(batch->target, batch->first,
+                                            (GLsizei) count, batch->data.f);
+        count_uniform_upload(sizeof (GLfloat) * 4 * count);
+    } // else if
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            ctx->glProgramLocalParameter4fvARB(batch->target, batch->first + i,
+                                               &batch->data.f[i * 4]);
+            count_uniform_upload(sizeof (GLfloat) * 4);
+        } // for
+    } // else
+} // arb1_flush_batch
+
+// Returns the 4-component slot for local parameter (loc), flushing first
+//  if (loc) doesn't extend the run that is already staged.
+static void *arb1_batch_slot(Arb1Batch *batch, const GLenum target,
+                             const GLuint loc, const int ints)
+{
+    if ( (batch->count > 0) &&
+         ((batch->target != target) || (batch->ints != ints) ||
+          (batch->first + batch->count != loc) ||
+          (batch->count == ARB1_BATCH_MAX)) )
+        arb1_flush_batch(batch);
+
+    if (batch->count == 0)
+    {
+        batch->target = target;
+        batch->first = loc;
+        batch->ints = ints;
+    } // if
+
+    batch->count++;
+    if (ints)
+        return &batch->data.i[(batch->count - 1) * 4];
+    return &batch->data.f[(batch->count - 1) * 4];
+} // arb1_batch_slot
+
 static void impl_ARB1_PushUniforms(void)
 {
     // vertex shader uniforms come first in program->uniforms array.
     MOJOSHADER_shaderType shader_type = MOJOSHADER_TYPE_VERTEX;
     GLenum arb_shader_type = arb1_shader_type(shader_type);
-    const MOJOSHADER_glProgram *program = ctx->bound_program;
+    MOJOSHADER_glProgram *program = ctx->bound_program;
     const uint32 count = program->uniform_count;
+    const int ints = ctx->have_GL_NV_gpu_program4;
     const GLfloat *srcf = program->vs_uniforms_float4;
     const GLint *srci = program->vs_uniforms_int4;
     const GLint *srcb = program->vs_uniforms_bool;
+    const DirtyRange *dirty = program->dirty[0];
+    uint32 pos[3] = { 0, 0, 0 };  // element offsets, by uniform type.
     GLint loc = 0;
     GLint texbem_loc = 0;
+    Arb1Batch batch;
     uint32 i;
 
     assert(count > 0);  // shouldn't call this with nothing to do!
 
+    batch.count = 0;
+
     for (i = 0; i < count; i++)
     {
         UniformMap *map = &program->uniforms[i];
@@ -830,6 +2446,8 @@ static void impl_ARB1_PushUniforms(void)
                 srcf = program->ps_uniforms_float4;
                 srci = program->ps_uniforms_int4;
                 srcb = program->ps_uniforms_bool;
+                dirty = program->dirty[1];
+                pos[0] = pos[1] = pos[2] = 0;
                 loc = 0;
             } // if
             else
@@ -845,52 +2463,57 @@ static void impl_ARB1_PushUniforms(void)
         if (type == MOJOSHADER_UNIFORM_FLOAT)
         {
             int i;
-            for (i = 0; i < size; i++, srcf += 4, loc++)
-                ctx->glProgramLocalParameter4fvARB(arb_shader_type, loc, srcf);
+            for (i = 0; i < size; i++, srcf += 4, loc++, pos[type]++)
+            {
+                if (in_dirty_range(&dirty[type], pos[type]))
+                {
+                    GLfloat *dst = (GLfloat *) arb1_batch_slot(&batch,
+                                                arb_shader_type, loc, 0);
+                    memcpy(dst, srcf, sizeof (GLfloat) * 4);
+                } // if
+            } // for
         } // if
         else if (type == MOJOSHADER_UNIFORM_INT)
         {
             int i;
-            if (ctx->have_GL_NV_gpu_program4)
-            {
-                // GL_NV_gpu_program4 has integer uniform loading support.
-                for (i = 0; i < size; i++, srci += 4, loc++)
-                    ctx->glProgramLocalParameterI4ivNV(arb_shader_type, loc, srci);
-            } // if
-            else
+            for (i = 0; i < size; i++, srci += 4, loc++, pos[type]++)
             {
-                for (i = 0; i < size; i++, srci += 4, loc++)
+                if (!in_dirty_range(&dirty[type], pos[type]))
+                    continue;
+
+                void *dst = arb1_batch_slot(&batch, arb_shader_type, loc, ints);
+                if (ints)  // GL_NV_gpu_program4 has integer uniform loading.
+                    memcpy(dst, srci, sizeof (GLint) * 4);
+                else
                 {
-                    const GLfloat fv[4] = {
-                        (GLfloat) srci[0], (GLfloat) srci[1],
-                        (GLfloat) srci[2], (GLfloat) srci[3]
-                    };
-                    ctx->glProgramLocalParameter4fvARB(arb_shader_type, loc, fv);
-                } // for
-            } // else
+                    GLfloat *fv = (GLfloat *) dst;
+                    fv[0] = (GLfloat) srci[0];
+                    fv[1] = (GLfloat) srci[1];
+                    fv[2] = (GLfloat) srci[2];
+                    fv[3] = (GLfloat) srci[3];
+                } // else
+            } // for
         } // else if
         else if (type == MOJOSHADER_UNIFORM_BOOL)
         {
             int i;
-            if (ctx->have_GL_NV_gpu_program4)
+            for (i = 0; i < size; i++, srcb++, loc++, pos[type]++)
             {
-                // GL_NV_gpu_program4 has integer uniform loading support.
-                for (i = 0; i < size; i++, srcb++, loc++)
+                if (!in_dirty_range(&dirty[type], pos[type]))
+                    continue;
+
+                void *dst = arb1_batch_slot(&batch, arb_shader_type, loc, ints);
+                if (ints)  // GL_NV_gpu_program4 has integer uniform loading.
                 {
-                    const GLint ib = (GLint) ((*srcb) ? 1 : 0);
-                    const GLint iv[4] = { ib, ib, ib, ib };
-                    ctx->glProgramLocalParameterI4ivNV(arb_shader_type, loc, iv);
-                } // for
-            } // if
-            else
-            {
-                for (i = 0; i < size; i++, srcb++, loc++)
+                    GLint *iv = (GLint *) dst;
+                    iv[0] = iv[1] = iv[2] = iv[3] = (*srcb) ? 1 : 0;
+                } // if
+                else
                 {
-                    const GLfloat fb = (GLfloat) ((*srcb) ? 1.0f : 0.0f);
-                    const GLfloat fv[4] = { fb, fb, fb, fb };
-                    ctx->glProgramLocalParameter4fvARB(arb_shader_type, loc, fv);
-                } // for
-            } // else
+                    GLfloat *fv = (GLfloat *) dst;
+                    fv[0] = fv[1] = fv[2] = fv[3] = (*srcb) ? 1.0f : 0.0f;
+                } // else
+            } // for
         } // else if
     } // for
 
@@ -903,13 +2526,20 @@ static void impl_ARB1_PushUniforms(void)
         loc = texbem_loc;
         for (i = 0; i < program->texbem_count; i++, srcf += 8)
         {
-            ctx->glProgramLocalParameter4fvARB(target, loc++, srcf);
-            ctx->glProgramLocalParameter4fvARB(target, loc++, srcf + 4);
+            memcpy(arb1_batch_slot(&batch, target, loc++, 0), srcf,
+                   sizeof (GLfloat) * 4);
+            memcpy(arb1_batch_slot(&batch, target, loc++, 0), srcf + 4,
+                   sizeof (GLfloat) * 4);
         } // for
     } // if
+
+    arb1_flush_batch(&batch);
+
+    memset(program->dirty, '\0', sizeof (program->dirty));
 } // impl_ARB1_PushUniforms
 
-static void impl_ARB1_PushSampler(GLint loc, GLuint sampler)
+static void impl_ARB1_PushSampler(MOJOSHADER_glProgram *program,
+                                  GLint loc, GLuint sampler)
 {
     // no-op in this profile...arb1 uses the texture units as-is.
     assert(loc == (GLint) sampler);
@@ -924,6 +2554,333 @@ const char *MOJOSHADER_glGetError(void)
 } // MOJOSHADER_glGetError
 
 
+#ifdef MOJOSHADER_GL_TRACE
+
+// The call tracer. lookup_entry_points() swaps each GL entry point for one
+//  of these wrappers, which calls the real one through ctx->trace_real and
+//  records it in the ring buffer if MOJOSHADER_glSetTrace() enabled that.
+//  Pointers to data we pass in are recorded as a payload hash instead.
+
+#define TRACE_ARG(x) ((uint64) (size_t) (x))
+
+static inline uint64 trace_float(const GLfloat f)
+{
+    union { GLfloat f; uint32 ui32; } cvt;
+    cvt.f = f;
+    return (uint64) cvt.ui32;
+} // trace_float
+
+static inline uint64 trace_begin(void)
+{
+    return (ctx->trace_calls != NULL) ? ticks_usecs() : 0;
+} // trace_begin
+
+static uint64 trace_strings(const GLsizei count, const GLchar **strings,
+                            const GLint *lengths, unsigned int *bytes)
+{
+    uint64 hash = HASH64_INIT;
+    GLsizei i;
+
+    *bytes = 0;
+    for (i = 0; i < count; i++)
+    {
+        const size_t len = ((lengths != NULL) && (lengths[i] >= 0)) ?
+                                (size_t) lengths[i] : strlen(strings[i]);
+        hash = hash64(hash, strings[i], len);
+        *bytes += (unsigned int) len;
+    } // for
+
+    return hash;
+} // trace_strings
+
+static void trace_record(const TraceFunction function, const uint64 start,
+                         const uint64 payload_hash, const size_t payload_bytes,
+                         const uint64 a0, const uint64 a1, const uint64 a2,
+                         const uint64 a3, const uint64 a4, const uint64 a5)
+{
+    MOJOSHADER_glTraceCall *call = &ctx->trace_calls[ctx->trace_next];
+    const uint64 now = ticks_usecs();
+
+    ctx->trace_next = (ctx->trace_next + 1) % ctx->trace_size;
+    if (ctx->trace_count < ctx->trace_size)
+        ctx->trace_count++;
+
+    call->usecs = start - ctx->trace_start;
+    call->payload_hash = payload_hash;
+    call->args[0] = a0;
+    call->args[1] = a1;
+    call->args[2] = a2;
+    call->args[3] = a3;
+    call->args[4] = a4;
+    call->args[5] = a5;
+    call->payload_bytes = (unsigned int) payload_bytes;
+    call->duration_usecs = (unsigned int) (now - start);
+    call->function = (unsigned int) function;
+} // trace_record
+
+#define TRACE_END(fn, data, len, a0, a1, a2, a3, a4, a5) \
+    if (start != 0) \
+    { \
+        const size_t payload_bytes = (data != NULL) ? (size_t) (len) : 0; \
+        trace_record(TRACE_##fn, start, \
+                     payload_bytes ? hash64(HASH64_INIT, data, payload_bytes) : 0, \
+                     payload_bytes, a0, a1, a2, a3, a4, a5); \
+    }
+
+#define TRACE_VOID(fn, typ, params, args, data, len, a0, a1, a2, a3, a4, a5) \
+    static void APIENTRY trace_##fn params \
+    { \
+        const uint64 start = trace_begin(); \
+        ((typ) ctx->trace_real[TRACE_##fn]) args; \
+        TRACE_END(fn, data, len, a0, a1, a2, a3, a4, a5); \
+    }
+
+#define TRACE_RETURN(ret, fn, typ, params, args, data, len, a0, a1, a2, a3, a4, a5) \
+    static ret APIENTRY trace_##fn params \
+    { \
+        const uint64 start = trace_begin(); \
+        ret retval = ((typ) ctx->trace_real[TRACE_##fn]) args; \
+        TRACE_END(fn, data, len, a0, a1, a2, a3, a4, a5); \
+        return retval; \
+    }
+
+
+TRACE_RETURN(const GLubyte *, glGetString, PFNGLGETSTRINGPROC, (GLenum name), (name), NULL, 0, TRACE_ARG(name), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLenum, glGetError, PFNGLGETERRORPROC, (void), (), NULL, 0, 0, 0, 0, 0, 0, 0)
+TRACE_VOID(glGetIntegerv, PFNGLGETINTEGERVPROC, (GLenum pname, GLint *params), (pname, params), NULL, 0, TRACE_ARG(pname), 0, 0, 0, 0, 0)
+TRACE_VOID(glEnable, PFNGLENABLEPROC, (GLenum cap), (cap), NULL, 0, TRACE_ARG(cap), 0, 0, 0, 0, 0)
+TRACE_VOID(glDisable, PFNGLDISABLEPROC, (GLenum cap), (cap), NULL, 0, TRACE_ARG(cap), 0, 0, 0, 0, 0)
+TRACE_RETURN(const GLubyte *, glGetStringi, PFNGLGETSTRINGIPROC, (GLenum name, GLuint index), (name, index), NULL, 0, TRACE_ARG(name), TRACE_ARG(index), 0, 0, 0, 0)
+TRACE_VOID(glDeleteShader, PFNGLDELETESHADERPROC, (GLuint shader), (shader), NULL, 0, TRACE_ARG(shader), 0, 0, 0, 0, 0)
+TRACE_VOID(glDeleteProgram, PFNGLDELETEPROGRAMPROC, (GLuint program), (program), NULL, 0, TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glAttachShader, PFNGLATTACHSHADERPROC, (GLuint program, GLuint shader), (program, shader), NULL, 0, TRACE_ARG(program), TRACE_ARG(shader), 0, 0, 0, 0)
+TRACE_VOID(glCompileShader, PFNGLCOMPILESHADERPROC, (GLuint shader), (shader), NULL, 0, TRACE_ARG(shader), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLuint, glCreateShader, PFNGLCREATESHADERPROC, (GLenum type), (type), NULL, 0, TRACE_ARG(type), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLuint, glCreateProgram, PFNGLCREATEPROGRAMPROC, (void), (), NULL, 0, 0, 0, 0, 0, 0, 0)
+TRACE_VOID(glDisableVertexAttribArray, PFNGLDISABLEVERTEXATTRIBARRAYPROC, (GLuint index), (index), NULL, 0, TRACE_ARG(index), 0, 0, 0, 0, 0)
+TRACE_VOID(glEnableVertexAttribArray, PFNGLENABLEVERTEXATTRIBARRAYPROC, (GLuint index), (index), NULL, 0, TRACE_ARG(index), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLint, glGetAttribLocation, PFNGLGETATTRIBLOCATIONPROC, (GLuint program, const GLchar *name), (program, name), name, strlen(name), TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glGetProgramInfoLog, PFNGLGETPROGRAMINFOLOGPROC, (GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog), (program, bufSize, length, infoLog), NULL, 0, TRACE_ARG(program), TRACE_ARG(bufSize), 0, 0, 0, 0)
+TRACE_VOID(glGetShaderInfoLog, PFNGLGETSHADERINFOLOGPROC, (GLuint shader, GLsizei bufSize, GLsizei *length, GLchar *infoLog), (shader, bufSize, length, infoLog), NULL, 0, TRACE_ARG(shader), TRACE_ARG(bufSize), 0, 0, 0, 0)
+TRACE_VOID(glGetShaderiv, PFNGLGETSHADERIVPROC, (GLuint shader, GLenum pname, GLint *params), (shader, pname, params), NULL, 0, TRACE_ARG(shader), TRACE_ARG(pname), 0, 0, 0, 0)
+TRACE_VOID(glGetProgramiv, PFNGLGETPROGRAMIVPROC, (GLuint program, GLenum pname, GLint *params), (program, pname, params), NULL, 0, TRACE_ARG(program), TRACE_ARG(pname), 0, 0, 0, 0)
+TRACE_RETURN(GLint, glGetUniformLocation, PFNGLGETUNIFORMLOCATIONPROC, (GLuint program, const GLchar *name), (program, name), name, strlen(name), TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glLinkProgram, PFNGLLINKPROGRAMPROC, (GLuint program), (program), NULL, 0, TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glUniform1i, PFNGLUNIFORM1IPROC, (GLint location, GLint v0), (location, v0), NULL, 0, TRACE_ARG(location), TRACE_ARG(v0), 0, 0, 0, 0)
+TRACE_VOID(glUniform1iv, PFNGLUNIFORM1IVPROC, (GLint location, GLsizei count, const GLint *value), (location, count, value), value, count * sizeof (GLint), TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+TRACE_VOID(glUniform1f, PFNGLUNIFORM1FPROC, (GLint location, GLfloat v0), (location, v0), NULL, 0, TRACE_ARG(location), trace_float(v0), 0, 0, 0, 0)
+#endif
+TRACE_VOID(glUniform4fv, PFNGLUNIFORM4FVPROC, (GLint location, GLsizei count, const GLfloat *value), (location, count, value), value, count * sizeof (GLfloat) * 4, TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+TRACE_VOID(glUniform4iv, PFNGLUNIFORM4IVPROC, (GLint location, GLsizei count, const GLint *value), (location, count, value), value, count * sizeof (GLint) * 4, TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+TRACE_VOID(glUseProgram, PFNGLUSEPROGRAMPROC, (GLuint program), (program), NULL, 0, TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glVertexAttribPointer, PFNGLVERTEXATTRIBPOINTERPROC, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer), (index, size, type, normalized, stride, pointer), NULL, 0, TRACE_ARG(index), TRACE_ARG(size), TRACE_ARG(type), TRACE_ARG(normalized), TRACE_ARG(stride), TRACE_ARG(pointer))
+TRACE_VOID(glDeleteObjectARB, PFNGLDELETEOBJECTARBPROC, (GLhandleARB obj), (obj), NULL, 0, TRACE_ARG(obj), 0, 0, 0, 0, 0)
+TRACE_VOID(glAttachObjectARB, PFNGLATTACHOBJECTARBPROC, (GLhandleARB containerObj, GLhandleARB obj), (containerObj, obj), NULL, 0, TRACE_ARG(containerObj), TRACE_ARG(obj), 0, 0, 0, 0)
+TRACE_VOID(glCompileShaderARB, PFNGLCOMPILESHADERARBPROC, (GLhandleARB shaderObj), (shaderObj), NULL, 0, TRACE_ARG(shaderObj), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLhandleARB, glCreateProgramObjectARB, PFNGLCREATEPROGRAMOBJECTARBPROC, (void), (), NULL, 0, 0, 0, 0, 0, 0, 0)
+TRACE_RETURN(GLhandleARB, glCreateShaderObjectARB, PFNGLCREATESHADEROBJECTARBPROC, (GLenum shaderType), (shaderType), NULL, 0, TRACE_ARG(shaderType), 0, 0, 0, 0, 0)
+TRACE_VOID(glGetInfoLogARB, PFNGLGETINFOLOGARBPROC, (GLhandleARB obj, GLsizei maxLength, GLsizei *length, GLcharARB *infoLog), (obj, maxLength, length, infoLog), NULL, 0, TRACE_ARG(obj), TRACE_ARG(maxLength), 0, 0, 0, 0)
+TRACE_VOID(glGetObjectParameterivARB, PFNGLGETOBJECTPARAMETERIVARBPROC, (GLhandleARB obj, GLenum pname, GLint *params), (obj, pname, params), NULL, 0, TRACE_ARG(obj), TRACE_ARG(pname), 0, 0, 0, 0)
+TRACE_RETURN(GLint, glGetUniformLocationARB, PFNGLGETUNIFORMLOCATIONARBPROC, (GLhandleARB programObj, const GLcharARB *name), (programObj, name), name, strlen(name), TRACE_ARG(programObj), 0, 0, 0, 0, 0)
+TRACE_VOID(glLinkProgramARB, PFNGLLINKPROGRAMARBPROC, (GLhandleARB programObj), (programObj), NULL, 0, TRACE_ARG(programObj), 0, 0, 0, 0, 0)
+TRACE_VOID(glUniform1iARB, PFNGLUNIFORM1IARBPROC, (GLint location, GLint v0), (location, v0), NULL, 0, TRACE_ARG(location), TRACE_ARG(v0), 0, 0, 0, 0)
+TRACE_VOID(glUniform1ivARB, PFNGLUNIFORM1IVARBPROC, (GLint location, GLsizei count, const GLint *value), (location, count, value), value, count * sizeof (GLint), TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+TRACE_VOID(glUniform4fvARB, PFNGLUNIFORM4FVARBPROC, (GLint location, GLsizei count, const GLfloat *value), (location, count, value), value, count * sizeof (GLfloat) * 4, TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+TRACE_VOID(glUniform4ivARB, PFNGLUNIFORM4IVARBPROC, (GLint location, GLsizei count, const GLint *value), (location, count, value), value, count * sizeof (GLint) * 4, TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0, 0)
+TRACE_VOID(glUseProgramObjectARB, PFNGLUSEPROGRAMOBJECTARBPROC, (GLhandleARB programObj), (programObj), NULL, 0, TRACE_ARG(programObj), 0, 0, 0, 0, 0)
+TRACE_VOID(glDisableVertexAttribArrayARB, PFNGLDISABLEVERTEXATTRIBARRAYARBPROC, (GLuint index), (index), NULL, 0, TRACE_ARG(index), 0, 0, 0, 0, 0)
+TRACE_VOID(glEnableVertexAttribArrayARB, PFNGLENABLEVERTEXATTRIBARRAYARBPROC, (GLuint index), (index), NULL, 0, TRACE_ARG(index), 0, 0, 0, 0, 0)
+TRACE_RETURN(GLint, glGetAttribLocationARB, PFNGLGETATTRIBLOCATIONARBPROC, (GLhandleARB programObj, const GLcharARB *name), (programObj, name), name, strlen(name), TRACE_ARG(programObj), 0, 0, 0, 0, 0)
+TRACE_VOID(glVertexAttribPointerARB, PFNGLVERTEXATTRIBPOINTERARBPROC, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer), (index, size, type, normalized, stride, pointer), NULL, 0, TRACE_ARG(index), TRACE_ARG(size), TRACE_ARG(type), TRACE_ARG(normalized), TRACE_ARG(stride), TRACE_ARG(pointer))
+TRACE_VOID(glGetProgramivARB, PFNGLGETPROGRAMIVARBPROC, (GLenum target, GLenum pname, GLint *params), (target, pname, params), NULL, 0, TRACE_ARG(target), TRACE_ARG(pname), 0, 0, 0, 0)
+TRACE_VOID(glProgramLocalParameter4fvARB, PFNGLPROGRAMLOCALPARAMETER4FVARBPROC, (GLenum target, GLuint index, const GLfloat *params), (target, index, params), params, sizeof (GLfloat) * 4, TRACE_ARG(target), TRACE_ARG(index), 0, 0, 0, 0)
+TRACE_VOID(glDeleteProgramsARB, PFNGLDELETEPROGRAMSARBPROC, (GLsizei n, const GLuint *programs), (n, programs), programs, n * sizeof (GLuint), TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glGenProgramsARB, PFNGLGENPROGRAMSARBPROC, (GLsizei n, GLuint *programs), (n, programs), NULL, 0, TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glBindProgramARB, PFNGLBINDPROGRAMARBPROC, (GLenum target, GLuint program), (target, program), NULL, 0, TRACE_ARG(target), TRACE_ARG(program), 0, 0, 0, 0)
+TRACE_VOID(glProgramStringARB, PFNGLPROGRAMSTRINGARBPROC, (GLenum target, GLenum format, GLsizei len, const GLvoid *string), (target, format, len, string), string, len, TRACE_ARG(target), TRACE_ARG(format), TRACE_ARG(len), 0, 0, 0)
+TRACE_VOID(glProgramLocalParameterI4ivNV, PFNGLPROGRAMLOCALPARAMETERI4IVNVPROC, (GLenum target, GLuint index, const GLint *params), (target, index, params), params, sizeof (GLint) * 4, TRACE_ARG(target), TRACE_ARG(index), 0, 0, 0, 0)
+TRACE_VOID(glProgramLocalParameters4fvEXT, PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC, (GLenum target, GLuint index, GLsizei count, const GLfloat *params), (target, index, count, params), params, sizeof (GLfloat) * 4 * count, TRACE_ARG(target), TRACE_ARG(index), TRACE_ARG(count), 0, 0, 0)
+TRACE_VOID(glProgramLocalParametersI4ivNV, PFNGLPROGRAMLOCALPARAMETERSI4IVNVPROC, (GLenum target, GLuint index, GLsizei count, const GLint *params), (target, index, count, params), params, sizeof (GLint) * 4 * count, TRACE_ARG(target), TRACE_ARG(index), TRACE_ARG(count), 0, 0, 0)
+TRACE_VOID(glVertexAttribDivisorARB, PFNGLVERTEXATTRIBDIVISORARBPROC, (GLuint index, GLuint divisor), (index, divisor), NULL, 0, TRACE_ARG(index), TRACE_ARG(divisor), 0, 0, 0, 0)
+TRACE_VOID(glGetProgramBinary, PFNGLGETPROGRAMBINARYPROC, (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary), (program, bufSize, length, binaryFormat, binary), NULL, 0, TRACE_ARG(program), TRACE_ARG(bufSize), 0, 0, 0, 0)
+TRACE_VOID(glProgramBinary, PFNGLPROGRAMBINARYPROC, (GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length), (program, binaryFormat, binary, length), binary, length, TRACE_ARG(program), TRACE_ARG(binaryFormat), 0, TRACE_ARG(length), 0, 0)
+TRACE_VOID(glProgramParameteri, PFNGLPROGRAMPARAMETERIPROC, (GLuint program, GLenum pname, GLint value), (program, pname, value), NULL, 0, TRACE_ARG(program), TRACE_ARG(pname), TRACE_ARG(value), 0, 0, 0)
+TRACE_VOID(glGenBuffers, PFNGLGENBUFFERSPROC, (GLsizei n, GLuint *buffers), (n, buffers), NULL, 0, TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glDeleteBuffers, PFNGLDELETEBUFFERSPROC, (GLsizei n, const GLuint *buffers), (n, buffers), buffers, n * sizeof (GLuint), TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glBindBuffer, PFNGLBINDBUFFERPROC, (GLenum target, GLuint buffer), (target, buffer), NULL, 0, TRACE_ARG(target), TRACE_ARG(buffer), 0, 0, 0, 0)
+TRACE_VOID(glBindBufferRange, PFNGLBINDBUFFERRANGEPROC, (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size), (target, index, buffer, offset, size), NULL, 0, TRACE_ARG(target), TRACE_ARG(index), TRACE_ARG(buffer), TRACE_ARG(offset), TRACE_ARG(size), 0)
+TRACE_RETURN(GLuint, glGetUniformBlockIndex, PFNGLGETUNIFORMBLOCKINDEXPROC, (GLuint program, const GLchar *uniformBlockName), (program, uniformBlockName), uniformBlockName, strlen(uniformBlockName), TRACE_ARG(program), 0, 0, 0, 0, 0)
+TRACE_VOID(glUniformBlockBinding, PFNGLUNIFORMBLOCKBINDINGPROC, (GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding), (program, uniformBlockIndex, uniformBlockBinding), NULL, 0, TRACE_ARG(program), TRACE_ARG(uniformBlockIndex), TRACE_ARG(uniformBlockBinding), 0, 0, 0)
+TRACE_RETURN(GLvoid *, glMapBufferRange, PFNGLMAPBUFFERRANGEPROC, (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access), (target, offset, length, access), NULL, 0, TRACE_ARG(target), TRACE_ARG(offset), TRACE_ARG(length), TRACE_ARG(access), 0, 0)
+TRACE_VOID(glBufferStorage, MOJO_PFNGLBUFFERSTORAGEPROC, (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags), (target, size, data, flags), data, size, TRACE_ARG(target), TRACE_ARG(size), 0, TRACE_ARG(flags), 0, 0)
+TRACE_VOID(glBufferSubData, PFNGLBUFFERSUBDATAPROC, (GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data), (target, offset, size, data), data, size, TRACE_ARG(target), TRACE_ARG(offset), TRACE_ARG(size), 0, 0, 0)
+TRACE_VOID(glCopyBufferSubData, PFNGLCOPYBUFFERSUBDATAPROC, (GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size), (readTarget, writeTarget, readOffset, writeOffset, size), NULL, 0, TRACE_ARG(readTarget), TRACE_ARG(writeTarget), TRACE_ARG(readOffset), TRACE_ARG(writeOffset), TRACE_ARG(size), 0)
+TRACE_RETURN(GLsync, glFenceSync, PFNGLFENCESYNCPROC, (GLenum condition, GLbitfield flags), (condition, flags), NULL, 0, TRACE_ARG(condition), TRACE_ARG(flags), 0, 0, 0, 0)
+TRACE_RETURN(GLenum, glClientWaitSync, PFNGLCLIENTWAITSYNCPROC, (GLsync sync, GLbitfield flags, GLuint64 timeout), (sync, flags, timeout), NULL, 0, TRACE_ARG(sync), TRACE_ARG(flags), (uint64) timeout, 0, 0, 0)
+TRACE_VOID(glDeleteSync, PFNGLDELETESYNCPROC, (GLsync sync), (sync), NULL, 0, TRACE_ARG(sync), 0, 0, 0, 0, 0)
+TRACE_VOID(glGenProgramPipelines, PFNGLGENPROGRAMPIPELINESPROC, (GLsizei n, GLuint *pipelines), (n, pipelines), NULL, 0, TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glDeleteProgramPipelines, PFNGLDELETEPROGRAMPIPELINESPROC, (GLsizei n, const GLuint *pipelines), (n, pipelines), pipelines, n * sizeof (GLuint), TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glBindProgramPipeline, PFNGLBINDPROGRAMPIPELINEPROC, (GLuint pipeline), (pipeline), NULL, 0, TRACE_ARG(pipeline), 0, 0, 0, 0, 0)
+TRACE_VOID(glUseProgramStages, PFNGLUSEPROGRAMSTAGESPROC, (GLuint pipeline, GLbitfield stages, GLuint program), (pipeline, stages, program), NULL, 0, TRACE_ARG(pipeline), TRACE_ARG(stages), TRACE_ARG(program), 0, 0, 0)
+TRACE_VOID(glProgramUniform1i, PFNGLPROGRAMUNIFORM1IPROC, (GLuint program, GLint location, GLint v0), (program, location, v0), NULL, 0, TRACE_ARG(program), TRACE_ARG(location), TRACE_ARG(v0), 0, 0, 0)
+TRACE_VOID(glProgramUniform1iv, PFNGLPROGRAMUNIFORM1IVPROC, (GLuint program, GLint location, GLsizei count, const GLint *value), (program, location, count, value), value, count * sizeof (GLint), TRACE_ARG(program), TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0)
+TRACE_VOID(glProgramUniform4fv, PFNGLPROGRAMUNIFORM4FVPROC, (GLuint program, GLint location, GLsizei count, const GLfloat *value), (program, location, count, value), value, count * sizeof (GLfloat) * 4, TRACE_ARG(program), TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0)
+TRACE_VOID(glProgramUniform4iv, PFNGLPROGRAMUNIFORM4IVPROC, (GLuint program, GLint location, GLsizei count, const GLint *value), (program, location, count, value), value, count * sizeof (GLint) * 4, TRACE_ARG(program), TRACE_ARG(location), TRACE_ARG(count), 0, 0, 0)
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+TRACE_VOID(glProgramUniform1f, PFNGLPROGRAMUNIFORM1FPROC, (GLuint program, GLint location, GLfloat v0), (program, location, v0), NULL, 0, TRACE_ARG(program), TRACE_ARG(location), trace_float(v0), 0, 0, 0)
+#endif
+TRACE_VOID(glMaxShaderCompilerThreadsKHR, MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC, (GLuint count), (count), NULL, 0, TRACE_ARG(count), 0, 0, 0, 0, 0)
+TRACE_VOID(glMaxShaderCompilerThreadsARB, MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC, (GLuint count), (count), NULL, 0, TRACE_ARG(count), 0, 0, 0, 0, 0)
+TRACE_VOID(glGenVertexArrays, PFNGLGENVERTEXARRAYSPROC, (GLsizei n, GLuint *arrays), (n, arrays), NULL, 0, TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glDeleteVertexArrays, PFNGLDELETEVERTEXARRAYSPROC, (GLsizei n, const GLuint *arrays), (n, arrays), arrays, n * sizeof (GLuint), TRACE_ARG(n), 0, 0, 0, 0, 0)
+TRACE_VOID(glBindVertexArray, PFNGLBINDVERTEXARRAYPROC, (GLuint array), (array), NULL, 0, TRACE_ARG(array), 0, 0, 0, 0, 0)
+
+// Shader source is a list of strings, so it gets hashed by hand.
+static void APIENTRY trace_glShaderSource(GLuint shader, GLsizei count,
+                                          const GLchar **string,
+                                          const GLint *length)
+{
+    const uint64 start = trace_begin();
+    unsigned int bytes = 0;
+    ((PFNGLSHADERSOURCEPROC) ctx->trace_real[TRACE_glShaderSource])(shader, count, string, length);
+    if (start != 0)
+    {
+        const uint64 hash = trace_strings(count, string, length, &bytes);
+        trace_record(TRACE_glShaderSource, start, hash, bytes,
+                     TRACE_ARG(shader), TRACE_ARG(count), 0, 0, 0, 0);
+    } // if
+} // trace_glShaderSource
+
+static void APIENTRY trace_glShaderSourceARB(GLhandleARB shaderObj,
+                                             GLsizei count,
+                                             const GLcharARB **string,
+                                             const GLint *length)
+{
+    const uint64 start = trace_begin();
+    unsigned int bytes = 0;
+    ((PFNGLSHADERSOURCEARBPROC) ctx->trace_real[TRACE_glShaderSourceARB])(shaderObj, count, string, length);
+    if (start != 0)
+    {
+        const uint64 hash = trace_strings(count, (const GLchar **) string,
+                                          length, &bytes);
+        trace_record(TRACE_glShaderSourceARB, start, hash, bytes,
+                       TRACE_ARG(shaderObj), TRACE_ARG(count), 0, 0, 0, 0);
+    } // if
+} // trace_glShaderSourceARB
+
+#undef TRACE_RETURN
+#undef TRACE_VOID
+#undef TRACE_END
+
+// Swap the loaded entry points for their tracing wrappers.
+static void trace_entry_points(void)
+{
+    #define TRACE_INSTALL(fn) { \
+        ctx->trace_real[TRACE_##fn] = (void *) ctx->fn; \
+        if (ctx->fn != NULL) \
+            ctx->fn = trace_##fn; \
+    }
+
+    TRACE_INSTALL(glGetString);
+    TRACE_INSTALL(glGetError);
+    TRACE_INSTALL(glGetIntegerv);
+    TRACE_INSTALL(glEnable);
+    TRACE_INSTALL(glDisable);
+    TRACE_INSTALL(glGetStringi);
+    TRACE_INSTALL(glDeleteShader);
+    TRACE_INSTALL(glDeleteProgram);
+    TRACE_INSTALL(glAttachShader);
+    TRACE_INSTALL(glCompileShader);
+    TRACE_INSTALL(glCreateShader);
+    TRACE_INSTALL(glCreateProgram);
+    TRACE_INSTALL(glDisableVertexAttribArray);
+    TRACE_INSTALL(glEnableVertexAttribArray);
+    TRACE_INSTALL(glGetAttribLocation);
+    TRACE_INSTALL(glGetProgramInfoLog);
+    TRACE_INSTALL(glGetShaderInfoLog);
+    TRACE_INSTALL(glGetShaderiv);
+    TRACE_INSTALL(glGetProgramiv);
+    TRACE_INSTALL(glGetUniformLocation);
+    TRACE_INSTALL(glLinkProgram);
+    TRACE_INSTALL(glShaderSource);
+    TRACE_INSTALL(glUniform1i);
+    TRACE_INSTALL(glUniform1iv);
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+    TRACE_INSTALL(glUniform1f);
+#endif
+    TRACE_INSTALL(glUniform4fv);
+    TRACE_INSTALL(glUniform4iv);
+    TRACE_INSTALL(glUseProgram);
+    TRACE_INSTALL(glVertexAttribPointer);
+    TRACE_INSTALL(glDeleteObjectARB);
+    TRACE_INSTALL(glAttachObjectARB);
+    TRACE_INSTALL(glCompileShaderARB);
+    TRACE_INSTALL(glCreateProgramObjectARB);
+    TRACE_INSTALL(glCreateShaderObjectARB);
+    TRACE_INSTALL(glGetInfoLogARB);
+    TRACE_INSTALL(glGetObjectParameterivARB);
+    TRACE_INSTALL(glGetUniformLocationARB);
+    TRACE_INSTALL(glLinkProgramARB);
+    TRACE_INSTALL(glShaderSourceARB);
+    TRACE_INSTALL(glUniform1iARB);
+    TRACE_INSTALL(glUniform1ivARB);
+    TRACE_INSTALL(glUniform4fvARB);
+    TRACE_INSTALL(glUniform4ivARB);
+    TRACE_INSTALL(glUseProgramObjectARB);
+    TRACE_INSTALL(glDisableVertexAttribArrayARB);
+    TRACE_INSTALL(glEnableVertexAttribArrayARB);
+    TRACE_INSTALL(glGetAttribLocationARB);
+    TRACE_INSTALL(glVertexAttribPointerARB);
+    TRACE_INSTALL(glGetProgramivARB);
+    TRACE_INSTALL(glProgramLocalParameter4fvARB);
+    TRACE_INSTALL(glDeleteProgramsARB);
+    TRACE_INSTALL(glGenProgramsARB);
+    TRACE_INSTALL(glBindProgramARB);
+    TRACE_INSTALL(glProgramStringARB);
+    TRACE_INSTALL(glProgramLocalParameterI4ivNV);
+    TRACE_INSTALL(glProgramLocalParameters4fvEXT);
+    TRACE_INSTALL(glProgramLocalParametersI4ivNV);
+    TRACE_INSTALL(glVertexAttribDivisorARB);
+    TRACE_INSTALL(glGetProgramBinary);
+    TRACE_INSTALL(glProgramBinary);
+    TRACE_INSTALL(glProgramParameteri);
+    TRACE_INSTALL(glGenBuffers);
+    TRACE_INSTALL(glDeleteBuffers);
+    TRACE_INSTALL(glBindBuffer);
+    TRACE_INSTALL(glBindBufferRange);
+    TRACE_INSTALL(glGetUniformBlockIndex);
+    TRACE_INSTALL(glUniformBlockBinding);
+    TRACE_INSTALL(glMapBufferRange);
+    TRACE_INSTALL(glBufferStorage);
+    TRACE_INSTALL(glBufferSubData);
+    TRACE_INSTALL(glCopyBufferSubData);
+    TRACE_INSTALL(glFenceSync);
+    TRACE_INSTALL(glClientWaitSync);
+    TRACE_INSTALL(glDeleteSync);
+    TRACE_INSTALL(glGenProgramPipelines);
+    TRACE_INSTALL(glDeleteProgramPipelines);
+    TRACE_INSTALL(glBindProgramPipeline);
+    TRACE_INSTALL(glUseProgramStages);
+    TRACE_INSTALL(glProgramUniform1i);
+    TRACE_INSTALL(glProgramUniform1iv);
+    TRACE_INSTALL(glProgramUniform4fv);
+    TRACE_INSTALL(glProgramUniform4iv);
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+    TRACE_INSTALL(glProgramUniform1f);
+#endif
+    TRACE_INSTALL(glMaxShaderCompilerThreadsKHR);
+    TRACE_INSTALL(glMaxShaderCompilerThreadsARB);
+    TRACE_INSTALL(glGenVertexArrays);
+    TRACE_INSTALL(glDeleteVertexArrays);
+    TRACE_INSTALL(glBindVertexArray);
+
+    #undef TRACE_INSTALL
+} // trace_entry_points
+
+#endif  // MOJOSHADER_GL_TRACE
+
+
 static void *loadsym(MOJOSHADER_glGetProcAddress lookup, void *d,
                      const char *fn, int *ext)
 {
@@ -1001,9 +2958,48 @@ static void lookup_entry_points(MOJOSHADER_glGetProcAddress lookup, void *d)
     DO_LOOKUP(GL_ARB_vertex_program, PFNGLBINDPROGRAMARBPROC, glBindProgramARB);
     DO_LOOKUP(GL_ARB_vertex_program, PFNGLPROGRAMSTRINGARBPROC, glProgramStringARB);
     DO_LOOKUP(GL_NV_gpu_program4, PFNGLPROGRAMLOCALPARAMETERI4IVNVPROC, glProgramLocalParameterI4ivNV);
+    DO_LOOKUP(GL_NV_gpu_program4, PFNGLPROGRAMLOCALPARAMETERSI4IVNVPROC, glProgramLocalParametersI4ivNV);
+    DO_LOOKUP(GL_EXT_gpu_program_parameters, PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC, glProgramLocalParameters4fvEXT);
     DO_LOOKUP(GL_ARB_instanced_arrays, PFNGLVERTEXATTRIBDIVISORARBPROC, glVertexAttribDivisorARB);
+    DO_LOOKUP(GL_ARB_get_program_binary, PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary);
+    DO_LOOKUP(GL_ARB_get_program_binary, PFNGLPROGRAMBINARYPROC, glProgramBinary);
+    DO_LOOKUP(GL_ARB_get_program_binary, PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLGENBUFFERSPROC, glGenBuffers);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLDELETEBUFFERSPROC, glDeleteBuffers);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLBINDBUFFERPROC, glBindBuffer);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLBINDBUFFERRANGEPROC, glBindBufferRange);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLGETUNIFORMBLOCKINDEXPROC, glGetUniformBlockIndex);
+    DO_LOOKUP(GL_ARB_uniform_buffer_object, PFNGLUNIFORMBLOCKBINDINGPROC, glUniformBlockBinding);
+    DO_LOOKUP(GL_ARB_map_buffer_range, PFNGLMAPBUFFERRANGEPROC, glMapBufferRange);
+    DO_LOOKUP(GL_ARB_buffer_storage, MOJO_PFNGLBUFFERSTORAGEPROC, glBufferStorage);
+    DO_LOOKUP(GL_ARB_copy_buffer, PFNGLBUFFERSUBDATAPROC, glBufferSubData);
+    DO_LOOKUP(GL_ARB_copy_buffer, PFNGLCOPYBUFFERSUBDATAPROC, glCopyBufferSubData);
+    DO_LOOKUP(GL_ARB_sync, PFNGLFENCESYNCPROC, glFenceSync);
+    DO_LOOKUP(GL_ARB_sync, PFNGLCLIENTWAITSYNCPROC, glClientWaitSync);
+    DO_LOOKUP(GL_ARB_sync, PFNGLDELETESYNCPROC, glDeleteSync);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLGENPROGRAMPIPELINESPROC, glGenProgramPipelines);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLDELETEPROGRAMPIPELINESPROC, glDeleteProgramPipelines);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLBINDPROGRAMPIPELINEPROC, glBindProgramPipeline);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLUSEPROGRAMSTAGESPROC, glUseProgramStages);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMUNIFORM1IPROC, glProgramUniform1i);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMUNIFORM1IVPROC, glProgramUniform1iv);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMUNIFORM4FVPROC, glProgramUniform4fv);
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMUNIFORM4IVPROC, glProgramUniform4iv);
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+    DO_LOOKUP(GL_ARB_separate_shader_objects, PFNGLPROGRAMUNIFORM1FPROC, glProgramUniform1f);
+#endif
+    DO_LOOKUP(GL_KHR_parallel_shader_compile, MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC, glMaxShaderCompilerThreadsKHR);
+    DO_LOOKUP(GL_ARB_parallel_shader_compile, MOJO_PFNGLMAXSHADERCOMPILERTHREADSPROC, glMaxShaderCompilerThreadsARB);
+    DO_LOOKUP(GL_ARB_vertex_array_object, PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays);
+    DO_LOOKUP(GL_ARB_vertex_array_object, PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays);
+    DO_LOOKUP(GL_ARB_vertex_array_object, PFNGLBINDVERTEXARRAYPROC, glBindVertexArray);
 
     #undef DO_LOOKUP
+
+#ifdef MOJOSHADER_GL_TRACE
+    trace_entry_points();
+#endif
 } // lookup_entry_points
 
 static inline int opengl_version_atleast(const int major, const int minor)
@@ -1112,6 +3108,7 @@ static void load_extensions(MOJOSHADER_glGetProcAddress lookup, void *d)
     ctx->have_GL_NV_fragment_program2 = 1;
     ctx->have_GL_NV_vertex_program3 = 1;
     ctx->have_GL_NV_gpu_program4 = 1;
+    ctx->have_GL_EXT_gpu_program_parameters = 1;
     ctx->have_GL_ARB_shader_objects = 1;
     ctx->have_GL_ARB_vertex_shader = 1;
     ctx->have_GL_ARB_fragment_shader = 1;
@@ -1120,6 +3117,17 @@ static void load_extensions(MOJOSHADER_glGetProcAddress lookup, void *d)
     ctx->have_GL_ARB_half_float_vertex = 1;
     ctx->have_GL_OES_vertex_half_float = 1;
     ctx->have_GL_ARB_instanced_arrays = 1;
+    ctx->have_GL_ARB_get_program_binary = 1;
+    ctx->have_GL_ARB_uniform_buffer_object = 1;
+    ctx->have_GL_ARB_map_buffer_range = 1;
+    ctx->have_GL_ARB_buffer_storage = 1;
+    ctx->have_GL_ARB_copy_buffer = 1;
+    ctx->have_GL_ARB_sync = 1;
+    ctx->have_GL_ARB_separate_shader_objects = 1;
+    ctx->have_GL_KHR_parallel_shader_compile = 1;
+    ctx->have_GL_ARB_parallel_shader_compile = 1;
+    ctx->have_GL_ARB_vertex_array_object = 1;
+    ctx->have_GL_ARB_explicit_uniform_location = 1;
 
     lookup_entry_points(lookup, d);
 
@@ -1214,10 +3222,24 @@ static void load_extensions(MOJOSHADER_glGetProcAddress lookup, void *d)
     VERIFY_EXT(GL_NV_vertex_program2_option, -1, -1);
     VERIFY_EXT(GL_NV_fragment_program2, -1, -1);
     VERIFY_EXT(GL_NV_vertex_program3, -1, -1);
+    VERIFY_EXT(GL_EXT_gpu_program_parameters, -1, -1);
     VERIFY_EXT(GL_NV_half_float, -1, -1);
     VERIFY_EXT(GL_ARB_half_float_vertex, 3, 0);
     VERIFY_EXT(GL_OES_vertex_half_float, -1, -1);
     VERIFY_EXT(GL_ARB_instanced_arrays, 3, 3);
+    VERIFY_EXT(GL_ARB_get_program_binary, 4, 1);
+    VERIFY_EXT(GL_ARB_uniform_buffer_object, 3, 1);
+    VERIFY_EXT(GL_ARB_map_buffer_range, 3, 0);
+    VERIFY_EXT(GL_ARB_buffer_storage, 4, 4);
+    VERIFY_EXT(GL_ARB_copy_buffer, 3, 1);
+    VERIFY_EXT(GL_ARB_sync, 3, 2);
+    VERIFY_EXT(GL_ARB_separate_shader_objects, 4, 1);
+    VERIFY_EXT(GL_KHR_parallel_shader_compile, -1, -1);
+    VERIFY_EXT(GL_ARB_parallel_shader_compile, -1, -1);
+    VERIFY_EXT(GL_ARB_vertex_array_object, 3, 0);
+    // Only trust the extension string here, since that's what decides if
+    //  the GLSL compiler honors UNIFORM_LOCATION() in glsl330 shaders.
+    VERIFY_EXT(GL_ARB_explicit_uniform_location, -1, -1);
 
     #undef VERIFY_EXT
 
@@ -1292,6 +3314,31 @@ static int valid_profile(const char *profile)
     } // else if
     #endif
 
+    #if SUPPORT_PROFILE_GLSLUBO
+    else if (strcmp(profile, MOJOSHADER_PROFILE_GLSLUBO) == 0)
+    {
+        MUST_HAVE_GLSL(MOJOSHADER_PROFILE_GLSLUBO, 1, 20);
+        MUST_HAVE(MOJOSHADER_PROFILE_GLSLUBO, GL_ARB_uniform_buffer_object);
+        MUST_HAVE(MOJOSHADER_PROFILE_GLSLUBO, GL_ARB_map_buffer_range);
+        MUST_HAVE(MOJOSHADER_PROFILE_GLSLUBO, GL_ARB_buffer_storage);
+        MUST_HAVE(MOJOSHADER_PROFILE_GLSLUBO, GL_ARB_sync);
+    } // else if
+    #endif
+
+    #if SUPPORT_PROFILE_GLSL330
+    else if (strcmp(profile, MOJOSHADER_PROFILE_GLSL330) == 0)
+    {
+        MUST_HAVE_GLSL(MOJOSHADER_PROFILE_GLSL330, 3, 30);
+    } // else if
+    #endif
+
+    #if SUPPORT_PROFILE_GLSL420
+    else if (strcmp(profile, MOJOSHADER_PROFILE_GLSL420) == 0)
+    {
+        MUST_HAVE_GLSL(MOJOSHADER_PROFILE_GLSL420, 4, 20);
+    } // else if
+    #endif
+
     #if SUPPORT_PROFILE_GLSL
     else if (strcmp(profile, MOJOSHADER_PROFILE_GLSL) == 0)
     {
@@ -1318,6 +3365,15 @@ static const char *profile_priorities[] = {
 #if SUPPORT_PROFILE_GLSL
     MOJOSHADER_PROFILE_GLSL,
 #endif
+#if SUPPORT_PROFILE_GLSLUBO
+    MOJOSHADER_PROFILE_GLSLUBO,  // opt-in, so it doesn't outrank glsl120.
+#endif
+#if SUPPORT_PROFILE_GLSL420
+    MOJOSHADER_PROFILE_GLSL420,  // opt-in, too.
+#endif
+#if SUPPORT_PROFILE_GLSL330
+    MOJOSHADER_PROFILE_GLSL330,
+#endif
 #if SUPPORT_PROFILE_ARB1_NV
     MOJOSHADER_PROFILE_NV4,
     MOJOSHADER_PROFILE_NV3,
@@ -1396,11 +3452,12 @@ const char *MOJOSHADER_glBestProfile(MOJOSHADER_glGetProcAddress gpa,
 } // MOJOSHADER_glBestProfile
 
 
-MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
+static MOJOSHADER_glContext *create_context(const char *profile,
                                         MOJOSHADER_glGetProcAddress lookup,
                                         void *lookup_d,
                                         MOJOSHADER_malloc m, MOJOSHADER_free f,
-                                        void *malloc_d)
+                                        void *malloc_d,
+                                        MOJOSHADER_glContext *share)
 {
     MOJOSHADER_glContext *retval = NULL;
     MOJOSHADER_glContext *current_ctx = ctx;
@@ -1421,6 +3478,11 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
     ctx->malloc_fn = m;
     ctx->free_fn = f;
     ctx->malloc_data = malloc_d;
+    ctx->vertex_array = &ctx->default_vertex_array;
+    if (share != NULL)
+        ctx->share_group = share->share_group;
+    else
+        ctx->share_group = atomic_increment(&share_group_serial);
     snprintf(ctx->profile, sizeof (ctx->profile), "%s", profile);
 
     load_extensions(lookup, lookup_d);
@@ -1440,12 +3502,18 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
     // !!! FIXME: generalize this part.
     if (profile == NULL) {}
 
-    // We don't check SUPPORT_PROFILE_GLSL120/ES here, since valid_profile() does.
+    // We don't check SUPPORT_PROFILE_GLSL120/ES/UBO/330/420 here, since valid_profile() does.
 #if SUPPORT_PROFILE_GLSL
     else if ( (strcmp(profile, MOJOSHADER_PROFILE_GLSL) == 0) ||
               (strcmp(profile, MOJOSHADER_PROFILE_GLSL120) == 0) ||
+              (strcmp(profile, MOJOSHADER_PROFILE_GLSLUBO) == 0) ||
+              (strcmp(profile, MOJOSHADER_PROFILE_GLSL330) == 0) ||
+              (strcmp(profile, MOJOSHADER_PROFILE_GLSL420) == 0) ||
               (strcmp(profile, MOJOSHADER_PROFILE_GLSLES) == 0) )
     {
+        const int core = (strcmp(profile, MOJOSHADER_PROFILE_GLSL330) == 0) ||
+                         (strcmp(profile, MOJOSHADER_PROFILE_GLSL420) == 0);
+
         ctx->profileMaxUniforms = impl_GLSL_MaxUniforms;
         ctx->profileCompileShader = impl_GLSL_CompileShader;
         ctx->profileDeleteShader = impl_GLSL_DeleteShader;
@@ -1454,6 +3522,8 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
         ctx->profileGetUniformLocation = impl_GLSL_GetUniformLocation;
         ctx->profileGetSamplerLocation = impl_GLSL_GetSamplerLocation;
         ctx->profileLinkProgram = impl_GLSL_LinkProgram;
+        ctx->profileShaderStatus = impl_GLSL_ShaderStatus;
+        ctx->profileLinkStatus = impl_GLSL_LinkStatus;
         ctx->profileFinalInitProgram = impl_GLSL_FinalInitProgram;
         ctx->profileUseProgram = impl_GLSL_UseProgram;
         ctx->profilePushConstantArray = impl_GLSL_PushConstantArray;
@@ -1461,6 +3531,52 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
         ctx->profilePushSampler = impl_GLSL_PushSampler;
         ctx->profileMustPushConstantArrays = impl_GLSL_MustPushConstantArrays;
         ctx->profileMustPushSamplers = impl_GLSL_MustPushSamplers;
+        ctx->async_capable = ctx->have_opengl_2;
+        ctx->known_attrib_locs = core;
+        ctx->known_uniform_locs = core && ctx->have_GL_ARB_explicit_uniform_location;
+        ctx->known_pixel_samplers = (strcmp(profile, MOJOSHADER_PROFILE_GLSL420) == 0);
+
+        // Pipelines need GL2 entry points, and the UBO and ES profiles bind
+        //  things per linked program, so only plain and core GLSL use them.
+        //  A shader's separable program (and its uniforms) would be visible
+        //  to every context in a share group, so only the first one gets
+        //  to use them.
+        if ( (share == NULL) &&
+             (ctx->have_opengl_2) && (!ctx->have_opengl_es) &&
+             (ctx->have_GL_ARB_separate_shader_objects) &&
+             ( (strcmp(profile, MOJOSHADER_PROFILE_GLSL) == 0) ||
+               (strcmp(profile, MOJOSHADER_PROFILE_GLSL120) == 0) ||
+               (core) ) )
+        {
+            ctx->use_pipelines = 1;
+            ctx->profileDeleteProgram = impl_GLSLSSO_DeleteProgram;
+            ctx->profileGetAttribLocation = impl_GLSLSSO_GetAttribLocation;
+            ctx->profileLinkProgram = impl_GLSLSSO_LinkProgram;
+            ctx->profileLinkStatus = impl_GLSLSSO_LinkStatus;
+            ctx->profileFinalInitProgram = impl_GLSLSSO_FinalInitProgram;
+            ctx->profileUseProgram = impl_GLSLSSO_UseProgram;
+            ctx->profilePushUniforms = impl_GLSLSSO_PushUniforms;
+            ctx->profileMustPushConstantArrays = impl_GLSLSSO_MustPushConstantArrays;
+            ctx->profileMustPushSamplers = impl_GLSLSSO_MustPushSamplers;
+        } // if
+
+        else if ( (ctx->have_opengl_2) && (!ctx->have_opengl_es) &&
+                  (ctx->have_GL_ARB_separate_shader_objects) )
+        {
+            ctx->program_dsa = 1;
+            ctx->profilePushConstantArray = impl_GLSLDSA_PushConstantArray;
+            ctx->profilePushSampler = impl_GLSLDSA_PushSampler;
+        } // else if
+
+        #if SUPPORT_PROFILE_GLSLUBO
+        if (strcmp(profile, MOJOSHADER_PROFILE_GLSLUBO) == 0)
+        {
+            ctx->profileFinalInitProgram = impl_GLSLUBO_FinalInitProgram;
+            ctx->profilePushUniforms = impl_GLSLUBO_PushUniforms;
+            if (!ubo_ring_create())
+                goto init_fail;
+        } // if
+        #endif
     } // if
 #endif
 
@@ -1479,6 +3595,8 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
         ctx->profileGetUniformLocation = impl_ARB1_GetUniformLocation;
         ctx->profileGetSamplerLocation = impl_ARB1_GetSamplerLocation;
         ctx->profileLinkProgram = impl_ARB1_LinkProgram;
+        ctx->profileShaderStatus = impl_ARB1_ShaderStatus;
+        ctx->profileLinkStatus = impl_ARB1_LinkStatus;
         ctx->profileFinalInitProgram = impl_ARB1_FinalInitProgram;
         ctx->profileUseProgram = impl_ARB1_UseProgram;
         ctx->profilePushConstantArray = impl_ARB1_PushConstantArray;
@@ -1498,6 +3616,8 @@ MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
     assert(ctx->profileGetUniformLocation != NULL);
     assert(ctx->profileGetSamplerLocation != NULL);
     assert(ctx->profileLinkProgram != NULL);
+    assert(ctx->profileShaderStatus != NULL);
+    assert(ctx->profileLinkStatus != NULL);
     assert(ctx->profileFinalInitProgram != NULL);
     assert(ctx->profileUseProgram != NULL);
     assert(ctx->profilePushConstantArray != NULL);
@@ -1515,1111 +3635,3809 @@ init_fail:
         f(ctx, malloc_d);
     ctx = current_ctx;
     return NULL;
+} // create_context
+
+
+MOJOSHADER_glContext *MOJOSHADER_glCreateContext(const char *profile,
+                                        MOJOSHADER_glGetProcAddress lookup,
+                                        void *lookup_d,
+                                        MOJOSHADER_malloc m, MOJOSHADER_free f,
+                                        void *malloc_d)
+{
+    return create_context(profile, lookup, lookup_d, m, f, malloc_d, NULL);
 } // MOJOSHADER_glCreateContext
 
 
+MOJOSHADER_glContext *MOJOSHADER_glCreateSharedContext(
+                                        MOJOSHADER_glContext *share,
+                                        MOJOSHADER_glGetProcAddress lookup,
+                                        void *lookup_d)
+{
+    // Shaders move between these, so they have to agree on what a shader
+    //  is and where its memory came from.
+    return create_context(share->profile, lookup, lookup_d, share->malloc_fn,
+                          share->free_fn, share->malloc_data, share);
+} // MOJOSHADER_glCreateSharedContext
+
+
 void MOJOSHADER_glMakeContextCurrent(MOJOSHADER_glContext *_ctx)
 {
     ctx = _ctx;
 } // MOJOSHADER_glMakeContextCurrent
 
 
-int MOJOSHADER_glMaxUniforms(MOJOSHADER_shaderType shader_type)
-{
-    return ctx->profileMaxUniforms(shader_type);
-} // MOJOSHADER_glMaxUniforms
-
+// The explicit-context entry points make (_ctx) current on this thread for
+//  the length of the call. The current context is thread-local, so other
+//  threads can't see this, but callbacks made during the call do.
+#define CALL_WITH_CONTEXT(_ctx, call) \
+    { \
+        MOJOSHADER_glContext *current_ctx = ctx; \
+        ctx = _ctx; \
+        call; \
+        ctx = current_ctx; \
+    }
 
-MOJOSHADER_glShader *MOJOSHADER_glCompileShader(const unsigned char *tokenbuf,
-                                                const unsigned int bufsize,
-                                                const MOJOSHADER_swizzle *swiz,
-                                                const unsigned int swizcount,
-                                                const MOJOSHADER_samplerMap *smap,
-                                                const unsigned int smapcount)
+MOJOSHADER_glShader *MOJOSHADER_glContextCompileShader(
+                                        MOJOSHADER_glContext *_ctx,
+                                        const unsigned char *tokenbuf,
+                                        const unsigned int bufsize,
+                                        const MOJOSHADER_swizzle *swiz,
+                                        const unsigned int swizcount,
+                                        const MOJOSHADER_samplerMap *smap,
+                                        const unsigned int smapcount)
 {
     MOJOSHADER_glShader *retval = NULL;
-    GLuint shader = 0;
+    CALL_WITH_CONTEXT(_ctx, retval = MOJOSHADER_glCompileShader(tokenbuf,
+                                       bufsize, swiz, swizcount, smap,
+                                       smapcount));
+    return retval;
+} // MOJOSHADER_glContextCompileShader
 
-    // This doesn't need a mainfn, since there's no GL lang that does.
-    const MOJOSHADER_parseData *pd = MOJOSHADER_parse(ctx->profile, NULL,
-                                                      tokenbuf, bufsize,
-                                                      swiz, swizcount,
-                                                      smap, smapcount,
-                                                      ctx->malloc_fn,
-                                                      ctx->free_fn,
-                                                      ctx->malloc_data);
-    if (pd->error_count > 0)
-    {
-        // !!! FIXME: put multiple errors in the buffer? Don't use
-        // !!! FIXME:  MOJOSHADER_glGetError() for this?
-        set_error(pd->errors[0].error);
-        goto compile_shader_fail;
-    } // if
+void MOJOSHADER_glContextBindProgram(MOJOSHADER_glContext *_ctx,
+                                     MOJOSHADER_glProgram *program)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glBindProgram(program));
+} // MOJOSHADER_glContextBindProgram
 
-    retval = (MOJOSHADER_glShader *) Malloc(sizeof (MOJOSHADER_glShader));
-    if (retval == NULL)
-        goto compile_shader_fail;
+void MOJOSHADER_glContextBindShaders(MOJOSHADER_glContext *_ctx,
+                                     MOJOSHADER_glShader *v,
+                                     MOJOSHADER_glShader *p)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glBindShaders(v, p));
+} // MOJOSHADER_glContextBindShaders
 
-    if (!ctx->profileCompileShader(pd, &shader))
-        goto compile_shader_fail;
+void MOJOSHADER_glContextSetVertexShaderUniformF(MOJOSHADER_glContext *_ctx,
+                                                 unsigned int idx,
+                                                 const float *data,
+                                                 unsigned int vec4n)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetVertexShaderUniformF(idx, data,
+                                                                 vec4n));
+} // MOJOSHADER_glContextSetVertexShaderUniformF
+
+void MOJOSHADER_glContextSetVertexShaderUniformI(MOJOSHADER_glContext *_ctx,
+                                                 unsigned int idx,
+                                                 const int *data,
+                                                 unsigned int ivec4n)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetVertexShaderUniformI(idx, data,
+                                                                 ivec4n));
+} // MOJOSHADER_glContextSetVertexShaderUniformI
+
+void MOJOSHADER_glContextSetVertexShaderUniformB(MOJOSHADER_glContext *_ctx,
+                                                 unsigned int idx,
+                                                 const int *data,
+                                                 unsigned int bcount)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetVertexShaderUniformB(idx, data,
+                                                                 bcount));
+} // MOJOSHADER_glContextSetVertexShaderUniformB
+
+void MOJOSHADER_glContextSetPixelShaderUniformF(MOJOSHADER_glContext *_ctx,
+                                                unsigned int idx,
+                                                const float *data,
+                                                unsigned int vec4n)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetPixelShaderUniformF(idx, data,
+                                                                vec4n));
+} // MOJOSHADER_glContextSetPixelShaderUniformF
+
+void MOJOSHADER_glContextSetPixelShaderUniformI(MOJOSHADER_glContext *_ctx,
+                                                unsigned int idx,
+                                                const int *data,
+                                                unsigned int ivec4n)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetPixelShaderUniformI(idx, data,
+                                                                ivec4n));
+} // MOJOSHADER_glContextSetPixelShaderUniformI
+
+void MOJOSHADER_glContextSetPixelShaderUniformB(MOJOSHADER_glContext *_ctx,
+                                                unsigned int idx,
+                                                const int *data,
+                                                unsigned int bcount)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glSetPixelShaderUniformB(idx, data,
+                                                                bcount));
+} // MOJOSHADER_glContextSetPixelShaderUniformB
 
-    retval->parseData = pd;
-    retval->handle = shader;
-    retval->refcount = 1;
-    return retval;
+void MOJOSHADER_glContextProgramReady(MOJOSHADER_glContext *_ctx)
+{
+    CALL_WITH_CONTEXT(_ctx, MOJOSHADER_glProgramReady());
+} // MOJOSHADER_glContextProgramReady
 
-compile_shader_fail:
-    MOJOSHADER_freeParseData(pd);
-    Free(retval);
-    if (shader != 0)
-        ctx->profileDeleteShader(shader);
-    return NULL;
-} // MOJOSHADER_glCompileShader
+#undef CALL_WITH_CONTEXT
 
 
-const MOJOSHADER_parseData *MOJOSHADER_glGetShaderParseData(
-                                                MOJOSHADER_glShader *shader)
+int MOJOSHADER_glMaxUniforms(MOJOSHADER_shaderType shader_type)
 {
-    return (shader != NULL) ? shader->parseData : NULL;
-} // MOJOSHADER_glGetShaderParseData
+    return ctx->profileMaxUniforms(shader_type);
+} // MOJOSHADER_glMaxUniforms
 
 
-static void shader_unref(MOJOSHADER_glShader *shader)
+// Returns a copy of (file) with room for (want) registers, or NULL if we're
+//  out of memory. New registers read as zero, like the old static arrays.
+static void *grow_register_file(void *file, uint *size, RegisterStamps *stamps,
+                                const size_t regsize, const uint maxregs,
+                                uint want)
 {
-    if (shader != NULL)
+    const uint oldsize = *size;
+    const uint oldgroups = (oldsize + 3) >> REG_STAMP_SHIFT;
+    uint newsize = (oldsize > 0) ? oldsize : 16;
+    uint newgroups;
+    uint8 *retval = NULL;
+    uint32 *blocks = NULL;
+
+    if (want > maxregs)
+        want = maxregs;
+    assert(want > oldsize);
+
+    while (newsize < want)
+        newsize *= 2;
+    if (newsize > maxregs)
+        newsize = maxregs;
+    newgroups = (newsize + 3) >> REG_STAMP_SHIFT;
+
+    retval = (uint8 *) Malloc(newsize * regsize);
+    blocks = (uint32 *) Malloc(newgroups * sizeof (uint32));
+    if ((retval == NULL) || (blocks == NULL))
     {
-        const uint32 refcount = shader->refcount;
-        if (refcount > 1)
-            shader->refcount--;
-        else
-        {
-            ctx->profileDeleteShader(shader->handle);
-            MOJOSHADER_freeParseData(shader->parseData);
-            Free(shader);
-        } // else
+        Free(retval);
+        Free(blocks);
+        return NULL;
     } // if
-} // shader_unref
 
-
-static void program_unref(MOJOSHADER_glProgram *program)
-{
-    if (program != NULL)
+    if (oldsize > 0)
     {
-        const uint32 refcount = program->refcount;
-        if (refcount > 1)
-            program->refcount--;
-        else
-        {
-            ctx->profileDeleteProgram(program->handle);
-            shader_unref(program->vertex);
-            shader_unref(program->fragment);
-            Free(program->vs_uniforms_float4);
-            Free(program->vs_uniforms_int4);
-            Free(program->vs_uniforms_bool);
-            Free(program->ps_uniforms_float4);
-            Free(program->ps_uniforms_int4);
-            Free(program->ps_uniforms_bool);
-            Free(program->uniforms);
-            Free(program->attributes);
-            Free(program);
-        } // else
+        memcpy(retval, file, oldsize * regsize);
+        memcpy(blocks, stamps->blocks, oldgroups * sizeof (uint32));
     } // if
-} // program_unref
+    memset(retval + (oldsize * regsize), '\0', (newsize - oldsize) * regsize);
+    memset(blocks + oldgroups, '\0', (newgroups - oldgroups) * sizeof (uint32));
+
+    Free(file);
+    Free(stamps->blocks);
+    stamps->blocks = blocks;
+    stat_add(&ctx->stats.register_file_bytes,
+             ((newsize - oldsize) * regsize) +
+             ((newgroups - oldgroups) * sizeof (uint32)));
+    *size = newsize;
+    return retval;
+} // grow_register_file
 
 
-static void fill_constant_array(GLfloat *f, const int base, const int size,
-                                const MOJOSHADER_parseData *pd)
+// Make sure register (want - 1) exists. Returns zero if we're out of memory.
+static int reserve_registers(const MOJOSHADER_shaderType shader_type,
+                             const MOJOSHADER_uniformType type,
+                             const uint want)
 {
-    int i;
-    int filled = 0;
-    for (i = 0; i < pd->constant_count; i++)
+    #define RESERVE_REGISTERS(stage, suffix, regsize, maxregs) { \
+        void *ptr; \
+        if (want <= ctx->stage##_reg_file_size[type]) \
+            return 1; \
+        ptr = grow_register_file(ctx->stage##_reg_file_##suffix, \
+                                 &ctx->stage##_reg_file_size[type], \
+                                 &ctx->stage##_reg_stamps[type], \
+                                 regsize, maxregs, want); \
+        if (ptr == NULL) \
+            return 0; \
+        ctx->stage##_reg_file_##suffix = ptr; \
+        return 1; \
+    }
+
+    if (shader_type == MOJOSHADER_TYPE_VERTEX)
     {
-        const MOJOSHADER_constant *c = &pd->constants[i];
-        if (c->type != MOJOSHADER_UNIFORM_FLOAT)
-            continue;
-        else if (c->index < base)
-            continue;
-        else if (c->index >= (base+size))
-            continue;
-        memcpy(&f[(c->index-base) * 4], &c->value.f, sizeof (c->value.f));
-        filled++;
-    } // for
+        switch (type)
+        {
+            case MOJOSHADER_UNIFORM_FLOAT:
+                RESERVE_REGISTERS(vs, f, sizeof (GLfloat) * 4, MAX_REG_FILE_F);
+            case MOJOSHADER_UNIFORM_INT:
+                RESERVE_REGISTERS(vs, i, sizeof (GLint) * 4, MAX_REG_FILE_I);
+            case MOJOSHADER_UNIFORM_BOOL:
+                RESERVE_REGISTERS(vs, b, sizeof (uint8), MAX_REG_FILE_B);
+            default: break;
+        } // switch
+    } // if
+    else if (shader_type == MOJOSHADER_TYPE_PIXEL)
+    {
+        switch (type)
+        {
+            case MOJOSHADER_UNIFORM_FLOAT:
+                RESERVE_REGISTERS(ps, f, sizeof (GLfloat) * 4, MAX_REG_FILE_F);
+            case MOJOSHADER_UNIFORM_INT:
+                RESERVE_REGISTERS(ps, i, sizeof (GLint) * 4, MAX_REG_FILE_I);
+            case MOJOSHADER_UNIFORM_BOOL:
+                RESERVE_REGISTERS(ps, b, sizeof (uint8), MAX_REG_FILE_B);
+            default: break;
+        } // switch
+    } // else if
 
-    assert(filled == size);
-} // fill_constant_array
+    #undef RESERVE_REGISTERS
 
+    return 1;  // nothing to reserve for this shader type.
+} // reserve_registers
 
-static int lookup_uniforms(MOJOSHADER_glProgram *program,
-                           MOJOSHADER_glShader *shader, int *bound)
+
+// Grow the register files to cover everything (pd) can read or write: its
+//  uniforms, the symbols effects copy parameters into, and preshader output.
+static int reserve_shader_registers(const MOJOSHADER_parseData *pd)
 {
-    const MOJOSHADER_parseData *pd = shader->parseData;
-    const MOJOSHADER_shaderType shader_type = pd->shader_type;
-    uint32 float4_count = 0;
-    uint32 int4_count = 0;
-    uint32 bool_count = 0;
-    int i;
+    const MOJOSHADER_preshader *preshader = pd->preshader;
+    uint want[3] = { 0, 0, 0 };
+    uint i, j;
 
     for (i = 0; i < pd->uniform_count; i++)
     {
         const MOJOSHADER_uniform *u = &pd->uniforms[i];
+        const uint end = u->index + (u->array_count ? u->array_count : 1);
+        if ((u->type >= 0) && (u->type < 3) && (end > want[u->type]))
+            want[u->type] = end;
+    } // for
 
-        if (u->constant)
+    for (i = 0; i < pd->symbol_count; i++)
+    {
+        const MOJOSHADER_symbol *sym = &pd->symbols[i];
+        const uint end = sym->register_index + sym->register_count;
+        MOJOSHADER_uniformType type;
+        if (sym->register_set == MOJOSHADER_SYMREGSET_FLOAT4)
+            type = MOJOSHADER_UNIFORM_FLOAT;
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_INT4)
+            type = MOJOSHADER_UNIFORM_INT;
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_BOOL)
+            type = MOJOSHADER_UNIFORM_BOOL;
+        else
+            continue;
+        if (end > want[type])
+            want[type] = end;
+    } // for
+
+    if (preshader != NULL)
+    {
+        for (i = 0; i < preshader->instruction_count; i++)
         {
-            // only do constants once, at link time. These aren't changed ever.
-            if (ctx->profileMustPushConstantArrays())
+            const MOJOSHADER_preshaderInstruction *inst = &preshader->instructions[i];
+            for (j = 0; j < inst->operand_count; j++)
             {
-                const int base = u->index;
-                const int size = u->array_count;
-                GLfloat *f = (GLfloat *) alloca(sizeof (GLfloat) * (size * 4));
-                fill_constant_array(f, base, size, pd);
-                if (!(*bound))
+                const MOJOSHADER_preshaderOperand *op = &inst->operands[j];
+                if (op->type == MOJOSHADER_PRESHADEROPERAND_OUTPUT)
                 {
-                    ctx->profileUseProgram(program);
-                    *bound = 1;
+                    // Output indices are in floats, not registers.
+                    const uint end = (op->index + inst->element_count + 3) / 4;
+                    if (end > want[MOJOSHADER_UNIFORM_FLOAT])
+                        want[MOJOSHADER_UNIFORM_FLOAT] = end;
                 } // if
-                ctx->profilePushConstantArray(program, u, f);
-            } // if
-        } // if
+            } // for
+        } // for
+    } // if
 
-        else
-        {
-            const GLint loc = ctx->profileGetUniformLocation(program, shader, i);
-            if (loc != -1)  // -1 means it was optimized out, or failure.
-            {
-                const int regcount = u->array_count;
-                UniformMap *map = &program->uniforms[program->uniform_count];
-                map->shader_type = shader_type;
-                map->uniform = u;
-                map->location = (GLuint) loc;
-                program->uniform_count++;
+    for (i = 0; i < 3; i++)
+    {
+        if (!reserve_registers(pd->shader_type, (MOJOSHADER_uniformType) i, want[i]))
+            return 0;
+    } // for
 
-                if (u->type == MOJOSHADER_UNIFORM_FLOAT)
-                    float4_count += regcount ? regcount : 1;
-                else if (u->type == MOJOSHADER_UNIFORM_INT)
-                    int4_count += regcount ? regcount : 1;
-                else if (u->type == MOJOSHADER_UNIFORM_BOOL)
-                    bool_count += regcount ? regcount : 1;
-                else
-                    assert(0 && "Unexpected register type");
-            } // if
-        } // else
+    return 1;
+} // reserve_shader_registers
+
+
+static void free_register_files(void)
+{
+    int i;
+    Free(ctx->vs_reg_file_f);
+    Free(ctx->vs_reg_file_i);
+    Free(ctx->vs_reg_file_b);
+    Free(ctx->ps_reg_file_f);
+    Free(ctx->ps_reg_file_i);
+    Free(ctx->ps_reg_file_b);
+    for (i = 0; i < 3; i++)
+    {
+        Free(ctx->vs_reg_stamps[i].blocks);
+        Free(ctx->ps_reg_stamps[i].blocks);
     } // for
+} // free_register_files
 
-    if (shader_type == MOJOSHADER_TYPE_PIXEL)
+
+static void shader_unref(MOJOSHADER_glShader *shader);
+
+// Hand translated source to the GL. (shader) takes ownership of (pd) on
+//  success; on failure, the error is set and the caller still owns it.
+static int compile_parsed_shader(MOJOSHADER_glShader *shader,
+                                 const MOJOSHADER_parseData *pd)
+{
+    GLuint handle = 0;
+
+    if (pd->error_count > 0)
     {
-        for (i = 0; i < pd->sampler_count; i++)
-        {
-            if (pd->samplers[i].texbem)
-            {
-                float4_count += 2;
-                program->texbem_count++;
-            } // if
-        } // for
+        // !!! FIXME: put multiple errors in the buffer? Don't use
+        // !!! FIXME:  MOJOSHADER_glGetError() for this?
+        set_error(pd->errors[0].error);
+        return 0;
     } // if
 
-    #define MAKE_ARRAY(typ, gltyp, siz, count) \
-        if (count) { \
-            const size_t buflen = sizeof (gltyp) * siz * count; \
-            gltyp *ptr = (gltyp *) Malloc(buflen); \
-            if (ptr == NULL) { \
-                return 0; \
-            } else if (shader_type == MOJOSHADER_TYPE_VERTEX) { \
-                program->vs_uniforms_##typ = ptr; \
-                program->vs_uniforms_##typ##_count = count; \
-            } else if (shader_type == MOJOSHADER_TYPE_PIXEL) { \
-                program->ps_uniforms_##typ = ptr; \
-                program->ps_uniforms_##typ##_count = count; \
-            } else { \
-                assert(0 && "unsupported shader type"); \
-            } \
-            memset(ptr, '\0', buflen); \
-        }
-
-    MAKE_ARRAY(float4, GLfloat, 4, float4_count);
-    MAKE_ARRAY(int4, GLint, 4, int4_count);
-    MAKE_ARRAY(bool, GLint, 1, bool_count);
+    if (!reserve_shader_registers(pd))
+        return 0;
 
-    #undef MAKE_ARRAY
+    const uint64 start = ticks_usecs();
+    const int compiled = ctx->profileCompileShader(pd, &handle);
+    stat_add(&ctx->stats.shaders_compiled, 1);
+    stat_add(&ctx->stats.shader_compile_usecs, ticks_usecs() - start);
+    if (!compiled)
+        return 0;
 
+    shader->parseData = pd;
+    shader->handle = handle;
+    shader->output_hash = hash64(HASH64_INIT, pd->output, pd->output_len);
+    shader->status = ctx->async_compile ? MOJOSHADER_GLSTATUS_PENDING :
+                                          MOJOSHADER_GLSTATUS_READY;
     return 1;
-} // lookup_uniforms
+} // compile_parsed_shader
 
 
-static void lookup_samplers(MOJOSHADER_glProgram *program,
-                            MOJOSHADER_glShader *shader, int *bound)
+// Shader interning...
+
+static uint32 hash_intern_key(const void *sym, void *data)
+{
+    (void) data;
+    const ShaderInternKey *key = (const ShaderInternKey *) sym;
+    return (uint32) (key->hash ^ (key->hash >> 32)) + (uint32) key->kind;
+} // hash_intern_key
+
+// Everything we read from a shader's parse data, other than its symbols.
+//  Effects keep their own parse data for those, so two shaders that match
+//  here can share a GL object (and a linked program) no matter where
+//  they came from.
+static int same_interface(const MOJOSHADER_parseData *a,
+                          const MOJOSHADER_parseData *b)
 {
-    const MOJOSHADER_parseData *pd = shader->parseData;
-    const MOJOSHADER_sampler *s = pd->samplers;
     int i;
 
-    if ((pd->sampler_count == 0) || (!ctx->profileMustPushSamplers()))
-        return;   // nothing to do here, so don't bother binding, etc.
-
-    // Link up the Samplers. These never change after link time, since they
-    //  are meant to be constant texture unit ids and not textures.
+    if ( (a->shader_type != b->shader_type) ||
+         (a->output_len != b->output_len) ||
+         (a->uniform_count != b->uniform_count) ||
+         (a->constant_count != b->constant_count) ||
+         (a->sampler_count != b->sampler_count) ||
+         (a->attribute_count != b->attribute_count) ||
+         (a->output_count != b->output_count) ||
+         (memcmp(a->output, b->output, a->output_len) != 0) )
+        return 0;
 
-    if (!(*bound))
+    for (i = 0; i < a->uniform_count; i++)
     {
-        ctx->profileUseProgram(program);
-        *bound = 1;
-    } // if
+        const MOJOSHADER_uniform *ua = &a->uniforms[i];
+        const MOJOSHADER_uniform *ub = &b->uniforms[i];
+        if ( (ua->type != ub->type) || (ua->index != ub->index) ||
+             (ua->array_count != ub->array_count) ||
+             (ua->constant != ub->constant) )
+            return 0;
+    } // for
 
-    for (i = 0; i < pd->sampler_count; i++)
+    for (i = 0; i < a->constant_count; i++)
     {
-        const GLint loc = ctx->profileGetSamplerLocation(program, shader, i);
-        if (loc >= 0)  // maybe the Sampler was optimized out?
-        {
-#ifdef MOJOSHADER_XNA4_VERTEX_TEXTURES
-            if (pd->shader_type == MOJOSHADER_TYPE_VERTEX)
-                ctx->profilePushSampler(loc, s[i].index + ctx->vertex_sampler_offset);
-            else
-#endif
-                ctx->profilePushSampler(loc, s[i].index);
-        } // if
+        const MOJOSHADER_constant *ca = &a->constants[i];
+        const MOJOSHADER_constant *cb = &b->constants[i];
+        if ( (ca->type != cb->type) || (ca->index != cb->index) ||
+             (memcmp(&ca->value, &cb->value, sizeof (ca->value)) != 0) )
+            return 0;
     } // for
-} // lookup_samplers
-
 
-// Right now, this just decides if we have to toggle pointsize support later.
-static void lookup_outputs(MOJOSHADER_glProgram *program,
-                           MOJOSHADER_glShader *shader)
-{
-    if (shader == NULL)
-        return;
+    for (i = 0; i < a->sampler_count; i++)
+    {
+        const MOJOSHADER_sampler *sa = &a->samplers[i];
+        const MOJOSHADER_sampler *sb = &b->samplers[i];
+        if ( (sa->type != sb->type) || (sa->index != sb->index) ||
+             (sa->texbem != sb->texbem) )
+            return 0;
+    } // for
 
-    const MOJOSHADER_parseData *pd = shader->parseData;
-    int i;
+    for (i = 0; i < a->attribute_count; i++)
+    {
+        if ( (a->attributes[i].usage != b->attributes[i].usage) ||
+             (a->attributes[i].index != b->attributes[i].index) )
+            return 0;
+    } // for
 
-    for (i = 0; i < pd->output_count; i++)
+    for (i = 0; i < a->output_count; i++)
     {
-        if (pd->outputs[i].usage == MOJOSHADER_USAGE_POINTSIZE)
-        {
-            program->uses_pointsize = 1;
-            break;
-        } // if
+        if ( (a->outputs[i].usage != b->outputs[i].usage) ||
+             (a->outputs[i].index != b->outputs[i].index) )
+            return 0;
     } // for
-} // lookup_outputs
 
+    return 1;
+} // same_interface
 
-static int lookup_attributes(MOJOSHADER_glProgram *program)
+static int match_intern_key(const void *_a, const void *_b, void *data)
 {
-    int i;
-    const MOJOSHADER_parseData *pd = program->vertex->parseData;
-    const MOJOSHADER_attribute *a = pd->attributes;
+    (void) data;
+    const ShaderInternKey *a = (const ShaderInternKey *) _a;
+    const ShaderInternKey *b = (const ShaderInternKey *) _b;
+    if ((a->kind != b->kind) || (a->hash != b->hash))
+        return 0;
+    else if (a->kind == SHADERINTERN_BYTECODE)
+        return (a->len == b->len) && (memcmp(a->bytes, b->bytes, a->len) == 0);
+    return same_interface(a->pd, b->pd);
+} // match_intern_key
 
-    for (i = 0; i < pd->attribute_count; i++)
-    {
-        const GLint loc = ctx->profileGetAttribLocation(program, i);
-        if (loc >= 0)  // maybe the Attribute was optimized out?
-        {
-            AttributeMap *map = &program->attributes[program->attribute_count];
-            map->attribute = &a[i];
-            map->location = loc;
-            program->vertex_attrib_loc[map->attribute->usage][map->attribute->index] = loc;
-            program->attribute_count++;
+static void nuke_intern_key(const void *key, const void *value, void *data)
+{
+    // Keys live in their shader, and the table doesn't hold a reference.
+    (void) data;
+    ((ShaderInternKey *) key)->interned = 0;
+    ((MOJOSHADER_glShader *) value)->intern_ctx = NULL;
+} // nuke_intern_key
+
+// Everything that goes into a translation, back to back, for a bytecode
+//  key to hash and compare. Interning only saves work, so this returns NULL
+//  without setting an error if we're out of memory.
+static uint8 *bytecode_key(const unsigned char *tokenbuf,
+                           const unsigned int bufsize,
+                           const MOJOSHADER_swizzle *swiz,
+                           const unsigned int swizcount,
+                           const MOJOSHADER_samplerMap *smap,
+                           const unsigned int smapcount,
+                           size_t *len)
+{
+    const size_t swizlen = sizeof (MOJOSHADER_swizzle) * swizcount;
+    const size_t smaplen = sizeof (MOJOSHADER_samplerMap) * smapcount;
+    uint8 *retval;
+    uint8 *ptr;
 
-            if (((size_t)loc) > STATICARRAYLEN(ctx->want_attr))
-            {
-                assert(0 && "Static array is too small.");  // laziness fail.
-                return 0;
-            } // if
-        } // if
-    } // for
+    *len = (sizeof (unsigned int) * 3) + bufsize + swizlen + smaplen;
+    retval = (uint8 *) ctx->malloc_fn((int) *len, ctx->malloc_data);
+    if (retval == NULL)
+        return NULL;
 
-    return 1;
-} // lookup_attributes
+    ptr = retval;
+    #define APPEND_KEY(src, srclen) \
+        if ((srclen) > 0) \
+        { \
+            memcpy(ptr, src, srclen); \
+            ptr += srclen; \
+        }
+    APPEND_KEY(&bufsize, sizeof (bufsize));
+    APPEND_KEY(tokenbuf, bufsize);
+    APPEND_KEY(&swizcount, sizeof (swizcount));
+    APPEND_KEY(swiz, swizlen);
+    APPEND_KEY(&smapcount, sizeof (smapcount));
+    APPEND_KEY(smap, smaplen);
+    #undef APPEND_KEY
+    return retval;
+} // bytecode_key
+
+// Find an interned shader and give the caller a reference to it, which it
+//  will delete. The lookup and the new owner have to happen together, or
+//  another context could drop the last owner in between.
+static MOJOSHADER_glShader *share_interned_shader(const ShaderInternKind kind,
+                                                  const uint64 hash,
+                                                  const MOJOSHADER_parseData *pd,
+                                                  const uint8 *bytes,
+                                                  const size_t len)
+{
+    MOJOSHADER_glShader *retval = NULL;
+    ShaderInternKey key;
+    const void *value = NULL;
 
+    if (ctx->shader_intern == NULL)
+        return NULL;
 
-// !!! FIXME: misnamed
-// build a list of indexes that need to be overwritten with constant values
-//  when pushing a uniform array to the GL.
-static int build_constants_lists(MOJOSHADER_glProgram *program)
-{
-    int i;
-    const int count = program->uniform_count;
-    for (i = 0; i < count; i++)
-    {
-        UniformMap *map = &program->uniforms[i];
-        const MOJOSHADER_uniform *u = map->uniform;
-        const int size = u->array_count;
+    memset(&key, '\0', sizeof (key));
+    key.kind = kind;
+    key.hash = hash;
+    key.pd = pd;
+    key.bytes = bytes;
+    key.len = len;
 
-        assert(!u->constant);
+    spinlock_lock(&ctx->intern_lock);
+    if (hash_find(ctx->shader_intern, &key, &value))
+    {
+        retval = (MOJOSHADER_glShader *) value;
+        atomic_increment(&retval->owners);
+        atomic_increment(&retval->refcount);
+    } // if
+    spinlock_unlock(&ctx->intern_lock);
 
-        if (size == 0)
-            continue;  // nothing to see here.
+    if (retval != NULL)
+        stat_add(&ctx->stats.shaders_interned, 1);
+    return retval;
+} // share_interned_shader
+
+// Interning only saves work, so if we run out of memory here, (shader)
+//  just doesn't get shared. (shader) takes ownership of (bytes), from
+//  bytecode_key(), even if it isn't interned.
+static void intern_shader(MOJOSHADER_glShader *shader,
+                          const ShaderInternKind kind, const uint64 hash,
+                          const uint8 *bytes, const size_t len)
+{
+    ShaderInternKey *key = &shader->keys[kind];
 
-        // only use arrays for 'c' registers.
-        assert(u->type == MOJOSHADER_UNIFORM_FLOAT);
+    // A key that was in a destroyed context's table might still hold bytes.
+    Free((void *) key->bytes);
+    key->bytes = bytes;
+    key->len = len;
 
-        // !!! FIXME: deal with this.
-    } // for
+    if ((kind == SHADERINTERN_BYTECODE) && (bytes == NULL))
+        return;
 
-    return 1;
-} // build_constants_lists
+    if (ctx->shader_intern == NULL)
+    {
+        ctx->shader_intern = hash_create(NULL, hash_intern_key,
+                                         match_intern_key, nuke_intern_key,
+                                         0, ctx->malloc_fn, ctx->free_fn,
+                                         ctx->malloc_data);
+        if (ctx->shader_intern == NULL)
+            return;
+    } // if
 
+    key->kind = kind;
+    key->hash = hash;
+    key->pd = (kind == SHADERINTERN_OUTPUT) ? shader->parseData : NULL;
+    spinlock_lock(&ctx->intern_lock);
+    if (hash_insert(ctx->shader_intern, key, shader) == 1)
+    {
+        key->interned = 1;
+        shader->intern_ctx = ctx;
+    } // if
+    spinlock_unlock(&ctx->intern_lock);
+} // intern_shader
 
-MOJOSHADER_glProgram *MOJOSHADER_glLinkProgram(MOJOSHADER_glShader *vshader,
-                                               MOJOSHADER_glShader *pshader)
+// Drop one owner of (shader), taking it out of the intern table with the
+//  last one. This can run on any context in the share group, so it locks
+//  the table's context. Returns how many owners are left.
+static long release_interned_shader(MOJOSHADER_glShader *shader)
 {
-    int bound = 0;
+    MOJOSHADER_glContext *owner = shader->intern_ctx;
+    long retval;
+    int i;
 
-    if ((vshader == NULL) && (pshader == NULL))
-        return NULL;
+    if (owner == NULL)  // never interned, so nobody else can find it.
+        return atomic_decrement(&shader->owners);
 
-    int numregs = 0;
-    MOJOSHADER_glProgram *retval = NULL;
-    const GLuint program = ctx->profileLinkProgram(vshader, pshader);
-    if (program == 0)
-        goto link_program_fail;
+    spinlock_lock(&owner->intern_lock);
+    retval = atomic_decrement(&shader->owners);
+    for (i = 0; (retval == 0) && (i < SHADERINTERN_TOTAL); i++)
+    {
+        if (shader->keys[i].interned)  // nuke_intern_key() clears these.
+            hash_remove(owner->shader_intern, &shader->keys[i]);
+    } // for
+    spinlock_unlock(&owner->intern_lock);
+    return retval;
+} // release_interned_shader
 
-    retval = (MOJOSHADER_glProgram *) Malloc(sizeof (MOJOSHADER_glProgram));
-    if (retval == NULL)
-        goto link_program_fail;
-    memset(retval, '\0', sizeof (MOJOSHADER_glProgram));
-    memset(retval->vertex_attrib_loc, 0xFF, sizeof(retval->vertex_attrib_loc));
 
-    numregs = 0;
-    if (vshader != NULL) numregs += vshader->parseData->uniform_count;
-    if (pshader != NULL) numregs += pshader->parseData->uniform_count;
-    if (numregs > 0)
+MOJOSHADER_glShader *MOJOSHADER_glCompileShader(const unsigned char *tokenbuf,
+                                                const unsigned int bufsize,
+                                                const MOJOSHADER_swizzle *swiz,
+                                                const unsigned int swizcount,
+                                                const MOJOSHADER_samplerMap *smap,
+                                                const unsigned int smapcount)
+{
+    MOJOSHADER_glShader *retval = NULL;
+    const MOJOSHADER_parseData *pd = NULL;
+    size_t keylen = 0;
+    uint8 *keybytes = bytecode_key(tokenbuf, bufsize, swiz, swizcount,
+                                   smap, smapcount, &keylen);
+    const uint64 bytecode = (keybytes != NULL) ?
+                             hash64(HASH64_INIT, keybytes, keylen) : 0;
+
+    // Seen this exact bytecode before? Then we don't even need to parse it.
+    if (keybytes != NULL)
     {
-        const size_t len = sizeof (UniformMap) * numregs;
-        retval->uniforms = (UniformMap *) Malloc(len);
-        if (retval->uniforms == NULL)
-            goto link_program_fail;
-        memset(retval->uniforms, '\0', len);
+        retval = share_interned_shader(SHADERINTERN_BYTECODE, bytecode, NULL,
+                                       keybytes, keylen);
+        if (retval != NULL)
+        {
+            Free(keybytes);
+            return retval;
+        } // if
     } // if
 
-    retval->handle = program;
-    retval->vertex = vshader;
-    retval->fragment = pshader;
-    retval->generation = ctx->generation - 1;
-    retval->refcount = 1;
+    // This doesn't need a mainfn, since there's no GL lang that does.
+    pd = MOJOSHADER_parse(ctx->profile, NULL, tokenbuf, bufsize,
+                          swiz, swizcount, smap, smapcount,
+                          ctx->malloc_fn, ctx->free_fn, ctx->malloc_data);
 
-    if (vshader != NULL)
+    // Different bytecode can still translate to the same source.
+    if (pd->error_count == 0)
     {
-        if (vshader->parseData->attribute_count > 0)
+        retval = share_interned_shader(SHADERINTERN_OUTPUT,
+                                       hash64(HASH64_INIT, pd->output,
+                                              pd->output_len), pd, NULL, 0);
+        if (retval != NULL)
         {
-            const int count = vshader->parseData->attribute_count;
-            const size_t len = sizeof (AttributeMap) * count;
-            retval->attributes = (AttributeMap *) Malloc(len);
-            if (retval->attributes == NULL)
-                goto link_program_fail;
+            // Take over an effect's borrowed parse data; it's equivalent.
+            //  The key is in the table, so swap it under the lock.
+            if (retval->parse_owner != NULL)
+            {
+                spinlock_lock(&ctx->intern_lock);
+                retval->parseData = pd;
+                retval->keys[SHADERINTERN_OUTPUT].pd = pd;
+                retval->parse_owner = NULL;
+                spinlock_unlock(&ctx->intern_lock);
+            } // if
+            else
+            {
+                MOJOSHADER_freeParseData(pd);
+            } // else
 
-            memset(retval->attributes, '\0', len);
-            if (!lookup_attributes(retval))
-                goto link_program_fail;
+            if (!retval->keys[SHADERINTERN_BYTECODE].interned)
+                intern_shader(retval, SHADERINTERN_BYTECODE, bytecode,
+                              keybytes, keylen);
+            else
+                Free(keybytes);
+            return retval;
         } // if
-
-        if (!lookup_uniforms(retval, vshader, &bound))
-            goto link_program_fail;
-        lookup_samplers(retval, vshader, &bound);
-        lookup_outputs(retval, pshader);
-        vshader->refcount++;
     } // if
 
-    if (pshader != NULL)
-    {
-        if (!lookup_uniforms(retval, pshader, &bound))
-            goto link_program_fail;
-        lookup_samplers(retval, pshader, &bound);
-        lookup_outputs(retval, pshader);
-        pshader->refcount++;
-    } // if
+    retval = (MOJOSHADER_glShader *) Malloc(sizeof (MOJOSHADER_glShader));
+    if (retval == NULL)
+        goto compile_shader_fail;
+    memset(retval, '\0', sizeof (MOJOSHADER_glShader));
 
-    if (!build_constants_lists(retval))
-        goto link_program_fail;
+    if (!compile_parsed_shader(retval, pd))
+        goto compile_shader_fail;
 
-    if (bound)  // reset the old binding.
-        ctx->profileUseProgram(ctx->bound_program);
+    retval->refcount = 1;
+    retval->owners = 1;
+    retval->share_group = ctx->share_group;
+    intern_shader(retval, SHADERINTERN_BYTECODE, bytecode, keybytes, keylen);
+    intern_shader(retval, SHADERINTERN_OUTPUT, retval->output_hash, NULL, 0);
+    return retval;
 
-    ctx->profileFinalInitProgram(retval);
+compile_shader_fail:
+    MOJOSHADER_freeParseData(pd);
+    Free(keybytes);
+    Free(retval);
+    return NULL;
+} // MOJOSHADER_glCompileShader
 
-    return retval;
 
-link_program_fail:
-    if (retval != NULL)
+MOJOSHADER_glShader *MOJOSHADER_glQueueShader(MOJOSHADER_glContext *_ctx,
+                                              const unsigned char *tokenbuf,
+                                              const unsigned int bufsize,
+                                              const MOJOSHADER_swizzle *swiz,
+                                              const unsigned int swizcount,
+                                              const MOJOSHADER_samplerMap *smap,
+                                              const unsigned int smapcount)
+{
+    // This can run on any thread, so it can't touch the current context
+    //  (or the error buffer). Just copy everything and queue it up.
+    const size_t swizlen = sizeof (MOJOSHADER_swizzle) * swizcount;
+    const size_t smaplen = sizeof (MOJOSHADER_samplerMap) * smapcount;
+    const size_t loadlen = sizeof (ShaderLoad) + swizlen + smaplen + bufsize;
+    MOJOSHADER_glShader *shader = NULL;
+    ShaderLoad *load = NULL;
+    uint8 *ptr = NULL;
+
+    shader = (MOJOSHADER_glShader *) _ctx->malloc_fn(sizeof (*shader),
+                                                     _ctx->malloc_data);
+    load = (ShaderLoad *) _ctx->malloc_fn((int) loadlen, _ctx->malloc_data);
+    if ((shader == NULL) || (load == NULL))
     {
-        Free(retval->vs_uniforms_float4);
-        Free(retval->vs_uniforms_int4);
-        Free(retval->vs_uniforms_bool);
-        Free(retval->ps_uniforms_float4);
-        Free(retval->ps_uniforms_int4);
-        Free(retval->ps_uniforms_bool);
-        Free(retval->uniforms);
-        Free(retval->attributes);
-        Free(retval);
+        if (shader != NULL)
+            _ctx->free_fn(shader, _ctx->malloc_data);
+        if (load != NULL)
+            _ctx->free_fn(load, _ctx->malloc_data);
+        return NULL;
     } // if
 
-    if (program != 0)
-        ctx->profileDeleteProgram(program);
+    memset(shader, '\0', sizeof (*shader));
+    shader->refcount = 2;  // the caller's, and the queue's until it's done.
+    shader->owners = 1;
+    shader->share_group = _ctx->share_group;
+    shader->status = MOJOSHADER_GLSTATUS_PENDING;
+    shader->load = load;
+
+    memset(load, '\0', sizeof (*load));
+    ptr = (uint8 *) (load + 1);
+    load->shader = shader;
+    load->ctx = _ctx;
+    load->state = SHADERLOAD_QUEUED;
+    load->swiz = (const MOJOSHADER_swizzle *) ptr;
+    load->swizcount = swizcount;
+    if (swizlen > 0)  // (swiz) can be NULL.
+        memcpy(ptr, swiz, swizlen);
+    ptr += swizlen;
+    load->smap = (const MOJOSHADER_samplerMap *) ptr;
+    load->smapcount = smapcount;
+    if (smaplen > 0)  // (smap) can be NULL.
+        memcpy(ptr, smap, smaplen);
+    ptr += smaplen;
+    load->tokenbuf = ptr;
+    load->bufsize = bufsize;
+    memcpy(ptr, tokenbuf, bufsize);
+    load->queued_usecs = ticks_usecs();
+
+    spinlock_lock(&_ctx->load_lock);
+    if (_ctx->load_queue_tail == NULL)
+        _ctx->load_queue_head = load;
+    else
+        _ctx->load_queue_tail->next = load;
+    _ctx->load_queue_tail = load;
+    _ctx->loads_in_flight++;
+    stat_add(&_ctx->stats.shaders_queued, 1);
+    spinlock_unlock(&_ctx->load_lock);
 
-    if (bound)
-        ctx->profileUseProgram(ctx->bound_program);
-
-    return NULL;
-} // MOJOSHADER_glLinkProgram
+    return shader;
+} // MOJOSHADER_glQueueShader
 
 
-static void update_enabled_arrays(void)
+// Remove (load) from a singly-linked list. Call with load_lock held.
+static void unlink_shader_load(ShaderLoad **head, ShaderLoad **tail,
+                               ShaderLoad *load)
 {
-    int highest_enabled = 0;
-    int i;
+    ShaderLoad *prev = NULL;
+    ShaderLoad *i;
 
-    // Enable/disable vertex arrays to match our needs.
-    // this happens to work in both ARB1 and GLSL, but if something alien
-    //  shows up, we'll have to split these into profile*() functions.
-    for (i = 0; i < ctx->max_attrs; i++)
+    for (i = *head; i != NULL; prev = i, i = i->next)
     {
-        const int want = (const int) ctx->want_attr[i];
-        const int have = (const int) ctx->have_attr[i];
-        if (want != have)
+        if (i == load)
         {
-            if (want)
-                ctx->glEnableVertexAttribArray(i);
+            if (prev == NULL)
+                *head = load->next;
             else
-                ctx->glDisableVertexAttribArray(i);
-            ctx->have_attr[i] = want;
+                prev->next = load->next;
+            if (*tail == load)
+                *tail = prev;
+            load->next = NULL;
+            return;
         } // if
-
-        if (want)
-            highest_enabled = i + 1;
     } // for
 
-    ctx->max_attrs = highest_enabled;  // trim unneeded iterations next time.
-} // update_enabled_arrays
+    assert(0 && "shader load isn't in this list");
+} // unlink_shader_load
 
 
-void MOJOSHADER_glBindProgram(MOJOSHADER_glProgram *program)
+// Run MOJOSHADER_parse() on a load we've claimed, on whatever thread. If
+//  (publish), it goes on the list for MOJOSHADER_glCompileQueuedShaders().
+static void translate_shader_load(MOJOSHADER_glContext *_ctx,
+                                  ShaderLoad *load, const int publish)
 {
-    if (program == ctx->bound_program)
-        return;  // nothing to do.
-
-    if (program != NULL)
-        program->refcount++;
-
-    memset(ctx->want_attr, '\0', sizeof (ctx->want_attr[0]) * ctx->max_attrs);
-
-    // If no program bound, disable all arrays, in case we're switching to
-    //  fixed function pipeline. Otherwise, we try to minimize state changes
-    //  by toggling just the changed set of needed arrays in ProgramReady().
-    if (program == NULL)
-        update_enabled_arrays();
-
-    ctx->profileUseProgram(program);
-    program_unref(ctx->bound_program);
-    ctx->bound_program = program;
-} // MOJOSHADER_glBindProgram
+    const uint64 start = ticks_usecs();
+    const MOJOSHADER_parseData *pd = MOJOSHADER_parse(_ctx->profile, NULL,
+                                                      load->tokenbuf,
+                                                      load->bufsize,
+                                                      load->swiz,
+                                                      load->swizcount,
+                                                      load->smap,
+                                                      load->smapcount,
+                                                      _ctx->malloc_fn,
+                                                      _ctx->free_fn,
+                                                      _ctx->malloc_data);
+    const uint64 elapsed = ticks_usecs() - start;
+
+    spinlock_lock(&_ctx->load_lock);
+    load->parseData = pd;
+    load->state = SHADERLOAD_TRANSLATED;
+    if (publish)
+    {
+        if (_ctx->load_done_tail == NULL)
+            _ctx->load_done_head = load;
+        else
+            _ctx->load_done_tail->next = load;
+        _ctx->load_done_tail = load;
+    } // if
+    stat_add(&_ctx->stats.shaders_translated, 1);
+    stat_add(&_ctx->stats.shader_translate_usecs, elapsed);
+    spinlock_unlock(&_ctx->load_lock);
+} // translate_shader_load
 
 
-typedef struct
+int MOJOSHADER_glTranslateQueuedShaders(MOJOSHADER_glContext *_ctx, int max)
 {
-    MOJOSHADER_glShader *vertex;
-    MOJOSHADER_glShader *fragment;
-} BoundShaders;
+    int retval = 0;
 
-static uint32 hash_shaders(const void *sym, void *data)
-{
-    (void) data;
-    const BoundShaders *s = (const BoundShaders *) sym;
-    const uint32 v = (s->vertex) ? (uint32) s->vertex->handle : 0;
-    const uint32 f = (s->fragment) ? (uint32) s->fragment->handle : 0;
-    return ((v & 0xFFFF) << 16) | (f & 0xFFFF);
-} // hash_shaders
+    // We count ourselves in (load_workers) until we're done touching
+    //  (_ctx), so MOJOSHADER_glDestroyContext() can wait us out.
+    spinlock_lock(&_ctx->load_lock);
+    _ctx->load_workers++;
+    while ((max <= 0) || (retval < max))
+    {
+        ShaderLoad *load = _ctx->load_queue_head;
+        if (load == NULL)
+            break;
 
-static int match_shaders(const void *_a, const void *_b, void *data)
-{
-    (void) data;
-    const BoundShaders *a = (const BoundShaders *) _a;
-    const BoundShaders *b = (const BoundShaders *) _b;
+        _ctx->load_queue_head = load->next;
+        if (_ctx->load_queue_tail == load)
+            _ctx->load_queue_tail = NULL;
+        load->next = NULL;
+        load->state = SHADERLOAD_TRANSLATING;
+        spinlock_unlock(&_ctx->load_lock);
 
-    const GLuint av = (a->vertex) ? a->vertex->handle : 0;
-    const GLuint bv = (b->vertex) ? b->vertex->handle : 0;
-    if (av != bv)
-        return 0;
+        translate_shader_load(_ctx, load, 1);
+        retval++;
 
-    const GLuint af = (a->fragment) ? a->fragment->handle : 0;
-    const GLuint bf = (b->fragment) ? b->fragment->handle : 0;
-    if (af != bf)
-        return 0;
+        spinlock_lock(&_ctx->load_lock);
+    } // while
+    _ctx->load_workers--;
+    spinlock_unlock(&_ctx->load_lock);
 
-    return 1;
-} // match_shaders
+    return retval;
+} // MOJOSHADER_glTranslateQueuedShaders
 
-static void nuke_shaders(const void *key, const void *value, void *data)
-{
-    (void) data;
-    Free((void *) key);  // this was a BoundShaders struct.
-    MOJOSHADER_glDeleteProgram((MOJOSHADER_glProgram *) value);
-} // nuke_shaders
 
-void MOJOSHADER_glBindShaders(MOJOSHADER_glShader *v, MOJOSHADER_glShader *p)
+// Compile a translated load on a GL thread, and retire it. This can be any
+//  context in the queue's share group.
+static void compile_shader_load(ShaderLoad *load)
 {
-    if ((v == NULL) && (p == NULL))
+    MOJOSHADER_glContext *owner = load->ctx;
+    MOJOSHADER_glShader *shader = load->shader;
+    const MOJOSHADER_parseData *pd = load->parseData;
+    uint64 now, latency;
+
+    shader->load = NULL;
+    if (atomic_decrement(&shader->refcount) == 0)  // deleted while queued?
     {
-        MOJOSHADER_glBindProgram(NULL);
-        return;
+        MOJOSHADER_freeParseData(pd);
+        Free(shader);
     } // if
-
-    // !!! FIXME: eventually support GL_EXT_separate_shader_objects.
-    if (ctx->linker_cache == NULL)
+    else
     {
-        ctx->linker_cache = hash_create(NULL, hash_shaders, match_shaders,
-                                        nuke_shaders, 0, ctx->malloc_fn,
-                                        ctx->free_fn, ctx->malloc_data);
-
-        if (ctx->linker_cache == NULL)
+        // Failed shaders keep their parse data, so callers can dig the
+        //  errors out with MOJOSHADER_glGetShaderParseData().
+        if (!compile_parsed_shader(shader, pd))
         {
-            out_of_memory();
-            return;
+            shader->parseData = pd;
+            shader->status = MOJOSHADER_GLSTATUS_FAILED;
         } // if
-    } // if
+    } // else
 
-    MOJOSHADER_glProgram *program = NULL;
-    BoundShaders shaders;
-    shaders.vertex = v;
-    shaders.fragment = p;
+    now = ticks_usecs();
+    latency = now - load->queued_usecs;
+    spinlock_lock(&owner->load_lock);
+    owner->loads_in_flight--;
+    stat_add(&owner->stats.shaders_loaded, 1);
+    stat_add(&owner->stats.shader_load_latency_usecs, latency);
+    if (latency > owner->stats.shader_load_latency_max_usecs)
+        stat_store(&owner->stats.shader_load_latency_max_usecs, latency);
+    spinlock_unlock(&owner->load_lock);
+
+    Free(load);
+} // compile_shader_load
+
+
+// Get a queued shader to the GL, if it isn't there yet. Without (wait), this
+//  only compiles it if a worker already translated it. With it, we translate
+//  it ourselves if no worker has started on it, or wait for the one that did.
+//  Returns zero if the shader is still on its way.
+static int finish_shader_load(MOJOSHADER_glShader *shader, const int wait)
+{
+    ShaderLoad *load = (shader != NULL) ? shader->load : NULL;
+    MOJOSHADER_glContext *owner = (load != NULL) ? load->ctx : NULL;
+    ShaderLoadState state;
 
-    const void *val = NULL;
-    if (hash_find(ctx->linker_cache, &shaders, &val))
-        program = (MOJOSHADER_glProgram *) val;
-    else
-    {
-        program = MOJOSHADER_glLinkProgram(v, p);
-        if (program == NULL)
-            return;
+    if (load == NULL)
+        return 1;
 
-        BoundShaders *item = (BoundShaders *) Malloc(sizeof (BoundShaders));
-        if (item == NULL)
+    while (1)
+    {
+        spinlock_lock(&owner->load_lock);
+        state = load->state;
+        if ((state == SHADERLOAD_QUEUED) && (wait))
         {
-            MOJOSHADER_glDeleteProgram(program);
-            return;
+            unlink_shader_load(&owner->load_queue_head,
+                               &owner->load_queue_tail, load);
+            load->state = SHADERLOAD_TRANSLATING;
         } // if
-
-        memcpy(item, &shaders, sizeof (BoundShaders));
-        if (hash_insert(ctx->linker_cache, item, program) != 1)
+        else if (state == SHADERLOAD_TRANSLATED)
         {
-            Free(item);
-            MOJOSHADER_glDeleteProgram(program);
-            out_of_memory();
-            return;
-        } // if
-    } // else
+            unlink_shader_load(&owner->load_done_head,
+                               &owner->load_done_tail, load);
+        } // else if
+        spinlock_unlock(&owner->load_lock);
 
-    assert(program != NULL);
-    MOJOSHADER_glBindProgram(program);
-} // MOJOSHADER_glBindShaders
+        if (state == SHADERLOAD_TRANSLATED)
+            break;
+        else if (!wait)
+            return 0;
+        else if (state == SHADERLOAD_QUEUED)
+        {
+            translate_shader_load(owner, load, 0);
+            break;
+        } // else if
 
+        spinlock_yield();  // a worker has it; let it finish.
+    } // while
 
-static inline uint minuint(const uint a, const uint b)
-{
-    return ((a < b) ? a : b);
-} // minuint
+    compile_shader_load(load);
+    return 1;
+} // finish_shader_load
 
 
-void MOJOSHADER_glSetVertexShaderUniformF(unsigned int idx, const float *data,
-                                          unsigned int vec4n)
+// Make sure a shader can be linked: queued shaders have to reach the GL
+//  first, and ones that failed to translate or compile never will.
+static int shader_loaded(MOJOSHADER_glShader *shader)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_f) / 4;
-    if (idx < maxregs)
+    if (shader == NULL)
+        return 1;
+
+    finish_shader_load(shader, 1);
+    if (shader->handle == 0)
     {
-        assert(sizeof (GLfloat) == sizeof (float));
-        const uint cpy = (minuint(maxregs - idx, vec4n) * sizeof (*data)) * 4;
-        memcpy(ctx->vs_reg_file_f + (idx * 4), data, cpy);
-        ctx->generation++;
+        const MOJOSHADER_parseData *pd = shader->parseData;
+        if ((pd != NULL) && (pd->error_count > 0))
+            set_error(pd->errors[0].error);
+        else
+            set_error("shader failed to compile");
+        return 0;
     } // if
-} // MOJOSHADER_glSetVertexShaderUniformF
 
+    return 1;
+} // shader_loaded
 
-void MOJOSHADER_glGetVertexShaderUniformF(unsigned int idx, float *data,
-                                          unsigned int vec4n)
+
+int MOJOSHADER_glCompileQueuedShaders(unsigned int budget_usecs)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_f) / 4;
-    if (idx < maxregs)
+    const uint64 start = ticks_usecs();
+    int retval = 0;
+
+    while (1)
     {
-        assert(sizeof (GLfloat) == sizeof (float));
-        const uint cpy = (minuint(maxregs - idx, vec4n) * sizeof (*data)) * 4;
-        memcpy(data, ctx->vs_reg_file_f + (idx * 4), cpy);
-    } // if
-} // MOJOSHADER_glGetVertexShaderUniformF
+        ShaderLoad *load = NULL;
 
+        spinlock_lock(&ctx->load_lock);
+        load = ctx->load_done_head;
+        if (load != NULL)
+        {
+            ctx->load_done_head = load->next;
+            if (ctx->load_done_tail == load)
+                ctx->load_done_tail = NULL;
+            load->next = NULL;
+        } // if
+        spinlock_unlock(&ctx->load_lock);
 
-void MOJOSHADER_glSetVertexShaderUniformI(unsigned int idx, const int *data,
-                                          unsigned int ivec4n)
-{
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_i) / 4;
-    if (idx < maxregs)
-    {
-        assert(sizeof (GLint) == sizeof (int));
-        const uint cpy = (minuint(maxregs - idx, ivec4n) * sizeof (*data)) * 4;
-        memcpy(ctx->vs_reg_file_i + (idx * 4), data, cpy);
-        ctx->generation++;
-    } // if
-} // MOJOSHADER_glSetVertexShaderUniformI
+        if (load == NULL)
+            break;
 
+        compile_shader_load(load);
 
-void MOJOSHADER_glGetVertexShaderUniformI(unsigned int idx, int *data,
-                                          unsigned int ivec4n)
+        if ((budget_usecs != 0) && ((ticks_usecs() - start) >= budget_usecs))
+            break;
+    } // while
+
+    spinlock_lock(&ctx->load_lock);
+    retval = ctx->loads_in_flight;
+    spinlock_unlock(&ctx->load_lock);
+    return retval;
+} // MOJOSHADER_glCompileQueuedShaders
+
+
+static void free_shader_load_list(ShaderLoad *load)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_i) / 4;
-    if (idx < maxregs)
+    while (load != NULL)
     {
-        assert(sizeof (GLint) == sizeof (int));
-        const uint cpy = (minuint(maxregs - idx, ivec4n) * sizeof (*data)) * 4;
-        memcpy(data, ctx->vs_reg_file_i + (idx * 4), cpy);
-    } // if
-} // MOJOSHADER_glGetVertexShaderUniformI
+        ShaderLoad *next = load->next;
+        if (load->parseData != NULL)
+            MOJOSHADER_freeParseData(load->parseData);
+        load->shader->load = NULL;
+        shader_unref(load->shader);
+        Free(load);
+        load = next;
+    } // while
+} // free_shader_load_list
+
+
+// Drop everything still queued, when the context goes away. A worker can be
+//  in the middle of translating a load it took off the queue, which is on
+//  neither list until it's done, so empty the queue and wait for the
+//  workers to leave; what they finish ends up on the done list.
+static void free_shader_loads(void)
+{
+    ShaderLoad *queued = NULL;
+    ShaderLoad *done = NULL;
+
+    spinlock_lock(&ctx->load_lock);
+    while (1)
+    {
+        queued = ctx->load_queue_head;
+        ctx->load_queue_head = ctx->load_queue_tail = NULL;
+        if (ctx->load_workers == 0)
+            break;
 
+        spinlock_unlock(&ctx->load_lock);
+        free_shader_load_list(queued);
+        spinlock_yield();
+        spinlock_lock(&ctx->load_lock);
+    } // while
 
-void MOJOSHADER_glSetVertexShaderUniformB(unsigned int idx, const int *data,
-                                          unsigned int bcount)
+    done = ctx->load_done_head;
+    ctx->load_done_head = ctx->load_done_tail = NULL;
+    ctx->loads_in_flight = 0;
+    spinlock_unlock(&ctx->load_lock);
+
+    free_shader_load_list(queued);
+    free_shader_load_list(done);
+} // free_shader_loads
+
+
+const MOJOSHADER_parseData *MOJOSHADER_glGetShaderParseData(
+                                                MOJOSHADER_glShader *shader)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_b) / 4;
-    if (idx < maxregs)
-    {
-        uint8 *wptr = ctx->vs_reg_file_b + idx;
-        uint8 *endptr = wptr + minuint(maxregs - idx, bcount);
-        while (wptr != endptr)
-            *(wptr++) = *(data++) ? 1 : 0;
-        ctx->generation++;
-    } // if
-} // MOJOSHADER_glSetVertexShaderUniformB
+    return (shader != NULL) ? shader->parseData : NULL;
+} // MOJOSHADER_glGetShaderParseData
 
 
-void MOJOSHADER_glGetVertexShaderUniformB(unsigned int idx, int *data,
-                                          unsigned int bcount)
+static void shader_unref(MOJOSHADER_glShader *shader)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->vs_reg_file_b) / 4;
-    if (idx < maxregs)
+    if (shader != NULL)
     {
-        uint8 *rptr = ctx->vs_reg_file_b + idx;
-        uint8 *endptr = rptr + minuint(maxregs - idx, bcount);
-        while (rptr != endptr)
-            *(data++) = (int) *(rptr++);
+        if (atomic_decrement(&shader->refcount) == 0)
+        {
+            // our separable program, if we've used this in a pipeline.
+            if (shader->program != 0)
+                ctx->glDeleteProgram(shader->program);
+            ctx->profileDeleteShader(shader->handle);
+            if (shader->parse_owner == NULL)
+                MOJOSHADER_freeParseData(shader->parseData);
+            Free((void *) shader->keys[SHADERINTERN_BYTECODE].bytes);
+            Free(shader);
+        } // if
     } // if
-} // MOJOSHADER_glGetVertexShaderUniformB
+} // shader_unref
 
 
-void MOJOSHADER_glSetPixelShaderUniformF(unsigned int idx, const float *data,
-                                         unsigned int vec4n)
+static void program_unref(MOJOSHADER_glProgram *program)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_f) / 4;
-    if (idx < maxregs)
+    if (program != NULL)
     {
-        assert(sizeof (GLfloat) == sizeof (float));
-        const uint cpy = (minuint(maxregs - idx, vec4n) * sizeof (*data)) * 4;
-        memcpy(ctx->ps_reg_file_f + (idx * 4), data, cpy);
-        ctx->generation++;
+        const uint32 refcount = program->refcount;
+        if (refcount > 1)
+            program->refcount--;
+        else
+        {
+            if (ctx->ubo_program == program)
+                ctx->ubo_program = NULL;
+            if ((program->vertex) && (program->vertex->pipeline == program))
+                program->vertex->pipeline = NULL;
+            if ((program->fragment) && (program->fragment->pipeline == program))
+                program->fragment->pipeline = NULL;
+            ctx->profileDeleteProgram(program->handle);
+            shader_unref(program->vertex);
+            shader_unref(program->fragment);
+            Free(program->vs_uniforms_float4);
+            Free(program->vs_uniforms_int4);
+            Free(program->vs_uniforms_bool);
+            Free(program->ps_uniforms_float4);
+            Free(program->ps_uniforms_int4);
+            Free(program->ps_uniforms_bool);
+            Free(program->uniforms);
+            Free(program->uniform_copies);
+            Free(program->attributes);
+            Free(program);
+        } // else
     } // if
-} // MOJOSHADER_glSetPixelShaderUniformF
+} // program_unref
 
 
-void MOJOSHADER_glGetPixelShaderUniformF(unsigned int idx, float *data,
-                                         unsigned int vec4n)
+static void fill_constant_array(GLfloat *f, const int base, const int size,
+                                const MOJOSHADER_parseData *pd)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_f) / 4;
-    if (idx < maxregs)
+    int i;
+    int filled = 0;
+    for (i = 0; i < pd->constant_count; i++)
     {
-        assert(sizeof (GLfloat) == sizeof (float));
-        const uint cpy = (minuint(maxregs - idx, vec4n) * sizeof (*data)) * 4;
-        memcpy(data, ctx->ps_reg_file_f + (idx * 4), cpy);
-    } // if
-} // MOJOSHADER_glGetPixelShaderUniformF
+        const MOJOSHADER_constant *c = &pd->constants[i];
+        if (c->type != MOJOSHADER_UNIFORM_FLOAT)
+            continue;
+        else if (c->index < base)
+            continue;
+        else if (c->index >= (base+size))
+            continue;
+        memcpy(&f[(c->index-base) * 4], &c->value.f, sizeof (c->value.f));
+        filled++;
+    } // for
 
+    assert(filled == size);
+} // fill_constant_array
 
-void MOJOSHADER_glSetPixelShaderUniformI(unsigned int idx, const int *data,
-                                         unsigned int ivec4n)
+
+// Make (program) current so we can set its link-time state, unless the
+//  profile can set it directly. init_linked_program() undoes this after.
+static void bind_for_push(MOJOSHADER_glProgram *program, int *bound)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_i) / 4;
-    if (idx < maxregs)
+    if ((!(*bound)) && (!ctx->program_dsa))
     {
-        assert(sizeof (GLint) == sizeof (int));
-        const uint cpy = (minuint(maxregs - idx, ivec4n) * sizeof (*data)) * 4;
-        memcpy(ctx->ps_reg_file_i + (idx * 4), data, cpy);
-        ctx->generation++;
+        ctx->profileUseProgram(program);
+        *bound = 1;
     } // if
-} // MOJOSHADER_glSetPixelShaderUniformI
+} // bind_for_push
+
+
+static int lookup_uniforms(MOJOSHADER_glProgram *program,
+                           MOJOSHADER_glShader *shader, int *bound)
+{
+    const MOJOSHADER_parseData *pd = shader->parseData;
+    const MOJOSHADER_shaderType shader_type = pd->shader_type;
+    uint32 float4_count = 0;
+    uint32 int4_count = 0;
+    uint32 bool_count = 0;
+    int i;
+
+    for (i = 0; i < pd->uniform_count; i++)
+    {
+        const MOJOSHADER_uniform *u = &pd->uniforms[i];
+
+        if (u->constant)
+        {
+            // only do constants once, at link time. These aren't changed ever.
+            if (ctx->profileMustPushConstantArrays())
+            {
+                const int base = u->index;
+                const int size = u->array_count;
+                GLfloat *f = (GLfloat *) alloca(sizeof (GLfloat) * (size * 4));
+                fill_constant_array(f, base, size, pd);
+                bind_for_push(program, bound);
+                ctx->profilePushConstantArray(program, u, f);
+            } // if
+        } // if
+
+        else
+        {
+            const GLint loc = ctx->profileGetUniformLocation(program, shader, i);
+            if (loc != -1)  // -1 means it was optimized out, or failure.
+            {
+                const int regcount = u->array_count;
+                UniformMap *map = &program->uniforms[program->uniform_count];
+                map->shader_type = shader_type;
+                map->uniform = u;
+                map->location = (GLuint) loc;
+                program->uniform_count++;
+
+                if (u->type == MOJOSHADER_UNIFORM_FLOAT)
+                    float4_count += regcount ? regcount : 1;
+                else if (u->type == MOJOSHADER_UNIFORM_INT)
+                    int4_count += regcount ? regcount : 1;
+                else if (u->type == MOJOSHADER_UNIFORM_BOOL)
+                    bool_count += regcount ? regcount : 1;
+                else
+                    assert(0 && "Unexpected register type");
+            } // if
+        } // else
+    } // for
+
+    if (shader_type == MOJOSHADER_TYPE_PIXEL)
+    {
+        for (i = 0; i < pd->sampler_count; i++)
+        {
+            if (pd->samplers[i].texbem)
+            {
+                float4_count += 2;
+                program->texbem_count++;
+            } // if
+        } // for
+    } // if
+
+    #define MAKE_ARRAY(typ, gltyp, siz, count) \
+        if (count) { \
+            const size_t buflen = sizeof (gltyp) * siz * count; \
+            gltyp *ptr = (gltyp *) Malloc(buflen); \
+            if (ptr == NULL) { \
+                return 0; \
+            } else if (shader_type == MOJOSHADER_TYPE_VERTEX) { \
+                program->vs_uniforms_##typ = ptr; \
+                program->vs_uniforms_##typ##_count = count; \
+            } else if (shader_type == MOJOSHADER_TYPE_PIXEL) { \
+                program->ps_uniforms_##typ = ptr; \
+                program->ps_uniforms_##typ##_count = count; \
+            } else { \
+                assert(0 && "unsupported shader type"); \
+            } \
+            memset(ptr, '\0', buflen); \
+        }
+
+    MAKE_ARRAY(float4, GLfloat, 4, float4_count);
+    MAKE_ARRAY(int4, GLint, 4, int4_count);
+    MAKE_ARRAY(bool, GLint, 1, bool_count);
+
+    #undef MAKE_ARRAY
+
+    return 1;
+} // lookup_uniforms
+
+
+static void lookup_samplers(MOJOSHADER_glProgram *program,
+                            MOJOSHADER_glShader *shader, int *bound)
+{
+    const MOJOSHADER_parseData *pd = shader->parseData;
+    const MOJOSHADER_sampler *s = pd->samplers;
+    int i;
+
+    if ((pd->sampler_count == 0) || (!ctx->profileMustPushSamplers()))
+        return;   // nothing to do here, so don't bother binding, etc.
+    else if ((pd->shader_type == MOJOSHADER_TYPE_PIXEL) && (ctx->known_pixel_samplers))
+        return;   // the shader already named its texture units.
+
+    // Link up the Samplers. These never change after link time, since they
+    //  are meant to be constant texture unit ids and not textures.
+
+    bind_for_push(program, bound);
+
+    for (i = 0; i < pd->sampler_count; i++)
+    {
+        const GLint loc = ctx->profileGetSamplerLocation(program, shader, i);
+        if (loc >= 0)  // maybe the Sampler was optimized out?
+        {
+#ifdef MOJOSHADER_XNA4_VERTEX_TEXTURES
+            if (pd->shader_type == MOJOSHADER_TYPE_VERTEX)
+                ctx->profilePushSampler(program, loc, s[i].index + ctx->vertex_sampler_offset);
+            else
+#endif
+                ctx->profilePushSampler(program, loc, s[i].index);
+        } // if
+    } // for
+} // lookup_samplers
+
+
+// Right now, this just decides if we have to toggle pointsize support later.
+static void lookup_outputs(MOJOSHADER_glProgram *program,
+                           MOJOSHADER_glShader *shader)
+{
+    if (shader == NULL)
+        return;
+
+    const MOJOSHADER_parseData *pd = shader->parseData;
+    int i;
+
+    for (i = 0; i < pd->output_count; i++)
+    {
+        if (pd->outputs[i].usage == MOJOSHADER_USAGE_POINTSIZE)
+        {
+            program->uses_pointsize = 1;
+            break;
+        } // if
+    } // for
+} // lookup_outputs
+
+
+static int lookup_attributes(MOJOSHADER_glProgram *program)
+{
+    int i;
+    const MOJOSHADER_parseData *pd = program->vertex->parseData;
+    const MOJOSHADER_attribute *a = pd->attributes;
+
+    for (i = 0; i < pd->attribute_count; i++)
+    {
+        const GLint loc = ctx->profileGetAttribLocation(program, i);
+        if (loc >= 0)  // maybe the Attribute was optimized out?
+        {
+            AttributeMap *map = &program->attributes[program->attribute_count];
+            map->attribute = &a[i];
+            map->location = loc;
+            program->vertex_attrib_loc[map->attribute->usage][map->attribute->index] = loc;
+            program->attribute_count++;
+
+            if (loc >= MAX_VERTEX_ATTRIBS)
+            {
+                assert(0 && "Static array is too small.");  // laziness fail.
+                return 0;
+            } // if
+        } // if
+    } // for
+
+    // Programs with the same attribute locations can share vertex arrays.
+    program->attrib_layout = hash64(HASH64_INIT, program->vertex_attrib_loc,
+                                    sizeof (program->vertex_attrib_loc));
+    return 1;
+} // lookup_attributes
+
+
+// !!! FIXME: misnamed
+// build a list of indexes that need to be overwritten with constant values
+//  when pushing a uniform array to the GL.
+static int build_constants_lists(MOJOSHADER_glProgram *program)
+{
+    int i;
+    const int count = program->uniform_count;
+    for (i = 0; i < count; i++)
+    {
+        UniformMap *map = &program->uniforms[i];
+        const MOJOSHADER_uniform *u = map->uniform;
+        const int size = u->array_count;
+
+        assert(!u->constant);
+
+        if (size == 0)
+            continue;  // nothing to see here.
+
+        // only use arrays for 'c' registers.
+        assert(u->type == MOJOSHADER_UNIFORM_FLOAT);
+
+        // !!! FIXME: deal with this.
+    } // for
+
+    return 1;
+} // build_constants_lists
+
+
+// Flatten program->uniforms (and the texbem registers) into the list of
+//  copies ProgramReady runs.
+static int build_uniform_copies(MOJOSHADER_glProgram *program)
+{
+    const uint32 max = program->uniform_count + program->texbem_count;
+    uint32 pos[2][3];  // next element of each array, by stage and type.
+    int last[2][3];  // latest op for each array, to merge with.
+    uint32 i;
+
+    if (max == 0)
+        return 1;
+
+    program->uniform_copies = (UniformCopy *) Malloc(sizeof (UniformCopy) * max);
+    if (program->uniform_copies == NULL)
+        return 0;
+
+    memset(pos, '\0', sizeof (pos));
+    memset(last, 0xFF, sizeof (last));
+
+    // vertex shader uniforms come first in program->uniforms array.
+    for (i = 0; i < program->uniform_count; i++)
+    {
+        const MOJOSHADER_uniform *u = program->uniforms[i].uniform;
+        const uint32 stage = (program->uniforms[i].shader_type ==
+                                MOJOSHADER_TYPE_PIXEL) ? 1 : 0;
+        const MOJOSHADER_uniformType type = u->type;
+        const uint32 size = u->array_count ? u->array_count : 1;
+        UniformCopy *op;
+
+        assert(!u->constant);
+        assert((type >= 0) && (type < 3));
+
+        op = (last[stage][type] >= 0) ?
+                &program->uniform_copies[last[stage][type]] : NULL;
+        if ((op != NULL) && (op->src + op->count == (uint32) u->index))
+            op->count += size;  // the array's elements are always contiguous.
+        else
+        {
+            last[stage][type] = (int) program->uniform_copy_count;
+            op = &program->uniform_copies[program->uniform_copy_count++];
+            op->kind = (UniformCopyKind) type;
+            op->stage = stage;
+            op->src = (uint32) u->index;
+            op->dst = pos[stage][type];
+            op->count = size;
+        } // else
+
+        pos[stage][type] += size;
+
+        // !!! FIXME: set constants that overlap the array.
+    } // for
+
+    // texbem registers go at the end of the pixel shader's float array.
+    assert((!program->texbem_count) || (program->fragment));
+    if ((program->texbem_count) && (program->fragment))
+    {
+        const MOJOSHADER_parseData *pd = program->fragment->parseData;
+        uint32 dst = program->ps_uniforms_float4_count -
+                     (program->texbem_count * 2);
+        int j;
+
+        for (j = 0; j < pd->sampler_count; j++)
+        {
+            const MOJOSHADER_sampler *samp = &pd->samplers[j];
+            if (samp->texbem)
+            {
+                UniformCopy *op;
+                assert(samp->index > 0);
+                assert(samp->index <= MAX_TEXBEMS);
+                op = &program->uniform_copies[program->uniform_copy_count++];
+                op->kind = UNIFORM_COPY_TEXBEM;
+                op->stage = 1;
+                op->src = (uint32) (samp->index - 1);
+                op->dst = dst;
+                op->count = 1;
+                dst += 2;
+            } // if
+        } // for
+
+        assert(dst == program->ps_uniforms_float4_count);
+    } // if
+
+    assert(program->uniform_copy_count <= max);
+    return 1;
+} // build_uniform_copies
+
+
+// Everything after the GL link: find what the program uses and build our
+//  copies of its uniform arrays. Returns zero on failure, in which case
+//  program_unref() cleans up whatever we got to.
+static int init_linked_program(MOJOSHADER_glProgram *retval)
+{
+    MOJOSHADER_glShader *vshader = retval->vertex;
+    MOJOSHADER_glShader *pshader = retval->fragment;
+    int bound = 0;
+    int numregs = 0;
+    int ok = 0;
+
+    if (vshader != NULL) numregs += vshader->parseData->uniform_count;
+    if (pshader != NULL) numregs += pshader->parseData->uniform_count;
+    if (numregs > 0)
+    {
+        const size_t len = sizeof (UniformMap) * numregs;
+        retval->uniforms = (UniformMap *) Malloc(len);
+        if (retval->uniforms == NULL)
+            goto init_program_done;
+        memset(retval->uniforms, '\0', len);
+    } // if
+
+    if (vshader != NULL)
+    {
+        if (vshader->parseData->attribute_count > 0)
+        {
+            const int count = vshader->parseData->attribute_count;
+            const size_t len = sizeof (AttributeMap) * count;
+            retval->attributes = (AttributeMap *) Malloc(len);
+            if (retval->attributes == NULL)
+                goto init_program_done;
+
+            memset(retval->attributes, '\0', len);
+            if (!lookup_attributes(retval))
+                goto init_program_done;
+        } // if
+
+        if (!lookup_uniforms(retval, vshader, &bound))
+            goto init_program_done;
+        lookup_samplers(retval, vshader, &bound);
+        lookup_outputs(retval, pshader);
+    } // if
+
+    if (pshader != NULL)
+    {
+        if (!lookup_uniforms(retval, pshader, &bound))
+            goto init_program_done;
+        lookup_samplers(retval, pshader, &bound);
+        lookup_outputs(retval, pshader);
+    } // if
+
+    if (!build_constants_lists(retval))
+        goto init_program_done;
+
+    if (!build_uniform_copies(retval))
+        goto init_program_done;
+
+    ok = 1;
+
+init_program_done:
+    if (bound)  // reset the old binding.
+        ctx->profileUseProgram(ctx->bound_program);
+
+    if (ok)
+        ctx->profileFinalInitProgram(retval);
+
+    return ok;
+} // init_linked_program
+
+
+MOJOSHADER_glProgram *MOJOSHADER_glLinkProgram(MOJOSHADER_glShader *vshader,
+                                               MOJOSHADER_glShader *pshader)
+{
+    int pending = 0;
+
+    if ((vshader == NULL) && (pshader == NULL))
+        return NULL;
+    else if ( ((vshader) && (vshader->share_group != ctx->share_group)) ||
+              ((pshader) && (pshader->share_group != ctx->share_group)) )
+    {
+        set_error("shader is from a context outside this share group");
+        return NULL;
+    } // else if
+    else if ((!shader_loaded(vshader)) || (!shader_loaded(pshader)))
+        return NULL;
+
+    // Shaders compiled in another context of our share group only grew
+    //  that context's register files.
+    if ( ((vshader) && (!reserve_shader_registers(vshader->parseData))) ||
+         ((pshader) && (!reserve_shader_registers(pshader->parseData))) )
+    {
+        out_of_memory();
+        return NULL;
+    } // if
+
+    MOJOSHADER_glProgram *retval = NULL;
+    const uint64 start = ticks_usecs();
+    const GLuint program = ctx->profileLinkProgram(vshader, pshader, &pending);
+    stat_add(&ctx->stats.program_link_usecs, ticks_usecs() - start);
+    if (program == 0)
+        return NULL;
+
+    retval = (MOJOSHADER_glProgram *) Malloc(sizeof (MOJOSHADER_glProgram));
+    if (retval == NULL)
+    {
+        ctx->profileDeleteProgram(program);
+        return NULL;
+    } // if
+
+    memset(retval, '\0', sizeof (MOJOSHADER_glProgram));
+    memset(retval->vertex_attrib_loc, 0xFF, sizeof(retval->vertex_attrib_loc));
+    retval->handle = program;
+    retval->vertex = vshader;
+    retval->fragment = pshader;
+    retval->generation = ctx->generation - 1;
+    retval->refcount = 1;
+    if (vshader != NULL) atomic_increment(&vshader->refcount);
+    if (pshader != NULL) atomic_increment(&pshader->refcount);
+
+    // An async link gets the rest done when someone asks for its status.
+    if (pending)
+        retval->status = MOJOSHADER_GLSTATUS_PENDING;
+    else if (init_linked_program(retval))
+        retval->status = MOJOSHADER_GLSTATUS_READY;
+    else
+    {
+        program_unref(retval);
+        return NULL;
+    } // else
+
+    return retval;
+} // MOJOSHADER_glLinkProgram
+
+
+// See if a pending link has finished (waiting for it if (wait)), and if so,
+//  finish setting the program up.
+static MOJOSHADER_glStatus program_status(MOJOSHADER_glProgram *program,
+                                          const int wait)
+{
+    if (program->status == MOJOSHADER_GLSTATUS_PENDING)
+    {
+        MOJOSHADER_glStatus status = ctx->profileLinkStatus(program, wait);
+        if ((status == MOJOSHADER_GLSTATUS_READY) &&
+            (!init_linked_program(program)))
+            status = MOJOSHADER_GLSTATUS_FAILED;
+        program->status = status;
+    } // if
+
+    return (MOJOSHADER_glStatus) program->status;
+} // program_status
+
+
+static void update_enabled_arrays(void)
+{
+    VertexArrayState *va = ctx->vertex_array;
+    uint32 changed = ctx->want_attr ^ va->have_attr;
+    int i;
+
+    // Enable/disable vertex arrays to match our needs.
+    // this happens to work in both ARB1 and GLSL, but if something alien
+    //  shows up, we'll have to split these into profile*() functions.
+    for (i = 0; changed != 0; i++, changed >>= 1)
+    {
+        if (changed & 1)
+        {
+            if (ctx->want_attr & (1u << i))
+                ctx->glEnableVertexAttribArray(i);
+            else
+                ctx->glDisableVertexAttribArray(i);
+        } // if
+    } // for
+
+    va->have_attr = ctx->want_attr;
+} // update_enabled_arrays
+
+
+static uint32 hash_vertex_array(const void *sym, void *data)
+{
+    (void) data;
+    const VertexArrayState *va = (const VertexArrayState *) sym;
+    const uint64 hash = hash64(hash64(HASH64_INIT, &va->layout,
+                                      sizeof (va->layout)),
+                               &va->decl, sizeof (va->decl));
+    return (uint32) (hash ^ (hash >> 32));
+} // hash_vertex_array
+
+
+static int match_vertex_array(const void *_a, const void *_b, void *data)
+{
+    (void) data;
+    const VertexArrayState *a = (const VertexArrayState *) _a;
+    const VertexArrayState *b = (const VertexArrayState *) _b;
+    return ((a->layout == b->layout) && (a->decl == b->decl));
+} // match_vertex_array
+
+
+static void nuke_vertex_array(const void *key, const void *value, void *data)
+{
+    (void) data;
+    (void) value;  // this is the same VertexArrayState struct as the key.
+    VertexArrayState *va = (VertexArrayState *) key;
+    if (ctx->vertex_array == va)
+        ctx->vertex_array = &ctx->default_vertex_array;
+    ctx->glDeleteVertexArrays(1, &va->vao);
+    stat_sub(&ctx->stats.vertex_array_objects, 1);
+    Free(va);
+} // nuke_vertex_array
+
+
+// With the vertex array cache on, make sure the vertex array for the bound
+//  program's attribute layout and the app's vertex declaration is bound,
+//  making one if we haven't seen this pair before. Anything without a
+//  declaration uses the app's own vertex array.
+static void select_vertex_array(void)
+{
+    const MOJOSHADER_glProgram *program = ctx->bound_program;
+    VertexArrayState *va = ctx->vertex_array;
+    VertexArrayState key;
+    const void *val = NULL;
+
+    if (ctx->vertex_array_cache == NULL)
+        return;
+
+    key.layout = ((program != NULL) && (ctx->vertex_decl != 0)) ?
+                    program->attrib_layout : 0;
+    key.decl = (key.layout != 0) ? ctx->vertex_decl : 0;
+    if ((key.layout == va->layout) && (key.decl == va->decl))
+        return;  // already bound.
+
+    if (key.layout == 0)
+        va = &ctx->default_vertex_array;
+    else if (hash_find(ctx->vertex_array_cache, &key, &val))
+        va = (VertexArrayState *) val;
+    else
+    {
+        va = (VertexArrayState *) Malloc(sizeof (VertexArrayState));
+        if (va == NULL)
+            return;  // keep using what we've got.
+        memset(va, '\0', sizeof (VertexArrayState));
+        va->layout = key.layout;
+        va->decl = key.decl;
+        ctx->glGenVertexArrays(1, &va->vao);
+        if (hash_insert(ctx->vertex_array_cache, va, va) != 1)
+        {
+            ctx->glDeleteVertexArrays(1, &va->vao);
+            Free(va);
+            out_of_memory();
+            return;
+        } // if
+        stat_add(&ctx->stats.vertex_array_objects, 1);
+    } // else
+
+    ctx->glBindVertexArray(va->vao);
+    ctx->vertex_array = va;
+    stat_add(&ctx->stats.vertex_array_binds, 1);
+} // select_vertex_array
+
+
+void MOJOSHADER_glBindProgram(MOJOSHADER_glProgram *program)
+{
+    if (program == ctx->bound_program)
+        return;  // nothing to do.
+
+    // Wait on async links. Failed ones never get bound, like a NULL from
+    //  MOJOSHADER_glLinkProgram(); the error is in MOJOSHADER_glGetError().
+    if ((program != NULL) &&
+        (program_status(program, 1) != MOJOSHADER_GLSTATUS_READY))
+        return;
+
+    if (program != NULL)
+        program->refcount++;
+
+    ctx->want_attr = 0;
+
+    // If no program bound, disable all arrays, in case we're switching to
+    //  fixed function pipeline. Otherwise, we try to minimize state changes
+    //  by toggling just the changed set of needed arrays in ProgramReady().
+    if (program == NULL)
+        update_enabled_arrays();
+
+    ctx->profileUseProgram(program);
+    program_unref(ctx->bound_program);
+    ctx->bound_program = program;
+    stat_add(&ctx->stats.program_binds, 1);
+} // MOJOSHADER_glBindProgram
+
+
+static uint32 hash_shaders(const void *sym, void *data)
+{
+    (void) data;
+    const BoundShaders *s = (const BoundShaders *) sym;
+    uint64 hash = HASH64_INIT;
+    hash = hash64(hash, &s->vertex, sizeof (s->vertex));
+    hash = hash64(hash, &s->fragment, sizeof (s->fragment));
+    return (uint32) (hash ^ (hash >> 32));
+} // hash_shaders
+
+static int match_shaders(const void *_a, const void *_b, void *data)
+{
+    (void) data;
+    const BoundShaders *a = (const BoundShaders *) _a;
+    const BoundShaders *b = (const BoundShaders *) _b;
+    return ((a->vertex == b->vertex) && (a->fragment == b->fragment));
+} // match_shaders
+
+static void linker_lru_unlink(BoundShaders *item)
+{
+    if (item->prev != NULL)
+        item->prev->next = item->next;
+    else
+        ctx->linker_lru_head = item->next;
+
+    if (item->next != NULL)
+        item->next->prev = item->prev;
+    else
+        ctx->linker_lru_tail = item->prev;
+
+    item->prev = item->next = NULL;
+} // linker_lru_unlink
+
+static void linker_lru_push(BoundShaders *item)
+{
+    item->prev = NULL;
+    item->next = ctx->linker_lru_head;
+    if (ctx->linker_lru_head != NULL)
+        ctx->linker_lru_head->prev = item;
+    else
+        ctx->linker_lru_tail = item;
+    ctx->linker_lru_head = item;
+} // linker_lru_push
+
+static void nuke_shaders(const void *key, const void *value, void *data)
+{
+    (void) data;
+    (void) value;  // this is the same BoundShaders struct as the key.
+    BoundShaders *item = (BoundShaders *) key;
+    MOJOSHADER_glProgram *program = item->program;
+    linker_lru_unlink(item);
+    stat_sub(&ctx->stats.linker_cache_programs, 1);
+    stat_sub(&ctx->stats.linker_cache_bytes, item->bytes);
+    Free(item);
+    MOJOSHADER_glDeleteProgram(program);
+} // nuke_shaders
+
+// What a program costs us in memory, for the linker cache budget. We can't
+//  see the driver's side of it, so this is just what we allocated.
+static size_t program_bytes(const MOJOSHADER_glProgram *program)
+{
+    return sizeof (MOJOSHADER_glProgram) +
+           (program->uniform_count * sizeof (UniformMap)) +
+           (program->uniform_copy_count * sizeof (UniformCopy)) +
+           (program->attribute_count * sizeof (AttributeMap)) +
+           (program->vs_uniforms_float4_count * sizeof (GLfloat) * 4) +
+           (program->vs_uniforms_int4_count * sizeof (GLint) * 4) +
+           (program->vs_uniforms_bool_count * sizeof (GLint)) +
+           (program->ps_uniforms_float4_count * sizeof (GLfloat) * 4) +
+           (program->ps_uniforms_int4_count * sizeof (GLint) * 4) +
+           (program->ps_uniforms_bool_count * sizeof (GLint));
+} // program_bytes
+
+static inline int linker_cache_over_budget(void)
+{
+    const MOJOSHADER_glStats *stats = &ctx->stats;
+    return ( ((ctx->linker_cache_max_programs > 0) &&
+              (stats->linker_cache_programs > ctx->linker_cache_max_programs)) ||
+             ((ctx->linker_cache_max_bytes > 0) &&
+              (stats->linker_cache_bytes > ctx->linker_cache_max_bytes)) );
+} // linker_cache_over_budget
+
+// Drop least recently used programs until we're in budget. Programs someone
+//  else holds a reference to (the bound program, mostly) are skipped, and
+//  so is (keep), if we're about to bind it.
+static void trim_linker_cache(const BoundShaders *keep)
+{
+    BoundShaders *item = ctx->linker_lru_tail;
+    while ((item != NULL) && (linker_cache_over_budget()))
+    {
+        BoundShaders *prev = item->prev;
+        if ((item != keep) && (item->program->refcount == 1))  // just ours?
+        {
+            hash_remove(ctx->linker_cache, item);
+            stat_add(&ctx->stats.linker_cache_evictions, 1);
+        } // if
+        item = prev;
+    } // while
+} // trim_linker_cache
+
+static MOJOSHADER_glProgram *get_linked_program(MOJOSHADER_glShader *v,
+                                                MOJOSHADER_glShader *p)
+{
+    // !!! FIXME: eventually support GL_EXT_separate_shader_objects.
+    if (ctx->linker_cache == NULL)
+    {
+        ctx->linker_cache = hash_create(NULL, hash_shaders, match_shaders,
+                                        nuke_shaders, 0, ctx->malloc_fn,
+                                        ctx->free_fn, ctx->malloc_data);
+
+        if (ctx->linker_cache == NULL)
+        {
+            out_of_memory();
+            return NULL;
+        } // if
+    } // if
+
+    MOJOSHADER_glProgram *program = NULL;
+    BoundShaders shaders;
+    memset(&shaders, '\0', sizeof (shaders));
+    shaders.vertex = v;
+    shaders.fragment = p;
+
+    const void *val = NULL;
+    if (hash_find(ctx->linker_cache, &shaders, &val))
+    {
+        BoundShaders *item = (BoundShaders *) val;
+        size_t bytes;
+        program = item->program;
+        stat_add(&ctx->stats.linker_cache_hits, 1);
+
+        // async links don't have their arrays until they're finished.
+        bytes = program_bytes(program);
+        stat_sub(&ctx->stats.linker_cache_bytes, item->bytes);
+        stat_add(&ctx->stats.linker_cache_bytes, bytes);
+        item->bytes = bytes;
+
+        // move it to the front of the LRU list.
+        if (item != ctx->linker_lru_head)
+        {
+            linker_lru_unlink(item);
+            linker_lru_push(item);
+        } // if
+    } // if
+    else
+    {
+        stat_add(&ctx->stats.linker_cache_misses, 1);
+        program = MOJOSHADER_glLinkProgram(v, p);
+        if (program == NULL)
+            return NULL;
+
+        BoundShaders *item = (BoundShaders *) Malloc(sizeof (BoundShaders));
+        if (item == NULL)
+        {
+            MOJOSHADER_glDeleteProgram(program);
+            return NULL;
+        } // if
+
+        memcpy(item, &shaders, sizeof (BoundShaders));
+        item->program = program;
+        item->bytes = program_bytes(program);
+        if (hash_insert(ctx->linker_cache, item, item) != 1)
+        {
+            Free(item);
+            MOJOSHADER_glDeleteProgram(program);
+            out_of_memory();
+            return NULL;
+        } // if
+
+        linker_lru_push(item);
+        stat_add(&ctx->stats.linker_cache_programs, 1);
+        stat_add(&ctx->stats.linker_cache_bytes, item->bytes);
+        trim_linker_cache(item);
+    } // else
+
+    return program;
+} // get_linked_program
+
+void MOJOSHADER_glBindShaders(MOJOSHADER_glShader *v, MOJOSHADER_glShader *p)
+{
+    if ((v == NULL) && (p == NULL))
+    {
+        MOJOSHADER_glBindProgram(NULL);
+        return;
+    } // if
+
+    MOJOSHADER_glProgram *program = get_linked_program(v, p);
+    if (program == NULL)
+        return;
+
+    MOJOSHADER_glBindProgram(program);
+} // MOJOSHADER_glBindShaders
+
+
+MOJOSHADER_glStatus MOJOSHADER_glBindShadersAsync(MOJOSHADER_glShader *v,
+                                                  MOJOSHADER_glShader *p)
+{
+    MOJOSHADER_glProgram *program = NULL;
+    MOJOSHADER_glStatus status;
+
+    if ((v == NULL) && (p == NULL))
+    {
+        MOJOSHADER_glBindProgram(NULL);
+        return MOJOSHADER_GLSTATUS_READY;
+    } // if
+
+    // Queued shaders can't link until they've reached the GL.
+    if ((!finish_shader_load(v, 0)) || (!finish_shader_load(p, 0)))
+        return MOJOSHADER_GLSTATUS_PENDING;
+
+    program = get_linked_program(v, p);
+    if (program == NULL)
+        return MOJOSHADER_GLSTATUS_FAILED;
+
+    status = program_status(program, 0);
+    if (status == MOJOSHADER_GLSTATUS_READY)
+        MOJOSHADER_glBindProgram(program);
+    return status;
+} // MOJOSHADER_glBindShadersAsync
+
+
+MOJOSHADER_glStatus MOJOSHADER_glShaderStatus(MOJOSHADER_glShader *shader,
+                                              int wait)
+{
+    if (!finish_shader_load(shader, wait))
+        return MOJOSHADER_GLSTATUS_PENDING;
+    else if (shader->status == MOJOSHADER_GLSTATUS_PENDING)
+        shader->status = ctx->profileShaderStatus(shader, wait);
+    return (MOJOSHADER_glStatus) shader->status;
+} // MOJOSHADER_glShaderStatus
+
+
+MOJOSHADER_glStatus MOJOSHADER_glProgramStatus(MOJOSHADER_glProgram *program,
+                                               int wait)
+{
+    return program_status(program, wait);
+} // MOJOSHADER_glProgramStatus
+
+
+static inline uint minuint(const uint a, const uint b)
+{
+    return ((a < b) ? a : b);
+} // minuint
+
+
+static inline int stamp_newer(const uint32 stamp, const uint32 since)
+{
+    return ((int32) (stamp - since)) > 0;  // survives wraparound.
+} // stamp_newer
+
+
+static void touch_registers(RegisterStamps *stamps, const uint idx,
+                            const uint count, const uint32 gen)
+{
+    if (count > 0)
+    {
+        const uint last = (idx + count - 1) >> REG_STAMP_SHIFT;
+        uint i;
+        for (i = idx >> REG_STAMP_SHIFT; i <= last; i++)
+            stamps->blocks[i] = gen;
+        stamps->latest = gen;
+    } // if
+} // touch_registers
+
+
+// ProgramReady marks elements in order, so this is nearly always an append
+//  to, or a merge with, the last span.
+static void mark_dirty(DirtyRange *range, const uint32 first,
+                       const uint32 count)
+{
+    const uint32 end = first + count;
+    uint32 i, j;
+
+    // First span that ends close enough to (first) to touch it.
+    for (i = 0; i < range->count; i++)
+    {
+        if (range->hi[i] + DIRTY_SPAN_GAP >= first)
+            break;
+    } // for
+
+    if ((i == range->count) || (end + DIRTY_SPAN_GAP < range->lo[i]))
+    {
+        if (range->count < MAX_DIRTY_SPANS)  // room for a new span at (i)?
+        {
+            const size_t len = sizeof (uint32) * (range->count - i);
+            memmove(&range->lo[i + 1], &range->lo[i], len);
+            memmove(&range->hi[i + 1], &range->hi[i], len);
+            range->lo[i] = first;
+            range->hi[i] = end;
+            range->count++;
+            return;
+        } // if
+
+        // Full up. Grow whichever neighbour is closer.
+        if (i == range->count)
+            i--;
+        else if ((i > 0) && ((first - range->hi[i-1]) < (range->lo[i] - end)))
+            i--;
+    } // if
+
+    range->lo[i] = minuint(range->lo[i], first);
+    range->hi[i] = (range->hi[i] > end) ? range->hi[i] : end;
+
+    // Swallow any later spans that (i) grew into.
+    for (j = i + 1; j < range->count; j++)
+    {
+        if (range->lo[j] > range->hi[i] + DIRTY_SPAN_GAP)
+            break;
+        else if (range->hi[j] > range->hi[i])
+            range->hi[i] = range->hi[j];
+    } // for
+
+    if (j > i + 1)
+    {
+        const size_t len = sizeof (uint32) * (range->count - j);
+        memmove(&range->lo[i + 1], &range->lo[j], len);
+        memmove(&range->hi[i + 1], &range->hi[j], len);
+        range->count -= (j - i - 1);
+    } // if
+} // mark_dirty
+
+
+// Copy (count) vec4 registers from (src) to (dst), marking just the ones
+//  that differ as dirty, so changing one bone in a big skinning palette
+//  doesn't upload the whole palette. Returns nonzero if anything changed.
+//  This compares bits, not values, so it works for GLint too, and a NaN
+//  that doesn't change doesn't get re-sent every time.
+static int copy_changed_vec4s(void *dst, const void *src, const uint32 count,
+                              DirtyRange *range, const uint32 first)
+{
+    const size_t len = sizeof (GLfloat) * 4;
+    uint8 *d = (uint8 *) dst;
+    const uint8 *s = (const uint8 *) src;
+    int changed = 0;
+    uint32 i;
+
+    for (i = 0; i < count; i++, d += len, s += len)
+    {
+#if HAVE_SSE2_INTRINSICS
+        const __m128i sv = _mm_loadu_si128((const __m128i *) s);
+        const __m128i dv = _mm_loadu_si128((const __m128i *) d);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sv, dv)) != 0xFFFF)
+        {
+            _mm_storeu_si128((__m128i *) d, sv);
+#else
+        if (memcmp(d, s, len) != 0)
+        {
+            memcpy(d, s, len);
+#endif
+            mark_dirty(range, first + i, 1);
+            changed = 1;
+        } // if
+    } // for
+
+    return changed;
+} // copy_changed_vec4s
+
+
+static inline void touch_all_registers(RegisterStamps *stamps, const uint32 gen)
+{
+    stamps->all = stamps->latest = gen;
+} // touch_all_registers
+
+
+static int registers_touched(const RegisterStamps *stamps, const uint idx,
+                             const uint count, const uint32 since)
+{
+    uint i, last;
+
+    if (!stamp_newer(stamps->latest, since))
+        return 0;
+    else if (stamp_newer(stamps->all, since))
+        return 1;
+
+    last = (idx + count - 1) >> REG_STAMP_SHIFT;
+    for (i = idx >> REG_STAMP_SHIFT; i <= last; i++)
+    {
+        if (stamp_newer(stamps->blocks[i], since))
+            return 1;
+    } // for
+
+    return 0;
+} // registers_touched
+
+
+// How many of (count) registers at (idx) we can write, after trying to grow
+//  the file to fit them. Out of memory just drops the ones that don't fit.
+static uint writable_registers(const MOJOSHADER_shaderType shader_type,
+                               const MOJOSHADER_uniformType type,
+                               const uint idx, const uint count)
+{
+    uint size;
+    reserve_registers(shader_type, type, idx + count);
+    if (shader_type == MOJOSHADER_TYPE_VERTEX)
+        size = ctx->vs_reg_file_size[type];
+    else
+        size = ctx->ps_reg_file_size[type];
+    return (idx < size) ? minuint(size - idx, count) : 0;
+} // writable_registers
+
+
+// How many of (count) registers at (idx) exist. The rest were never set.
+static inline uint readable_registers(const uint size, const uint idx,
+                                      const uint count)
+{
+    return (idx < size) ? minuint(size - idx, count) : 0;
+} // readable_registers
+
+
+void MOJOSHADER_glSetVertexShaderUniformF(unsigned int idx, const float *data,
+                                          unsigned int vec4n)
+{
+    const uint maxregs = MAX_REG_FILE_F;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLfloat) == sizeof (float));
+        const uint count = writable_registers(MOJOSHADER_TYPE_VERTEX,
+                                              MOJOSHADER_UNIFORM_FLOAT, idx,
+                                              minuint(maxregs - idx, vec4n));
+        if (count > 0)
+            memcpy(ctx->vs_reg_file_f + (idx * 4), data, count * sizeof (*data) * 4);
+        ctx->vs_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->vs_reg_stamps[MOJOSHADER_UNIFORM_FLOAT], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetVertexShaderUniformF
+
+
+void MOJOSHADER_glGetVertexShaderUniformF(unsigned int idx, float *data,
+                                          unsigned int vec4n)
+{
+    const uint maxregs = MAX_REG_FILE_F;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLfloat) == sizeof (float));
+        const uint want = minuint(maxregs - idx, vec4n);
+        const uint have = readable_registers(ctx->vs_reg_file_size[MOJOSHADER_UNIFORM_FLOAT], idx, want);
+        if (have > 0)
+            memcpy(data, ctx->vs_reg_file_f + (idx * 4), have * sizeof (*data) * 4);
+        memset(data + (have * 4), '\0', (want - have) * sizeof (*data) * 4);
+    } // if
+} // MOJOSHADER_glGetVertexShaderUniformF
+
+
+void MOJOSHADER_glSetVertexShaderUniformI(unsigned int idx, const int *data,
+                                          unsigned int ivec4n)
+{
+    const uint maxregs = MAX_REG_FILE_I;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLint) == sizeof (int));
+        const uint count = writable_registers(MOJOSHADER_TYPE_VERTEX,
+                                              MOJOSHADER_UNIFORM_INT, idx,
+                                              minuint(maxregs - idx, ivec4n));
+        if (count > 0)
+            memcpy(ctx->vs_reg_file_i + (idx * 4), data, count * sizeof (*data) * 4);
+        ctx->vs_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->vs_reg_stamps[MOJOSHADER_UNIFORM_INT], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetVertexShaderUniformI
+
+
+void MOJOSHADER_glGetVertexShaderUniformI(unsigned int idx, int *data,
+                                          unsigned int ivec4n)
+{
+    const uint maxregs = MAX_REG_FILE_I;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLint) == sizeof (int));
+        const uint want = minuint(maxregs - idx, ivec4n);
+        const uint have = readable_registers(ctx->vs_reg_file_size[MOJOSHADER_UNIFORM_INT], idx, want);
+        if (have > 0)
+            memcpy(data, ctx->vs_reg_file_i + (idx * 4), have * sizeof (*data) * 4);
+        memset(data + (have * 4), '\0', (want - have) * sizeof (*data) * 4);
+    } // if
+} // MOJOSHADER_glGetVertexShaderUniformI
+
+
+void MOJOSHADER_glSetVertexShaderUniformB(unsigned int idx, const int *data,
+                                          unsigned int bcount)
+{
+    // !!! FIXME: bool registers aren't vec4s, so this /4 looks wrong, but
+    // !!! FIXME:  it's what the API has always accepted.
+    const uint maxregs = MAX_REG_FILE_B / 4;
+    if (idx < maxregs)
+    {
+        const uint count = writable_registers(MOJOSHADER_TYPE_VERTEX,
+                                              MOJOSHADER_UNIFORM_BOOL, idx,
+                                              minuint(maxregs - idx, bcount));
+        uint8 *wptr = ctx->vs_reg_file_b + idx;
+        uint8 *endptr = wptr + count;
+        while (wptr != endptr)
+            *(wptr++) = *(data++) ? 1 : 0;
+        ctx->vs_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->vs_reg_stamps[MOJOSHADER_UNIFORM_BOOL], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetVertexShaderUniformB
+
+
+void MOJOSHADER_glGetVertexShaderUniformB(unsigned int idx, int *data,
+                                          unsigned int bcount)
+{
+    const uint maxregs = MAX_REG_FILE_B / 4;
+    if (idx < maxregs)
+    {
+        const uint want = minuint(maxregs - idx, bcount);
+        const uint have = readable_registers(ctx->vs_reg_file_size[MOJOSHADER_UNIFORM_BOOL], idx, want);
+        uint8 *rptr = ctx->vs_reg_file_b + idx;
+        uint8 *endptr = rptr + have;
+        int *dataend = data + want;
+        while (rptr != endptr)
+            *(data++) = (int) *(rptr++);
+        while (data != dataend)
+            *(data++) = 0;
+    } // if
+} // MOJOSHADER_glGetVertexShaderUniformB
+
+
+void MOJOSHADER_glSetPixelShaderUniformF(unsigned int idx, const float *data,
+                                         unsigned int vec4n)
+{
+    const uint maxregs = MAX_REG_FILE_F;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLfloat) == sizeof (float));
+        const uint count = writable_registers(MOJOSHADER_TYPE_PIXEL,
+                                              MOJOSHADER_UNIFORM_FLOAT, idx,
+                                              minuint(maxregs - idx, vec4n));
+        if (count > 0)
+            memcpy(ctx->ps_reg_file_f + (idx * 4), data, count * sizeof (*data) * 4);
+        ctx->ps_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->ps_reg_stamps[MOJOSHADER_UNIFORM_FLOAT], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetPixelShaderUniformF
+
+
+void MOJOSHADER_glGetPixelShaderUniformF(unsigned int idx, float *data,
+                                         unsigned int vec4n)
+{
+    const uint maxregs = MAX_REG_FILE_F;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLfloat) == sizeof (float));
+        const uint want = minuint(maxregs - idx, vec4n);
+        const uint have = readable_registers(ctx->ps_reg_file_size[MOJOSHADER_UNIFORM_FLOAT], idx, want);
+        if (have > 0)
+            memcpy(data, ctx->ps_reg_file_f + (idx * 4), have * sizeof (*data) * 4);
+        memset(data + (have * 4), '\0', (want - have) * sizeof (*data) * 4);
+    } // if
+} // MOJOSHADER_glGetPixelShaderUniformF
+
+
+void MOJOSHADER_glSetPixelShaderUniformI(unsigned int idx, const int *data,
+                                         unsigned int ivec4n)
+{
+    const uint maxregs = MAX_REG_FILE_I;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLint) == sizeof (int));
+        const uint count = writable_registers(MOJOSHADER_TYPE_PIXEL,
+                                              MOJOSHADER_UNIFORM_INT, idx,
+                                              minuint(maxregs - idx, ivec4n));
+        if (count > 0)
+            memcpy(ctx->ps_reg_file_i + (idx * 4), data, count * sizeof (*data) * 4);
+        ctx->ps_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->ps_reg_stamps[MOJOSHADER_UNIFORM_INT], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetPixelShaderUniformI
 
 
 void MOJOSHADER_glGetPixelShaderUniformI(unsigned int idx, int *data,
                                          unsigned int ivec4n)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_i) / 4;
-    if (idx < maxregs)
+    const uint maxregs = MAX_REG_FILE_I;
+    if (idx < maxregs)
+    {
+        assert(sizeof (GLint) == sizeof (int));
+        const uint want = minuint(maxregs - idx, ivec4n);
+        const uint have = readable_registers(ctx->ps_reg_file_size[MOJOSHADER_UNIFORM_INT], idx, want);
+        if (have > 0)
+            memcpy(data, ctx->ps_reg_file_i + (idx * 4), have * sizeof (*data) * 4);
+        memset(data + (have * 4), '\0', (want - have) * sizeof (*data) * 4);
+    } // if
+} // MOJOSHADER_glGetPixelShaderUniformI
+
+
+void MOJOSHADER_glSetPixelShaderUniformB(unsigned int idx, const int *data,
+                                         unsigned int bcount)
+{
+    // !!! FIXME: bool registers aren't vec4s, so this /4 looks wrong, but
+    // !!! FIXME:  it's what the API has always accepted.
+    const uint maxregs = MAX_REG_FILE_B / 4;
+    if (idx < maxregs)
+    {
+        const uint count = writable_registers(MOJOSHADER_TYPE_PIXEL,
+                                              MOJOSHADER_UNIFORM_BOOL, idx,
+                                              minuint(maxregs - idx, bcount));
+        uint8 *wptr = ctx->ps_reg_file_b + idx;
+        uint8 *endptr = wptr + count;
+        while (wptr != endptr)
+            *(wptr++) = *(data++) ? 1 : 0;
+        ctx->ps_reg_file_stamp++;
+        ctx->generation++;
+        touch_registers(&ctx->ps_reg_stamps[MOJOSHADER_UNIFORM_BOOL], idx,
+                        count, ctx->generation);
+    } // if
+} // MOJOSHADER_glSetPixelShaderUniformB
+
+
+void MOJOSHADER_glGetPixelShaderUniformB(unsigned int idx, int *data,
+                                         unsigned int bcount)
+{
+    const uint maxregs = MAX_REG_FILE_B / 4;
+    if (idx < maxregs)
+    {
+        const uint want = minuint(maxregs - idx, bcount);
+        const uint have = readable_registers(ctx->ps_reg_file_size[MOJOSHADER_UNIFORM_BOOL], idx, want);
+        uint8 *rptr = ctx->ps_reg_file_b + idx;
+        uint8 *endptr = rptr + have;
+        int *dataend = data + want;
+        while (rptr != endptr)
+            *(data++) = (int) *(rptr++);
+        while (data != dataend)
+            *(data++) = 0;
+    } // if
+} // MOJOSHADER_glGetPixelShaderUniformB
+
+
+static inline GLenum opengl_attr_type(const MOJOSHADER_attributeType type)
+{
+    switch (type)
+    {
+        case MOJOSHADER_ATTRIBUTE_UNKNOWN: return GL_NONE; // oh well.
+        case MOJOSHADER_ATTRIBUTE_BYTE: return GL_BYTE;
+        case MOJOSHADER_ATTRIBUTE_UBYTE: return GL_UNSIGNED_BYTE;
+        case MOJOSHADER_ATTRIBUTE_SHORT: return GL_SHORT;
+        case MOJOSHADER_ATTRIBUTE_USHORT: return GL_UNSIGNED_SHORT;
+        case MOJOSHADER_ATTRIBUTE_INT: return GL_INT;
+        case MOJOSHADER_ATTRIBUTE_UINT: return GL_UNSIGNED_INT;
+        case MOJOSHADER_ATTRIBUTE_FLOAT: return GL_FLOAT;
+        case MOJOSHADER_ATTRIBUTE_DOUBLE: return GL_DOUBLE;
+
+        case MOJOSHADER_ATTRIBUTE_HALF_FLOAT:
+            if (ctx->have_GL_NV_half_float)
+                return GL_HALF_FLOAT_NV;
+            else if (ctx->have_GL_ARB_half_float_vertex)
+                return GL_HALF_FLOAT_ARB;
+            else if (ctx->have_GL_OES_vertex_half_float)
+                return GL_HALF_FLOAT_OES;
+            break;
+    } // switch
+
+    return GL_NONE;  // oh well. Raises a GL error later.
+} // opengl_attr_type
+
+
+int MOJOSHADER_glGetVertexAttribLocation(MOJOSHADER_usage usage, int index)
+{
+    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
+        return -1;
+
+    return ctx->bound_program->vertex_attrib_loc[usage][index];
+} // MOJOSHADER_glGetVertexAttribLocation
+
+
+// !!! FIXME: shouldn't (index) be unsigned?
+void MOJOSHADER_glSetVertexAttribute(MOJOSHADER_usage usage,
+                                     int index, unsigned int size,
+                                     MOJOSHADER_attributeType type,
+                                     int normalized, unsigned int stride,
+                                     const void *ptr)
+{
+    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
+        return;
+
+    const GLenum gl_type = opengl_attr_type(type);
+    const GLboolean norm = (normalized) ? GL_TRUE : GL_FALSE;
+    const GLint gl_index = ctx->bound_program->vertex_attrib_loc[usage][index];
+    VertexArrayState *va;
+    VertexAttribState *attr;
+    const GLuint buffer = ctx->vertex_buffer;
+
+    if (gl_index == -1)
+        return; // Nothing to do, this shader doesn't use this stream.
+
+    select_vertex_array();
+    va = ctx->vertex_array;
+    attr = &va->attr[gl_index];
+
+    // Our cached vertex arrays are only touched by us, and their
+    //  declaration covers the buffers. The app's own vertex array is only
+    //  shadowed if the app tells us its buffer bindings. We never ask the
+    //  GL, as glGet*() can stall a threaded driver.
+    if ((va == &ctx->default_vertex_array) && (!ctx->vertex_buffer_known))
+        va->known_attr &= ~(1u << gl_index);
+
+    if ( (va->known_attr & (1u << gl_index)) && (attr->buffer == buffer) &&
+         (attr->size == (GLint) size) && (attr->type == gl_type) &&
+         (attr->normalized == norm) && (attr->stride == (GLsizei) stride) &&
+         (attr->ptr == ptr) )
+        stat_add(&ctx->stats.vertex_attribs_elided, 1);
+    else
+    {
+        // this happens to work in both ARB1 and GLSL, but if something alien
+        //  shows up, we'll have to split these into profile*() functions.
+        ctx->glVertexAttribPointer(gl_index, size, gl_type, norm, stride, ptr);
+        attr->buffer = buffer;
+        attr->size = (GLint) size;
+        attr->type = gl_type;
+        attr->normalized = norm;
+        attr->stride = (GLsizei) stride;
+        attr->ptr = ptr;
+        va->known_attr |= (1u << gl_index);
+        stat_add(&ctx->stats.vertex_attribs_applied, 1);
+    } // else
+
+    // flag this array as in use, so we can enable it later.
+    ctx->want_attr |= (1u << gl_index);
+} // MOJOSHADER_glSetVertexAttribute
+
+
+// !!! FIXME: shouldn't (index) be unsigned?
+void MOJOSHADER_glSetVertexAttribDivisor(MOJOSHADER_usage usage,
+                                         int index, unsigned int divisor)
+{
+    assert(ctx->have_GL_ARB_instanced_arrays);
+
+    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
+        return;
+
+    const GLint gl_index = ctx->bound_program->vertex_attrib_loc[usage][index];
+
+    if (gl_index == -1)
+        return; // Nothing to do, this shader doesn't use this stream.
+
+    select_vertex_array();
+    if (divisor != ctx->vertex_array->attr_divisor[gl_index])
+    {
+        ctx->glVertexAttribDivisorARB(gl_index, divisor);
+        ctx->vertex_array->attr_divisor[gl_index] = divisor;
+        stat_add(&ctx->stats.vertex_attribs_applied, 1);
+    } // if
+    else
+        stat_add(&ctx->stats.vertex_attribs_elided, 1);
+} // MOJOSHADER_glSetVertexAttribDivisor
+
+
+void MOJOSHADER_glSetLegacyBumpMapEnv(unsigned int sampler, float mat00,
+                                      float mat01, float mat10, float mat11,
+                                      float lscale, float loffset)
+{
+    if ((sampler == 0) || (sampler > (MAX_TEXBEMS+1)))
+        return;
+
+    GLfloat *dstf = ctx->texbem_state + (6 * (sampler-1));
+    *(dstf++) = (GLfloat) mat00;
+    *(dstf++) = (GLfloat) mat01;
+    *(dstf++) = (GLfloat) mat10;
+    *(dstf++) = (GLfloat) mat11;
+    *(dstf++) = (GLfloat) lscale;
+    *(dstf++) = (GLfloat) loffset;
+    ctx->generation++;
+} // MOJOSHADER_glSetLegacyBumpMapEnv
+
+
+static inline int must_rebind_uniform_blocks(const MOJOSHADER_glProgram *p)
+{
+    return ( (ctx->ubo_ring != 0) && (ctx->ubo_program != p) &&
+             ((p->vs_block_size > 0) || (p->ps_block_size > 0)) );
+} // must_rebind_uniform_blocks
+
+
+// Separable stage programs are shared by every pipeline that uses them, so
+//  if another pipeline pushed its uniforms to one of our stages since we
+//  last did, our whole copy of that stage has to go up again.
+static void claim_pipeline_stages(MOJOSHADER_glProgram *program)
+{
+    MOJOSHADER_glShader *vertex = program->vertex;
+    MOJOSHADER_glShader *fragment = program->fragment;
+    DirtyRange *dirty;
+
+    if ((vertex != NULL) && (vertex->pipeline != program))
+    {
+        dirty = program->dirty[0];
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_FLOAT], 0,
+                   (uint32) program->vs_uniforms_float4_count);
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_INT], 0,
+                   (uint32) program->vs_uniforms_int4_count);
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_BOOL], 0,
+                   (uint32) program->vs_uniforms_bool_count);
+        vertex->pipeline = program;
+        program->stages_stale = 1;
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+        program->current_flip = -1;  // unknown, so push it again.
+#endif
+    } // if
+
+    if ((fragment != NULL) && (fragment->pipeline != program))
+    {
+        dirty = program->dirty[1];
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_FLOAT], 0,
+                   (uint32) program->ps_uniforms_float4_count);
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_INT], 0,
+                   (uint32) program->ps_uniforms_int4_count);
+        mark_dirty(&dirty[MOJOSHADER_UNIFORM_BOOL], 0,
+                   (uint32) program->ps_uniforms_bool_count);
+        fragment->pipeline = program;
+        program->stages_stale = 1;
+    } // if
+} // claim_pipeline_stages
+
+
+void MOJOSHADER_glProgramReady(void)
+{
+    MOJOSHADER_glProgram *program = ctx->bound_program;
+
+    stat_add(&ctx->stats.program_ready_calls, 1);
+
+    if (program == NULL)
+        return;  // nothing to do.
+
+    if (ctx->use_pipelines)
+        claim_pipeline_stages(program);
+
+    // Toggle vertex attribute arrays on/off, based on our needs.
+    select_vertex_array();
+    update_enabled_arrays();
+
+    if (program->uses_pointsize != ctx->pointsize_enabled)
+    {
+        if (program->uses_pointsize)
+            ctx->glEnable(GL_PROGRAM_POINT_SIZE);
+        else
+            ctx->glDisable(GL_PROGRAM_POINT_SIZE);
+        ctx->pointsize_enabled = program->uses_pointsize;
+    } // if
+
+    // push Uniforms to the program from our register files...
+    if ( (program->uniform_copy_count) &&
+         (program->generation != ctx->generation) )
+    {
+        const UniformCopy *op = program->uniform_copies;
+        const UniformCopy *end = op + program->uniform_copy_count;
+        const uint32 since = program->generation;
+        const int full = !program->uniforms_synced;
+        const RegisterStamps *stamps[2] = {
+            ctx->vs_reg_stamps, ctx->ps_reg_stamps
+        };
+        const GLfloat *srcf[2] = { ctx->vs_reg_file_f, ctx->ps_reg_file_f };
+        const GLint *srci[2] = { ctx->vs_reg_file_i, ctx->ps_reg_file_i };
+        const uint8 *srcb[2] = { ctx->vs_reg_file_b, ctx->ps_reg_file_b };
+        GLfloat *dstf[2] = {
+            program->vs_uniforms_float4, program->ps_uniforms_float4
+        };
+        GLint *dsti[2] = {
+            program->vs_uniforms_int4, program->ps_uniforms_int4
+        };
+        GLint *dstb[2] = {
+            program->vs_uniforms_bool, program->ps_uniforms_bool
+        };
+        int uniforms_changed = 0;
+
+        for (; op != end; op++)
+        {
+            const uint32 stage = op->stage;
+            DirtyRange *dirty = program->dirty[stage];
+
+            // Only compare registers written since this program last looked.
+            if ( (op->kind != UNIFORM_COPY_TEXBEM) && (!full) &&
+                 (!registers_touched(&stamps[stage][op->kind], op->src,
+                                     op->count, since)) )
+                continue;
+
+            switch (op->kind)
+            {
+                case UNIFORM_COPY_FLOAT4:
+                    uniforms_changed |= copy_changed_vec4s(
+                                            dstf[stage] + (op->dst * 4),
+                                            srcf[stage] + (op->src * 4),
+                                            op->count,
+                                            &dirty[MOJOSHADER_UNIFORM_FLOAT],
+                                            op->dst);
+                    break;
+
+                case UNIFORM_COPY_INT4:
+                    uniforms_changed |= copy_changed_vec4s(
+                                            dsti[stage] + (op->dst * 4),
+                                            srci[stage] + (op->src * 4),
+                                            op->count,
+                                            &dirty[MOJOSHADER_UNIFORM_INT],
+                                            op->dst);
+                    break;
+
+                case UNIFORM_COPY_BOOL:
+                {
+                    const uint8 *b = srcb[stage] + op->src;
+                    GLint *dst = dstb[stage] + op->dst;
+                    uint32 i;
+                    for (i = 0; i < op->count; i++)
+                    {
+                        if (dst[i] != b[i])
+                        {
+                            dst[i] = (GLint) b[i];
+                            mark_dirty(&dirty[MOJOSHADER_UNIFORM_BOOL],
+                                       op->dst + i, 1);
+                            uniforms_changed = 1;
+                        } // if
+                    } // for
+                    break;
+                } // case
+
+                case UNIFORM_COPY_TEXBEM:
+                {
+                    const GLfloat *src = &ctx->texbem_state[6 * op->src];
+                    GLfloat *dst = dstf[1] + (op->dst * 4);
+                    if ((full) || (memcmp(dst, src, sizeof (GLfloat) * 6) != 0))
+                    {
+                        memcpy(dst, src, sizeof (GLfloat) * 6);
+                        dst[6] = 0.0f;
+                        dst[7] = 0.0f;
+                        mark_dirty(&dirty[MOJOSHADER_UNIFORM_FLOAT],
+                                   op->dst, 2);
+                        uniforms_changed = 1;
+                    } // if
+                    break;
+                } // case
+            } // switch
+        } // for
+
+        program->generation = ctx->generation;
+        program->uniforms_synced = 1;
+
+        if ( (uniforms_changed) || (program->stages_stale) ||
+             (must_rebind_uniform_blocks(program)) )
+        {
+            ctx->profilePushUniforms();
+            program->stages_stale = 0;
+            stat_add(&ctx->stats.program_ready_pushes, 1);
+        } // if
+    } // if
+
+    // Uniform block bindings belong to the context, not the program, so
+    //  switching programs has to push even if no register changed. The same
+    //  goes for pipeline stages another pipeline has pushed to.
+    else if ((program->stages_stale) || (must_rebind_uniform_blocks(program)))
+    {
+        ctx->profilePushUniforms();
+        program->stages_stale = 0;
+        stat_add(&ctx->stats.program_ready_pushes, 1);
+    } // else if
+} // MOJOSHADER_glProgramReady
+
+
+void MOJOSHADER_glDeleteProgram(MOJOSHADER_glProgram *program)
+{
+    program_unref(program);
+} // MOJOSHADER_glDeleteProgram
+
+
+void MOJOSHADER_glDeleteShader(MOJOSHADER_glShader *shader)
+{
+    if (shader == NULL)
+        return;
+
+    // Interned shaders can have other owners, who still want its programs.
+    if (release_interned_shader(shader) > 0)
+    {
+        shader_unref(shader);
+        return;
+    } // if
+
+    // See if this was bound as an unlinked program anywhere...
+    if (ctx->linker_cache)
+    {
+        const void *key = NULL;
+        void *iter = NULL;
+        int morekeys = hash_iter_keys(ctx->linker_cache, &key, &iter);
+        while (morekeys)
+        {
+            const BoundShaders *shaders = (const BoundShaders *) key;
+            // Do this here so we don't confuse the iteration by removing...
+            morekeys = hash_iter_keys(ctx->linker_cache, &key, &iter);
+            if ((shaders->vertex == shader) || (shaders->fragment == shader))
+            {
+                // Deletes the linked program, which will unref the shader.
+                hash_remove(ctx->linker_cache, shaders);
+            } // if
+        } // while
+    } // if
+
+    shader_unref(shader);
+} // MOJOSHADER_glDeleteShader
+
+
+void MOJOSHADER_glDestroyContext(MOJOSHADER_glContext *_ctx)
+{
+    MOJOSHADER_glContext *current_ctx = ctx;
+    ctx = _ctx;
+    MOJOSHADER_glBindProgram(NULL);
+    if (ctx->linker_cache)
+        hash_destroy(ctx->linker_cache);
+    if (ctx->shader_intern)
+    {
+        spinlock_lock(&ctx->intern_lock);
+        hash_destroy(ctx->shader_intern);
+        spinlock_unlock(&ctx->intern_lock);
+    } // if
+    free_shader_loads();
+    if (ctx->vertex_array_cache)
+        hash_destroy(ctx->vertex_array_cache);
+#ifdef MOJOSHADER_GL_TRACE
+    Free(ctx->trace_calls);
+#endif
+    Free(ctx->program_binary_dir);
+    free_register_files();
+    ubo_ring_destroy();
+#ifdef MOJOSHADER_EFFECT_SUPPORT
+    if (ctx->state_blocks)
+        hash_destroy(ctx->state_blocks);
+#endif
+    lookup_entry_points(NULL, NULL);   // !!! FIXME: is there a value to this?
+    Free(ctx);
+    ctx = ((current_ctx == _ctx) ? NULL : current_ctx);
+} // MOJOSHADER_glDestroyContext
+
+
+int MOJOSHADER_glSetAsyncCompile(int enable)
+{
+    ctx->async_compile = ((enable) && (ctx->async_capable));
+    if (ctx->async_compile)
     {
-        assert(sizeof (GLint) == sizeof (int));
-        const uint cpy = (minuint(maxregs - idx, ivec4n) * sizeof (*data)) * 4;
-        memcpy(data, ctx->ps_reg_file_i + (idx * 4), cpy);
+        // Let the driver pick how many threads to compile with.
+        if (ctx->have_GL_KHR_parallel_shader_compile)
+            ctx->glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        else if (ctx->have_GL_ARB_parallel_shader_compile)
+            ctx->glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
     } // if
-} // MOJOSHADER_glGetPixelShaderUniformI
+    return ctx->async_compile;
+} // MOJOSHADER_glSetAsyncCompile
 
 
-void MOJOSHADER_glSetPixelShaderUniformB(unsigned int idx, const int *data,
-                                         unsigned int bcount)
+int MOJOSHADER_glSetVertexArrayCache(int enable)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_b) / 4;
-    if (idx < maxregs)
+    GLint vao = 0;
+
+    if ((enable) && (ctx->vertex_array_cache == NULL) &&
+        (ctx->have_GL_ARB_vertex_array_object))
     {
-        uint8 *wptr = ctx->ps_reg_file_b + idx;
-        uint8 *endptr = wptr + minuint(maxregs - idx, bcount);
-        while (wptr != endptr)
-            *(wptr++) = *(data++) ? 1 : 0;
-        ctx->generation++;
+        ctx->vertex_array_cache = hash_create(NULL, hash_vertex_array,
+                                              match_vertex_array,
+                                              nuke_vertex_array, 0,
+                                              ctx->malloc_fn, ctx->free_fn,
+                                              ctx->malloc_data);
+        if (ctx->vertex_array_cache == NULL)
+            out_of_memory();
+        else
+        {
+            // Whatever the app has bound is our default vertex array.
+            ctx->glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+            ctx->default_vertex_array.vao = (GLuint) vao;
+        } // else
     } // if
-} // MOJOSHADER_glSetPixelShaderUniformB
 
+    else if ((!enable) && (ctx->vertex_array_cache != NULL))
+    {
+        hash_destroy(ctx->vertex_array_cache);
+        ctx->vertex_array_cache = NULL;
+        ctx->glBindVertexArray(ctx->default_vertex_array.vao);
+        ctx->vertex_array = &ctx->default_vertex_array;
+    } // else if
+
+    return (ctx->vertex_array_cache != NULL);
+} // MOJOSHADER_glSetVertexArrayCache
 
-void MOJOSHADER_glGetPixelShaderUniformB(unsigned int idx, int *data,
-                                         unsigned int bcount)
+
+void MOJOSHADER_glSetVertexDeclaration(unsigned long long decl)
 {
-    const uint maxregs = STATICARRAYLEN(ctx->ps_reg_file_b) / 4;
-    if (idx < maxregs)
+    ctx->vertex_decl = decl;
+} // MOJOSHADER_glSetVertexDeclaration
+
+
+void MOJOSHADER_glSetVertexBuffer(unsigned int buffer)
+{
+    ctx->vertex_buffer = (GLuint) buffer;
+    ctx->vertex_buffer_known = 1;
+} // MOJOSHADER_glSetVertexBuffer
+
+
+void MOJOSHADER_glSetLinkerCacheBudget(unsigned long long max_programs,
+                                       unsigned long long max_bytes)
+{
+    ctx->linker_cache_max_programs = max_programs;
+    ctx->linker_cache_max_bytes = max_bytes;
+    if (ctx->linker_cache != NULL)
+        trim_linker_cache(NULL);
+} // MOJOSHADER_glSetLinkerCacheBudget
+
+
+int MOJOSHADER_glSetProgramBinaryCache(const char *dirname)
+{
+    char *dup = NULL;
+
+    if (dirname != NULL)
     {
-        uint8 *rptr = ctx->ps_reg_file_b + idx;
-        uint8 *endptr = rptr + minuint(maxregs - idx, bcount);
-        while (rptr != endptr)
-            *(data++) = (int) *(rptr++);
+        dup = (char *) Malloc(strlen(dirname) + 1);
+        if (dup == NULL)
+            return 0;
+        strcpy(dup, dirname);
     } // if
-} // MOJOSHADER_glGetPixelShaderUniformB
 
+    Free(ctx->program_binary_dir);
+    ctx->program_binary_dir = dup;
+    return use_program_binary_cache();
+} // MOJOSHADER_glSetProgramBinaryCache
 
-static inline GLenum opengl_attr_type(const MOJOSHADER_attributeType type)
+
+void MOJOSHADER_glGetStats(MOJOSHADER_glStats *stats)
+{
+    // Every field is an unsigned long long, see stat_add().
+    const unsigned long long *src = (const unsigned long long *) &ctx->stats;
+    unsigned long long *dst = (unsigned long long *) stats;
+    const size_t count = sizeof (MOJOSHADER_glStats) / sizeof (*src);
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        dst[i] = stat_load(&src[i]);
+} // MOJOSHADER_glGetStats
+
+
+void MOJOSHADER_glResetStats(void)
+{
+    // These describe what exists right now, not what has happened.
+    const uint64 register_file_bytes = ctx->stats.register_file_bytes;
+    const uint64 linker_cache_programs = ctx->stats.linker_cache_programs;
+    const uint64 linker_cache_bytes = ctx->stats.linker_cache_bytes;
+    const uint64 vertex_array_objects = ctx->stats.vertex_array_objects;
+    unsigned long long *dst = (unsigned long long *) &ctx->stats;
+    const size_t count = sizeof (MOJOSHADER_glStats) / sizeof (*dst);
+    size_t i;
+
+    // Workers add to the load counters under load_lock. Without it, a
+    //  worker's add could straddle the reset and bring back the old total.
+    spinlock_lock(&ctx->load_lock);
+    for (i = 0; i < count; i++)
+        stat_store(&dst[i], 0);
+    spinlock_unlock(&ctx->load_lock);
+
+    stat_store(&ctx->stats.register_file_bytes, register_file_bytes);
+    stat_store(&ctx->stats.linker_cache_programs, linker_cache_programs);
+    stat_store(&ctx->stats.linker_cache_bytes, linker_cache_bytes);
+    stat_store(&ctx->stats.vertex_array_objects, vertex_array_objects);
+} // MOJOSHADER_glResetStats
+
+
+// The GL call tracer's public API...
+
+static const struct { const char *name; TraceStateType state; } trace_functions[] =
+{
+    { "frame", TRACESTATE_NONE },
+    #define TRACE_FUNCTION(fn, state) { #fn, TRACESTATE_##state },
+    TRACE_FUNCTIONS
+    #undef TRACE_FUNCTION
+};
+
+const char *MOJOSHADER_glTraceFunctionName(unsigned int function)
+{
+    return (function < TRACE_TOTAL) ? trace_functions[function].name : NULL;
+} // MOJOSHADER_glTraceFunctionName
+
+
+int MOJOSHADER_glSetTrace(unsigned int max_calls)
+{
+#ifdef MOJOSHADER_GL_TRACE
+    MOJOSHADER_glTraceCall *calls = NULL;
+
+    if (max_calls > 0)
+    {
+        calls = (MOJOSHADER_glTraceCall *)
+                    Malloc(sizeof (MOJOSHADER_glTraceCall) * max_calls);
+        if (calls == NULL)
+            return 0;
+    } // if
+
+    Free(ctx->trace_calls);
+    ctx->trace_calls = calls;
+    ctx->trace_size = max_calls;
+    ctx->trace_next = 0;
+    ctx->trace_count = 0;
+    ctx->trace_start = ticks_usecs();
+    return 1;
+#else
+    (void) max_calls;
+    set_error("MojoShader was built without MOJOSHADER_GL_TRACE");
+    return 0;
+#endif
+} // MOJOSHADER_glSetTrace
+
+
+void MOJOSHADER_glTraceFrame(void)
+{
+#ifdef MOJOSHADER_GL_TRACE
+    if (ctx->trace_calls != NULL)
+    {
+        const uint64 start = ticks_usecs();
+        trace_record(TRACE_FRAME, start, 0, 0, 0, 0, 0, 0, 0, 0);
+    } // if
+#endif
+} // MOJOSHADER_glTraceFrame
+
+
+unsigned int MOJOSHADER_glGetTrace(MOJOSHADER_glTraceCall *calls,
+                                   unsigned int max_calls)
+{
+#ifdef MOJOSHADER_GL_TRACE
+    uint32 count, pos, i;
+
+    if ((ctx->trace_calls == NULL) || (ctx->trace_size == 0))
+        return 0;  // tracing is off.
+    else if (calls == NULL)
+        return ctx->trace_count;
+
+    count = (max_calls < ctx->trace_count) ? max_calls : ctx->trace_count;
+    // the newest (count) calls, oldest first.
+    pos = (ctx->trace_next + ctx->trace_size - count) % ctx->trace_size;
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(&calls[i], &ctx->trace_calls[pos], sizeof (*calls));
+        pos = (pos + 1) % ctx->trace_size;
+    } // for
+
+    return count;
+#else
+    (void) calls;
+    (void) max_calls;
+    return 0;
+#endif
+} // MOJOSHADER_glGetTrace
+
+
+// The last value the analyzer saw for a piece of GL state.
+typedef struct TraceState
+{
+    uint64 slot;
+    uint64 key[2];
+    uint64 value;
+} TraceState;
+
+static uint32 hash_trace_state(const void *sym, void *data)
+{
+    (void) data;
+    const uint64 hash = hash64(HASH64_INIT, sym, sizeof (uint64) * 3);
+    return (uint32) (hash ^ (hash >> 32));
+} // hash_trace_state
+
+static int match_trace_state(const void *a, const void *b, void *data)
+{
+    (void) data;
+    return (memcmp(a, b, sizeof (uint64) * 3) == 0);
+} // match_trace_state
+
+static void nuke_trace_state(const void *key, const void *value, void *data)
+{
+    (void) key;
+    (void) value;
+    (void) data;  // they all live in one array.
+} // nuke_trace_state
+
+
+// Does (call) set GL state to what it already was? (program) and
+//  (vertex_array) track the current bindings, since glUniform*() applies to
+//  the program and attribute arrays live in the vertex array object.
+static int trace_redundant(HashTable *states, TraceState *pool,
+                           uint32 *pool_used, uint64 *program,
+                           uint64 *vertex_array,
+                           const MOJOSHADER_glTraceCall *call)
 {
+    const TraceStateType type = trace_functions[call->function].state;
+    const unsigned long long *args = call->args;
+    const void *val = NULL;
+    TraceState state;
+    int first_value = 0;  // first argument that's a value, not a key.
+    int enable = -1;
+    int redundant = 0;
+
+    memset(&state, '\0', sizeof (state));
     switch (type)
     {
-        case MOJOSHADER_ATTRIBUTE_UNKNOWN: return GL_NONE; // oh well.
-        case MOJOSHADER_ATTRIBUTE_BYTE: return GL_BYTE;
-        case MOJOSHADER_ATTRIBUTE_UBYTE: return GL_UNSIGNED_BYTE;
-        case MOJOSHADER_ATTRIBUTE_SHORT: return GL_SHORT;
-        case MOJOSHADER_ATTRIBUTE_USHORT: return GL_UNSIGNED_SHORT;
-        case MOJOSHADER_ATTRIBUTE_INT: return GL_INT;
-        case MOJOSHADER_ATTRIBUTE_UINT: return GL_UNSIGNED_INT;
-        case MOJOSHADER_ATTRIBUTE_FLOAT: return GL_FLOAT;
-        case MOJOSHADER_ATTRIBUTE_DOUBLE: return GL_DOUBLE;
+        case TRACESTATE_NONE:
+            return 0;
 
-        case MOJOSHADER_ATTRIBUTE_HALF_FLOAT:
-            if (ctx->have_GL_NV_half_float)
-                return GL_HALF_FLOAT_NV;
-            else if (ctx->have_GL_ARB_half_float_vertex)
-                return GL_HALF_FLOAT_ARB;
-            else if (ctx->have_GL_OES_vertex_half_float)
-                return GL_HALF_FLOAT_OES;
+        case TRACESTATE_ENABLE:
+        case TRACESTATE_DISABLE:
+            state.slot = TRACESTATE_ENABLE;
+            state.key[0] = args[0];
+            enable = (type == TRACESTATE_ENABLE);
+            break;
+
+        case TRACESTATE_ENABLE_ARRAY:
+        case TRACESTATE_DISABLE_ARRAY:
+            state.slot = TRACESTATE_ENABLE_ARRAY;
+            state.key[0] = args[0];
+            state.key[1] = *vertex_array;
+            enable = (type == TRACESTATE_ENABLE_ARRAY);
+            break;
+
+        case TRACESTATE_PROGRAM:
+            state.slot = TRACESTATE_PROGRAM;
+            *program = args[0];
+            break;
+
+        // glUniform and glProgramUniform on the same program are the same
+        //  state, so they share a slot.
+        case TRACESTATE_UNIFORM:
+            state.slot = TRACESTATE_UNIFORM;
+            state.key[0] = *program;
+            state.key[1] = args[0];
+            first_value = 1;
+            break;
+
+        case TRACESTATE_PROGRAM_UNIFORM:
+            state.slot = TRACESTATE_UNIFORM;
+            state.key[0] = args[0];
+            state.key[1] = args[1];
+            first_value = 2;
+            break;
+
+        case TRACESTATE_VERTEX_ARRAY:
+            state.slot = TRACESTATE_VERTEX_ARRAY;
+            *vertex_array = args[0];
+            break;
+
+        case TRACESTATE_ATTRIB_POINTER:
+        case TRACESTATE_ATTRIB_DIVISOR:
+            state.slot = type;
+            state.key[0] = args[0];
+            state.key[1] = *vertex_array;
+            first_value = 1;
+            break;
+
+        case TRACESTATE_GLOBAL:
+            state.slot = TRACESTATE_GLOBAL + call->function;
+            break;
+
+        case TRACESTATE_KEY1:
+            state.slot = TRACESTATE_GLOBAL + call->function;
+            state.key[0] = args[0];
+            first_value = 1;
+            break;
+
+        case TRACESTATE_KEY2:
+            state.slot = TRACESTATE_GLOBAL + call->function;
+            state.key[0] = args[0];
+            state.key[1] = args[1];
+            first_value = 2;
             break;
     } // switch
 
-    return GL_NONE;  // oh well. Raises a GL error later.
-} // opengl_attr_type
+    if (enable != -1)
+        state.value = (uint64) enable;
+    else
+    {
+        state.value = hash64(HASH64_INIT, &args[first_value],
+                    sizeof (uint64) * (MOJOSHADER_GLTRACE_MAX_ARGS - first_value));
+        state.value = hash64(state.value, &call->payload_hash,
+                             sizeof (call->payload_hash));
+    } // else
 
+    if (hash_find(states, &state, &val))
+    {
+        TraceState *prev = (TraceState *) val;
+        redundant = (prev->value == state.value);
+        prev->value = state.value;
+    } // if
+    else
+    {
+        TraceState *item = &pool[(*pool_used)++];
+        memcpy(item, &state, sizeof (TraceState));
+        if (hash_insert(states, item, item) != 1)
+            return -1;
+    } // else
 
-int MOJOSHADER_glGetVertexAttribLocation(MOJOSHADER_usage usage, int index)
+    return redundant;
+} // trace_redundant
+
+
+static int cmp_trace_function_report(const void *_a, const void *_b)
 {
-    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
-        return -1;
+    const MOJOSHADER_glTraceFunctionReport *a = (const MOJOSHADER_glTraceFunctionReport *) _a;
+    const MOJOSHADER_glTraceFunctionReport *b = (const MOJOSHADER_glTraceFunctionReport *) _b;
+    if (a->calls != b->calls)
+        return (a->calls > b->calls) ? -1 : 1;
+    return strcmp(a->name, b->name);
+} // cmp_trace_function_report
+
+
+int MOJOSHADER_glAnalyzeTrace(const MOJOSHADER_glTraceCall *calls,
+                              unsigned int count,
+                              MOJOSHADER_glTraceReport *report,
+                              MOJOSHADER_malloc m, MOJOSHADER_free f, void *d)
+{
+    MOJOSHADER_glTraceFunctionReport funcs[TRACE_TOTAL];
+    HashTable *states = NULL;
+    TraceState *pool = NULL;
+    uint32 pool_used = 0;
+    uint64 program = 0;
+    uint64 vertex_array = 0;
+    int in_frame = 0;
+    uint32 frame_calls = 0;
+    uint32 frame_redundant = 0;
+    uint64 framed_calls = 0;
+    uint64 framed_redundant = 0;
+    int retval = 0;
+    uint32 i;
 
-    return ctx->bound_program->vertex_attrib_loc[usage][index];
-} // MOJOSHADER_glGetVertexAttribLocation
+    assert(TRACE_TOTAL <= MOJOSHADER_GLTRACE_MAX_FUNCTIONS);
+
+    if (m == NULL) m = MOJOSHADER_internal_malloc;
+    if (f == NULL) f = MOJOSHADER_internal_free;
+
+    memset(report, '\0', sizeof (MOJOSHADER_glTraceReport));
+    memset(funcs, '\0', sizeof (funcs));
+    for (i = 0; i < TRACE_TOTAL; i++)
+        funcs[i].name = trace_functions[i].name;
+
+    states = hash_create(NULL, hash_trace_state, match_trace_state,
+                         nuke_trace_state, 0, m, f, d);
+    if (states == NULL)
+        goto analyze_done;
+
+    // At most one new piece of state per call.
+    if (count > 0)
+    {
+        pool = (TraceState *) m((int) (sizeof (TraceState) * count), d);
+        if (pool == NULL)
+            goto analyze_done;
+    } // if
+
+    for (i = 0; i < count; i++)
+    {
+        const MOJOSHADER_glTraceCall *call = &calls[i];
+        int redundant;
+
+        if (call->function == TRACE_FRAME)
+        {
+            // only count frames we saw from start to end.
+            if (in_frame)
+            {
+                report->frames++;
+                framed_calls += frame_calls;
+                framed_redundant += frame_redundant;
+                if (frame_calls > report->max_frame_calls)
+                    report->max_frame_calls = frame_calls;
+            } // if
+            in_frame = 1;
+            frame_calls = frame_redundant = 0;
+            continue;
+        } // if
+
+        else if (call->function >= TRACE_TOTAL)
+            continue;  // not something we know about.
+
+        redundant = trace_redundant(states, pool, &pool_used, &program,
+                                    &vertex_array, call);
+        if (redundant < 0)
+            goto analyze_done;  // out of memory.
+
+        funcs[call->function].calls++;
+        funcs[call->function].redundant += redundant;
+        funcs[call->function].usecs += call->duration_usecs;
+        report->calls++;
+        report->redundant += redundant;
+        frame_calls++;
+        frame_redundant += redundant;
+    } // for
+
+    if (report->calls > 0)
+        report->redundant_percent = (report->redundant * 100.0) / report->calls;
+    if (report->frames > 0)
+    {
+        report->calls_per_frame = ((double) framed_calls) / report->frames;
+        report->redundant_per_frame = ((double) framed_redundant) / report->frames;
+    } // if
+
+    // Report the functions that were called, busiest first.
+    qsort(funcs + 1, TRACE_TOTAL - 1, sizeof (funcs[0]),
+          cmp_trace_function_report);
+    for (i = 1; (i < TRACE_TOTAL) && (funcs[i].calls > 0); i++)
+    {
+        MOJOSHADER_glTraceFunctionReport *func = &funcs[i];
+        func->redundant_percent = (func->redundant * 100.0) / func->calls;
+        memcpy(&report->functions[report->function_count++], func,
+               sizeof (*func));
+    } // for
+
+    retval = 1;
+
+analyze_done:
+    if (pool != NULL)
+        f(pool, d);
+    if (states != NULL)
+        hash_destroy(states);
+    return retval;
+} // MOJOSHADER_glAnalyzeTrace
+
+
+#ifdef MOJOSHADER_FLIP_RENDERTARGET
+
+
+void MOJOSHADER_glProgramViewportFlip(int flip)
+{
+    assert(ctx->bound_program->vs_flip_loc != -1);
+
+    if (ctx->use_pipelines)
+        claim_pipeline_stages(ctx->bound_program);
+
+    /* Some compilers require that vpFlip be a float value, rather than int.
+     * However, there's no real reason for it to be a float in the API, so we
+     * do a cast in here. That's not so bad, right...?
+     * -flibit
+     */
+    if (flip != ctx->bound_program->current_flip)
+    {
+        if (ctx->use_pipelines)
+        {
+            ctx->glProgramUniform1f(ctx->bound_program->vertex->program,
+                                    ctx->bound_program->vs_flip_loc,
+                                    (float) flip);
+        } // if
+        else if (ctx->program_dsa)
+        {
+            ctx->glProgramUniform1f(ctx->bound_program->handle,
+                                    ctx->bound_program->vs_flip_loc,
+                                    (float) flip);
+        } // else if
+        else
+            ctx->glUniform1f(ctx->bound_program->vs_flip_loc, (float) flip);
+        ctx->bound_program->current_flip = flip;
+    } // if
+}
+
+
+#endif
+
+
+#ifdef MOJOSHADER_EFFECT_SUPPORT
+
+
+/* Everything BeginPass needs to know about a pass, resolved at compile time.
+ * NULL shaders mean the pass leaves that stage alone. If a raw shader is a
+ * preshader, the real shader is selected later, in CommitChanges.
+ */
+typedef struct EffectPassBinding
+{
+    MOJOSHADER_glShader *vert;
+    MOJOSHADER_glShader *frag;
+    MOJOSHADER_effectShader *vert_raw;
+    MOJOSHADER_effectShader *frag_raw;
+    int has_preshader;
+    // Linked lazily for passes that always bind the same two shaders. If
+    //  that link fails, we don't try again.
+    MOJOSHADER_glProgram *program;
+    int link_failed;
+    // Interned ID of this pass's render states, see intern_state_block().
+    uint32 render_block;
+} EffectPassBinding;
+
+/* A shader's parameter copies, flattened at compile time. Each op copies
+ * or converts one or more symbols whose source values and destination
+ * registers are both contiguous, so CommitChanges doesn't have to work out
+ * the type of every symbol every time.
+ */
+typedef enum CopyKind
+{
+    COPY_FLOAT4,         // memcpy into the float registers
+    COPY_INT4,           // memcpy into the int registers
+    CONVERT_INT_FLOAT4,  // int/bool parameters in float registers
+    CONVERT_INT_BOOL     // int/bool parameters in bool registers
+} CopyKind;
+
+typedef struct CopyOp
+{
+    CopyKind kind;
+    uint32 param;         // parameter of the first symbol, our source
+    uint32 first_symbol;  // symbols covered, for version tracking
+    uint32 symbol_count;
+    uint32 dst;           // element offset into the register file
+    uint32 count;         // elements, or registers for CONVERT_INT_BOOL
+    uint32 columns;       // elements used per source row for conversions
+} CopyOp;
+
+typedef struct CopyPlan
+{
+    uint32 op_count;
+    CopyOp *ops;
+} CopyPlan;
+
+// A vertex/pixel pairing that some pass can bind, for MOJOSHADER_glEffectPrewarm.
+typedef struct EffectPrewarm
+{
+    MOJOSHADER_glShader *vert;
+    MOJOSHADER_glShader *frag;
+    EffectPassBinding *binding;  // static pass that holds the program, or NULL.
+} EffectPrewarm;
+
+struct MOJOSHADER_glEffect
+{
+    MOJOSHADER_effect *effect;
+    unsigned int num_shaders;
+    MOJOSHADER_glShader **shaders;
+    unsigned int *shader_indices;
+    unsigned int num_preshaders;
+    unsigned int *preshader_indices;
+    MOJOSHADER_glShader *current_vert;
+    MOJOSHADER_glShader *current_frag;
+    MOJOSHADER_effectShader *current_vert_raw;
+    MOJOSHADER_effectShader *current_frag_raw;
+    MOJOSHADER_glProgram *prev_program;
+
+    /* The pass table, indexed by technique_pass_offsets[technique] + pass.
+     */
+    unsigned int *technique_pass_offsets;
+    EffectPassBinding *pass_bindings;
+
+    /* Interned ID of each shader object's sampler states, indexed by object,
+     * and the IDs of the state changes we most recently handed out.
+     */
+    uint32 *sampler_blocks;
+    uint32 current_render_block;
+    uint32 current_sampler_block;
+    uint32 current_vertex_sampler_block;
+
+    /* Parameter versions as of the last copy into the register files,
+     * indexed by param_version_offsets[object index] + symbol index. The
+     * preshader's symbols, if any, follow the shader's symbols.
+     */
+    unsigned int *param_version_offsets;
+    unsigned int *param_versions;
+
+    /* Copy plans, two per object: [index * 2] copies the shader's symbols to
+     * the register files, [index * 2 + 1] copies its preshader's symbols to
+     * the preshader registers. copy_ops is the backing store for all of them.
+     */
+    CopyPlan *copy_plans;
+    CopyOp *copy_ops;
+
+    /* The shaders we last copied into each register file, and the register
+     * file stamp afterward. If either changes, we have to copy everything.
+     */
+    MOJOSHADER_effectShader *copied_vert_raw;
+    MOJOSHADER_effectShader *copied_frag_raw;
+    uint32 copied_vert_stamp;
+    uint32 copied_frag_stamp;
+
+    /* The parameter block we read values from, or NULL for the effect's own
+     * parameters, and the serials of the blocks we last copied from.
+     */
+    MOJOSHADER_effectParamBlock *param_block;
+    unsigned int copied_vert_block;
+    unsigned int copied_frag_block;
+
+    /* Every pairing the effect's passes can bind, built on the first
+     * MOJOSHADER_glEffectPrewarm() call, and how far we've gotten through it.
+     */
+    int prewarm_built;
+    EffectPrewarm *prewarm;
+    unsigned int prewarm_count;
+    unsigned int prewarm_next;
+    unsigned int prewarm_failed;
+    uint64 prewarm_usecs;
+};
 
 
-// !!! FIXME: shouldn't (index) be unsigned?
-void MOJOSHADER_glSetVertexAttribute(MOJOSHADER_usage usage,
-                                     int index, unsigned int size,
-                                     MOJOSHADER_attributeType type,
-                                     int normalized, unsigned int stride,
-                                     const void *ptr)
+static inline int raw_shader_index(const MOJOSHADER_glEffect *glEffect,
+                                   const MOJOSHADER_effectShader *raw)
 {
-    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
-        return;
+    return (const MOJOSHADER_effectObject *) raw - glEffect->effect->objects;
+} // raw_shader_index
 
-    const GLenum gl_type = opengl_attr_type(type);
-    const GLboolean norm = (normalized) ? GL_TRUE : GL_FALSE;
-    const GLint gl_index = ctx->bound_program->vertex_attrib_loc[usage][index];
 
-    if (gl_index == -1)
-        return; // Nothing to do, this shader doesn't use this stream.
+/* State blocks are flattened to sorted (register, type, value) triples so
+ * that identical blocks from any pass of any effect intern to the same ID.
+ */
+typedef struct StateBlock
+{
+    uint32 id;
+    uint32 word_count;
+    uint32 words[1];  // actually word_count elements.
+} StateBlock;
 
-    // this happens to work in both ARB1 and GLSL, but if something alien
-    //  shows up, we'll have to split these into profile*() functions.
-    ctx->glVertexAttribPointer(gl_index, size, gl_type, norm, stride, ptr);
+static uint32 hash_state_block(const void *sym, void *data)
+{
+    (void) data;
+    const StateBlock *block = (const StateBlock *) sym;
+    uint32 hash = 5381;
+    uint32 i;
+    for (i = 0; i < block->word_count; i++)
+        hash = ((hash << 5) + hash) ^ block->words[i];
+    return hash;
+} // hash_state_block
 
-    // flag this array as in use, so we can enable it later.
-    ctx->want_attr[gl_index] = 1;
-    if (ctx->max_attrs < (gl_index + 1))
-        ctx->max_attrs = gl_index + 1;
-} // MOJOSHADER_glSetVertexAttribute
+static int match_state_block(const void *_a, const void *_b, void *data)
+{
+    (void) data;
+    const StateBlock *a = (const StateBlock *) _a;
+    const StateBlock *b = (const StateBlock *) _b;
+    return ((a->word_count == b->word_count) &&
+            (memcmp(a->words, b->words, a->word_count * sizeof (uint32)) == 0));
+} // match_state_block
 
+static void nuke_state_block(const void *key, const void *value, void *data)
+{
+    (void) data;
+    (void) value;
+    Free((void *) key);
+} // nuke_state_block
 
-// !!! FIXME: shouldn't (index) be unsigned?
-void MOJOSHADER_glSetVertexAttribDivisor(MOJOSHADER_usage usage,
-                                         int index, unsigned int divisor)
+static int cmp_state_triple(const void *_a, const void *_b)
 {
-    assert(ctx->have_GL_ARB_instanced_arrays);
+    const uint32 *a = (const uint32 *) _a;
+    const uint32 *b = (const uint32 *) _b;
+    if (a[0] != b[0])
+        return (a[0] < b[0]) ? -1 : 1;
+    if (a[1] != b[1])
+        return (a[1] < b[1]) ? -1 : 1;
+    return 0;
+} // cmp_state_triple
+
+// Sorts (block)'s triples, then returns the ID of the matching interned
+//  block, interning a copy if this is new. Returns 0 on error.
+static uint32 intern_state_block(StateBlock *block)
+{
+    const void *val = NULL;
 
-    if ((ctx->bound_program == NULL) || (ctx->bound_program->vertex == NULL))
-        return;
+    if (ctx->state_blocks == NULL)
+    {
+        ctx->state_blocks = hash_create(NULL, hash_state_block,
+                                        match_state_block, nuke_state_block,
+                                        0, ctx->malloc_fn, ctx->free_fn,
+                                        ctx->malloc_data);
+        if (ctx->state_blocks == NULL)
+        {
+            out_of_memory();
+            return 0;
+        } // if
+    } // if
 
-    const GLint gl_index = ctx->bound_program->vertex_attrib_loc[usage][index];
+    qsort(block->words, block->word_count / 3, sizeof (uint32) * 3,
+          cmp_state_triple);
 
-    if (gl_index == -1)
-        return; // Nothing to do, this shader doesn't use this stream.
+    if (hash_find(ctx->state_blocks, block, &val))
+        return ((const StateBlock *) val)->id;
 
-    if (divisor != ctx->attr_divisor[gl_index])
+    const size_t len = sizeof (StateBlock) + (block->word_count * sizeof (uint32));
+    StateBlock *item = (StateBlock *) Malloc(len);
+    if (item == NULL)
+        return 0;
+    memcpy(item, block, len);
+    item->id = ++ctx->state_block_count;
+    if (hash_insert(ctx->state_blocks, item, item) != 1)
     {
-        ctx->glVertexAttribDivisorARB(gl_index, divisor);
-        ctx->attr_divisor[gl_index] = divisor;
+        Free(item);
+        out_of_memory();
+        return 0;
     } // if
-} // MOJOSHADER_glSetVertexAttribDivisor
 
+    return item->id;
+} // intern_state_block
 
-void MOJOSHADER_glSetLegacyBumpMapEnv(unsigned int sampler, float mat00,
-                                      float mat01, float mat10, float mat11,
-                                      float lscale, float loffset)
+static uint32 intern_render_states(const MOJOSHADER_effectPass *pass)
 {
-    if ((sampler == 0) || (sampler > (MAX_TEXBEMS+1)))
-        return;
+    uint32 retval;
+    int i;
+    StateBlock *block = (StateBlock *) Malloc(sizeof (StateBlock) +
+                        (pass->state_count * 3 * sizeof (uint32)));
+    if (block == NULL)
+        return 0;
 
-    GLfloat *dstf = ctx->texbem_state + (6 * (sampler-1));
-    *(dstf++) = (GLfloat) mat00;
-    *(dstf++) = (GLfloat) mat01;
-    *(dstf++) = (GLfloat) mat10;
-    *(dstf++) = (GLfloat) mat11;
-    *(dstf++) = (GLfloat) lscale;
-    *(dstf++) = (GLfloat) loffset;
-    ctx->generation++;
-} // MOJOSHADER_glSetLegacyBumpMapEnv
+    block->word_count = 0;
+    for (i = 0; i < pass->state_count; i++)
+    {
+        const MOJOSHADER_effectState *state = &pass->states[i];
+        if (state->type == MOJOSHADER_RS_VERTEXSHADER
+         || state->type == MOJOSHADER_RS_PIXELSHADER)
+            continue;
+        block->words[block->word_count++] = 0;
+        block->words[block->word_count++] = (uint32) state->type;
+        block->words[block->word_count++] = (uint32) state->value.valuesI[0];
+    } // for
 
+    retval = intern_state_block(block);
+    Free(block);
+    return retval;
+} // intern_render_states
 
-void MOJOSHADER_glProgramReady(void)
+static uint32 intern_sampler_states(const MOJOSHADER_effectShader *raw)
 {
-    MOJOSHADER_glProgram *program = ctx->bound_program;
+    uint32 retval;
+    uint32 count = 0;
+    int i, j;
 
-    if (program == NULL)
-        return;  // nothing to do.
+    for (i = 0; i < raw->sampler_count; i++)
+        count += raw->samplers[i].sampler_state_count;
 
-    // Toggle vertex attribute arrays on/off, based on our needs.
-    update_enabled_arrays();
+    StateBlock *block = (StateBlock *) Malloc(sizeof (StateBlock) +
+                                              (count * 3 * sizeof (uint32)));
+    if (block == NULL)
+        return 0;
 
-    if (program->uses_pointsize != ctx->pointsize_enabled)
+    block->word_count = 0;
+    for (i = 0; i < raw->sampler_count; i++)
     {
-        if (program->uses_pointsize)
-            ctx->glEnable(GL_PROGRAM_POINT_SIZE);
-        else
-            ctx->glDisable(GL_PROGRAM_POINT_SIZE);
-        ctx->pointsize_enabled = program->uses_pointsize;
-    } // if
+        const MOJOSHADER_samplerStateRegister *reg = &raw->samplers[i];
+        for (j = 0; j < reg->sampler_state_count; j++)
+        {
+            const MOJOSHADER_effectSamplerState *state = &reg->sampler_states[j];
+            // Textures are always reported, so they don't identify a block.
+            if (state->type == MOJOSHADER_SAMP_TEXTURE)
+                continue;
+            block->words[block->word_count++] = reg->sampler_register;
+            block->words[block->word_count++] = (uint32) state->type;
+            block->words[block->word_count++] = (uint32) state->value.valuesI[0];
+        } // for
+    } // for
 
-    // push Uniforms to the program from our register files...
-    if ( ((program->uniform_count) || (program->texbem_count)) &&
-         (program->generation != ctx->generation))
-    {
-        // vertex shader uniforms come first in program->uniforms array.
-        const uint32 count = program->uniform_count;
-        const GLfloat *srcf = ctx->vs_reg_file_f;
-        const GLint *srci = ctx->vs_reg_file_i;
-        const uint8 *srcb = ctx->vs_reg_file_b;
-        MOJOSHADER_shaderType shader_type = MOJOSHADER_TYPE_VERTEX;
-        GLfloat *dstf = program->vs_uniforms_float4;
-        GLint *dsti = program->vs_uniforms_int4;
-        GLint *dstb = program->vs_uniforms_bool;
-        uint8 uniforms_changed = 0;
-        uint32 i;
+    retval = intern_state_block(block);
+    Free(block);
+    return retval;
+} // intern_sampler_states
 
-        for (i = 0; i < count; i++)
+static int build_pass_bindings(MOJOSHADER_glEffect *glEffect)
+{
+    MOJOSHADER_effect *effect = glEffect->effect;
+    MOJOSHADER_malloc m = effect->malloc;
+    void *d = effect->malloc_data;
+    unsigned int num_passes = 0;
+    int i, j, k, l;
+
+    glEffect->technique_pass_offsets = (unsigned int *) m(effect->technique_count * sizeof (unsigned int), d);
+    if (glEffect->technique_pass_offsets == NULL)
+        return 0;
+    for (i = 0; i < effect->technique_count; i++)
+    {
+        glEffect->technique_pass_offsets[i] = num_passes;
+        num_passes += effect->techniques[i].pass_count;
+    } // for
+
+    glEffect->sampler_blocks = (uint32 *) m(effect->object_count * sizeof (uint32), d);
+    if (glEffect->sampler_blocks == NULL)
+        return 0;
+    memset(glEffect->sampler_blocks, '\0', effect->object_count * sizeof (uint32));
+    for (i = 0; i < effect->object_count; i++)
+    {
+        const MOJOSHADER_effectObject *object = &effect->objects[i];
+        if (object->type == MOJOSHADER_SYMTYPE_PIXELSHADER
+         || object->type == MOJOSHADER_SYMTYPE_VERTEXSHADER)
         {
-            UniformMap *map = &program->uniforms[i];
-            const MOJOSHADER_shaderType uniform_shader_type = map->shader_type;
-            const MOJOSHADER_uniform *u = map->uniform;
-            const MOJOSHADER_uniformType type = u->type;
-            const int index = u->index;
-            const int size = u->array_count ? u->array_count : 1;
+            glEffect->sampler_blocks[i] = intern_sampler_states(&object->shader);
+            if (glEffect->sampler_blocks[i] == 0)
+                return 0;
+        } // if
+    } // for
 
-            assert(!u->constant);
+    if (num_passes == 0)
+        return 1;
+
+    glEffect->pass_bindings = (EffectPassBinding *) m(num_passes * sizeof (EffectPassBinding), d);
+    if (glEffect->pass_bindings == NULL)
+        return 0;
+    memset(glEffect->pass_bindings, '\0', num_passes * sizeof (EffectPassBinding));
 
-            // Did we switch from vertex to pixel (to geometry, etc)?
-            if (shader_type != uniform_shader_type)
+    for (i = 0; i < effect->technique_count; i++)
+    {
+        const MOJOSHADER_effectTechnique *technique = &effect->techniques[i];
+        for (j = 0; j < technique->pass_count; j++)
+        {
+            const MOJOSHADER_effectPass *pass = &technique->passes[j];
+            EffectPassBinding *binding = &glEffect->pass_bindings[glEffect->technique_pass_offsets[i] + j];
+            binding->render_block = intern_render_states(pass);
+            if (binding->render_block == 0)
+                return 0;
+            for (k = 0; k < pass->state_count; k++)
             {
-                // we start with vertex, move to pixel, then to geometry, etc.
-                //  The array should always be sorted as such.
-                if (uniform_shader_type == MOJOSHADER_TYPE_PIXEL)
+                const MOJOSHADER_effectState *state = &pass->states[k];
+                MOJOSHADER_glShader **gls;
+                MOJOSHADER_effectShader **raw;
+                if (state->type == MOJOSHADER_RS_VERTEXSHADER)
                 {
-                    assert(shader_type == MOJOSHADER_TYPE_VERTEX);
-                    srcf = ctx->ps_reg_file_f;
-                    srci = ctx->ps_reg_file_i;
-                    srcb = ctx->ps_reg_file_b;
-                    dstf = program->ps_uniforms_float4;
-                    dsti = program->ps_uniforms_int4;
-                    dstb = program->ps_uniforms_bool;
+                    gls = &binding->vert;
+                    raw = &binding->vert_raw;
                 } // if
-                else
+                else if (state->type == MOJOSHADER_RS_PIXELSHADER)
                 {
-                    // Should be ordered vertex, then pixel, then geometry.
-                    assert(0 && "Unexpected shader type");
-                } // else
-
-                shader_type = uniform_shader_type;
-            } // if
+                    gls = &binding->frag;
+                    raw = &binding->frag_raw;
+                } // else if
+                else
+                    continue;
 
-            if (type == MOJOSHADER_UNIFORM_FLOAT)
-            {
-                const size_t count = 4 * size;
-                const GLfloat *f = &srcf[index * 4];
-                if (memcmp(dstf, f, sizeof (GLfloat) * count) != 0)
-                {
-                    memcpy(dstf, f, sizeof (GLfloat) * count);
-                    uniforms_changed = 1;
-                }
-                dstf += count;
-            } // if
-            else if (type == MOJOSHADER_UNIFORM_INT)
-            {
-                const size_t count = 4 * size;
-                const GLint *i = &srci[index * 4];
-                if (memcmp(dsti, i, sizeof (GLint) * count) != 0)
+                for (l = 0; l < glEffect->num_shaders; l++)
                 {
-                    memcpy(dsti, i, sizeof (GLint) * count);
-                    uniforms_changed = 1;
-                } // if
-                dsti += count;
-            } // else if
-            else if (type == MOJOSHADER_UNIFORM_BOOL)
-            {
-                const size_t count = size;
-                const uint8 *b = &srcb[index];
-                size_t i;
-                for (i = 0; i < count; i++)
-                    if (dstb[i] != b[i])
+                    if (*state->value.valuesI == glEffect->shader_indices[l])
                     {
-                        dstb[i] = (GLint) b[i];
-                        uniforms_changed = 1;
+                        *raw = &effect->objects[*state->value.valuesI].shader;
+                        *gls = glEffect->shaders[l];
+                        break;
                     } // if
-                dstb += count;
-            } // else if
-
-            // !!! FIXME: set constants that overlap the array.
-        } // for
-
-        assert((!program->texbem_count) || (program->fragment));
-        if ((program->texbem_count) && (program->fragment))
-        {
-            const MOJOSHADER_parseData *pd = program->fragment->parseData;
-            const int samp_count = pd->sampler_count;
-            const MOJOSHADER_sampler *samps = pd->samplers;
-            GLfloat *dstf = program->ps_uniforms_float4;
-            int texbem_count = 0;
-
-            dstf += (program->ps_uniforms_float4_count * 4) -
-                     (program->texbem_count * 8);
-
-            assert(program->texbem_count <= MAX_TEXBEMS);
-            for (i = 0; i < samp_count; i++)
-            {
-                if (samps[i].texbem)
+                } // for
+                for (l = 0; l < glEffect->num_preshaders; l++)
                 {
-                    assert(samps[i].index > 0);
-                    assert(samps[i].index <= MAX_TEXBEMS);
-                    memcpy(dstf, &ctx->texbem_state[6 * (samps[i].index-1)],
-                           sizeof (GLfloat) * 6);
-                    dstf[6] = 0.0f;
-                    dstf[7] = 0.0f;
-                    dstf += 8;
-                    texbem_count++;
-                } // if
+                    if (*state->value.valuesI == glEffect->preshader_indices[l])
+                    {
+                        *raw = &effect->objects[*state->value.valuesI].shader;
+                        binding->has_preshader = 1;
+                        break;
+                    } // if
+                } // for
             } // for
+        } // for
+    } // for
 
-            assert(texbem_count == program->texbem_count);
-        } // if
-
-        program->generation = ctx->generation;
-
-        if (uniforms_changed)
-            ctx->profilePushUniforms();
-    } // if
-} // MOJOSHADER_glProgramReady
+    return 1;
+} // build_pass_bindings
 
 
-void MOJOSHADER_glDeleteProgram(MOJOSHADER_glProgram *program)
+static void build_copy_plan(const MOJOSHADER_effect *effect,
+                            const unsigned int *param_loc,
+                            const MOJOSHADER_symbol *symbols,
+                            const unsigned int symbol_count,
+                            CopyPlan *plan)
 {
-    program_unref(program);
-} // MOJOSHADER_glDeleteProgram
+    int i;
+    for (i = 0; i < symbol_count; i++)
+    {
+        const MOJOSHADER_symbol *sym = &symbols[i];
+        const MOJOSHADER_effectValue *param = &effect->params[param_loc[i]].value;
+        CopyOp op;
 
+        op.param = param_loc[i];
+        op.first_symbol = i;
+        op.symbol_count = 1;
+        op.columns = (param->type.columns > 0) ? param->type.columns : 1;
+        // float/int registers are vec4, so they have 4 elements each
+        op.dst = sym->register_index << 2;
+        op.count = sym->register_count << 2;
 
-void MOJOSHADER_glDeleteShader(MOJOSHADER_glShader *shader)
-{
-    // See if this was bound as an unlinked program anywhere...
-    if (ctx->linker_cache)
-    {
-        const void *key = NULL;
-        void *iter = NULL;
-        int morekeys = hash_iter_keys(ctx->linker_cache, &key, &iter);
-        while (morekeys)
+        if (sym->register_set == MOJOSHADER_SYMREGSET_SAMPLER)
+            continue;
+        else if (param->type.parameter_type == MOJOSHADER_SYMTYPE_FLOAT)
+            op.kind = COPY_FLOAT4;
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_FLOAT4)
         {
-            const BoundShaders *shaders = (const BoundShaders *) key;
-            // Do this here so we don't confuse the iteration by removing...
-            morekeys = hash_iter_keys(ctx->linker_cache, &key, &iter);
-            if ((shaders->vertex == shader) || (shaders->fragment == shader))
+            // Structs are a whole different world...
+            if (param->type.parameter_class == MOJOSHADER_SYMCLASS_STRUCT)
+                op.kind = COPY_FLOAT4;
+            else
+                op.kind = CONVERT_INT_FLOAT4;
+        } // else if
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_INT4)
+            op.kind = COPY_INT4;
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_BOOL)
+        {
+            // regb is not a vec4, so these are in registers, not elements.
+            op.kind = CONVERT_INT_BOOL;
+            op.dst = sym->register_index;
+            op.count = sym->register_count;
+        } // else if
+        else
+            continue;
+
+        /* Merge with the previous op if both ends are contiguous. Sources are
+         * only contiguous if the values live in the effect's param_storage.
+         */
+        if (plan->op_count > 0 && effect->param_storage != NULL)
+        {
+            CopyOp *prev = &plan->ops[plan->op_count - 1];
+            const char *prevsrc = (const char *) effect->params[prev->param].value.values;
+            const char *src = (const char *) param->values;
+            if (prev->kind == op.kind
+             && op.kind != CONVERT_INT_BOOL
+             && (op.kind != CONVERT_INT_FLOAT4 || (prev->columns == 4 && op.columns == 4))
+             && prev->first_symbol + prev->symbol_count == i
+             && prev->dst + prev->count == op.dst
+             && prevsrc + (prev->count * 4) == src)
             {
-                // Deletes the linked program, which will unref the shader.
-                hash_remove(ctx->linker_cache, shaders);
+                prev->symbol_count++;
+                prev->count += op.count;
+                continue;
             } // if
-        } // while
-    } // if
-
-    shader_unref(shader);
-} // MOJOSHADER_glDeleteShader
+        } // if
 
+        plan->ops[plan->op_count++] = op;
+    } // for
+} // build_copy_plan
 
-void MOJOSHADER_glDestroyContext(MOJOSHADER_glContext *_ctx)
+static int build_copy_plans(MOJOSHADER_glEffect *glEffect,
+                            const unsigned int num_ops)
 {
-    MOJOSHADER_glContext *current_ctx = ctx;
-    ctx = _ctx;
-    MOJOSHADER_glBindProgram(NULL);
-    if (ctx->linker_cache)
-        hash_destroy(ctx->linker_cache);
-    lookup_entry_points(NULL, NULL);   // !!! FIXME: is there a value to this?
-    Free(ctx);
-    ctx = ((current_ctx == _ctx) ? NULL : current_ctx);
-} // MOJOSHADER_glDestroyContext
-
+    MOJOSHADER_effect *effect = glEffect->effect;
+    MOJOSHADER_malloc m = effect->malloc;
+    void *d = effect->malloc_data;
+    CopyOp *ops;
+    int i;
 
-#ifdef MOJOSHADER_FLIP_RENDERTARGET
+    glEffect->copy_plans = (CopyPlan *) m(effect->object_count * 2 * sizeof (CopyPlan), d);
+    if (glEffect->copy_plans == NULL)
+        return 0;
+    memset(glEffect->copy_plans, '\0', effect->object_count * 2 * sizeof (CopyPlan));
 
+    if (num_ops == 0)
+        return 1;
 
-void MOJOSHADER_glProgramViewportFlip(int flip)
-{
-    assert(ctx->bound_program->vs_flip_loc != -1);
+    // One op per symbol is the worst case, merging only makes it smaller.
+    glEffect->copy_ops = (CopyOp *) m(num_ops * sizeof (CopyOp), d);
+    if (glEffect->copy_ops == NULL)
+        return 0;
 
-    /* Some compilers require that vpFlip be a float value, rather than int.
-     * However, there's no real reason for it to be a float in the API, so we
-     * do a cast in here. That's not so bad, right...?
-     * -flibit
-     */
-    if (flip != ctx->bound_program->current_flip)
+    ops = glEffect->copy_ops;
+    for (i = 0; i < effect->object_count; i++)
     {
-        ctx->glUniform1f(ctx->bound_program->vs_flip_loc, (float) flip);
-        ctx->bound_program->current_flip = flip;
-    } // if
-}
+        const MOJOSHADER_effectObject *object = &effect->objects[i];
+        const MOJOSHADER_effectShader *raw = &object->shader;
+        CopyPlan *plan = &glEffect->copy_plans[i * 2];
+        if ((object->type != MOJOSHADER_SYMTYPE_PIXELSHADER
+          && object->type != MOJOSHADER_SYMTYPE_VERTEXSHADER)
+         || raw->is_preshader)
+            continue;
 
+        plan[0].ops = ops;
+        build_copy_plan(effect, raw->params, raw->shader->symbols,
+                        raw->shader->symbol_count, &plan[0]);
+        ops += plan[0].op_count;
 
-#endif
+        if (raw->shader->preshader)
+        {
+            plan[1].ops = ops;
+            build_copy_plan(effect, raw->preshader_params,
+                            raw->shader->preshader->symbols,
+                            raw->shader->preshader->symbol_count, &plan[1]);
+            ops += plan[1].op_count;
+        } // if
+    } // for
 
+    return 1;
+} // build_copy_plans
 
-#ifdef MOJOSHADER_EFFECT_SUPPORT
 
+// Is (shader) already in the first (count) of (glEffect)'s shaders?
+static int effect_has_shader(const MOJOSHADER_glEffect *glEffect,
+                             const unsigned int count,
+                             const MOJOSHADER_glShader *shader)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        if (glEffect->shaders[i] == shader)
+            return 1;
+    } // for
+    return 0;
+} // effect_has_shader
 
-struct MOJOSHADER_glEffect
+/* Drop our reference to each distinct shader. A shader that still has
+ * other owners gets its own copy of the parse data we lent it, since that
+ * goes away with the effect.
+ */
+static void release_effect_shaders(MOJOSHADER_glEffect *glEffect)
 {
-    MOJOSHADER_effect *effect;
-    unsigned int num_shaders;
-    MOJOSHADER_glShader *shaders;
-    unsigned int *shader_indices;
-    unsigned int num_preshaders;
-    unsigned int *preshader_indices;
-    MOJOSHADER_glShader *current_vert;
-    MOJOSHADER_glShader *current_frag;
-    MOJOSHADER_effectShader *current_vert_raw;
-    MOJOSHADER_effectShader *current_frag_raw;
-    MOJOSHADER_glProgram *prev_program;
-};
+    unsigned int i;
+    for (i = 0; i < glEffect->num_shaders; i++)
+    {
+        MOJOSHADER_glShader *shader = glEffect->shaders[i];
+        if ((shader == NULL) || (effect_has_shader(glEffect, i, shader)))
+            continue;  // never compiled, or already released.
+
+        if ((shader->parse_owner == glEffect) && (shader->owners > 1))
+        {
+            const MOJOSHADER_parseData *pd = shader->parseData;
+            pd = copyparsedata(pd, pd->malloc, pd->malloc_data);
+            spinlock_lock(&ctx->intern_lock);  // the key is in our table.
+            shader->parseData = pd;
+            shader->keys[SHADERINTERN_OUTPUT].pd = pd;
+            shader->parse_owner = NULL;
+            spinlock_unlock(&ctx->intern_lock);
+        } // if
+
+        MOJOSHADER_glDeleteShader(shader);
+    } // for
+} // release_effect_shaders
 
 
 MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effect)
@@ -2630,7 +7448,9 @@ MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effect)
     void *d = effect->malloc_data;
     int current_shader = 0;
     int current_preshader = 0;
-    GLuint shader = 0;
+    unsigned int num_versions = 0;
+    const MOJOSHADER_parseData *pd = NULL;
+    MOJOSHADER_glShader *gls = NULL;
 
     MOJOSHADER_glEffect *retval = (MOJOSHADER_glEffect *) m(sizeof (MOJOSHADER_glEffect), d);
     if (retval == NULL)
@@ -2655,14 +7475,14 @@ MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effect)
     } // for
 
     // Alloc shader information
-    retval->shaders = (MOJOSHADER_glShader *) m(retval->num_shaders * sizeof (MOJOSHADER_glShader), d);
+    retval->shaders = (MOJOSHADER_glShader **) m(retval->num_shaders * sizeof (MOJOSHADER_glShader *), d);
     if (retval->shaders == NULL)
     {
         f(retval, d);
         out_of_memory();
         return NULL;
     } // if
-    memset(retval->shaders, '\0', retval->num_shaders * sizeof (MOJOSHADER_glShader));
+    memset(retval->shaders, '\0', retval->num_shaders * sizeof (MOJOSHADER_glShader *));
     retval->shader_indices = (unsigned int *) m(retval->num_shaders * sizeof (unsigned int), d);
     if (retval->shader_indices == NULL)
     {
@@ -2688,6 +7508,46 @@ MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effect)
         memset(retval->preshader_indices, '\0', retval->num_preshaders * sizeof (unsigned int));
     } // if
 
+    // Alloc parameter version tracking
+    retval->param_version_offsets = (unsigned int *) m(effect->object_count * sizeof (unsigned int), d);
+    if (retval->param_version_offsets == NULL)
+    {
+        f(retval->shaders, d);
+        f(retval->shader_indices, d);
+        f(retval->preshader_indices, d);
+        f(retval, d);
+        out_of_memory();
+        return NULL;
+    } // if
+    for (i = 0; i < effect->object_count; i++)
+    {
+        MOJOSHADER_effectObject *object = &effect->objects[i];
+        retval->param_version_offsets[i] = num_versions;
+        if ((object->type == MOJOSHADER_SYMTYPE_PIXELSHADER
+          || object->type == MOJOSHADER_SYMTYPE_VERTEXSHADER)
+         && !object->shader.is_preshader)
+        {
+            num_versions += object->shader.shader->symbol_count;
+            if (object->shader.shader->preshader)
+                num_versions += object->shader.shader->preshader->symbol_count;
+        } // if
+    } // for
+    if (num_versions > 0)
+    {
+        retval->param_versions = (unsigned int *) m(num_versions * sizeof (unsigned int), d);
+        if (retval->param_versions == NULL)
+        {
+            f(retval->param_version_offsets, d);
+            f(retval->shaders, d);
+            f(retval->shader_indices, d);
+            f(retval->preshader_indices, d);
+            f(retval, d);
+            out_of_memory();
+            return NULL;
+        } // if
+        memset(retval->param_versions, '\0', num_versions * sizeof (unsigned int));
+    } // if
+
     // Run through the shaders again, compiling and tracking the object indices
     for (i = 0; i < effect->object_count; i++)
     {
@@ -2700,23 +7560,69 @@ MOJOSHADER_glEffect *MOJOSHADER_glCompileEffect(MOJOSHADER_effect *effect)
                 retval->preshader_indices[current_preshader++] = i;
                 continue;
             } // if
-            if (!ctx->profileCompileShader(object->shader.shader, &shader))
+            // Even a shared shader's registers must cover our symbols.
+            pd = object->shader.shader;
+            if (!reserve_shader_registers(pd))
+            {
+                out_of_memory();
                 goto compile_shader_fail;
-            retval->shaders[current_shader].parseData = object->shader.shader;
-            retval->shaders[current_shader].handle = shader;
-            retval->shaders[current_shader].refcount = 1;
+            } // if
+
+            /* Effects repeat shaders, within an effect and between them,
+             * so reuse any shader that translated to the same thing. We
+             * only take one reference per distinct shader, though.
+             */
+            gls = share_interned_shader(SHADERINTERN_OUTPUT,
+                                        hash64(HASH64_INIT, pd->output,
+                                               pd->output_len), pd, NULL, 0);
+            if (gls == NULL)
+            {
+                gls = (MOJOSHADER_glShader *) Malloc(sizeof (MOJOSHADER_glShader));
+                if (gls == NULL)
+                    goto compile_shader_fail;
+                memset(gls, '\0', sizeof (MOJOSHADER_glShader));
+                if (!compile_parsed_shader(gls, pd))
+                {
+                    Free(gls);
+                    goto compile_shader_fail;
+                } // if
+                gls->refcount = 1;
+                gls->owners = 1;
+                gls->share_group = ctx->share_group;
+                gls->parse_owner = retval;
+                intern_shader(gls, SHADERINTERN_OUTPUT, gls->output_hash,
+                              NULL, 0);
+            } // if
+            else if (effect_has_shader(retval, current_shader, gls))
+            {
+                // Already ours, so give back the extra reference.
+                atomic_decrement(&gls->owners);
+                atomic_decrement(&gls->refcount);
+            } // else if
+            retval->shaders[current_shader] = gls;
             retval->shader_indices[current_shader] = i;
             current_shader++;
         } // if
     } // for
 
     retval->effect = effect;
+    if (!build_pass_bindings(retval) || !build_copy_plans(retval, num_versions))
+    {
+        out_of_memory();
+        goto compile_shader_fail;
+    } // if
     return retval;
 
 compile_shader_fail:
-    for (i = 0; i < retval->num_shaders; i++)
-        if (retval->shaders[i].handle != 0)
-            ctx->profileDeleteShader(retval->shaders[i].handle);
+    release_effect_shaders(retval);
+    f(retval->copy_ops, d);
+    f(retval->copy_plans, d);
+    f(retval->sampler_blocks, d);
+    f(retval->pass_bindings, d);
+    f(retval->technique_pass_offsets, d);
+    f(retval->param_versions, d);
+    f(retval->param_version_offsets, d);
+    f(retval->preshader_indices, d);
     f(retval->shader_indices, d);
     f(retval->shaders, d);
     f(retval, d);
@@ -2726,34 +7632,251 @@ compile_shader_fail:
 
 void MOJOSHADER_glDeleteEffect(MOJOSHADER_glEffect *glEffect)
 {
-    int i;
+    int i, j;
     MOJOSHADER_free f = glEffect->effect->free;
     void *d = glEffect->effect->malloc_data;
 
-    for (i = 0; i < glEffect->num_shaders; i++)
+    // Drop the programs we're holding for static passes.
+    for (i = 0; i < glEffect->effect->technique_count; i++)
     {
-        /* Arbitarily add a reference to the refcount.
-         * We're going to be calling glDeleteShader so we can clean out the
-         * program cache, but we can NOT let it free() the array elements!
-         * We'll do that ourselves, as we malloc()'d in CompileEffect.
-         * -flibit
-         */
-        glEffect->shaders[i].refcount++;
-        MOJOSHADER_glDeleteShader(&glEffect->shaders[i]);
-
-        /* Delete the shader, but do NOT delete the parse data!
-         * The parse data belongs to the parent effect.
-         * -flibit
-         */
-        ctx->profileDeleteShader(glEffect->shaders[i].handle);
+        EffectPassBinding *bindings = glEffect->pass_bindings + glEffect->technique_pass_offsets[i];
+        for (j = 0; j < glEffect->effect->techniques[i].pass_count; j++)
+            program_unref(bindings[j].program);
     } // for
 
+    release_effect_shaders(glEffect);
+
+    f(glEffect->prewarm, d);
+    f(glEffect->shaders, d);
+    f(glEffect->copy_ops, d);
+    f(glEffect->copy_plans, d);
+    f(glEffect->sampler_blocks, d);
+    f(glEffect->pass_bindings, d);
+    f(glEffect->technique_pass_offsets, d);
+    f(glEffect->param_versions, d);
+    f(glEffect->param_version_offsets, d);
     f(glEffect->shader_indices, d);
     f(glEffect->preshader_indices, d);
     f(glEffect, d);
 } // MOJOSHADER_glDeleteEffect
 
 
+// Fills (out) with every shader (raw) can end up binding: just (gls) for a
+//  plain shader, or each shader in the array a preshader selects from.
+//  (out) must hold num_shaders elements. Returns the number of shaders.
+static unsigned int shader_choices(const MOJOSHADER_glEffect *glEffect,
+                                   const MOJOSHADER_effectShader *raw,
+                                   MOJOSHADER_glShader *gls,
+                                   MOJOSHADER_glShader **out)
+{
+    const MOJOSHADER_effectValue *param;
+    unsigned int retval = 0;
+    unsigned int i, j, k;
+
+    if (raw == NULL)
+        return 0;
+    else if (!raw->is_preshader)
+    {
+        if (gls == NULL)
+            return 0;
+        out[0] = gls;
+        return 1;
+    } // else if
+
+    param = &glEffect->effect->params[raw->params[0]].value;
+    for (i = 0; i < param->value_count; i++)
+    {
+        for (j = 0; j < glEffect->num_shaders; j++)
+        {
+            if (param->valuesI[i] == (int) glEffect->shader_indices[j])
+                break;
+        } // for
+        if (j == glEffect->num_shaders)
+            continue;
+
+        for (k = 0; k < retval; k++)
+        {
+            if (out[k] == glEffect->shaders[j])
+                break;
+        } // for
+        if (k == retval)
+            out[retval++] = glEffect->shaders[j];
+    } // for
+
+    return retval;
+} // shader_choices
+
+/* Walk the passes the way BeginPass does, where a pass that only sets one
+ * stage keeps the other stage from the pass before it. Pairings where a
+ * stage is still unknown come from the application, so we skip those.
+ */
+static int build_prewarm_list(MOJOSHADER_glEffect *glEffect)
+{
+    MOJOSHADER_effect *effect = glEffect->effect;
+    MOJOSHADER_malloc m = effect->malloc;
+    MOJOSHADER_free f = effect->free;
+    void *d = effect->malloc_data;
+    const size_t choicelen = (glEffect->num_shaders + 1) * sizeof (MOJOSHADER_glShader *);
+    MOJOSHADER_glShader **vchoices = (MOJOSHADER_glShader **) m(choicelen, d);
+    MOJOSHADER_glShader **fchoices = (MOJOSHADER_glShader **) m(choicelen, d);
+    unsigned int max_pairs = 0;
+    int pass_fill, i, j;
+    unsigned int k, l, n;
+
+    if ((vchoices == NULL) || (fchoices == NULL))
+    {
+        f(vchoices, d);
+        f(fchoices, d);
+        out_of_memory();
+        return 0;
+    } // if
+
+    // First pass counts the pairings, second pass fills in the unique ones.
+    for (pass_fill = 0; pass_fill < 2; pass_fill++)
+    {
+        if (pass_fill)
+        {
+            if (max_pairs > 0)
+            {
+                glEffect->prewarm = (EffectPrewarm *) m(max_pairs * sizeof (EffectPrewarm), d);
+                if (glEffect->prewarm == NULL)
+                {
+                    f(vchoices, d);
+                    f(fchoices, d);
+                    out_of_memory();
+                    return 0;
+                } // if
+            } // if
+            glEffect->prewarm_count = 0;
+        } // if
+
+        for (i = 0; i < effect->technique_count; i++)
+        {
+            EffectPassBinding *bindings = glEffect->pass_bindings + glEffect->technique_pass_offsets[i];
+            MOJOSHADER_effectShader *rawVert = NULL;
+            MOJOSHADER_effectShader *rawFrag = NULL;
+            MOJOSHADER_glShader *vert = NULL;
+            MOJOSHADER_glShader *frag = NULL;
+            for (j = 0; j < effect->techniques[i].pass_count; j++)
+            {
+                EffectPassBinding *binding = &bindings[j];
+                unsigned int vcount, fcount;
+                if (binding->vert_raw != NULL)
+                {
+                    rawVert = binding->vert_raw;
+                    vert = binding->vert;
+                } // if
+                if (binding->frag_raw != NULL)
+                {
+                    rawFrag = binding->frag_raw;
+                    frag = binding->frag;
+                } // if
+
+                vcount = shader_choices(glEffect, rawVert, vert, vchoices);
+                fcount = shader_choices(glEffect, rawFrag, frag, fchoices);
+                if (!pass_fill)
+                {
+                    max_pairs += vcount * fcount;
+                    continue;
+                } // if
+
+                for (k = 0; k < vcount; k++)
+                {
+                    for (l = 0; l < fcount; l++)
+                    {
+                        EffectPrewarm *item = NULL;
+                        for (n = 0; n < glEffect->prewarm_count; n++)
+                        {
+                            if ((glEffect->prewarm[n].vert == vchoices[k])
+                             && (glEffect->prewarm[n].frag == fchoices[l]))
+                            {
+                                item = &glEffect->prewarm[n];
+                                break;
+                            } // if
+                        } // for
+                        if (item == NULL)
+                        {
+                            item = &glEffect->prewarm[glEffect->prewarm_count++];
+                            item->vert = vchoices[k];
+                            item->frag = fchoices[l];
+                            item->binding = NULL;
+                        } // if
+
+                        // BeginPass holds on to static passes' programs.
+                        if ((item->binding == NULL) && (!binding->has_preshader)
+                         && (binding->vert == item->vert)
+                         && (binding->frag == item->frag))
+                            item->binding = binding;
+                    } // for
+                } // for
+            } // for
+        } // for
+    } // for
+
+    f(vchoices, d);
+    f(fchoices, d);
+    glEffect->prewarm_built = 1;
+    return 1;
+} // build_prewarm_list
+
+
+int MOJOSHADER_glEffectPrewarm(MOJOSHADER_glEffect *glEffect,
+                               unsigned int budget_usecs,
+                               MOJOSHADER_glEffectPrewarmProgress *progress)
+{
+    const uint64 start = ticks_usecs();
+    int retval = 0;
+
+    if ((glEffect->prewarm_built) || (build_prewarm_list(glEffect)))
+    {
+        while (glEffect->prewarm_next < glEffect->prewarm_count)
+        {
+            EffectPrewarm *item = &glEffect->prewarm[glEffect->prewarm_next++];
+            EffectPassBinding *binding = item->binding;
+
+            // Static passes that were already bound hold their program.
+            if ((binding != NULL) && (binding->link_failed))
+                glEffect->prewarm_failed++;
+            else if ((binding == NULL) || (binding->program == NULL))
+            {
+                MOJOSHADER_glProgram *program;
+                program = get_linked_program(item->vert, item->frag);
+                if (program == NULL)
+                {
+                    glEffect->prewarm_failed++;
+                    if (binding != NULL)
+                        binding->link_failed = 1;
+                } // if
+                else if (binding != NULL)
+                {
+                    binding->program = program;
+                    program->refcount++;
+                } // else if
+            } // if
+
+            if ((budget_usecs != 0) && ((ticks_usecs() - start) >= budget_usecs))
+                break;
+        } // while
+
+        retval = (int) (glEffect->prewarm_count - glEffect->prewarm_next);
+    } // if
+    else
+        retval = -1;
+
+    glEffect->prewarm_usecs += ticks_usecs() - start;
+
+    if (progress != NULL)
+    {
+        progress->programs_total = glEffect->prewarm_count;
+        progress->programs_linked = glEffect->prewarm_next - glEffect->prewarm_failed;
+        progress->programs_failed = glEffect->prewarm_failed;
+        progress->usecs = glEffect->prewarm_usecs;
+    } // if
+
+    return retval;
+} // MOJOSHADER_glEffectPrewarm
+
+
 void MOJOSHADER_glEffectBegin(MOJOSHADER_glEffect *glEffect,
                               unsigned int *numPasses,
                               int saveShaderState,
@@ -2768,15 +7891,23 @@ void MOJOSHADER_glEffectBegin(MOJOSHADER_glEffect *glEffect,
 } // MOJOSHADER_glEffectBegin
 
 
+void MOJOSHADER_glEffectBindParamBlock(MOJOSHADER_glEffect *glEffect,
+                                       MOJOSHADER_effectParamBlock *block)
+{
+    assert(block == NULL || block->effect == glEffect->effect);
+    glEffect->param_block = block;
+} // MOJOSHADER_glEffectBindParamBlock
+
+
 void MOJOSHADER_glEffectBeginPass(MOJOSHADER_glEffect *glEffect,
                                   unsigned int pass)
 {
-    int i, j;
     MOJOSHADER_effectPass *curPass;
-    MOJOSHADER_effectState *state;
+    EffectPassBinding *binding;
+    const int technique = glEffect->effect->current_technique
+                        - glEffect->effect->techniques;
     MOJOSHADER_effectShader *rawVert = glEffect->current_vert_raw;
     MOJOSHADER_effectShader *rawFrag = glEffect->current_frag_raw;
-    int has_preshader = 0;
 
     if (ctx->bound_program != NULL)
     {
@@ -2787,39 +7918,24 @@ void MOJOSHADER_glEffectBeginPass(MOJOSHADER_glEffect *glEffect,
     assert(glEffect->effect->current_pass == -1);
     glEffect->effect->current_pass = pass;
     curPass = &glEffect->effect->current_technique->passes[pass];
+    binding = &glEffect->pass_bindings[glEffect->technique_pass_offsets[technique] + pass];
 
-    // !!! FIXME: I bet this could be stored at parse/compile time. -flibit
-    for (i = 0; i < curPass->state_count; i++)
+    if (binding->vert_raw != NULL)
     {
-        state = &curPass->states[i];
-        #define ASSIGN_SHADER(stype, raw, gls) \
-            (state->type == stype) \
-            { \
-                j = 0; \
-                do \
-                { \
-                    if (*state->value.valuesI == glEffect->shader_indices[j]) \
-                    { \
-                        raw = &glEffect->effect->objects[*state->value.valuesI].shader; \
-                        glEffect->gls = &glEffect->shaders[j]; \
-                        break; \
-                    } \
-                    else if (glEffect->num_preshaders > 0 \
-                          && *state->value.valuesI == glEffect->preshader_indices[j]) \
-                    { \
-                        raw = &glEffect->effect->objects[*state->value.valuesI].shader; \
-                        has_preshader = 1; \
-                        break; \
-                    } \
-                } while (++j < glEffect->num_shaders); \
-            }
-        if ASSIGN_SHADER(MOJOSHADER_RS_VERTEXSHADER, rawVert, current_vert)
-        else if ASSIGN_SHADER(MOJOSHADER_RS_PIXELSHADER, rawFrag, current_frag)
-        #undef ASSIGN_SHADER
-    } // for
+        rawVert = binding->vert_raw;
+        if (binding->vert != NULL)
+            glEffect->current_vert = binding->vert;
+    } // if
+    if (binding->frag_raw != NULL)
+    {
+        rawFrag = binding->frag_raw;
+        if (binding->frag != NULL)
+            glEffect->current_frag = binding->frag;
+    } // if
 
     glEffect->effect->state_changes->render_state_changes = curPass->states;
     glEffect->effect->state_changes->render_state_change_count = curPass->state_count;
+    glEffect->current_render_block = binding->render_block;
 
     glEffect->current_vert_raw = rawVert;
     glEffect->current_frag_raw = rawFrag;
@@ -2828,19 +7944,41 @@ void MOJOSHADER_glEffectBeginPass(MOJOSHADER_glEffect *glEffect,
      * CommitChanges to actually bind the final shaders.
      * -flibit
      */
-    if (!has_preshader)
+    if (!binding->has_preshader)
     {
-        MOJOSHADER_glBindShaders(glEffect->current_vert,
-                                 glEffect->current_frag);
+        /* Passes that set both shaders always want the same program, so
+         * hang on to it and skip the linker cache next time.
+         */
+        if (binding->vert != NULL && binding->frag != NULL)
+        {
+            if ((binding->program == NULL) && (!binding->link_failed))
+            {
+                binding->program = get_linked_program(binding->vert,
+                                                      binding->frag);
+                if (binding->program != NULL)
+                    binding->program->refcount++;
+                else
+                    binding->link_failed = 1;
+            } // if
+            if (binding->program != NULL)
+                MOJOSHADER_glBindProgram(binding->program);
+        } // if
+        else
+        {
+            MOJOSHADER_glBindShaders(glEffect->current_vert,
+                                     glEffect->current_frag);
+        } // else
         if (glEffect->current_vert_raw != NULL)
         {
             glEffect->effect->state_changes->vertex_sampler_state_changes = rawVert->samplers;
             glEffect->effect->state_changes->vertex_sampler_state_change_count = rawVert->sampler_count;
+            glEffect->current_vertex_sampler_block = glEffect->sampler_blocks[raw_shader_index(glEffect, rawVert)];
         } // if
         if (glEffect->current_frag_raw != NULL)
         {
             glEffect->effect->state_changes->sampler_state_changes = rawFrag->samplers;
             glEffect->effect->state_changes->sampler_state_change_count = rawFrag->sampler_count;
+            glEffect->current_sampler_block = glEffect->sampler_blocks[raw_shader_index(glEffect, rawFrag)];
         } // if
     } // if
 
@@ -2848,65 +7986,160 @@ void MOJOSHADER_glEffectBeginPass(MOJOSHADER_glEffect *glEffect,
 } // MOJOSHADER_glEffectBeginPass
 
 
-static inline void copy_parameter_data(MOJOSHADER_effectParam *params,
-                                       unsigned int *param_loc,
-                                       MOJOSHADER_symbol *symbols,
-                                       unsigned int symbol_count,
-                                       GLfloat *regf, GLint *regi, uint8 *regb)
+static inline const void *param_values(const MOJOSHADER_glEffect *glEffect,
+                                       const unsigned int idx)
+{
+    const MOJOSHADER_effect *effect = glEffect->effect;
+    const MOJOSHADER_effectValue *value = &effect->params[idx].value;
+    const MOJOSHADER_effectParamBlock *block = glEffect->param_block;
+    if (block == NULL || value->type.parameter_class == MOJOSHADER_SYMCLASS_OBJECT)
+        return value->values;
+    return (const char *) block->storage + ((const char *) value->values
+                                          - (const char *) effect->param_storage);
+} // param_values
+
+
+static inline unsigned int param_version(const MOJOSHADER_glEffect *glEffect,
+                                         const unsigned int idx)
 {
-    int i, j, r, c;
+    if (glEffect->param_block != NULL)
+        return glEffect->param_block->versions[idx];
+    return glEffect->effect->params[idx].version;
+} // param_version
+
+
+static inline int run_copy_plan(const MOJOSHADER_glEffect *glEffect,
+                                const CopyPlan *plan,
+                                const unsigned int *param_loc,
+                                unsigned int *versions,
+                                int copy_all,
+                                GLfloat *regf, GLint *regi, uint8 *regb,
+                                RegisterStamps *stamps)
+{
+    // Anything we write here is seen by ProgramReady as of the next generation.
+    const uint32 gen = ctx->generation + 1;
+    uint32 i, j, c, r;
+    int written = 0;
 
-    i = 0;
-    for (i = 0; i < symbol_count; i++)
+    for (i = 0; i < plan->op_count; i++)
     {
-        const MOJOSHADER_symbol *sym = &symbols[i];
-        const MOJOSHADER_effectValue *param = &params[param_loc[i]].value;
+        const CopyOp *op = &plan->ops[i];
+        int stale = copy_all;
 
-        // float/int registers are vec4, so they have 4 elements each
-        const uint32 start = sym->register_index << 2;
+        // Version 0 was never set through the API, so the app may be
+        //  writing value.values directly, and we can't trust it.
+        for (j = op->first_symbol; j < op->first_symbol + op->symbol_count; j++)
+        {
+            const unsigned int version = param_version(glEffect, param_loc[j]);
+            if (version == 0 || version != versions[j])
+                stale = 1;
+            versions[j] = version;
+        } // for
+        if (!stale)
+            continue;
 
-        if (param->type.parameter_type == MOJOSHADER_SYMTYPE_FLOAT)
-            memcpy(regf + start, param->valuesF, sym->register_count << 4);
-        else if (sym->register_set == MOJOSHADER_SYMREGSET_FLOAT4)
+        const void *values = param_values(glEffect, op->param);
+
+        /* We compare before writing, so that switching between parameter
+         * blocks (or redundant sets) doesn't bump the generation for nothing.
+         * The conversion loops are kept branch-free so they vectorize.
+         */
+        switch (op->kind)
         {
-            // Structs are a whole different world...
-            if (param->type.parameter_class == MOJOSHADER_SYMCLASS_STRUCT)
-                memcpy(regf + start, param->valuesF, sym->register_count << 4);
-            else
+            case COPY_FLOAT4:
+                if (memcmp(regf + op->dst, values, op->count << 2) != 0)
+                {
+                    memcpy(regf + op->dst, values, op->count << 2);
+                    if (stamps != NULL)
+                    {
+                        touch_registers(&stamps[MOJOSHADER_UNIFORM_FLOAT],
+                                        op->dst >> 2, op->count >> 2, gen);
+                    } // if
+                    written = 1;
+                } // if
+                break;
+
+            case COPY_INT4:
+                if (regi == NULL)
+                    break;
+                if (memcmp(regi + op->dst, values, op->count << 2) != 0)
+                {
+                    memcpy(regi + op->dst, values, op->count << 2);
+                    if (stamps != NULL)
+                    {
+                        touch_registers(&stamps[MOJOSHADER_UNIFORM_INT],
+                                        op->dst >> 2, op->count >> 2, gen);
+                    } // if
+                    written = 1;
+                } // if
+                break;
+
+            case CONVERT_INT_FLOAT4:
             {
                 // Sometimes int/bool parameters get thrown into float registers...
-                j = 0;
-                do
+                const GLint *src = (const GLint *) values;
+                GLfloat *dst = regf + op->dst;
+                int diff = 0;
+                if (op->columns == 4)
                 {
-                    c = 0;
-                    do
+                    for (j = 0; j < op->count; j++)
                     {
-                        regf[start + (j << 2) + c] = (float) param->valuesI[(j << 2) + c];
-                    } while (++c < param->type.columns);
-                } while (++j < sym->register_count);
-            } // else
-        } // else if
-        else if (sym->register_set == MOJOSHADER_SYMREGSET_INT4)
-            memcpy(regi + start, param->valuesI, sym->register_count << 4);
-        else if (sym->register_set == MOJOSHADER_SYMREGSET_BOOL)
-        {
-            j = 0;
-            r = 0;
-            do
+                        const GLfloat f = (GLfloat) src[j];
+                        diff |= (dst[j] != f);
+                        dst[j] = f;
+                    } // for
+                } // if
+                else
+                {
+                    for (j = 0; j < op->count; j += 4)
+                    {
+                        for (c = 0; c < op->columns; c++)
+                        {
+                            const GLfloat f = (GLfloat) src[j + c];
+                            diff |= (dst[j + c] != f);
+                            dst[j + c] = f;
+                        } // for
+                    } // for
+                } // else
+                if ((diff) && (stamps != NULL))
+                {
+                    touch_registers(&stamps[MOJOSHADER_UNIFORM_FLOAT],
+                                    op->dst >> 2, op->count >> 2, gen);
+                } // if
+                written |= diff;
+                break;
+            } // case
+
+            case CONVERT_INT_BOOL:
             {
-                c = 0;
-                do
+                // Rows are packed down to (columns) bools, up to (count).
+                const GLint *src = (const GLint *) values;
+                uint8 *dst = regb + op->dst;
+                int diff = 0;
+                if (regb == NULL)
+                    break;
+                for (r = 0, j = 0; r < op->count; j += 4)
                 {
-                    // regb is not a vec4, enjoy that 'start' bitshift! -flibit
-                    regb[(start >> 2) + r + c] = param->valuesI[(j << 2) + c];
-                    c++;
-                } while (c < param->type.columns && ((r + c) < sym->register_count));
-                r += c;
-                j++;
-            } while (r < sym->register_count);
-        } // else if
+                    for (c = 0; c < op->columns && r < op->count; c++, r++)
+                    {
+                        const uint8 b = (uint8) src[j + c];
+                        diff |= (dst[r] != b);
+                        dst[r] = b;
+                    } // for
+                } // for
+                if ((diff) && (stamps != NULL))
+                {
+                    touch_registers(&stamps[MOJOSHADER_UNIFORM_BOOL],
+                                    op->dst, op->count, gen);
+                } // if
+                written |= diff;
+                break;
+            } // case
+        } // switch
     } // for
-} // copy_parameter_data
+
+    return written;
+} // run_copy_plan
 
 
 void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect)
@@ -2916,10 +8149,16 @@ void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect)
 
     /* Used for shader selection from preshaders */
     int i, j;
-    MOJOSHADER_effectValue *param;
+    const MOJOSHADER_effectValue *param;
+    const GLint *valuesI;
+    const unsigned int block_serial = (glEffect->param_block != NULL) ?
+                                       glEffect->param_block->serial : 0;
     float selector;
     int shader_object;
     int selector_ran = 0;
+    int changed = 0;
+
+    stat_add(&ctx->stats.effect_commits, 1);
 
     /* For effect passes with arrays of shaders, we have to run a preshader
      * that determines which shader to use, based on a parameter's value.
@@ -2933,12 +8172,14 @@ void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect)
             do \
             { \
                 param = &glEffect->effect->params[raw->preshader_params[i]].value; \
+                valuesI = (const GLint *) param_values(glEffect, raw->preshader_params[i]); \
                 for (j = 0; j < (param->value_count >> 2); j++) \
                     memcpy(raw->preshader->registers + raw->preshader->symbols[i].register_index + j, \
-                           param->valuesI + (j << 2), \
+                           valuesI + (j << 2), \
                            param->type.columns << 2); \
             } while (++i < raw->preshader->symbol_count); \
             MOJOSHADER_runPreshader(raw->preshader, &selector); \
+            stat_add(&ctx->stats.preshader_runs, 1); \
             shader_object = glEffect->effect->params[raw->params[0]].value.valuesI[(int) selector]; \
             raw = &glEffect->effect->objects[shader_object].shader; \
             i = 0; \
@@ -2946,7 +8187,7 @@ void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect)
             { \
                 if (shader_object == glEffect->shader_indices[i]) \
                 { \
-                    gls = &glEffect->shaders[i]; \
+                    gls = glEffect->shaders[i]; \
                     break; \
                 } \
             } while (++i < glEffect->num_shaders); \
@@ -2963,50 +8204,221 @@ void MOJOSHADER_glEffectCommitChanges(MOJOSHADER_glEffect *glEffect)
         {
             glEffect->effect->state_changes->vertex_sampler_state_changes = rawVert->samplers;
             glEffect->effect->state_changes->vertex_sampler_state_change_count = rawVert->sampler_count;
+            glEffect->current_vertex_sampler_block = glEffect->sampler_blocks[raw_shader_index(glEffect, rawVert)];
         } // if
         if (glEffect->current_frag_raw != NULL)
         {
             glEffect->effect->state_changes->sampler_state_changes = rawFrag->samplers;
             glEffect->effect->state_changes->sampler_state_change_count = rawFrag->sampler_count;
+            glEffect->current_sampler_block = glEffect->sampler_blocks[raw_shader_index(glEffect, rawFrag)];
         } // if
     } // if
 
     /* This is where parameters are copied into the constant buffers.
      * If you're looking for where things slow down immensely, look at
-     * the copy_parameter_data() and MOJOSHADER_runPreshader() functions.
+     * the run_copy_plan() and MOJOSHADER_runPreshader() functions.
+     * Only parameters whose version changed since our last copy are written,
+     * unless someone else wrote to the register file in the meantime, or the
+     * parameter block changed.
      * -flibit
      */
-    // !!! FIXME: We're just copying everything every time. Blech. -flibit
-    // !!! FIXME: We're just running the preshaders every time. Blech. -flibit
     // !!! FIXME: Will the preshader ever want int/bool registers? -flibit
-    #define COPY_PARAMETER_DATA(raw, stage) \
+    #define COPY_PARAMETER_DATA(raw, stage, owner) \
         if (raw != NULL) \
         { \
-            copy_parameter_data(glEffect->effect->params, raw->params, \
-                                raw->shader->symbols, \
-                                raw->shader->symbol_count, \
-                                ctx->stage##_reg_file_f, \
-                                ctx->stage##_reg_file_i, \
-                                ctx->stage##_reg_file_b); \
+            unsigned int *versions = glEffect->param_versions + \
+                glEffect->param_version_offsets[raw_shader_index(glEffect, raw)]; \
+            const int copy_all = ((glEffect->copied_##owner##_raw != raw) \
+                               || (glEffect->copied_##owner##_block != block_serial) \
+                               || (glEffect->copied_##owner##_stamp != ctx->stage##_reg_file_stamp)); \
+            const CopyPlan *plan = &glEffect->copy_plans[raw_shader_index(glEffect, raw) * 2]; \
+            int written = run_copy_plan(glEffect, &plan[0], raw->params, \
+                                        versions, \
+                                        copy_all, \
+                                        ctx->stage##_reg_file_f, \
+                                        ctx->stage##_reg_file_i, \
+                                        ctx->stage##_reg_file_b, \
+                                        ctx->stage##_reg_stamps); \
             if (raw->shader->preshader) \
             { \
-                copy_parameter_data(glEffect->effect->params, raw->preshader_params, \
-                                    raw->shader->preshader->symbols, \
-                                    raw->shader->preshader->symbol_count, \
-                                    raw->shader->preshader->registers, \
-                                    NULL, \
-                                    NULL); \
-                MOJOSHADER_runPreshader(raw->shader->preshader, ctx->stage##_reg_file_f); \
+                if (run_copy_plan(glEffect, &plan[1], raw->preshader_params, \
+                                  versions + raw->shader->symbol_count, \
+                                  copy_all, \
+                                  raw->shader->preshader->registers, \
+                                  NULL, \
+                                  NULL, \
+                                  NULL) || copy_all) \
+                { \
+                    MOJOSHADER_runPreshader(raw->shader->preshader, ctx->stage##_reg_file_f); \
+                    stat_add(&ctx->stats.preshader_runs, 1); \
+                    touch_all_registers(&ctx->stage##_reg_stamps[MOJOSHADER_UNIFORM_FLOAT], \
+                                        ctx->generation + 1); \
+                    written = 1; \
+                } \
+            } \
+            glEffect->copied_##owner##_raw = raw; \
+            glEffect->copied_##owner##_block = block_serial; \
+            if (written) \
+            { \
+                glEffect->copied_##owner##_stamp = ++ctx->stage##_reg_file_stamp; \
+                changed = 1; \
             } \
+            else \
+                glEffect->copied_##owner##_stamp = ctx->stage##_reg_file_stamp; \
         }
-    COPY_PARAMETER_DATA(rawVert, vs)
-    COPY_PARAMETER_DATA(rawFrag, ps)
+    COPY_PARAMETER_DATA(rawVert, vs, vert)
+    COPY_PARAMETER_DATA(rawFrag, ps, frag)
     #undef COPY_PARAMETER_DATA
 
-    ctx->generation++;
+    if (changed)
+        ctx->generation++;
 } // MOJOSHADER_glEffectCommitChanges
 
 
+static void sampler_state_delta(const int stage,
+                                const uint32 block,
+                                const MOJOSHADER_samplerStateRegister *regs,
+                                const unsigned int reg_count,
+                                unsigned int *delta_count,
+                                const MOJOSHADER_samplerStateRegister **delta)
+{
+    MOJOSHADER_samplerStateRegister *outreg = ctx->sampler_register_delta[stage];
+    const int same_block = (block == ctx->applied_sampler_block[stage]);
+    unsigned int count = 0;
+    int i, j;
+
+    for (i = 0; i < reg_count; i++)
+    {
+        const MOJOSHADER_samplerStateRegister *reg = &regs[i];
+        const uint32 regidx = reg->sampler_register;
+        MOJOSHADER_effectSamplerState *outstate;
+        unsigned int state_count = 0;
+
+        // Registers we can't shadow, we just pass along.
+        if (regidx >= MAX_SAMPLER_REGS || count >= MAX_SAMPLER_REGS)
+        {
+            stat_add(&ctx->stats.sampler_states_applied, reg->sampler_state_count);
+            if (count < MAX_SAMPLER_REGS)
+                outreg[count++] = *reg;
+            continue;
+        } // if
+
+        outstate = ctx->sampler_state_delta[stage][regidx];
+        for (j = 0; j < reg->sampler_state_count; j++)
+        {
+            const MOJOSHADER_effectSamplerState *state = &reg->sampler_states[j];
+            const uint32 type = (uint32) state->type;
+            const uint32 value = (uint32) state->value.valuesI[0];
+            if (type != MOJOSHADER_SAMP_TEXTURE)
+            {
+                if (type >= MAX_SAMPLER_STATES)
+                    ; // don't know this one, pass it along.
+                else if (same_block
+                      || (ctx->sampler_state_known[stage][regidx][type]
+                       && ctx->sampler_state_shadow[stage][regidx][type] == value))
+                {
+                    stat_add(&ctx->stats.sampler_states_elided, 1);
+                    continue;
+                } // else if
+                else
+                {
+                    ctx->sampler_state_known[stage][regidx][type] = 1;
+                    ctx->sampler_state_shadow[stage][regidx][type] = value;
+                } // else
+            } // if
+
+            if (state_count < MAX_SAMPLER_STATES)
+                outstate[state_count++] = *state;
+            stat_add(&ctx->stats.sampler_states_applied, 1);
+        } // for
+
+        if (state_count > 0)
+        {
+            outreg[count] = *reg;
+            outreg[count].sampler_state_count = state_count;
+            outreg[count].sampler_states = outstate;
+            count++;
+        } // if
+    } // for
+
+    ctx->applied_sampler_block[stage] = block;
+    *delta_count = count;
+    *delta = outreg;
+} // sampler_state_delta
+
+
+void MOJOSHADER_glEffectGetStateDelta(MOJOSHADER_glEffect *glEffect,
+                                      MOJOSHADER_effectStateChanges *delta)
+{
+    const MOJOSHADER_effectStateChanges *changes = glEffect->effect->state_changes;
+    int i;
+
+    /* Render states... */
+    delta->render_state_change_count = 0;
+    delta->render_state_changes = ctx->render_state_delta;
+    if (glEffect->current_render_block == ctx->applied_render_block)
+    {
+        // Same block as last time, so everything in it is already applied.
+        for (i = 0; i < changes->render_state_change_count; i++)
+        {
+            const MOJOSHADER_renderStateType type = changes->render_state_changes[i].type;
+            if (type != MOJOSHADER_RS_VERTEXSHADER
+             && type != MOJOSHADER_RS_PIXELSHADER)
+                stat_add(&ctx->stats.render_states_elided, 1);
+        } // for
+    } // if
+    else
+    {
+        for (i = 0; i < changes->render_state_change_count; i++)
+        {
+            const MOJOSHADER_effectState *state = &changes->render_state_changes[i];
+            const uint32 type = (uint32) state->type;
+            const uint32 value = (uint32) state->value.valuesI[0];
+            if (type == MOJOSHADER_RS_VERTEXSHADER
+             || type == MOJOSHADER_RS_PIXELSHADER)
+                continue;
+            if (type < MAX_RENDER_STATES)
+            {
+                if (ctx->render_state_known[type]
+                 && ctx->render_state_shadow[type] == value)
+                {
+                    stat_add(&ctx->stats.render_states_elided, 1);
+                    continue;
+                } // if
+                ctx->render_state_known[type] = 1;
+                ctx->render_state_shadow[type] = value;
+            } // if
+            if (delta->render_state_change_count < MAX_RENDER_STATES)
+                ctx->render_state_delta[delta->render_state_change_count++] = *state;
+            stat_add(&ctx->stats.render_states_applied, 1);
+        } // for
+        ctx->applied_render_block = glEffect->current_render_block;
+    } // else
+
+    /* Sampler states... */
+    sampler_state_delta(0, glEffect->current_sampler_block,
+                        changes->sampler_state_changes,
+                        changes->sampler_state_change_count,
+                        &delta->sampler_state_change_count,
+                        &delta->sampler_state_changes);
+    sampler_state_delta(1, glEffect->current_vertex_sampler_block,
+                        changes->vertex_sampler_state_changes,
+                        changes->vertex_sampler_state_change_count,
+                        &delta->vertex_sampler_state_change_count,
+                        &delta->vertex_sampler_state_changes);
+} // MOJOSHADER_glEffectGetStateDelta
+
+
+void MOJOSHADER_glEffectResetStateDelta(void)
+{
+    ctx->applied_render_block = 0;
+    ctx->applied_sampler_block[0] = 0;
+    ctx->applied_sampler_block[1] = 0;
+    memset(ctx->render_state_known, '\0', sizeof (ctx->render_state_known));
+    memset(ctx->sampler_state_known, '\0', sizeof (ctx->sampler_state_known));
+} // MOJOSHADER_glEffectResetStateDelta
+
+
 void MOJOSHADER_glEffectEndPass(MOJOSHADER_glEffect *glEffect)
 {
     assert(glEffect->effect->current_pass != -1);
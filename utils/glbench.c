@@ -0,0 +1,838 @@
+/**
+ * MojoShader; generate shader programs from bytecode of compiled
+ *  Direct3D shaders.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by the MojoShader contributors.
+ */
+
+// A headless benchmark for the OpenGL glue. The "GL" here is the stub from
+//  glstub.c, which counts every call it gets. On top of that we replay an
+//  FNA-style frame (effect passes, parameter sets, vertex attributes,
+//  ProgramReady) thousands of times, and report the cost per draw for each
+//  profile. A skinning palette run also checks that what reached the GL
+//  matches what was set, and exits non-zero if it doesn't.
+//  There's no GPU work at all, so the numbers are MojoShader's own overhead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "glstub.h"
+
+
+// The benchmark itself...
+
+static unsigned long long ticks_nsecs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long) ((now.QuadPart * 1000000000.0) / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((unsigned long long) ts.tv_sec) * 1000000000) + ts.tv_nsec;
+#endif
+} // ticks_nsecs
+
+// One draw, the way FNA's SpriteBatch and friends do it.
+static void draw(StubEffect *fx, MOJOSHADER_glEffect *glEffect,
+                 const unsigned int n)
+{
+    const size_t stride = 24;
+    const char *vertices = (const char *) ((n % 512) * 4 * stride);
+    MOJOSHADER_effectStateChanges changes;
+    MOJOSHADER_effectStateChanges delta;
+    unsigned int passes = 0;
+    unsigned int pass;
+    float color[4];
+
+    // Switch effects every so often, new matrix per batch, color per draw.
+    if ((n % 64) == 0)
+    {
+        MOJOSHADER_effectSetTechnique(&fx->effect,
+                                      &fx->techniques[(n / 64) & 1]);
+    } // if
+
+    if ((n % 16) == 0)
+    {
+        float matrix[16];
+        memset(matrix, '\0', sizeof (matrix));
+        matrix[0] = matrix[5] = matrix[10] = matrix[15] = 1.0f;
+        matrix[12] = (float) (n % 1024);
+        MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_MATRIX],
+                                           matrix, 0, sizeof (matrix));
+    } // if
+
+    color[0] = (float) (n & 0xFF) / 255.0f;
+    color[1] = color[2] = color[3] = 1.0f;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_COLOR],
+                                       color, 0, sizeof (color));
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_TINT],
+                                       color, 0, sizeof (color));
+
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    for (pass = 0; pass < passes; pass++)
+    {
+        MOJOSHADER_glEffectBeginPass(glEffect, pass);
+        MOJOSHADER_glEffectGetStateDelta(glEffect, &delta);
+        MOJOSHADER_glSetVertexBuffer(1);  // one big dynamic vertex buffer.
+        MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_POSITION, 0, 3,
+                                        MOJOSHADER_ATTRIBUTE_FLOAT, 0,
+                                        (unsigned int) stride, vertices);
+        MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_TEXCOORD, 0, 2,
+                                        MOJOSHADER_ATTRIBUTE_FLOAT, 0,
+                                        (unsigned int) stride, vertices + 12);
+        MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_COLOR, 0, 4,
+                                        MOJOSHADER_ATTRIBUTE_UBYTE, 1,
+                                        (unsigned int) stride, vertices + 20);
+        MOJOSHADER_glProgramReady();
+        // glDrawElements() would go here.
+        MOJOSHADER_glEffectEndPass(glEffect);
+    } // for
+    MOJOSHADER_glEffectEnd(glEffect);
+} // draw
+
+// Make a current context for (cfg), with the sprite effect compiled on it.
+//  Returns 1 on success, -1 if this build doesn't support the profile, and
+//  0 if something went wrong. Either way, the reason gets printed.
+static int setup_config(const StubConfig *cfg, MOJOSHADER_glContext **ctx,
+                        StubEffect **fx, MOJOSHADER_glEffect **glEffect)
+{
+    printf("%-12s %-8s ", cfg->name, cfg->profile);
+    fflush(stdout);
+
+    stub_configure(cfg);
+    *ctx = MOJOSHADER_glCreateContext(cfg->profile, stub_lookup, NULL,
+                                      NULL, NULL, NULL);
+    if (*ctx == NULL)
+    {
+        printf("skipped: %s\n", MOJOSHADER_glGetError());
+        return -1;
+    } // if
+
+    MOJOSHADER_glMakeContextCurrent(*ctx);
+
+    *glEffect = NULL;
+    *fx = stub_create_effect(cfg->profile);
+    if (*fx != NULL)
+        *glEffect = MOJOSHADER_glCompileEffect(&(*fx)->effect);
+    if (*glEffect == NULL)
+    {
+        printf("failed: %s\n", MOJOSHADER_glGetError());
+        if (*fx != NULL)
+            stub_destroy_effect(*fx);
+        MOJOSHADER_glMakeContextCurrent(NULL);
+        MOJOSHADER_glDestroyContext(*ctx);
+        return 0;
+    } // if
+
+    return 1;
+} // setup_config
+
+static void teardown_config(MOJOSHADER_glContext *ctx, StubEffect *fx,
+                            MOJOSHADER_glEffect *glEffect)
+{
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    MOJOSHADER_glMakeContextCurrent(NULL);
+    MOJOSHADER_glDestroyContext(ctx);
+    stub_quit();
+} // teardown_config
+
+static int run_config(const StubConfig *cfg, const unsigned int draws,
+                      const unsigned int frames)
+{
+    MOJOSHADER_glContext *ctx = NULL;
+    MOJOSHADER_glEffect *glEffect = NULL;
+    StubEffect *fx = NULL;
+    MOJOSHADER_glStats stats;
+    unsigned long long start, elapsed, total = 0, gl_calls = 0;
+    unsigned long long uniform_calls, attrib_calls;
+    unsigned int frame, n;
+    double per_draw;
+    int i;
+
+    i = setup_config(cfg, &ctx, &fx, &glEffect);
+    if (i <= 0)
+        return (i < 0);
+
+    // One frame to link everything and fill the caches, then measure.
+    for (n = 0; n < draws; n++)
+        draw(fx, glEffect, n);
+
+    MOJOSHADER_glResetStats();
+    memset(stub_calls, '\0', sizeof (stub_calls));
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        start = ticks_nsecs();
+        for (n = 0; n < draws; n++)
+            draw(fx, glEffect, n);
+        elapsed = ticks_nsecs() - start;
+        total += elapsed;
+    } // for
+
+    MOJOSHADER_glGetStats(&stats);
+
+    uniform_calls = stub_calls[CALL_glUniform1i] + stub_calls[CALL_glUniform1iv] +
+                    stub_calls[CALL_glUniform4fv] + stub_calls[CALL_glUniform4iv] +
+                    stub_calls[CALL_glProgramUniform1i] +
+                    stub_calls[CALL_glProgramUniform1iv] +
+                    stub_calls[CALL_glProgramUniform4fv] +
+                    stub_calls[CALL_glProgramUniform4iv] +
+                    stub_calls[CALL_glBindBufferRange] +
+                    stub_calls[CALL_glProgramLocalParameter4fvARB] +
+                    stub_calls[CALL_glProgramLocalParameters4fvEXT] +
+                    stub_calls[CALL_glProgramLocalParameterI4ivNV] +
+                    stub_calls[CALL_glProgramLocalParametersI4ivNV];
+    attrib_calls = stub_calls[CALL_glVertexAttribPointer] +
+                   stub_calls[CALL_glEnableVertexAttribArray] +
+                   stub_calls[CALL_glDisableVertexAttribArray] +
+                   stub_calls[CALL_glVertexAttribDivisor] +
+                   stub_calls[CALL_glVertexAttribDivisorARB] +
+                   stub_calls[CALL_glBindVertexArray];
+
+    for (i = 0; i < CALL_TOTAL; i++)
+        gl_calls += stub_calls[i];
+
+    n = draws * frames;
+    per_draw = (double) total / (double) n;
+    printf("%8.1f ns/draw  %5.2f GL calls/draw  (uniform %.2f, attrib %.2f, "
+           "%.0f uniform bytes)\n", per_draw,
+           (double) gl_calls / n,
+           (double) uniform_calls / n, (double) attrib_calls / n,
+           (double) stats.uniform_bytes_uploaded / n);
+
+    if (getenv("GLBENCH_VERBOSE") != NULL)
+    {
+        for (i = 0; i < CALL_TOTAL; i++)
+        {
+            if (stub_calls[i] != 0)
+                printf("    %-32s %llu\n", stub_names[i], stub_calls[i]);
+        } // for
+    } // if
+
+    teardown_config(ctx, fx, glEffect);
+    return 1;
+} // run_config
+
+// Just MOJOSHADER_glProgramReady(), with the sprite program bound: with
+//  nothing to do, after a change to one register, and after a change to
+//  all five. This is the part of a draw that dirty tracking speeds up.
+static int run_program_ready(const StubConfig *cfg, const unsigned int count)
+{
+    MOJOSHADER_glContext *ctx = NULL;
+    MOJOSHADER_glEffect *glEffect = NULL;
+    StubEffect *fx = NULL;
+    MOJOSHADER_effectStateChanges changes;
+    unsigned long long start, clean, one, all;
+    unsigned int passes = 0;
+    unsigned int n;
+    float regs[5 * 4];
+    int rc;
+
+    rc = setup_config(cfg, &ctx, &fx, &glEffect);
+    if (rc <= 0)
+        return (rc < 0);
+
+    memset(regs, '\0', sizeof (regs));
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, 0);
+    MOJOSHADER_glProgramReady();  // link it and push everything once.
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+        MOJOSHADER_glProgramReady();
+    clean = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        regs[0] = (float) n;
+        MOJOSHADER_glSetVertexShaderUniformF(4, regs, 1);
+        MOJOSHADER_glProgramReady();
+    } // for
+    one = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        regs[0] = (float) n;
+        MOJOSHADER_glSetVertexShaderUniformF(0, regs, 5);
+        MOJOSHADER_glProgramReady();
+    } // for
+    all = ticks_nsecs() - start;
+
+    printf("%8.1f ns clean  %8.1f ns one register  %8.1f ns all registers\n",
+           (double) clean / count, (double) one / count,
+           (double) all / count);
+
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+    teardown_config(ctx, fx, glEffect);
+    return 1;
+} // run_program_ready
+
+// The loop MOJOSHADER_glEffectCommitChanges() ran before it had a copy
+//  plan, kept here to benchmark against. It works out what to do from each
+//  symbol, every commit, and copies everything whether it changed or not.
+static void old_copy_parameter_data(const MOJOSHADER_effectParam *params,
+                                    const unsigned int *param_loc,
+                                    const MOJOSHADER_symbol *symbols,
+                                    const unsigned int symbol_count,
+                                    GLfloat *regf, GLint *regi,
+                                    unsigned char *regb)
+{
+    unsigned int i;
+    int j, r, c;
+
+    for (i = 0; i < symbol_count; i++)
+    {
+        const MOJOSHADER_symbol *sym = &symbols[i];
+        const MOJOSHADER_effectValue *param = &params[param_loc[i]].value;
+
+        // float/int registers are vec4, so they have 4 elements each
+        const unsigned int start = sym->register_index << 2;
+
+        if (param->type.parameter_type == MOJOSHADER_SYMTYPE_FLOAT)
+            memcpy(regf + start, param->valuesF, sym->register_count << 4);
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_FLOAT4)
+        {
+            if (param->type.parameter_class == MOJOSHADER_SYMCLASS_STRUCT)
+                memcpy(regf + start, param->valuesF, sym->register_count << 4);
+            else
+            {
+                j = 0;
+                do
+                {
+                    c = 0;
+                    do
+                    {
+                        regf[start + (j << 2) + c] = (float) param->valuesI[(j << 2) + c];
+                    } while (++c < (int) param->type.columns);
+                } while (++j < (int) sym->register_count);
+            } // else
+        } // else if
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_INT4)
+            memcpy(regi + start, param->valuesI, sym->register_count << 4);
+        else if (sym->register_set == MOJOSHADER_SYMREGSET_BOOL)
+        {
+            j = 0;
+            r = 0;
+            do
+            {
+                c = 0;
+                do
+                {
+                    regb[(start >> 2) + r + c] = (unsigned char) param->valuesI[(j << 2) + c];
+                    c++;
+                } while (c < (int) param->type.columns && ((r + c) < (int) sym->register_count));
+                r += c;
+                j++;
+            } while (r < (int) sym->register_count);
+        } // else if
+    } // for
+} // old_copy_parameter_data
+
+// Set what the sprite effect's first pass reads, like a draw() does.
+static void set_sprite_params(StubEffect *fx, const unsigned int n)
+{
+    float matrix[16];
+    float color[4];
+    memset(matrix, '\0', sizeof (matrix));
+    matrix[0] = matrix[5] = matrix[10] = matrix[15] = 1.0f;
+    matrix[12] = (float) n;
+    color[0] = (float) (n & 0xFF) / 255.0f;
+    color[1] = color[2] = color[3] = 1.0f;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_MATRIX],
+                                       matrix, 0, sizeof (matrix));
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_COLOR],
+                                       color, 0, sizeof (color));
+} // set_sprite_params
+
+// The sprite effect's parameter copy, the old loop against the copy plan
+//  MOJOSHADER_glEffectCommitChanges() runs now: with every parameter set
+//  before each commit, and with nothing set. The commit also has its own
+//  bookkeeping to do, so this is a little unfair to the copy plan.
+static int run_copy_plan(const StubConfig *cfg, const unsigned int count)
+{
+    static GLfloat regf[256 * 4];
+    static GLint regi[16 * 4];
+    static unsigned char regb[16];
+    MOJOSHADER_glContext *ctx = NULL;
+    MOJOSHADER_glEffect *glEffect = NULL;
+    StubEffect *fx = NULL;
+    MOJOSHADER_effectStateChanges changes;
+    const MOJOSHADER_effectShader *vs;
+    unsigned long long start, old_set, old_clean, plan_set, plan_clean;
+    unsigned int passes = 0;
+    unsigned int n;
+    int rc;
+
+    rc = setup_config(cfg, &ctx, &fx, &glEffect);
+    if (rc <= 0)
+        return (rc < 0);
+
+    vs = &fx->objects[OBJ_VS].shader;
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, 0);
+
+    #define OLD_COPY() \
+        old_copy_parameter_data(fx->params, vs->params, \
+                                vs->shader->symbols, vs->shader->symbol_count, \
+                                regf, regi, regb)
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        set_sprite_params(fx, n);
+        OLD_COPY();
+    } // for
+    old_set = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+        OLD_COPY();
+    old_clean = ticks_nsecs() - start;
+
+    #undef OLD_COPY
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        set_sprite_params(fx, n);
+        MOJOSHADER_glEffectCommitChanges(glEffect);
+    } // for
+    plan_set = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+        MOJOSHADER_glEffectCommitChanges(glEffect);
+    plan_clean = ticks_nsecs() - start;
+
+    printf("%8.1f ns old loop  %8.1f ns copy plan  "
+           "(nothing set: %.1f ns old, %.1f ns plan)\n",
+           (double) old_set / count, (double) plan_set / count,
+           (double) old_clean / count, (double) plan_clean / count);
+
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+    teardown_config(ctx, fx, glEffect);
+    return 1;
+} // run_copy_plan
+
+// A skinning palette: a vertex shader that reads c0 through c127, which the
+//  app sets all at once every draw, with only a bone or two moved. This is
+//  the case copy_changed_vec4s() has to be fast for.
+#define PALETTE_REGS 128
+
+static MOJOSHADER_glProgram *link_palette_program(MOJOSHADER_glShader **vs,
+                                                  MOJOSHADER_glShader **ps)
+{
+    static const unsigned int ps_body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl v0
+        OP_MOV, DST(REG_COLOROUT, 0, 0xF), SRC(REG_INPUT, 0),
+        OP_END
+    };
+    static unsigned int body[4 * PALETTE_REGS + 16];
+    static unsigned int buf[4 * PALETTE_REGS + 64];
+    MOJOSHADER_glProgram *program = NULL;
+    size_t len = 0;
+    unsigned int i;
+
+    body[len++] = OP_DCL;  // dcl_position v0
+    body[len++] = 0x80000000;
+    body[len++] = DST(REG_INPUT, 0, 0xF);
+    body[len++] = OP_MOV;  // mov r0, c0
+    body[len++] = DST(REG_TEMP, 0, 0xF);
+    body[len++] = SRC(REG_CONST, 0);
+    for (i = 1; i < PALETTE_REGS; i++)
+    {
+        body[len++] = OP_ADD;  // add r0, r0, c(i)
+        body[len++] = DST(REG_TEMP, 0, 0xF);
+        body[len++] = SRC(REG_TEMP, 0);
+        body[len++] = SRC(REG_CONST, i);
+    } // for
+    body[len++] = OP_MUL;  // mul oPos, v0, r0
+    body[len++] = DST(REG_RASTOUT, 0, 0xF);
+    body[len++] = SRC(REG_INPUT, 0);
+    body[len++] = SRC(REG_TEMP, 0);
+    body[len++] = OP_END;
+
+    len = stub_build_shader(buf, VERSION_VS_2_0, NULL, 0, body,
+                            len * sizeof (unsigned int));
+    *vs = MOJOSHADER_glCompileShader((const unsigned char *) buf,
+                                     (unsigned int) len, NULL, 0, NULL, 0);
+    len = stub_build_shader(buf, VERSION_PS_2_0, NULL, 0, ps_body,
+                            sizeof (ps_body));
+    *ps = MOJOSHADER_glCompileShader((const unsigned char *) buf,
+                                     (unsigned int) len, NULL, 0, NULL, 0);
+    if ((*vs != NULL) && (*ps != NULL))
+        program = MOJOSHADER_glLinkProgram(*vs, *ps);
+    return program;
+} // link_palette_program
+
+// Does what reached the GL match (palette)? A plain loop, one float at a
+//  time, comparing bits like ProgramReady() does, so -0.0 isn't 0.0.
+static int palette_uploaded(const GLfloat *uploaded, const float *palette)
+{
+    unsigned int i;
+    for (i = 0; i < PALETTE_REGS * 4; i++)
+    {
+        if (memcmp(&uploaded[i], &palette[i], sizeof (float)) != 0)
+            return 0;
+    } // for
+    return 1;
+} // palette_uploaded
+
+// Set the whole palette, then make it ready. Returns uniform bytes sent.
+static unsigned long long set_palette(const float *palette)
+{
+    MOJOSHADER_glStats before, after;
+    MOJOSHADER_glGetStats(&before);
+    MOJOSHADER_glSetVertexShaderUniformF(0, palette, PALETTE_REGS);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetStats(&after);
+    return after.uniform_bytes_uploaded - before.uniform_bytes_uploaded;
+} // set_palette
+
+static int run_palette(const StubConfig *cfg, const unsigned int count)
+{
+    static float palette[PALETTE_REGS * 4];
+    const unsigned int nan_bits = 0x7FC00001;
+    MOJOSHADER_glContext *ctx = NULL;
+    MOJOSHADER_glEffect *glEffect = NULL;
+    MOJOSHADER_glProgram *program;
+    MOJOSHADER_glShader *vs = NULL, *ps = NULL;
+    const GLfloat *uploaded = NULL;
+    StubEffect *fx = NULL;
+    unsigned long long start, elapsed, bytes = 0;
+    unsigned int seed = 1;
+    unsigned int n;
+    float nan;
+    GLint loc;
+    int ok = 1;
+    int rc;
+
+    rc = setup_config(cfg, &ctx, &fx, &glEffect);
+    if (rc <= 0)
+        return (rc < 0);
+
+    program = link_palette_program(&vs, &ps);
+    if (program == NULL)
+    {
+        printf("failed: %s\n", MOJOSHADER_glGetError());
+        ok = 0;
+        goto palette_done;
+    } // if
+
+    memset(palette, '\0', sizeof (palette));
+    MOJOSHADER_glBindProgram(program);
+    set_palette(palette);  // push everything once.
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        palette[((n * 7) % PALETTE_REGS) * 4] = (float) n;  // move a bone.
+        bytes += set_palette(palette);
+    } // for
+    elapsed = ticks_nsecs() - start;
+
+    printf("%8.1f ns/set  %6.1f uniform bytes/set  ",
+           (double) elapsed / count, (double) bytes / count);
+
+    // Check the uploads against the palette, with random changes, some of
+    //  them to values only a bitwise compare can tell apart. The stub keeps
+    //  uniform arrays one register per location, ARB1 local parameters
+    //  one register per index, and uniform blocks as they were in the
+    //  buffer, so any way the floats are contiguous.
+    loc = stub_uniform_location("vs_uniforms_vec4");
+    if (strcmp(cfg->profile, MOJOSHADER_PROFILE_GLSLUBO) == 0)
+        uploaded = (const GLfloat *) stub_uniform_blocks[0];
+    else if (strcmp(cfg->profile, MOJOSHADER_PROFILE_ARB1) == 0)
+        uploaded = stub_local_params[0][0].f;
+    else if (loc >= 0)
+        uploaded = stub_uniforms[loc].f;
+    else
+    {
+        printf("uploads not checked\n");
+        goto palette_done;
+    } // else
+
+    memcpy(&nan, &nan_bits, sizeof (nan));
+    for (n = 0; (ok) && (n < 1000); n++)
+    {
+        const unsigned int changes = n % 4;
+        unsigned int i;
+        for (i = 0; i < changes; i++)
+        {
+            seed = (seed * 1103515245) + 12345;
+            switch ((seed >> 16) % 3)
+            {
+                case 0: palette[(seed >> 8) % (PALETTE_REGS * 4)] = -0.0f; break;
+                case 1: palette[(seed >> 8) % (PALETTE_REGS * 4)] = nan; break;
+                default: palette[(seed >> 8) % (PALETTE_REGS * 4)] = (float) n; break;
+            } // switch
+        } // for
+        set_palette(palette);
+        ok = palette_uploaded(uploaded, palette);
+    } // for
+
+    // Setting the same bits again, NaN or not, sends nothing.
+    if ((ok) && (set_palette(palette) != 0))
+        ok = 0;
+
+    printf("%s\n", ok ? "uploads match" : "UPLOADS DON'T MATCH");
+
+palette_done:
+    MOJOSHADER_glBindProgram(NULL);
+    if (program != NULL)
+        MOJOSHADER_glDeleteProgram(program);
+    if (vs != NULL)
+        MOJOSHADER_glDeleteShader(vs);
+    if (ps != NULL)
+        MOJOSHADER_glDeleteShader(ps);
+    teardown_config(ctx, fx, glEffect);
+    return ok;
+} // run_palette
+
+// The loop MOJOSHADER_glProgramReady() ran before it had a copy plan, kept
+//  here to benchmark against: every uniform of (pd), one at a time, with a
+//  branch on its type and a compare against what the program has. The
+//  texbem part is left out; the palette program doesn't have any.
+static int old_program_ready_copy(const MOJOSHADER_parseData *pd,
+                                  const GLfloat *srcf, const GLint *srci,
+                                  const unsigned char *srcb,
+                                  GLfloat *dstf, GLint *dsti, GLint *dstb)
+{
+    int changed = 0;
+    int i;
+
+    for (i = 0; i < pd->uniform_count; i++)
+    {
+        const MOJOSHADER_uniform *u = &pd->uniforms[i];
+        const int size = u->array_count ? u->array_count : 1;
+
+        if (u->type == MOJOSHADER_UNIFORM_FLOAT)
+        {
+            const size_t count = 4 * size;
+            const GLfloat *f = &srcf[u->index * 4];
+            if (memcmp(dstf, f, sizeof (GLfloat) * count) != 0)
+            {
+                memcpy(dstf, f, sizeof (GLfloat) * count);
+                changed = 1;
+            } // if
+            dstf += count;
+        } // if
+        else if (u->type == MOJOSHADER_UNIFORM_INT)
+        {
+            const size_t count = 4 * size;
+            const GLint *src = &srci[u->index * 4];
+            if (memcmp(dsti, src, sizeof (GLint) * count) != 0)
+            {
+                memcpy(dsti, src, sizeof (GLint) * count);
+                changed = 1;
+            } // if
+            dsti += count;
+        } // else if
+        else if (u->type == MOJOSHADER_UNIFORM_BOOL)
+        {
+            const unsigned char *b = &srcb[u->index];
+            int j;
+            for (j = 0; j < size; j++)
+            {
+                if (dstb[j] != b[j])
+                {
+                    dstb[j] = (GLint) b[j];
+                    changed = 1;
+                } // if
+            } // for
+            dstb += size;
+        } // else if
+    } // for
+
+    return changed;
+} // old_program_ready_copy
+
+// ProgramReady()'s copy from the register file for the palette program,
+//  which has a separate uniform for each of its registers: the old loop
+//  against the copy plan. Both get the same register set first, one
+//  register or the whole palette. The real thing also pushes what changed
+//  to the (stub) GL, which the old loop doesn't, so this is a little unfair
+//  to the copy plan.
+static int run_uniform_copy(const StubConfig *cfg, const unsigned int count)
+{
+    static GLfloat regf[PALETTE_REGS * 4];
+    static GLfloat dstf[PALETTE_REGS * 4];
+    static GLint regi[4], dsti[4], dstb[4];
+    static unsigned char regb[4];
+    static float palette[PALETTE_REGS * 4];
+    MOJOSHADER_glContext *ctx = NULL;
+    MOJOSHADER_glEffect *glEffect = NULL;
+    MOJOSHADER_glProgram *program;
+    MOJOSHADER_glShader *vs = NULL, *ps = NULL;
+    const MOJOSHADER_parseData *pd;
+    StubEffect *fx = NULL;
+    unsigned long long start, old_one, old_all, plan_one, plan_all;
+    unsigned int n;
+    int changes = 0;
+    int ok = 1;
+    int rc;
+
+    rc = setup_config(cfg, &ctx, &fx, &glEffect);
+    if (rc <= 0)
+        return (rc < 0);
+
+    program = link_palette_program(&vs, &ps);
+    if (program == NULL)
+    {
+        printf("failed: %s\n", MOJOSHADER_glGetError());
+        ok = 0;
+        goto uniform_copy_done;
+    } // if
+
+    pd = MOJOSHADER_glGetShaderParseData(vs);
+    memset(palette, '\0', sizeof (palette));
+    MOJOSHADER_glBindProgram(program);
+    set_palette(palette);  // push everything once.
+
+    #define SET_ONE(n) { \
+        const unsigned int reg = ((n) * 7) % PALETTE_REGS; \
+        palette[reg * 4] += 1.0f; \
+    }
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        const unsigned int reg = (n * 7) % PALETTE_REGS;
+        SET_ONE(n);
+        memcpy(&regf[reg * 4], &palette[reg * 4], sizeof (GLfloat) * 4);
+        changes += old_program_ready_copy(pd, regf, regi, regb,
+                                          dstf, dsti, dstb);
+    } // for
+    old_one = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        SET_ONE(n + 1);
+        memcpy(regf, palette, sizeof (regf));
+        changes += old_program_ready_copy(pd, regf, regi, regb,
+                                          dstf, dsti, dstb);
+    } // for
+    old_all = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        const unsigned int reg = (n * 7) % PALETTE_REGS;
+        SET_ONE(n + 2);
+        MOJOSHADER_glSetVertexShaderUniformF(reg, &palette[reg * 4], 1);
+        MOJOSHADER_glProgramReady();
+    } // for
+    plan_one = ticks_nsecs() - start;
+
+    start = ticks_nsecs();
+    for (n = 0; n < count; n++)
+    {
+        SET_ONE(n + 3);
+        set_palette(palette);
+    } // for
+    plan_all = ticks_nsecs() - start;
+
+    #undef SET_ONE
+
+    // The old loop saw every change, too, or it wasn't doing the work.
+    if (changes != (int) (count * 2))
+        ok = 0;
+
+    printf("%3d uniforms  one register: %.1f ns old, %.1f ns plan  "
+           "palette: %.1f ns old, %.1f ns plan%s\n", pd->uniform_count,
+           (double) old_one / count, (double) plan_one / count,
+           (double) old_all / count, (double) plan_all / count,
+           ok ? "" : "  OLD LOOP MISSED CHANGES");
+
+uniform_copy_done:
+    MOJOSHADER_glBindProgram(NULL);
+    if (program != NULL)
+        MOJOSHADER_glDeleteProgram(program);
+    if (vs != NULL)
+        MOJOSHADER_glDeleteShader(vs);
+    if (ps != NULL)
+        MOJOSHADER_glDeleteShader(ps);
+    teardown_config(ctx, fx, glEffect);
+    return ok;
+} // run_uniform_copy
+
+int main(int argc, char **argv)
+{
+    const unsigned int draws = (argc > 1) ? (unsigned int) atoi(argv[1]) : 2000;
+    const unsigned int frames = (argc > 2) ? (unsigned int) atoi(argv[2]) : 100;
+    int retval = 0;
+    int i;
+
+    if ((draws == 0) || (frames == 0))
+    {
+        fprintf(stderr, "USAGE: %s [draws per frame] [frames]\n", argv[0]);
+        return 1;
+    } // if
+
+    printf("MojoShader GL benchmark: %u draws x %u frames, stub GL\n\n",
+           draws, frames);
+
+    for (i = 0; i < stub_config_count; i++)
+    {
+        if (!run_config(&stub_configs[i], draws, frames))
+            retval = 1;
+    } // for
+
+    printf("\nProgramReady() with the sprite program bound, %u calls each\n\n",
+           draws * frames);
+
+    for (i = 0; i < stub_config_count; i++)
+    {
+        if (!run_program_ready(&stub_configs[i], draws * frames))
+            retval = 1;
+    } // for
+
+    printf("\nThe sprite effect's parameters copied at CommitChanges(), "
+           "%u commits each\n\n", draws * frames);
+
+    if (!run_copy_plan(&stub_configs[0], draws * frames))
+        retval = 1;
+
+    printf("\nA %u register palette set every draw, one register changed, "
+           "%u draws\n\n", PALETTE_REGS, draws * frames);
+
+    for (i = 0; i < stub_config_count; i++)
+    {
+        if (!run_palette(&stub_configs[i], draws * frames))
+            retval = 1;
+    } // for
+
+    printf("\nProgramReady()'s copy for the palette program, %u sets each\n\n",
+           draws * frames);
+
+    if (!run_uniform_copy(&stub_configs[0], draws * frames))
+        retval = 1;
+
+    return retval;
+} // main
+
+// end of glbench.c ...
+
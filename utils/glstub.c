@@ -0,0 +1,926 @@
+/**
+ * MojoShader; generate shader programs from bytecode of compiled
+ *  Direct3D shaders.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by the MojoShader contributors.
+ */
+
+// The stub GL shared by glbench and gltest. See glstub.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include "glstub.h"
+
+
+// The stub GL...
+
+#ifdef _WIN32
+typedef LONG stub_atomic;
+#define stub_atomic_increment(x) InterlockedIncrement(x)
+#define stub_atomic_decrement(x) InterlockedDecrement(x)
+#define stub_lock() while (InterlockedExchange(&stub_mutex, 1)) Sleep(0)
+#define stub_unlock() InterlockedExchange(&stub_mutex, 0)
+#else
+typedef long stub_atomic;
+#define stub_atomic_increment(x) __sync_add_and_fetch(x, 1)
+#define stub_atomic_decrement(x) __sync_sub_and_fetch(x, 1)
+#define stub_lock() while (__sync_lock_test_and_set(&stub_mutex, 1)) sched_yield()
+#define stub_unlock() __sync_lock_release(&stub_mutex)
+#endif
+
+const char *stub_names[CALL_TOTAL] =
+{
+    #define STUB(fn) #fn,
+    STUB_FUNCTIONS
+    #undef STUB
+};
+
+STUB_THREADLOCAL unsigned long long stub_calls[CALL_TOTAL];
+STUB_THREADLOCAL StubUniform stub_uniforms[STUB_MAX_UNIFORMS];
+STUB_THREADLOCAL unsigned char stub_uniform_blocks[STUB_MAX_BLOCKS][STUB_MAX_BLOCK_SIZE];
+STUB_THREADLOCAL StubUniform stub_local_params[2][STUB_MAX_LOCAL_PARAMS];
+STUB_THREADLOCAL GLsizeiptr stub_uniform_block_sizes[STUB_MAX_BLOCKS];
+
+static const StubConfig *config = NULL;
+static const char *extension_list[64];
+static int extension_count = 0;
+static char extension_buf[1024];
+static volatile stub_atomic next_object = 0;
+static volatile stub_atomic live_shaders = 0;
+static volatile stub_atomic stub_mutex = 0;
+static STUB_THREADLOCAL void *mapped_buffer = NULL;
+int stub_no_binaries = 0;
+int stub_compile_polls = 0;
+int stub_fail_links = 0;
+int stub_link_usecs = 0;
+
+// What we know about each object, by name. Names past the end look like
+//  objects that are finished and linked.
+#define MAX_STUB_OBJECTS 4096
+typedef struct StubObject
+{
+    int failed;
+    int polls;  // GL_COMPLETION_STATUS_KHR queries left before it's done.
+} StubObject;
+static StubObject objects[MAX_STUB_OBJECTS];
+
+static StubObject *stub_object(GLuint name)
+{
+    static StubObject finished;
+    if (name >= MAX_STUB_OBJECTS)
+    {
+        memset(&finished, '\0', sizeof (finished));
+        return &finished;
+    } // if
+    return &objects[name];
+} // stub_object
+
+// Every program "binary" we hand out is this, and it's all we'll load.
+#define STUB_BINARY_FORMAT 0x5354
+static const char stub_binary[16] = "glstub binary";
+
+// Uniform and attribute locations: names are numbered as we first see them.
+//  Shared contexts look names up from several threads, hence the lock.
+#define MAX_STUB_NAMES 256
+static char uniform_names[MAX_STUB_NAMES][64];
+static int uniform_name_count = 0;
+static char attrib_names[MAX_STUB_NAMES][64];
+static int attrib_name_count = 0;
+
+static int stub_name_index(char names[][64], int *count, const char *name,
+                           const size_t len, const int add)
+{
+    int retval = -1;
+    int i;
+
+    if (len >= sizeof (names[0]))
+        return -1;
+
+    stub_lock();
+    for (i = 0; i < *count; i++)
+    {
+        if ((strncmp(names[i], name, len) == 0) && (names[i][len] == '\0'))
+        {
+            retval = i;
+            break;
+        } // if
+    } // for
+
+    if ((retval < 0) && (add) && (*count < MAX_STUB_NAMES))
+    {
+        memcpy(names[*count], name, len);
+        names[*count][len] = '\0';
+        retval = (*count)++;
+    } // if
+    stub_unlock();
+
+    return retval;
+} // stub_name_index
+
+static GLuint stub_new_object(void)
+{
+    return (GLuint) stub_atomic_increment(&next_object);
+} // stub_new_object
+
+static const GLubyte *APIENTRY stub_glGetString(GLenum name)
+{
+    stub_calls[CALL_glGetString]++;
+    switch (name)
+    {
+        case GL_VERSION: return (const GLubyte *) config->version;
+        case GL_RENDERER: return (const GLubyte *) "MojoShader stub";
+        case GL_VENDOR: return (const GLubyte *) "MojoShader";
+        case GL_SHADING_LANGUAGE_VERSION: return (const GLubyte *) config->glsl_version;
+        case GL_EXTENSIONS: return (const GLubyte *) config->extensions;
+    } // switch
+    return NULL;
+} // stub_glGetString
+
+static const GLubyte *APIENTRY stub_glGetStringi(GLenum name, GLuint index)
+{
+    stub_calls[CALL_glGetStringi]++;
+    if ((name != GL_EXTENSIONS) || (index >= (GLuint) extension_count))
+        return NULL;
+    return (const GLubyte *) extension_list[index];
+} // stub_glGetStringi
+
+static void APIENTRY stub_glGetIntegerv(GLenum pname, GLint *val)
+{
+    stub_calls[CALL_glGetIntegerv]++;
+    switch (pname)
+    {
+        case GL_NUM_EXTENSIONS: *val = extension_count; break;
+        case GL_PROGRAM_ERROR_POSITION_ARB: *val = -1; break;
+        case GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT: *val = 256; break;
+        case GL_MAX_UNIFORM_BLOCK_SIZE: *val = 65536; break;
+        case GL_MAX_TEXTURE_IMAGE_UNITS: *val = 16; break;
+        case GL_MAX_VERTEX_ATTRIBS: *val = 16; break;
+        case GL_ARRAY_BUFFER_BINDING: *val = 0; break;
+        case GL_VERTEX_ARRAY_BINDING: *val = 0; break;
+        default: *val = 4096; break;  // uniform limits, mostly.
+    } // switch
+} // stub_glGetIntegerv
+
+static GLenum APIENTRY stub_glGetError(void)
+{
+    stub_calls[CALL_glGetError]++;
+    return GL_NO_ERROR;
+} // stub_glGetError
+
+static GLuint APIENTRY stub_glCreateShader(GLenum type)
+{
+    stub_calls[CALL_glCreateShader]++;
+    stub_atomic_increment(&live_shaders);
+    return stub_new_object();
+} // stub_glCreateShader
+
+static void APIENTRY stub_glCompileShader(GLuint shader)
+{
+    stub_calls[CALL_glCompileShader]++;
+    stub_object(shader)->polls = stub_compile_polls;
+} // stub_glCompileShader
+
+static void APIENTRY stub_glDeleteShader(GLuint shader)
+{
+    stub_calls[CALL_glDeleteShader]++;
+    if (shader != 0)
+        stub_atomic_decrement(&live_shaders);
+} // stub_glDeleteShader
+
+static GLuint APIENTRY stub_glCreateProgram(void)
+{
+    stub_calls[CALL_glCreateProgram]++;
+    return stub_new_object();
+} // stub_glCreateProgram
+
+static unsigned long long stub_ticks_usecs(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long) (now.QuadPart / (freq.QuadPart / 1000000));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((unsigned long long) ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000);
+#endif
+} // stub_ticks_usecs
+
+static void APIENTRY stub_glLinkProgram(GLuint program)
+{
+    StubObject *obj = stub_object(program);
+    const unsigned long long start = stub_ticks_usecs();
+    stub_calls[CALL_glLinkProgram]++;
+    while ((stub_ticks_usecs() - start) < (unsigned long long) stub_link_usecs)
+        ;  // a slow driver.
+    obj->failed = stub_fail_links;
+    obj->polls = stub_compile_polls;
+} // stub_glLinkProgram
+
+static void APIENTRY stub_glProgramBinary(GLuint program, GLenum format,
+                                          const void *binary, GLsizei len)
+{
+    const int ok = ( (format == STUB_BINARY_FORMAT) &&
+                     (len == (GLsizei) sizeof (stub_binary)) &&
+                     (memcmp(binary, stub_binary, sizeof (stub_binary)) == 0) );
+    stub_calls[CALL_glProgramBinary]++;
+    stub_object(program)->failed = !ok;
+} // stub_glProgramBinary
+
+static void APIENTRY stub_glGetProgramBinary(GLuint program, GLsizei bufsize,
+                                             GLsizei *len, GLenum *format,
+                                             void *binary)
+{
+    stub_calls[CALL_glGetProgramBinary]++;
+    if (bufsize < (GLsizei) sizeof (stub_binary))
+    {
+        if (len != NULL) *len = 0;
+        return;
+    } // if
+    memcpy(binary, stub_binary, sizeof (stub_binary));
+    if (len != NULL) *len = (GLsizei) sizeof (stub_binary);
+    *format = STUB_BINARY_FORMAT;
+} // stub_glGetProgramBinary
+
+static void stub_object_iv(GLuint obj, GLenum pname, GLint *val)
+{
+    switch (pname)
+    {
+        case GL_COMPILE_STATUS:
+        case GL_LINK_STATUS:
+            *val = stub_object(obj)->failed ? GL_FALSE : GL_TRUE;
+            break;
+        case GL_COMPLETION_STATUS_KHR:
+        {
+            StubObject *object = stub_object(obj);
+            *val = (object->polls > 0) ? GL_FALSE : GL_TRUE;
+            if (object->polls > 0)
+                object->polls--;
+            break;
+        } // case
+        case GL_PROGRAM_BINARY_LENGTH:
+            *val = stub_no_binaries ? 0 : (GLint) sizeof (stub_binary);
+            break;
+        default:
+            *val = 0;  // empty logs.
+            break;
+    } // switch
+} // stub_object_iv
+
+static void APIENTRY stub_glGetShaderiv(GLuint obj, GLenum pname, GLint *val)
+{
+    stub_calls[CALL_glGetShaderiv]++;
+    stub_object_iv(obj, pname, val);
+} // stub_glGetShaderiv
+
+static void APIENTRY stub_glGetProgramiv(GLuint obj, GLenum pname, GLint *val)
+{
+    stub_calls[CALL_glGetProgramiv]++;
+    stub_object_iv(obj, pname, val);
+} // stub_glGetProgramiv
+
+// Logs are empty, except that failed objects say so.
+static void stub_info_log(GLuint obj, GLsizei len, GLsizei *outlen,
+                          GLchar *log)
+{
+    const char *str = stub_object(obj)->failed ? "glstub: failed" : "";
+    if ((log != NULL) && (len > 0))
+        snprintf(log, (size_t) len, "%s", str);
+    if (outlen != NULL)
+        *outlen = (log != NULL) ? (GLsizei) strlen(log) : 0;
+} // stub_info_log
+
+static void APIENTRY stub_glGetShaderInfoLog(GLuint obj, GLsizei len,
+                                             GLsizei *outlen, GLchar *log)
+{
+    stub_calls[CALL_glGetShaderInfoLog]++;
+    stub_info_log(obj, len, outlen, log);
+} // stub_glGetShaderInfoLog
+
+static void APIENTRY stub_glGetProgramInfoLog(GLuint obj, GLsizei len,
+                                              GLsizei *outlen, GLchar *log)
+{
+    stub_calls[CALL_glGetProgramInfoLog]++;
+    stub_info_log(obj, len, outlen, log);
+} // stub_glGetProgramInfoLog
+
+// "name[n]" is n past "name", so arrays have consecutive locations.
+static GLint APIENTRY stub_glGetUniformLocation(GLuint program,
+                                                const GLchar *name)
+{
+    const char *bracket = strchr(name, '[');
+    const size_t len = bracket ? (size_t) (bracket - name) : strlen(name);
+    const int idx = stub_name_index(uniform_names, &uniform_name_count,
+                                    name, len, 1);
+    stub_calls[CALL_glGetUniformLocation]++;
+    if (idx < 0)
+        return -1;
+    return (idx * 1024) + (bracket ? atoi(bracket + 1) : 0);
+} // stub_glGetUniformLocation
+
+static GLint APIENTRY stub_glGetAttribLocation(GLuint program,
+                                               const GLchar *name)
+{
+    const int idx = stub_name_index(attrib_names, &attrib_name_count,
+                                    name, strlen(name), 1);
+    stub_calls[CALL_glGetAttribLocation]++;
+    return (idx < 0) ? -1 : (idx % 16);
+} // stub_glGetAttribLocation
+
+static GLuint APIENTRY stub_glGetUniformBlockIndex(GLuint program,
+                                                   const GLchar *name)
+{
+    stub_calls[CALL_glGetUniformBlockIndex]++;
+    return 0;
+} // stub_glGetUniformBlockIndex
+
+static void stub_gen(GLsizei n, GLuint *objs)
+{
+    GLsizei i;
+    for (i = 0; i < n; i++)
+        objs[i] = stub_new_object();
+} // stub_gen
+
+static void APIENTRY stub_glGenBuffers(GLsizei n, GLuint *objs)
+{
+    stub_calls[CALL_glGenBuffers]++;
+    stub_gen(n, objs);
+} // stub_glGenBuffers
+
+static void APIENTRY stub_glGenVertexArrays(GLsizei n, GLuint *objs)
+{
+    stub_calls[CALL_glGenVertexArrays]++;
+    stub_gen(n, objs);
+} // stub_glGenVertexArrays
+
+static void APIENTRY stub_glGenProgramPipelines(GLsizei n, GLuint *objs)
+{
+    stub_calls[CALL_glGenProgramPipelines]++;
+    stub_gen(n, objs);
+} // stub_glGenProgramPipelines
+
+static void APIENTRY stub_glGenProgramsARB(GLsizei n, GLuint *objs)
+{
+    stub_calls[CALL_glGenProgramsARB]++;
+    stub_gen(n, objs);
+} // stub_glGenProgramsARB
+
+static void APIENTRY stub_glGetProgramivARB(GLenum target, GLenum pname,
+                                            GLint *val)
+{
+    stub_calls[CALL_glGetProgramivARB]++;
+    *val = 256;
+} // stub_glGetProgramivARB
+
+// There's only ever one mapped buffer, MojoShader's uniform buffer ring.
+static void *APIENTRY stub_glMapBufferRange(GLenum target, GLintptr offset,
+                                            GLsizeiptr length,
+                                            GLbitfield access)
+{
+    stub_calls[CALL_glMapBufferRange]++;
+    free(mapped_buffer);
+    mapped_buffer = malloc((size_t) length);
+    return mapped_buffer;
+} // stub_glMapBufferRange
+
+static void APIENTRY stub_glBindBufferRange(GLenum target, GLuint idx,
+                                            GLuint buffer, GLintptr offset,
+                                            GLsizeiptr size)
+{
+    stub_calls[CALL_glBindBufferRange]++;
+    if ((idx < STUB_MAX_BLOCKS) && (mapped_buffer != NULL))
+    {
+        const GLsizeiptr len = (size < STUB_MAX_BLOCK_SIZE) ? size : STUB_MAX_BLOCK_SIZE;
+        memcpy(stub_uniform_blocks[idx], (char *) mapped_buffer + offset, len);
+        stub_uniform_block_sizes[idx] = size;
+    } // if
+} // stub_glBindBufferRange
+
+// These only ever touch the ring, too, and the stub runs them right away,
+//  which is the order the GL would run them in.
+static void APIENTRY stub_glBufferSubData(GLenum target, GLintptr offset,
+                                          GLsizeiptr size, const GLvoid *data)
+{
+    stub_calls[CALL_glBufferSubData]++;
+    if (mapped_buffer != NULL)
+        memcpy((char *) mapped_buffer + offset, data, (size_t) size);
+} // stub_glBufferSubData
+
+static void APIENTRY stub_glCopyBufferSubData(GLenum readtarget,
+                                              GLenum writetarget,
+                                              GLintptr readoffset,
+                                              GLintptr writeoffset,
+                                              GLsizeiptr size)
+{
+    stub_calls[CALL_glCopyBufferSubData]++;
+    if (mapped_buffer != NULL)
+    {
+        memmove((char *) mapped_buffer + writeoffset,
+                (char *) mapped_buffer + readoffset, (size_t) size);
+    } // if
+} // stub_glCopyBufferSubData
+
+static GLsync APIENTRY stub_glFenceSync(GLenum condition, GLbitfield flags)
+{
+    stub_calls[CALL_glFenceSync]++;
+    return (GLsync) 1;
+} // stub_glFenceSync
+
+static GLenum APIENTRY stub_glClientWaitSync(GLsync sync, GLbitfield flags,
+                                             GLuint64 timeout)
+{
+    stub_calls[CALL_glClientWaitSync]++;
+    return GL_ALREADY_SIGNALED;
+} // stub_glClientWaitSync
+
+// Uniform uploads: count them, and keep the values.
+static void stub_store_uniforms(GLint loc, GLsizei n, const GLfloat *f,
+                                const GLint *i, const int components)
+{
+    GLsizei j;
+    if (loc < 0)
+        return;
+    for (j = 0; (j < n) && (loc + j < STUB_MAX_UNIFORMS); j++)
+    {
+        if (f != NULL)
+            memcpy(stub_uniforms[loc + j].f, f + (j * 4), sizeof (GLfloat) * 4);
+        else
+            memcpy(stub_uniforms[loc + j].i, i + (j * components),
+                   sizeof (GLint) * components);
+    } // for
+} // stub_store_uniforms
+
+#define STUB_UNIFORM(fn, params, loc, n, f, i, components) \
+    static void APIENTRY stub_##fn params { \
+        stub_calls[CALL_##fn]++; \
+        stub_store_uniforms(loc, n, f, i, components); \
+    }
+
+STUB_UNIFORM(glUniform1i, (GLint loc, GLint v), loc, 1, NULL, &v, 1)
+STUB_UNIFORM(glUniform1iv, (GLint loc, GLsizei n, const GLint *v), loc, n, NULL, v, 1)
+STUB_UNIFORM(glUniform4fv, (GLint loc, GLsizei n, const GLfloat *v), loc, n, v, NULL, 4)
+STUB_UNIFORM(glUniform4iv, (GLint loc, GLsizei n, const GLint *v), loc, n, NULL, v, 4)
+STUB_UNIFORM(glProgramUniform1i, (GLuint p, GLint loc, GLint v), loc, 1, NULL, &v, 1)
+STUB_UNIFORM(glProgramUniform1iv, (GLuint p, GLint loc, GLsizei n, const GLint *v), loc, n, NULL, v, 1)
+STUB_UNIFORM(glProgramUniform4fv, (GLuint p, GLint loc, GLsizei n, const GLfloat *v), loc, n, v, NULL, 4)
+STUB_UNIFORM(glProgramUniform4iv, (GLuint p, GLint loc, GLsizei n, const GLint *v), loc, n, NULL, v, 4)
+
+#undef STUB_UNIFORM
+
+// ARB1 local parameters: always four components, floats or ints.
+static void stub_store_local_params(GLenum target, GLuint idx, GLsizei n,
+                                    const GLfloat *f, const GLint *i)
+{
+    StubUniform *params = stub_local_params[target == GL_FRAGMENT_PROGRAM_ARB];
+    GLsizei j;
+    for (j = 0; (j < n) && (idx + j < STUB_MAX_LOCAL_PARAMS); j++)
+    {
+        if (f != NULL)
+            memcpy(params[idx + j].f, f + (j * 4), sizeof (GLfloat) * 4);
+        else
+            memcpy(params[idx + j].i, i + (j * 4), sizeof (GLint) * 4);
+    } // for
+} // stub_store_local_params
+
+#define STUB_LOCAL(fn, params, target, idx, n, f, i) \
+    static void APIENTRY stub_##fn params { \
+        stub_calls[CALL_##fn]++; \
+        stub_store_local_params(target, idx, n, f, i); \
+    }
+
+STUB_LOCAL(glProgramLocalParameter4fvARB, (GLenum target, GLuint idx, const GLfloat *v), target, idx, 1, v, NULL)
+STUB_LOCAL(glProgramLocalParameters4fvEXT, (GLenum target, GLuint idx, GLsizei n, const GLfloat *v), target, idx, n, v, NULL)
+STUB_LOCAL(glProgramLocalParameterI4ivNV, (GLenum target, GLuint idx, const GLint *v), target, idx, 1, NULL, v)
+STUB_LOCAL(glProgramLocalParametersI4ivNV, (GLenum target, GLuint idx, GLsizei n, const GLint *v), target, idx, n, NULL, v)
+
+#undef STUB_LOCAL
+
+// Entry points that only need counting.
+#define STUB_VOID(fn, params) \
+    static void APIENTRY stub_##fn params { stub_calls[CALL_##fn]++; }
+
+STUB_VOID(glEnable, (GLenum cap))
+STUB_VOID(glDisable, (GLenum cap))
+STUB_VOID(glDeleteProgram, (GLuint program))
+STUB_VOID(glDeleteSync, (GLsync sync))
+STUB_VOID(glUseProgram, (GLuint program))
+STUB_VOID(glUseProgramStages, (GLuint pipeline, GLbitfield stages, GLuint p))
+STUB_VOID(glBindProgramPipeline, (GLuint pipeline))
+STUB_VOID(glActiveShaderProgram, (GLuint pipeline, GLuint p))
+STUB_VOID(glBindBuffer, (GLenum target, GLuint buffer))
+STUB_VOID(glUniformBlockBinding, (GLuint p, GLuint idx, GLuint binding))
+STUB_VOID(glVertexAttribPointer, (GLuint idx, GLint size, GLenum type, GLboolean norm, GLsizei stride, const void *ptr))
+STUB_VOID(glEnableVertexAttribArray, (GLuint idx))
+STUB_VOID(glDisableVertexAttribArray, (GLuint idx))
+STUB_VOID(glVertexAttribDivisor, (GLuint idx, GLuint divisor))
+STUB_VOID(glVertexAttribDivisorARB, (GLuint idx, GLuint divisor))
+STUB_VOID(glBindVertexArray, (GLuint vao))
+STUB_VOID(glBindProgramARB, (GLenum target, GLuint p))
+
+#undef STUB_VOID
+
+// !!! FIXME: Calling this through another function's prototype is only
+// !!! FIXME:  safe where the caller pops the arguments. That's everywhere
+// !!! FIXME:  but 32-bit Windows, where APIENTRY is __stdcall.
+static void APIENTRY stub_other(void)
+{
+    stub_calls[CALL_other]++;
+} // stub_other
+
+void *MOJOSHADERCALL stub_lookup(const char *fnname, void *data)
+{
+    static const struct { const char *name; void *fn; } stubs[] =
+    {
+        #define STUB(fn) { #fn, (void *) stub_##fn },
+        STUB_FUNCTIONS
+        #undef STUB
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof (stubs) / sizeof (stubs[0]); i++)
+    {
+        if (strcmp(stubs[i].name, fnname) == 0)
+            return stubs[i].fn;
+    } // for
+
+    return (void *) stub_other;
+} // stub_lookup
+
+GLint stub_uniform_location(const char *name)
+{
+    const int idx = stub_name_index(uniform_names, &uniform_name_count,
+                                    name, strlen(name), 0);
+    return (idx < 0) ? -1 : (idx * 1024);
+} // stub_uniform_location
+
+long stub_live_shaders(void)
+{
+    return (long) live_shaders;
+} // stub_live_shaders
+
+void stub_configure(const StubConfig *cfg)
+{
+    char *ptr;
+
+    config = cfg;
+    next_object = 0;
+    live_shaders = 0;
+    stub_no_binaries = 0;
+    stub_compile_polls = 0;
+    stub_fail_links = 0;
+    stub_link_usecs = 0;
+    memset(objects, '\0', sizeof (objects));
+    uniform_name_count = 0;
+    attrib_name_count = 0;
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    memset(stub_uniforms, '\0', sizeof (stub_uniforms));
+    memset(stub_uniform_blocks, '\0', sizeof (stub_uniform_blocks));
+    memset(stub_local_params, '\0', sizeof (stub_local_params));
+    memset(stub_uniform_block_sizes, '\0', sizeof (stub_uniform_block_sizes));
+
+    // glGetStringi() wants the extension string split up.
+    extension_count = 0;
+    snprintf(extension_buf, sizeof (extension_buf), "%s", cfg->extensions);
+    for (ptr = strtok(extension_buf, " "); ptr != NULL; ptr = strtok(NULL, " "))
+    {
+        if (extension_count < (int) (sizeof (extension_list) / sizeof (extension_list[0])))
+            extension_list[extension_count++] = ptr;
+    } // for
+} // stub_configure
+
+void stub_quit(void)
+{
+    free(mapped_buffer);
+    mapped_buffer = NULL;
+} // stub_quit
+
+const StubConfig stub_configs[] =
+{
+    {
+        "GL 2.1", MOJOSHADER_PROFILE_GLSL, "2.1 MojoShader stub", "1.20",
+        "GL_ARB_shader_objects GL_ARB_vertex_shader GL_ARB_fragment_shader "
+        "GL_ARB_shading_language_100 GL_ARB_instanced_arrays"
+    },
+    {
+        "GL 3.3 core", MOJOSHADER_PROFILE_GLSL120, "3.3 MojoShader stub", "3.30",
+        "GL_ARB_instanced_arrays GL_ARB_vertex_array_object "
+        "GL_ARB_uniform_buffer_object GL_ARB_map_buffer_range GL_ARB_sync"
+    },
+    {
+        "GL 4.5 core", MOJOSHADER_PROFILE_GLSL, "4.5 MojoShader stub", "4.50",
+        "GL_ARB_instanced_arrays GL_ARB_vertex_array_object "
+        "GL_ARB_uniform_buffer_object GL_ARB_map_buffer_range GL_ARB_sync "
+        "GL_ARB_buffer_storage GL_ARB_separate_shader_objects "
+        "GL_ARB_get_program_binary"
+    },
+    {
+        "GL 4.5 core", MOJOSHADER_PROFILE_GLSLUBO, "4.5 MojoShader stub", "4.50",
+        "GL_ARB_instanced_arrays GL_ARB_vertex_array_object "
+        "GL_ARB_uniform_buffer_object GL_ARB_map_buffer_range GL_ARB_sync "
+        "GL_ARB_buffer_storage GL_ARB_separate_shader_objects "
+        "GL_ARB_get_program_binary"
+    },
+    {
+        "GL 3.3 core", MOJOSHADER_PROFILE_GLSL330, "3.3 MojoShader stub", "3.30",
+        "GL_ARB_instanced_arrays GL_ARB_vertex_array_object "
+        "GL_ARB_uniform_buffer_object GL_ARB_map_buffer_range GL_ARB_sync"
+    },
+    {
+        "GL 4.5 core", MOJOSHADER_PROFILE_GLSL420, "4.5 MojoShader stub", "4.50",
+        "GL_ARB_instanced_arrays GL_ARB_vertex_array_object "
+        "GL_ARB_uniform_buffer_object GL_ARB_map_buffer_range GL_ARB_sync "
+        "GL_ARB_buffer_storage GL_ARB_separate_shader_objects "
+        "GL_ARB_get_program_binary GL_ARB_explicit_uniform_location"
+    },
+    {
+        "GL 2.1", MOJOSHADER_PROFILE_ARB1, "2.1 MojoShader stub", "1.20",
+        "GL_ARB_vertex_program GL_ARB_fragment_program "
+        "GL_EXT_gpu_program_parameters GL_ARB_instanced_arrays"
+    },
+};
+
+const int stub_config_count = (int) (sizeof (stub_configs) / sizeof (stub_configs[0]));
+
+
+// Building shaders...
+
+size_t stub_build_shader(unsigned int *out, const unsigned int version,
+                         const CtabConstant *constants, const int count,
+                         const unsigned int *body, const size_t bodylen)
+{
+    static const char creator[] = "glstub";
+    const char *target = (version == VERSION_VS_2_0) ? "vs_2_0" : "ps_2_0";
+    unsigned char ctab[1024];
+    unsigned int *header = (unsigned int *) ctab;
+    size_t pos = 28 + (count * 20) + (count * 16);
+    size_t ctabwords;
+    size_t outwords = 0;
+    int i;
+
+    memset(ctab, '\0', sizeof (ctab));
+
+    #define ADD_STRING(str, offsetptr) { \
+        *(offsetptr) = (unsigned int) pos; \
+        strcpy((char *) ctab + pos, str); \
+        pos += strlen(str) + 1; \
+    }
+
+    header[0] = 28;  // sizeof (D3DXSHADER_CONSTANTTABLE)
+    ADD_STRING(creator, &header[1]);
+    header[2] = version;
+    header[3] = (unsigned int) count;
+    header[4] = 28;
+    ADD_STRING(target, &header[6]);
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned char *info = ctab + 28 + (i * 20);
+        unsigned short *type = (unsigned short *) (ctab + 28 + (count * 20) + (i * 16));
+        unsigned short *regs = (unsigned short *) (info + 4);
+        unsigned int *offsets = (unsigned int *) info;
+        ADD_STRING(constants[i].name, &offsets[0]);
+        regs[0] = (unsigned short) constants[i].regset;
+        regs[1] = (unsigned short) constants[i].regindex;
+        regs[2] = (unsigned short) constants[i].regcount;
+        offsets[3] = 28 + (count * 20) + (i * 16);
+        type[0] = (unsigned short) constants[i].symclass;
+        type[1] = (unsigned short) constants[i].type;
+        type[2] = (unsigned short) constants[i].rows;
+        type[3] = (unsigned short) constants[i].columns;
+        type[4] = 1;  // elements
+    } // for
+
+    #undef ADD_STRING
+
+    ctabwords = (pos + 3) / 4;
+    out[outwords++] = version;
+    out[outwords++] = 0xFFFE | ((unsigned int) (ctabwords + 1) << 16);
+    out[outwords++] = CTAB_ID;
+    memcpy(out + outwords, ctab, ctabwords * 4);
+    outwords += ctabwords;
+    memcpy(out + outwords, body, bodylen);
+    outwords += bodylen / sizeof (unsigned int);
+    return outwords * sizeof (unsigned int);
+} // stub_build_shader
+
+// A sprite shader: MatrixTransform in c0-c3, DiffuseColor in c4.
+static const CtabConstant vs_constants[] =
+{
+    { "MatrixTransform", MOJOSHADER_SYMREGSET_FLOAT4, 0, 4, MOJOSHADER_SYMCLASS_MATRIX_COLUMNS, 4, 4, MOJOSHADER_SYMTYPE_FLOAT },
+    { "DiffuseColor", MOJOSHADER_SYMREGSET_FLOAT4, 4, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+};
+
+static const unsigned int vs_body[] =
+{
+    OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+    OP_DCL, 0x80000005, DST(REG_INPUT, 1, 0xF),  // dcl_texcoord v1
+    OP_DCL, 0x8000000A, DST(REG_INPUT, 2, 0xF),  // dcl_color v2
+    OP_DP4, DST(REG_RASTOUT, 0, 0x1), SRC(REG_INPUT, 0), SRC(REG_CONST, 0),
+    OP_DP4, DST(REG_RASTOUT, 0, 0x2), SRC(REG_INPUT, 0), SRC(REG_CONST, 1),
+    OP_DP4, DST(REG_RASTOUT, 0, 0x4), SRC(REG_INPUT, 0), SRC(REG_CONST, 2),
+    OP_DP4, DST(REG_RASTOUT, 0, 0x8), SRC(REG_INPUT, 0), SRC(REG_CONST, 3),
+    OP_MOV, DST(REG_TEXCRDOUT, 0, 0xF), SRC(REG_INPUT, 1),
+    OP_MUL, DST(REG_ATTROUT, 0, 0xF), SRC(REG_INPUT, 2), SRC(REG_CONST, 4),
+    OP_END
+};
+
+// Texture times vertex color, and a tinted version with Tint in c0.
+static const CtabConstant ps_tint_constants[] =
+{
+    { "Tint", MOJOSHADER_SYMREGSET_FLOAT4, 0, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+};
+
+static const unsigned int ps_body[] =
+{
+    OP_DCL, 0x80000000, DST(REG_TEXTURE, 0, 0xF),  // dcl t0
+    OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl v0
+    OP_DCL, 0x90000000, DST(REG_SAMPLER, 0, 0xF),  // dcl_2d s0
+    OP_TEX, DST(REG_TEMP, 0, 0xF), SRC(REG_TEXTURE, 0), SRC(REG_SAMPLER, 0),
+    OP_MUL, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_INPUT, 0),
+    OP_MOV, DST(REG_COLOROUT, 0, 0xF), SRC(REG_TEMP, 0),
+    OP_END
+};
+
+static const unsigned int ps_tint_body[] =
+{
+    OP_DCL, 0x80000000, DST(REG_TEXTURE, 0, 0xF),  // dcl t0
+    OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl v0
+    OP_DCL, 0x90000000, DST(REG_SAMPLER, 0, 0xF),  // dcl_2d s0
+    OP_TEX, DST(REG_TEMP, 0, 0xF), SRC(REG_TEXTURE, 0), SRC(REG_SAMPLER, 0),
+    OP_MUL, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_INPUT, 0),
+    OP_MUL, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 0),
+    OP_MOV, DST(REG_COLOROUT, 0, 0xF), SRC(REG_TEMP, 0),
+    OP_END
+};
+
+
+// Building the effect...
+
+static void *MOJOSHADERCALL stub_malloc(int bytes, void *data)
+{
+    return malloc((size_t) bytes);
+} // stub_malloc
+
+static void MOJOSHADERCALL stub_free(void *ptr, void *data)
+{
+    free(ptr);
+} // stub_free
+
+static void set_param(MOJOSHADER_effectParam *param, const char *name,
+                      MOJOSHADER_symbolClass symclass, unsigned int rows,
+                      float *values)
+{
+    memset(param, '\0', sizeof (*param));
+    param->value.name = name;
+    param->value.type.parameter_class = symclass;
+    param->value.type.parameter_type = MOJOSHADER_SYMTYPE_FLOAT;
+    param->value.type.rows = rows;
+    param->value.type.columns = 4;
+    param->value.value_count = rows * 4;
+    param->value.valuesF = values;
+} // set_param
+
+static int set_shader(StubEffect *fx, const int obj,
+                      const MOJOSHADER_symbolType type,
+                      const MOJOSHADER_parseData *pd,
+                      unsigned int *params)
+{
+    MOJOSHADER_effectShader *shader = &fx->objects[obj].shader;
+    if ((pd == NULL) || (pd->error_count > 0))
+    {
+        fprintf(stderr, "shader %d: %s\n", obj,
+                pd ? pd->errors[0].error : "out of memory");
+        MOJOSHADER_freeParseData(pd);
+        return 0;
+    } // if
+    fx->objects[obj].type = type;
+    shader->type = type;
+    shader->param_count = (unsigned int) pd->symbol_count;
+    shader->params = params;
+    shader->shader = pd;
+    return 1;
+} // set_shader
+
+static void set_pass(StubEffect *fx, const int technique,
+                     const char *name, const int ps_obj)
+{
+    MOJOSHADER_effectState *states = fx->states[technique];
+    MOJOSHADER_effectPass *pass = &fx->passes[technique];
+    MOJOSHADER_effectTechnique *tech = &fx->techniques[technique];
+
+    memset(states, '\0', sizeof (fx->states[technique]));
+    states[0].type = MOJOSHADER_RS_VERTEXSHADER;
+    states[0].value.valuesI = &fx->object_index[OBJ_VS];
+    states[1].type = MOJOSHADER_RS_PIXELSHADER;
+    states[1].value.valuesI = &fx->object_index[ps_obj];
+    states[2].type = MOJOSHADER_RS_ALPHABLENDENABLE;
+    states[2].value.valuesI = &fx->blend_enable;
+    states[3].type = MOJOSHADER_RS_CULLMODE;
+    states[3].value.valuesI = &fx->cull_mode;
+
+    memset(pass, '\0', sizeof (*pass));
+    pass->name = name;
+    pass->state_count = 4;
+    pass->states = states;
+
+    memset(tech, '\0', sizeof (*tech));
+    tech->name = name;
+    tech->pass_count = 1;
+    tech->passes = pass;
+} // set_pass
+
+StubEffect *stub_create_effect(const char *profile)
+{
+    unsigned int vs[256], ps[256], ps_tint[256];
+    size_t vslen, pslen, ps_tintlen;
+    StubEffect *fx = (StubEffect *) calloc(1, sizeof (StubEffect));
+    int i;
+
+    if (fx == NULL)
+        return NULL;
+
+    vslen = stub_build_shader(vs, VERSION_VS_2_0, vs_constants, 2,
+                              vs_body, sizeof (vs_body));
+    pslen = stub_build_shader(ps, VERSION_PS_2_0, NULL, 0,
+                              ps_body, sizeof (ps_body));
+    ps_tintlen = stub_build_shader(ps_tint, VERSION_PS_2_0,
+                                   ps_tint_constants, 1,
+                                   ps_tint_body, sizeof (ps_tint_body));
+
+    for (i = 0; i < OBJ_COUNT; i++)
+        fx->object_index[i] = i;
+    fx->vs_params[0] = PARAM_MATRIX;
+    fx->vs_params[1] = PARAM_COLOR;
+    fx->ps_tint_params[0] = PARAM_TINT;
+
+    #define PARSE(buf, len) \
+        MOJOSHADER_parse(profile, NULL, (const unsigned char *) buf, \
+                         (unsigned int) len, NULL, 0, NULL, 0, \
+                         stub_malloc, stub_free, NULL)
+
+    if ( (!set_shader(fx, OBJ_VS, MOJOSHADER_SYMTYPE_VERTEXSHADER,
+                      PARSE(vs, vslen), fx->vs_params)) ||
+         (!set_shader(fx, OBJ_PS, MOJOSHADER_SYMTYPE_PIXELSHADER,
+                      PARSE(ps, pslen), NULL)) ||
+         (!set_shader(fx, OBJ_PS_TINT, MOJOSHADER_SYMTYPE_PIXELSHADER,
+                      PARSE(ps_tint, ps_tintlen), fx->ps_tint_params)) )
+    {
+        for (i = 0; i < OBJ_COUNT; i++)
+            MOJOSHADER_freeParseData(fx->objects[i].shader.shader);
+        free(fx);
+        return NULL;
+    } // if
+
+    #undef PARSE
+
+    set_param(&fx->params[PARAM_MATRIX], "MatrixTransform",
+              MOJOSHADER_SYMCLASS_MATRIX_COLUMNS, 4, fx->storage);
+    set_param(&fx->params[PARAM_COLOR], "DiffuseColor",
+              MOJOSHADER_SYMCLASS_VECTOR, 1, fx->storage + 16);
+    set_param(&fx->params[PARAM_TINT], "Tint",
+              MOJOSHADER_SYMCLASS_VECTOR, 1, fx->storage + 20);
+
+    fx->blend_enable = 1;
+    fx->cull_mode = 1;
+    set_pass(fx, 0, "Sprite", OBJ_PS);
+    set_pass(fx, 1, "TintedSprite", OBJ_PS_TINT);
+
+    fx->effect.profile = profile;
+    fx->effect.param_count = PARAM_COUNT;
+    fx->effect.params = fx->params;
+    fx->effect.technique_count = 2;
+    fx->effect.techniques = fx->techniques;
+    fx->effect.current_technique = &fx->techniques[0];
+    fx->effect.current_pass = -1;
+    fx->effect.object_count = OBJ_COUNT;
+    fx->effect.objects = fx->objects;
+    fx->effect.malloc = stub_malloc;
+    fx->effect.free = stub_free;
+    fx->effect.param_storage_size = sizeof (fx->storage);
+    fx->effect.param_storage = fx->storage;
+    return fx;
+} // stub_create_effect
+
+void stub_destroy_effect(StubEffect *fx)
+{
+    int i;
+    for (i = 0; i < OBJ_COUNT; i++)
+        MOJOSHADER_freeParseData(fx->objects[i].shader.shader);
+    free(fx);
+} // stub_destroy_effect
+
+// end of glstub.c ...
+
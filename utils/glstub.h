@@ -0,0 +1,269 @@
+/**
+ * MojoShader; generate shader programs from bytecode of compiled
+ *  Direct3D shaders.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by the MojoShader contributors.
+ */
+
+// The stub GL shared by glbench and gltest. It answers just enough queries
+//  for MOJOSHADER_glCreateContext() to succeed, counts every call it gets,
+//  and remembers the uniforms it was handed, so the tests can check what
+//  actually reached the "GPU". There's no GPU work at all.
+//
+// Call counts and uniforms are per thread; everything else is shared, and
+//  stub_configure() must be called before any other thread touches the GL.
+
+#ifndef _INCL_GLSTUB_H_
+#define _INCL_GLSTUB_H_
+
+#include "mojoshader.h"
+#include "mojoshader_effects.h"
+
+#define GL_GLEXT_LEGACY 1
+#include "GL/gl.h"
+#include "GL/glext.h"
+
+#ifndef MOJOSHADER_EFFECT_SUPPORT
+#error The stub GL needs MOJOSHADER_EFFECT_SUPPORT.
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+#ifdef _MSC_VER
+#define STUB_THREADLOCAL __declspec(thread)
+#else
+#define STUB_THREADLOCAL __thread
+#endif
+
+
+// The stub GL...
+
+// Every entry point we have a real stub for. Anything else MojoShader asks
+//  for gets a stub that does nothing and returns nothing.
+#define STUB_FUNCTIONS \
+    STUB(glGetString) \
+    STUB(glGetStringi) \
+    STUB(glGetIntegerv) \
+    STUB(glGetError) \
+    STUB(glEnable) \
+    STUB(glDisable) \
+    STUB(glCreateShader) \
+    STUB(glCompileShader) \
+    STUB(glDeleteShader) \
+    STUB(glCreateProgram) \
+    STUB(glDeleteProgram) \
+    STUB(glLinkProgram) \
+    STUB(glProgramBinary) \
+    STUB(glGetProgramBinary) \
+    STUB(glGetShaderiv) \
+    STUB(glGetProgramiv) \
+    STUB(glGetShaderInfoLog) \
+    STUB(glGetProgramInfoLog) \
+    STUB(glGetUniformLocation) \
+    STUB(glGetAttribLocation) \
+    STUB(glGetUniformBlockIndex) \
+    STUB(glGenBuffers) \
+    STUB(glGenVertexArrays) \
+    STUB(glGenProgramPipelines) \
+    STUB(glGenProgramsARB) \
+    STUB(glGetProgramivARB) \
+    STUB(glMapBufferRange) \
+    STUB(glFenceSync) \
+    STUB(glClientWaitSync) \
+    STUB(glDeleteSync) \
+    STUB(glUseProgram) \
+    STUB(glUniform1i) \
+    STUB(glUniform1iv) \
+    STUB(glUniform4fv) \
+    STUB(glUniform4iv) \
+    STUB(glProgramUniform1i) \
+    STUB(glProgramUniform1iv) \
+    STUB(glProgramUniform4fv) \
+    STUB(glProgramUniform4iv) \
+    STUB(glUseProgramStages) \
+    STUB(glBindProgramPipeline) \
+    STUB(glActiveShaderProgram) \
+    STUB(glBindBuffer) \
+    STUB(glBindBufferRange) \
+    STUB(glBufferSubData) \
+    STUB(glCopyBufferSubData) \
+    STUB(glUniformBlockBinding) \
+    STUB(glVertexAttribPointer) \
+    STUB(glEnableVertexAttribArray) \
+    STUB(glDisableVertexAttribArray) \
+    STUB(glVertexAttribDivisor) \
+    STUB(glVertexAttribDivisorARB) \
+    STUB(glBindVertexArray) \
+    STUB(glBindProgramARB) \
+    STUB(glProgramLocalParameter4fvARB) \
+    STUB(glProgramLocalParameters4fvEXT) \
+    STUB(glProgramLocalParameterI4ivNV) \
+    STUB(glProgramLocalParametersI4ivNV) \
+    STUB(other)
+
+typedef enum StubFunction
+{
+    #define STUB(fn) CALL_##fn,
+    STUB_FUNCTIONS
+    #undef STUB
+    CALL_TOTAL
+} StubFunction;
+
+extern const char *stub_names[CALL_TOTAL];
+extern STUB_THREADLOCAL unsigned long long stub_calls[CALL_TOTAL];
+
+// What the stub claims to be.
+typedef struct StubConfig
+{
+    const char *name;
+    const char *profile;
+    const char *version;
+    const char *glsl_version;
+    const char *extensions;  // space separated.
+} StubConfig;
+
+// One config per profile we can drive, GL 2.1 GLSL first, ARB1 last.
+extern const StubConfig stub_configs[];
+extern const int stub_config_count;
+
+// Uniforms land here, by location. glGetUniformLocation() numbers names as
+//  it first sees them and puts "name[n]" n past "name", so an array's
+//  elements are stub_uniforms[stub_uniform_location("name") + n].
+#define STUB_MAX_UNIFORMS (16 * 1024)
+typedef union StubUniform
+{
+    GLfloat f[4];
+    GLint i[4];
+} StubUniform;
+
+extern STUB_THREADLOCAL StubUniform stub_uniforms[STUB_MAX_UNIFORMS];
+
+// What each uniform buffer binding held when glBindBufferRange() last
+//  pointed it into the mapped buffer.
+#define STUB_MAX_BLOCKS 4
+#define STUB_MAX_BLOCK_SIZE 4096
+extern STUB_THREADLOCAL unsigned char stub_uniform_blocks[STUB_MAX_BLOCKS][STUB_MAX_BLOCK_SIZE];
+extern STUB_THREADLOCAL GLsizeiptr stub_uniform_block_sizes[STUB_MAX_BLOCKS];
+
+// ARB1 program local parameters land here, by index, vertex programs in
+//  [0] and fragment programs in [1].
+#define STUB_MAX_LOCAL_PARAMS 256
+extern STUB_THREADLOCAL StubUniform stub_local_params[2][STUB_MAX_LOCAL_PARAMS];
+
+// Locations are handed out by name, so a test can ask where one went.
+//  Returns -1 if MojoShader never asked for (name).
+GLint stub_uniform_location(const char *name);
+
+// Count calls from scratch, and forget every name and uniform, for (cfg).
+void stub_configure(const StubConfig *cfg);
+
+// Free what the stub allocated on this thread.
+void stub_quit(void);
+
+// Pass this to MOJOSHADER_glCreateContext().
+void *MOJOSHADERCALL stub_lookup(const char *fnname, void *data);
+
+// GL shader objects created and not yet deleted, on any thread.
+long stub_live_shaders(void);
+
+// Program binaries from glGetProgramBinary() always load, unless they've
+//  been tampered with. Set this to act like a driver that never has a
+//  binary to hand out.
+extern int stub_no_binaries;
+
+// With GL_KHR_parallel_shader_compile in the config's extensions, shaders
+//  compiled and programs linked from now on answer GL_FALSE to this many
+//  GL_COMPLETION_STATUS_KHR queries before they're done.
+extern int stub_compile_polls;
+
+// Programs linked from now on fail to link.
+extern int stub_fail_links;
+
+// glLinkProgram() takes at least this many microseconds from now on.
+extern int stub_link_usecs;
+
+
+// Building shaders...
+
+// Shader model 2 token helpers. See the D3D9 docs for the encoding.
+#define VERSION_VS_2_0 0xFFFE0200
+#define VERSION_PS_2_0 0xFFFF0200
+#define CTAB_ID 0x42415443  // 'CTAB'
+#define REG(type, num) (0x80000000 | (((type) & 0x7) << 28) | \
+                        (((type) & 0x18) << 8) | (num))
+#define DST(type, num, mask) (REG(type, num) | ((mask) << 16))
+#define SRC(type, num) (REG(type, num) | (0xE4 << 16))  // .xyzw
+#define REG_TEMP 0
+#define REG_INPUT 1
+#define REG_CONST 2
+#define REG_TEXTURE 3
+#define REG_RASTOUT 4
+#define REG_ATTROUT 5
+#define REG_TEXCRDOUT 6
+#define REG_COLOROUT 8
+#define REG_SAMPLER 10
+#define OP(opcode, len) (((len) << 24) | (opcode))
+#define OP_MOV OP(0x01, 2)
+#define OP_ADD OP(0x02, 3)
+#define OP_MUL OP(0x05, 3)
+#define OP_DP4 OP(0x09, 3)
+#define OP_DCL OP(0x1F, 2)
+#define OP_TEX OP(0x42, 3)
+#define OP_END 0x0000FFFF
+
+typedef struct CtabConstant
+{
+    const char *name;
+    MOJOSHADER_symbolRegisterSet regset;
+    unsigned int regindex;
+    unsigned int regcount;
+    MOJOSHADER_symbolClass symclass;
+    unsigned int rows;
+    unsigned int columns;
+    MOJOSHADER_symbolType type;
+} CtabConstant;
+
+// Writes (version), a constant table for (constants), then (body) to (out).
+//  Returns the length in bytes.
+size_t stub_build_shader(unsigned int *out, const unsigned int version,
+                         const CtabConstant *constants, const int count,
+                         const unsigned int *body, const size_t bodylen);
+
+
+// Building the effect...
+
+// This is the layout MOJOSHADER_parseEffect() would give us for a sprite
+//  effect with two techniques, minus the parts the GL glue doesn't read.
+//  MatrixTransform is in c0-c3 and DiffuseColor in c4 of the vertex shader,
+//  the pixel shader is texture times vertex color, and the tinted one
+//  multiplies by Tint in c0.
+enum { PARAM_MATRIX, PARAM_COLOR, PARAM_TINT, PARAM_COUNT };
+enum { OBJ_VS, OBJ_PS, OBJ_PS_TINT, OBJ_COUNT };
+
+typedef struct StubEffect
+{
+    MOJOSHADER_effect effect;
+    MOJOSHADER_effectParam params[PARAM_COUNT];
+    MOJOSHADER_effectObject objects[OBJ_COUNT];
+    MOJOSHADER_effectTechnique techniques[2];
+    MOJOSHADER_effectPass passes[2];
+    MOJOSHADER_effectState states[2][4];
+    unsigned int vs_params[2];
+    unsigned int ps_tint_params[1];
+    int object_index[OBJ_COUNT];
+    int blend_enable;
+    int cull_mode;
+    float storage[16 + 4 + 4];
+} StubEffect;
+
+StubEffect *stub_create_effect(const char *profile);
+void stub_destroy_effect(StubEffect *fx);
+
+#endif  // _INCL_GLSTUB_H_
+
+// end of glstub.h ...
+
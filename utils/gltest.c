@@ -0,0 +1,2009 @@
+/**
+ * MojoShader; generate shader programs from bytecode of compiled
+ *  Direct3D shaders.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by the MojoShader contributors.
+ */
+
+// Regression tests for the OpenGL glue, run against the stub GL in glstub.c.
+//  "gltest name" runs one test, "gltest" runs them all. The stub counts
+//  every GL call and keeps every uniform it's handed, so these check what
+//  MojoShader actually sends to the GL, not just that it didn't crash.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "glstub.h"
+
+#define CHECK(x) \
+    do { \
+        if (!(x)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", \
+                    __FILE__, __LINE__, #x); \
+            return 0; \
+        } \
+    } while (0)
+
+#define CHECK_NO_ERROR() \
+    do { \
+        const char *err = MOJOSHADER_glGetError(); \
+        if (*err != '\0') \
+        { \
+            fprintf(stderr, "%s:%d: unexpected error: %s\n", \
+                    __FILE__, __LINE__, err); \
+            return 0; \
+        } \
+    } while (0)
+
+
+// Helpers...
+
+// Configure the stub as (cfg) and make a current context for it.
+static MOJOSHADER_glContext *create_context(const StubConfig *cfg)
+{
+    MOJOSHADER_glContext *ctx;
+    stub_configure(cfg);
+    ctx = MOJOSHADER_glCreateContext(cfg->profile, stub_lookup, NULL,
+                                     NULL, NULL, NULL);
+    if (ctx == NULL)
+        fprintf(stderr, "%s %s: %s\n", cfg->name, cfg->profile,
+                MOJOSHADER_glGetError());
+    else
+        MOJOSHADER_glMakeContextCurrent(ctx);
+    return ctx;
+} // create_context
+
+static void destroy_context(MOJOSHADER_glContext *ctx)
+{
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glMakeContextCurrent(NULL);
+    MOJOSHADER_glDestroyContext(ctx);
+    stub_quit();
+} // destroy_context
+
+// One pass of the sprite effect, and the ProgramReady() before a draw.
+static void draw_pass(MOJOSHADER_glEffect *glEffect, const unsigned int pass)
+{
+    MOJOSHADER_effectStateChanges changes;
+    unsigned int passes = 0;
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, pass);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+} // draw_pass
+
+static void *MOJOSHADERCALL test_malloc(int bytes, void *data)
+{
+    return malloc((size_t) bytes);
+} // test_malloc
+
+static void MOJOSHADERCALL test_free(void *ptr, void *data)
+{
+    free(ptr);
+} // test_free
+
+// Just enough threads to run a test function elsewhere and get its result.
+typedef struct TestThread
+{
+    int (*fn)(void *data);
+    void *data;
+    int result;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t thread;
+#endif
+} TestThread;
+
+#ifdef _WIN32
+static DWORD WINAPI test_thread_main(LPVOID _t)
+{
+    TestThread *t = (TestThread *) _t;
+    t->result = t->fn(t->data);
+    return 0;
+} // test_thread_main
+
+static int start_thread(TestThread *t, int (*fn)(void *), void *data)
+{
+    t->fn = fn;
+    t->data = data;
+    t->result = 0;
+    t->handle = CreateThread(NULL, 0, test_thread_main, t, 0, NULL);
+    return (t->handle != NULL);
+} // start_thread
+
+static int join_thread(TestThread *t)
+{
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    return t->result;
+} // join_thread
+
+static void yield_thread(void)
+{
+    Sleep(0);
+} // yield_thread
+#else
+static void *test_thread_main(void *_t)
+{
+    TestThread *t = (TestThread *) _t;
+    t->result = t->fn(t->data);
+    return NULL;
+} // test_thread_main
+
+static int start_thread(TestThread *t, int (*fn)(void *), void *data)
+{
+    t->fn = fn;
+    t->data = data;
+    t->result = 0;
+    return (pthread_create(&t->thread, NULL, test_thread_main, t) == 0);
+} // start_thread
+
+static int join_thread(TestThread *t)
+{
+    pthread_join(t->thread, NULL);
+    return t->result;
+} // join_thread
+
+static void yield_thread(void)
+{
+    sched_yield();
+} // yield_thread
+#endif
+
+// A one-pass effect: a vertex shader with a parameter per constant, and a
+//  pixel shader that just passes t0 through. Parameter values are laid
+//  out back to back in (storage), a whole register (4 values) per row.
+#define MAX_TEST_PARAMS 8
+typedef struct TestEffect
+{
+    MOJOSHADER_effect effect;
+    MOJOSHADER_effectParam params[MAX_TEST_PARAMS];
+    MOJOSHADER_effectObject objects[2];
+    MOJOSHADER_effectTechnique technique;
+    MOJOSHADER_effectPass pass;
+    MOJOSHADER_effectState states[2];
+    unsigned int vs_params[MAX_TEST_PARAMS];
+    int object_index[2];
+    float storage[1024];
+} TestEffect;
+
+static const unsigned int ps_passthrough_body[] =
+{
+    OP_DCL, 0x80000000, DST(REG_TEXTURE, 0, 0xF),  // dcl t0
+    OP_MOV, DST(REG_COLOROUT, 0, 0xF), SRC(REG_TEXTURE, 0),
+    OP_END
+};
+
+static const MOJOSHADER_parseData *test_parse(const char *profile,
+                                              const unsigned int *buf,
+                                              const size_t len)
+{
+    const MOJOSHADER_parseData *pd;
+    pd = MOJOSHADER_parse(profile, NULL, (const unsigned char *) buf,
+                          (unsigned int) len, NULL, 0, NULL, 0,
+                          test_malloc, test_free, NULL);
+    if (pd->error_count > 0)
+    {
+        fprintf(stderr, "parse: %s\n", pd->errors[0].error);
+        MOJOSHADER_freeParseData(pd);
+        return NULL;
+    } // if
+    return pd;
+} // test_parse
+
+static TestEffect *create_test_effect(const char *profile,
+                                      const CtabConstant *constants,
+                                      const int count,
+                                      const unsigned int *vs_body,
+                                      const size_t vs_bodylen)
+{
+    static unsigned int vs[2048], ps[256];
+    const size_t vslen = stub_build_shader(vs, VERSION_VS_2_0, constants,
+                                           count, vs_body, vs_bodylen);
+    const size_t pslen = stub_build_shader(ps, VERSION_PS_2_0, NULL, 0,
+                                           ps_passthrough_body,
+                                           sizeof (ps_passthrough_body));
+    TestEffect *fx = (TestEffect *) calloc(1, sizeof (TestEffect));
+    const MOJOSHADER_parseData *vspd = test_parse(profile, vs, vslen);
+    const MOJOSHADER_parseData *pspd = test_parse(profile, ps, pslen);
+    unsigned int offset = 0;
+    int i;
+
+    if ((fx == NULL) || (vspd == NULL) || (pspd == NULL) ||
+        (count > MAX_TEST_PARAMS) ||
+        (vspd->symbol_count != count))
+    {
+        MOJOSHADER_freeParseData(vspd);
+        MOJOSHADER_freeParseData(pspd);
+        free(fx);
+        return NULL;
+    } // if
+
+    for (i = 0; i < count; i++)
+    {
+        MOJOSHADER_effectValue *value = &fx->params[i].value;
+        value->name = constants[i].name;
+        value->type.parameter_class = constants[i].symclass;
+        value->type.parameter_type = constants[i].type;
+        value->type.rows = constants[i].rows;
+        value->type.columns = constants[i].columns;
+        value->value_count = constants[i].regcount * 4;
+        value->valuesF = fx->storage + offset;
+        offset += value->value_count;
+        fx->vs_params[i] = i;
+    } // for
+
+    fx->object_index[0] = 0;
+    fx->object_index[1] = 1;
+    fx->objects[0].type = MOJOSHADER_SYMTYPE_VERTEXSHADER;
+    fx->objects[0].shader.type = MOJOSHADER_SYMTYPE_VERTEXSHADER;
+    fx->objects[0].shader.param_count = (unsigned int) count;
+    fx->objects[0].shader.params = fx->vs_params;
+    fx->objects[0].shader.shader = vspd;
+    fx->objects[1].type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    fx->objects[1].shader.type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    fx->objects[1].shader.shader = pspd;
+
+    fx->states[0].type = MOJOSHADER_RS_VERTEXSHADER;
+    fx->states[0].value.valuesI = &fx->object_index[0];
+    fx->states[1].type = MOJOSHADER_RS_PIXELSHADER;
+    fx->states[1].value.valuesI = &fx->object_index[1];
+    fx->pass.name = "Test";
+    fx->pass.state_count = 2;
+    fx->pass.states = fx->states;
+    fx->technique.name = "Test";
+    fx->technique.pass_count = 1;
+    fx->technique.passes = &fx->pass;
+
+    fx->effect.profile = profile;
+    fx->effect.param_count = count;
+    fx->effect.params = fx->params;
+    fx->effect.technique_count = 1;
+    fx->effect.techniques = &fx->technique;
+    fx->effect.current_technique = &fx->technique;
+    fx->effect.current_pass = -1;
+    fx->effect.object_count = 2;
+    fx->effect.objects = fx->objects;
+    fx->effect.malloc = test_malloc;
+    fx->effect.free = test_free;
+    fx->effect.param_storage_size = sizeof (fx->storage);
+    fx->effect.param_storage = fx->storage;
+    return fx;
+} // create_test_effect
+
+// Draw both passes of the sprite effect on a fresh context for (cfg),
+//  using the program binary cache in (dir), and get the context's stats.
+static int draw_with_binary_cache(const StubConfig *cfg, const char *dir,
+                                  const int no_binaries,
+                                  MOJOSHADER_glStats *stats)
+{
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect = NULL;
+    StubEffect *fx = NULL;
+    int retval = 0;
+
+    if (ctx == NULL)
+        return 0;
+
+    stub_no_binaries = no_binaries;
+    if (!MOJOSHADER_glSetProgramBinaryCache(dir))
+        fprintf(stderr, "no program binary cache: %s\n", MOJOSHADER_glGetError());
+    else if ((fx = stub_create_effect(cfg->profile)) == NULL)
+        fprintf(stderr, "couldn't build the sprite effect\n");
+    else if ((glEffect = MOJOSHADER_glCompileEffect(&fx->effect)) == NULL)
+        fprintf(stderr, "compile: %s\n", MOJOSHADER_glGetError());
+    else
+    {
+        draw_pass(glEffect, 0);
+        draw_pass(glEffect, 1);
+        retval = 1;
+    } // else
+
+    MOJOSHADER_glGetStats(stats);
+    if (glEffect != NULL)
+    {
+        MOJOSHADER_glBindProgram(NULL);
+        MOJOSHADER_glDeleteEffect(glEffect);
+    } // if
+    if (fx != NULL)
+        stub_destroy_effect(fx);
+    destroy_context(ctx);
+    return retval;
+} // draw_with_binary_cache
+
+typedef enum CacheFileOp { CACHE_COUNT, CACHE_TRUNCATE, CACHE_TAMPER } CacheFileOp;
+
+// Mess with every file in the program binary cache, and count them.
+static int program_binary_files(const char *dir, const CacheFileOp op)
+{
+    char path[1024];
+    char buf[256];
+    int retval = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find;
+    snprintf(path, sizeof (path), "%s\\*.bin", dir);
+    find = FindFirstFileA(path, &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return 0;
+    do
+    {
+        const char *name = data.cFileName;
+#else
+    struct dirent *dent;
+    DIR *dirp = opendir(dir);
+    if (dirp == NULL)
+        return 0;
+    while ((dent = readdir(dirp)) != NULL)
+    {
+        const char *name = dent->d_name;
+        const size_t len = strlen(name);
+        if ((len < 4) || (strcmp(name + len - 4, ".bin") != 0))
+            continue;
+#endif
+        snprintf(path, sizeof (path), "%s/%s", dir, name);
+        retval++;
+        if (op != CACHE_COUNT)
+        {
+            FILE *io = fopen(path, "rb");
+            size_t len = 0;
+            if (io != NULL)
+            {
+                len = fread(buf, 1, sizeof (buf), io);
+                fclose(io);
+            } // if
+            if ((len > 0) && ((io = fopen(path, "wb")) != NULL))
+            {
+                if (op == CACHE_TRUNCATE)
+                    len--;
+                else
+                    buf[len - 1] ^= 0xFF;  // the end of the binary itself.
+                fwrite(buf, len, 1, io);
+                fclose(io);
+            } // if
+        } // if
+#ifdef _WIN32
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    } // while
+    closedir(dirp);
+#endif
+    return retval;
+} // program_binary_files
+
+static void destroy_test_effect(TestEffect *fx)
+{
+    MOJOSHADER_freeParseData(fx->objects[0].shader.shader);
+    MOJOSHADER_freeParseData(fx->objects[1].shader.shader);
+    free(fx);
+} // destroy_test_effect
+
+
+// The tests...
+
+// Every config makes a context, compiles the sprite effect, draws with it,
+//  and gives back every GL shader it made.
+static int test_contexts(void)
+{
+    int i;
+    for (i = 0; i < stub_config_count; i++)
+    {
+        const StubConfig *cfg = &stub_configs[i];
+        MOJOSHADER_glContext *ctx = create_context(cfg);
+        MOJOSHADER_glEffect *glEffect;
+        StubEffect *fx;
+
+        CHECK(ctx != NULL);
+        fx = stub_create_effect(cfg->profile);
+        CHECK(fx != NULL);
+        glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+        CHECK(glEffect != NULL);
+        draw_pass(glEffect, 0);
+        CHECK_NO_ERROR();
+
+        MOJOSHADER_glBindProgram(NULL);
+        MOJOSHADER_glDeleteEffect(glEffect);
+        stub_destroy_effect(fx);
+        destroy_context(ctx);
+        CHECK(stub_live_shaders() == 0);
+    } // for
+    return 1;
+} // test_contexts
+
+
+// Effect parameters of every kind reach the register files, and the GL, with
+//  the right conversions: float matrices and vectors (one merged copy),
+//  ints in float registers (whole rows and scalars), int registers, and
+//  bools packed down into the bool registers.
+static int test_copy_plan(void)
+{
+    static const CtabConstant constants[] =
+    {
+        { "World", MOJOSHADER_SYMREGSET_FLOAT4, 0, 4, MOJOSHADER_SYMCLASS_MATRIX_COLUMNS, 4, 4, MOJOSHADER_SYMTYPE_FLOAT },
+        { "Light", MOJOSHADER_SYMREGSET_FLOAT4, 4, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+        { "Count", MOJOSHADER_SYMREGSET_FLOAT4, 5, 1, MOJOSHADER_SYMCLASS_SCALAR, 1, 1, MOJOSHADER_SYMTYPE_INT },
+        { "Offsets", MOJOSHADER_SYMREGSET_FLOAT4, 6, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_INT },
+        { "Loops", MOJOSHADER_SYMREGSET_INT4, 0, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_INT },
+        { "Flags", MOJOSHADER_SYMREGSET_BOOL, 0, 2, MOJOSHADER_SYMCLASS_SCALAR, 1, 1, MOJOSHADER_SYMTYPE_BOOL },
+    };
+    static const unsigned int body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+        OP_DCL, 0x80000005, DST(REG_INPUT, 1, 0xF),  // dcl_texcoord v1
+        OP_DP4, DST(REG_RASTOUT, 0, 0x1), SRC(REG_INPUT, 0), SRC(REG_CONST, 0),
+        OP_DP4, DST(REG_RASTOUT, 0, 0x2), SRC(REG_INPUT, 0), SRC(REG_CONST, 1),
+        OP_DP4, DST(REG_RASTOUT, 0, 0x4), SRC(REG_INPUT, 0), SRC(REG_CONST, 2),
+        OP_DP4, DST(REG_RASTOUT, 0, 0x8), SRC(REG_INPUT, 0), SRC(REG_CONST, 3),
+        OP_MUL, DST(REG_TEXCRDOUT, 0, 0xF), SRC(REG_INPUT, 1), SRC(REG_CONST, 4),
+        OP_MUL, DST(REG_TEXCRDOUT, 1, 0xF), SRC(REG_INPUT, 1), SRC(REG_CONST, 5),
+        OP_MUL, DST(REG_TEXCRDOUT, 2, 0xF), SRC(REG_INPUT, 1), SRC(REG_CONST, 6),
+        OP_END
+    };
+    enum { WORLD, LIGHT, COUNT, OFFSETS, LOOPS, FLAGS };
+    const StubConfig *cfg = &stub_configs[0];
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect;
+    MOJOSHADER_effectStateChanges changes;
+    TestEffect *fx;
+    float expect[7 * 4];
+    float regf[7 * 4];
+    float junk[4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+    int regi[4], regb[2];
+    unsigned int passes = 0;
+    GLint loc;
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = create_test_effect(cfg->profile, constants, 6, body, sizeof (body));
+    CHECK(fx != NULL);
+
+    // Values that were never set through the API go up on first use too.
+    for (i = 0; i < 16; i++)
+        fx->params[WORLD].value.valuesF[i] = (float) (i + 1);
+    for (i = 0; i < 4; i++)
+    {
+        fx->params[LIGHT].value.valuesF[i] = 0.5f * i;
+        fx->params[OFFSETS].value.valuesI[i] = -i;
+        fx->params[LOOPS].value.valuesI[i] = 10 + i;
+    } // for
+    fx->params[COUNT].value.valuesI[0] = 3;
+    fx->params[FLAGS].value.valuesI[0] = 1;  // one row per element.
+    fx->params[FLAGS].value.valuesI[4] = 0;
+
+    memset(expect, '\0', sizeof (expect));
+    memcpy(expect, fx->params[WORLD].value.valuesF, sizeof (float) * 20);
+    expect[20] = 3.0f;  // scalars only fill .x
+    for (i = 0; i < 4; i++)
+        expect[24 + i] = (float) -i;
+
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+    draw_pass(glEffect, 0);
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glGetVertexShaderUniformF(0, regf, 7);
+    MOJOSHADER_glGetVertexShaderUniformI(0, regi, 1);
+    MOJOSHADER_glGetVertexShaderUniformB(0, regb, 2);
+    CHECK(memcmp(regf, expect, sizeof (expect)) == 0);
+    for (i = 0; i < 4; i++)
+        CHECK(regi[i] == 10 + i);
+    CHECK((regb[0] == 1) && (regb[1] == 0));
+
+    // ...and they made it to the GL.
+    loc = stub_uniform_location("vs_uniforms_vec4");
+    CHECK(loc >= 0);
+    CHECK(memcmp(&stub_uniforms[loc], expect, sizeof (expect)) == 0);
+
+    // Nothing changed, nothing to upload.
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, 0);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glEffectCommitChanges(glEffect);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[CALL_glUniform4fv] == 0);
+
+    // Something else wrote to the register file; the effect puts its
+    //  parameters back.
+    MOJOSHADER_glSetVertexShaderUniformF(0, junk, 1);
+    MOJOSHADER_glSetVertexShaderUniformF(5, junk, 1);
+    MOJOSHADER_glEffectCommitChanges(glEffect);
+    MOJOSHADER_glGetVertexShaderUniformF(0, regf, 7);
+    CHECK(memcmp(regf, expect, sizeof (expect) - sizeof (junk) * 2) == 0);
+    CHECK(regf[20] == 3.0f);
+
+    // A set goes up at the next commit.
+    i = 7;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[COUNT], &i, 0, sizeof (i));
+    i = 1;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[FLAGS], &i, 16, sizeof (i));
+    MOJOSHADER_glEffectCommitChanges(glEffect);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetVertexShaderUniformF(5, regf, 1);
+    MOJOSHADER_glGetVertexShaderUniformB(0, regb, 2);
+    CHECK(regf[0] == 7.0f);
+    CHECK(stub_uniforms[loc + 5].f[0] == 7.0f);
+    CHECK((regb[0] == 1) && (regb[1] == 1));
+
+    // FNA writes value.values directly and never touches the version, so
+    //  a parameter that was never set has to be checked every time.
+    fx->params[LIGHT].value.valuesF[0] = 9.0f;
+    MOJOSHADER_glEffectCommitChanges(glEffect);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_uniforms[loc + 4].f[0] == 9.0f);
+    fx->params[LIGHT].value.valuesF[0] = 10.0f;
+    MOJOSHADER_glEffectCommitChanges(glEffect);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_uniforms[loc + 4].f[0] == 10.0f);
+
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+    MOJOSHADER_glDeleteEffect(glEffect);
+    destroy_test_effect(fx);
+    destroy_context(ctx);
+    return 1;
+} // test_copy_plan
+
+
+// Linked programs go to the program binary cache, and come back from it
+//  without a link. Binaries the driver rejects fall back to a full link,
+//  and files that don't add up are misses that get deleted.
+static int test_binary_cache(void)
+{
+    static const char *dir = "gltest_binaries";
+    const StubConfig *cfg = &stub_configs[2];  // GL 4.5, GLSL.
+    MOJOSHADER_glStats stats;
+    unsigned long long links;
+    int files;
+
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+
+    // Start with an empty cache: that's the truncation check at the end,
+    //  on whatever an earlier run left behind.
+    program_binary_files(dir, CACHE_TRUNCATE);
+    CHECK(draw_with_binary_cache(cfg, dir, 1, &stats));
+    CHECK(program_binary_files(dir, CACHE_COUNT) == 0);
+
+    // Cold: every program is linked, and saved.
+    CHECK(draw_with_binary_cache(cfg, dir, 0, &stats));
+    CHECK_NO_ERROR();
+    links = stats.program_links;
+    files = program_binary_files(dir, CACHE_COUNT);
+    CHECK(links > 0);
+    CHECK(stats.program_binaries_loaded == 0);
+    CHECK(stats.program_binaries_missed == links);
+    CHECK(stub_calls[CALL_glGetProgramBinary] == links);
+    CHECK(files == (int) links);
+
+    // Warm: every program comes from the cache, nothing is linked.
+    CHECK(draw_with_binary_cache(cfg, dir, 0, &stats));
+    CHECK_NO_ERROR();
+    CHECK(stats.program_links == 0);
+    CHECK(stats.program_binaries_loaded == links);
+    CHECK(stats.program_binaries_missed == 0);
+    CHECK(stub_calls[CALL_glLinkProgram] == 0);
+    CHECK(stub_calls[CALL_glProgramBinary] == links);
+
+    // The driver rejects the binaries: link them after all, and save the
+    //  new ones over the old.
+    CHECK(program_binary_files(dir, CACHE_TAMPER) == files);
+    CHECK(draw_with_binary_cache(cfg, dir, 0, &stats));
+    CHECK_NO_ERROR();
+    CHECK(stats.program_binaries_loaded == 0);
+    CHECK(stats.program_binaries_missed == links);
+    CHECK(stats.program_links == links);
+    CHECK(draw_with_binary_cache(cfg, dir, 0, &stats));
+    CHECK(stats.program_binaries_loaded == links);
+
+    // Truncated files never reach the driver, and are deleted. The driver
+    //  has no binaries to give us this time, so nothing takes their place.
+    CHECK(program_binary_files(dir, CACHE_TRUNCATE) == files);
+    CHECK(draw_with_binary_cache(cfg, dir, 1, &stats));
+    CHECK_NO_ERROR();
+    CHECK(stats.program_links == links);
+    CHECK(stub_calls[CALL_glProgramBinary] == 0);
+    CHECK(stats.program_binaries_loaded == 0);
+    CHECK(program_binary_files(dir, CACHE_COUNT) == 0);
+    return 1;
+} // test_binary_cache
+
+
+// glslubo fills a std140 block per stage, from the float, int and bool
+//  register files in that order. A stage with no uniforms binds nothing,
+//  and one with only some kinds leaves the others out.
+static int test_uniform_blocks(void)
+{
+    const StubConfig *cfg = &stub_configs[3];  // GL 4.5, GLSLUBO.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect;
+    StubEffect *fx;
+    float matrix[16];
+    float color[4] = { 0.25f, 0.5f, 0.75f, 1.0f };
+    float tint[4] = { 2.0f, 3.0f, 4.0f, 5.0f };
+    int i;
+
+    CHECK(ctx != NULL);
+    CHECK(strcmp(cfg->profile, MOJOSHADER_PROFILE_GLSLUBO) == 0);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+
+    for (i = 0; i < 16; i++)
+        matrix[i] = (float) i;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_MATRIX], matrix,
+                                       0, sizeof (matrix));
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_COLOR], color,
+                                       0, sizeof (color));
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_TINT], tint,
+                                       0, sizeof (tint));
+
+    // The plain sprite's pixel shader has no uniforms at all.
+    draw_pass(glEffect, 0);
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[CALL_glBindBufferRange] == 1);
+    CHECK(stub_uniform_block_sizes[0] == 5 * 16);
+    CHECK(memcmp(stub_uniform_blocks[0], matrix, sizeof (matrix)) == 0);
+    CHECK(memcmp(stub_uniform_blocks[0] + 64, color, sizeof (color)) == 0);
+    CHECK(stub_uniform_block_sizes[1] == 0);
+
+    // The tinted one has floats, but no ints or bools.
+    MOJOSHADER_effectSetTechnique(&fx->effect, &fx->techniques[1]);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    draw_pass(glEffect, 0);
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[CALL_glBindBufferRange] == 2);
+    CHECK(stub_uniform_block_sizes[1] == 16);
+    CHECK(memcmp(stub_uniform_blocks[1], tint, sizeof (tint)) == 0);
+    CHECK(memcmp(stub_uniform_blocks[0], matrix, sizeof (matrix)) == 0);
+
+    // A new value means a fresh copy of the block in the ring.
+    color[0] = 8.0f;
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[PARAM_COLOR], color,
+                                       0, sizeof (color));
+    draw_pass(glEffect, 0);
+    CHECK(memcmp(stub_uniform_blocks[0] + 64, color, sizeof (color)) == 0);
+    CHECK(memcmp(stub_uniform_blocks[1], tint, sizeof (tint)) == 0);
+
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    return 1;
+} // test_uniform_blocks
+
+
+// A block big enough that the ring copies it forward itself, and only the
+//  changes get sent: as long as the same program pushes, and not too much
+//  changed. Either way, the block that gets bound has everything in it.
+#define WIDE_REGS 64
+static int test_uniform_block_changes(void)
+{
+    static unsigned int body[4 * WIDE_REGS + 16];
+    static unsigned int vs_buf[4 * WIDE_REGS + 64];
+    static unsigned int ps_buf[64];
+    static float regs[WIDE_REGS * 4];
+    const StubConfig *cfg = &stub_configs[3];  // GL 4.5, GLSLUBO.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glShader *vs, *ps;
+    MOJOSHADER_glProgram *program, *other;
+    MOJOSHADER_glStats before, after;
+    size_t vslen, pslen;
+    size_t len = 0;
+    int i;
+
+    CHECK(ctx != NULL);
+    body[len++] = OP_DCL;  // dcl_position v0
+    body[len++] = 0x80000000;
+    body[len++] = DST(REG_INPUT, 0, 0xF);
+    body[len++] = OP_MOV;  // mov r0, c0
+    body[len++] = DST(REG_TEMP, 0, 0xF);
+    body[len++] = SRC(REG_CONST, 0);
+    for (i = 1; i < WIDE_REGS; i++)
+    {
+        body[len++] = OP_ADD;  // add r0, r0, c(i)
+        body[len++] = DST(REG_TEMP, 0, 0xF);
+        body[len++] = SRC(REG_TEMP, 0);
+        body[len++] = SRC(REG_CONST, i);
+    } // for
+    body[len++] = OP_MUL;  // mul oPos, v0, r0
+    body[len++] = DST(REG_RASTOUT, 0, 0xF);
+    body[len++] = SRC(REG_INPUT, 0);
+    body[len++] = SRC(REG_TEMP, 0);
+    body[len++] = OP_END;
+
+    vslen = stub_build_shader(vs_buf, VERSION_VS_2_0, NULL, 0, body,
+                              len * sizeof (unsigned int));
+    pslen = stub_build_shader(ps_buf, VERSION_PS_2_0, NULL, 0,
+                              ps_passthrough_body,
+                              sizeof (ps_passthrough_body));
+    vs = MOJOSHADER_glCompileShader((const unsigned char *) vs_buf,
+                                    (unsigned int) vslen, NULL, 0, NULL, 0);
+    ps = MOJOSHADER_glCompileShader((const unsigned char *) ps_buf,
+                                    (unsigned int) pslen, NULL, 0, NULL, 0);
+    CHECK((vs != NULL) && (ps != NULL));
+    program = MOJOSHADER_glLinkProgram(vs, ps);
+    CHECK(program != NULL);
+
+    for (i = 0; i < WIDE_REGS * 4; i++)
+        regs[i] = (float) i;
+    MOJOSHADER_glBindProgram(program);
+    MOJOSHADER_glSetVertexShaderUniformF(0, regs, WIDE_REGS);
+    MOJOSHADER_glProgramReady();
+    CHECK_NO_ERROR();
+    CHECK(stub_uniform_block_sizes[0] == WIDE_REGS * 16);
+    CHECK(memcmp(stub_uniform_blocks[0], regs, sizeof (regs)) == 0);
+
+    // One register: the last push gets copied forward, and 16 bytes sent.
+    regs[4 * 10] = -1.0f;
+    MOJOSHADER_glGetStats(&before);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(10, regs + (4 * 10), 1);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetStats(&after);
+    CHECK(stub_calls[CALL_glCopyBufferSubData] == 1);
+    CHECK(stub_calls[CALL_glBufferSubData] == 1);
+    CHECK(after.uniform_bytes_uploaded - before.uniform_bytes_uploaded == 16);
+    CHECK(memcmp(stub_uniform_blocks[0], regs, sizeof (regs)) == 0);
+
+    // Most of it: a fresh copy is cheaper.
+    for (i = 0; i < WIDE_REGS * 4; i += 2)
+        regs[i] += 100.0f;
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(0, regs, WIDE_REGS);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[CALL_glCopyBufferSubData] == 0);
+    CHECK(stub_calls[CALL_glBufferSubData] == 0);
+    CHECK(memcmp(stub_uniform_blocks[0], regs, sizeof (regs)) == 0);
+
+    // Another program pushed in between, so ours isn't at the end of the
+    //  ring anymore, and it goes up whole.
+    other = MOJOSHADER_glLinkProgram(vs, NULL);
+    CHECK(other != NULL);
+    MOJOSHADER_glBindProgram(other);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glBindProgram(program);
+    regs[4 * 20] = -2.0f;
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(20, regs + (4 * 20), 1);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[CALL_glCopyBufferSubData] == 0);
+    CHECK(memcmp(stub_uniform_blocks[0], regs, sizeof (regs)) == 0);
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glDeleteProgram(other);
+    MOJOSHADER_glDeleteProgram(program);
+    MOJOSHADER_glDeleteShader(vs);
+    MOJOSHADER_glDeleteShader(ps);
+    destroy_context(ctx);
+    return 1;
+} // test_uniform_block_changes
+
+
+// ProgramReady() with nothing changed costs no GL calls, and a change only
+//  uploads the registers that changed.
+static int test_program_ready(void)
+{
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect;
+    MOJOSHADER_effectStateChanges changes;
+    MOJOSHADER_glStats before, after;
+    unsigned int passes = 0;
+    float regs[5 * 4];
+    StubEffect *fx;
+    GLint loc;
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, 0);
+    MOJOSHADER_glProgramReady();
+    CHECK_NO_ERROR();
+    loc = stub_uniform_location("vs_uniforms_vec4");
+    CHECK(loc >= 0);
+
+    #define COUNT_GL_CALLS(total) \
+        do { \
+            total = 0; \
+            for (i = 0; i < CALL_TOTAL; i++) \
+                total += stub_calls[i]; \
+        } while (0)
+
+    {
+        unsigned long long total;
+        memset(stub_calls, '\0', sizeof (stub_calls));
+        for (i = 0; i < 100; i++)
+            MOJOSHADER_glProgramReady();
+        COUNT_GL_CALLS(total);
+        CHECK(total == 0);
+    }
+
+    // One register: one upload, of just that register.
+    for (i = 0; i < 20; i++)
+        regs[i] = (float) (i + 100);
+    MOJOSHADER_glGetStats(&before);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(4, regs, 1);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetStats(&after);
+    CHECK(stub_calls[CALL_glUniform4fv] == 1);
+    CHECK(after.uniform_bytes_uploaded - before.uniform_bytes_uploaded == 16);
+    CHECK(memcmp(stub_uniforms[loc + 4].f, regs, 16) == 0);
+
+    // Registers 1 and 3: one upload, covering 1 through 3.
+    MOJOSHADER_glGetStats(&before);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(1, regs + 4, 1);
+    MOJOSHADER_glSetVertexShaderUniformF(3, regs + 12, 1);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetStats(&after);
+    CHECK(stub_calls[CALL_glUniform4fv] == 1);
+    CHECK(after.uniform_bytes_uploaded - before.uniform_bytes_uploaded == 48);
+    CHECK(memcmp(stub_uniforms[loc + 1].f, regs + 4, 16) == 0);
+    CHECK(memcmp(stub_uniforms[loc + 3].f, regs + 12, 16) == 0);
+
+    // Setting a register to what it already holds isn't a change.
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(3, regs + 12, 1);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[CALL_glUniform4fv] == 0);
+
+    #undef COUNT_GL_CALLS
+
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    return 1;
+} // test_program_ready
+
+
+// Switching parameter blocks between draws only uploads the registers where
+//  the blocks differ, and a set through a block goes up like any other.
+static int test_param_blocks(void)
+{
+    static const CtabConstant constants[] =
+    {
+        { "A", MOJOSHADER_SYMREGSET_FLOAT4, 0, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+        { "B", MOJOSHADER_SYMREGSET_FLOAT4, 1, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+        { "C", MOJOSHADER_SYMREGSET_FLOAT4, 2, 1, MOJOSHADER_SYMCLASS_VECTOR, 1, 4, MOJOSHADER_SYMTYPE_FLOAT },
+    };
+    static const unsigned int body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+        OP_MUL, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0), SRC(REG_CONST, 0),
+        OP_MUL, DST(REG_TEXCRDOUT, 0, 0xF), SRC(REG_INPUT, 0), SRC(REG_CONST, 1),
+        OP_MUL, DST(REG_TEXCRDOUT, 1, 0xF), SRC(REG_INPUT, 0), SRC(REG_CONST, 2),
+        OP_END
+    };
+    static const float poison[4] = { -7.0f, -7.0f, -7.0f, -7.0f };
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_effectParamBlock *blocks[2];
+    MOJOSHADER_glEffect *glEffect;
+    MOJOSHADER_glStats before, after;
+    TestEffect *fx;
+    float b0[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+    float b1[4] = { 5.0f, 6.0f, 7.0f, 8.0f };
+    float c1[4] = { 9.0f, 10.0f, 11.0f, 12.0f };
+    float a[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+    GLint loc;
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = create_test_effect(cfg->profile, constants, 3, body, sizeof (body));
+    CHECK(fx != NULL);
+    MOJOSHADER_effectSetRawValueHandle(&fx->params[0], a, 0, sizeof (a));
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+
+    // Both blocks start out as copies of the effect's values; they only
+    //  differ in B.
+    for (i = 0; i < 2; i++)
+    {
+        blocks[i] = MOJOSHADER_effectCreateParamBlock(&fx->effect);
+        CHECK(blocks[i] != NULL);
+    } // for
+    MOJOSHADER_effectParamBlockSetRawValueHandle(blocks[0], &fx->params[1],
+                                                 b0, 0, sizeof (b0));
+    MOJOSHADER_effectParamBlockSetRawValueHandle(blocks[1], &fx->params[1],
+                                                 b1, 0, sizeof (b1));
+
+    MOJOSHADER_glEffectBindParamBlock(glEffect, blocks[0]);
+    draw_pass(glEffect, 0);
+    CHECK_NO_ERROR();
+    loc = stub_uniform_location("vs_uniforms_vec4");
+    CHECK(loc >= 0);
+    CHECK(memcmp(stub_uniforms[loc].f, a, sizeof (a)) == 0);
+    CHECK(memcmp(stub_uniforms[loc + 1].f, b0, sizeof (b0)) == 0);
+
+    // Anything that goes up where it shouldn't gets caught by the poison.
+    for (i = 0; i < 2; i++)
+    {
+        const float *expect = (i == 0) ? b1 : b0;
+        MOJOSHADER_glEffectBindParamBlock(glEffect, blocks[i ^ 1]);
+        memcpy(stub_uniforms[loc].f, poison, sizeof (poison));
+        memcpy(stub_uniforms[loc + 2].f, poison, sizeof (poison));
+        MOJOSHADER_glGetStats(&before);
+        memset(stub_calls, '\0', sizeof (stub_calls));
+        draw_pass(glEffect, 0);
+        MOJOSHADER_glGetStats(&after);
+        CHECK(stub_calls[CALL_glUniform4fv] == 1);
+        CHECK(after.uniform_bytes_uploaded - before.uniform_bytes_uploaded == 16);
+        CHECK(memcmp(stub_uniforms[loc + 1].f, expect, 16) == 0);
+        CHECK(memcmp(stub_uniforms[loc].f, poison, sizeof (poison)) == 0);
+        CHECK(memcmp(stub_uniforms[loc + 2].f, poison, sizeof (poison)) == 0);
+    } // for
+
+    // A set through the bound block goes up, and only that register.
+    MOJOSHADER_effectParamBlockSetRawValueHandle(blocks[0], &fx->params[2],
+                                                 c1, 0, sizeof (c1));
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    draw_pass(glEffect, 0);
+    CHECK(stub_calls[CALL_glUniform4fv] == 1);
+    CHECK(memcmp(stub_uniforms[loc + 2].f, c1, sizeof (c1)) == 0);
+    CHECK(memcmp(stub_uniforms[loc].f, poison, sizeof (poison)) == 0);
+
+    // Same block, nothing new: nothing to upload.
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    draw_pass(glEffect, 0);
+    CHECK(stub_calls[CALL_glUniform4fv] == 0);
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glEffectBindParamBlock(glEffect, NULL);
+    MOJOSHADER_glDeleteEffect(glEffect);
+    MOJOSHADER_effectDeleteParamBlock(blocks[0]);
+    MOJOSHADER_effectDeleteParamBlock(blocks[1]);
+    destroy_test_effect(fx);
+    destroy_context(ctx);
+    return 1;
+} // test_param_blocks
+
+
+// With a linker cache budget, binding more shader pairs than it allows
+//  evicts the least recently bound ones, but never the bound program, and
+//  an evicted pair just links again the next time it's bound.
+#define BUDGET_PAIRS 4
+static int test_linker_budget(void)
+{
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glShader *vs[BUDGET_PAIRS];
+    MOJOSHADER_glShader *ps;
+    MOJOSHADER_glStats stats;
+    unsigned int buf[64];
+    unsigned long long links;
+    size_t len;
+    int i;
+
+    CHECK(ctx != NULL);
+    len = stub_build_shader(buf, VERSION_PS_2_0, NULL, 0, ps_passthrough_body,
+                            sizeof (ps_passthrough_body));
+    ps = MOJOSHADER_glCompileShader((const unsigned char *) buf,
+                                    (unsigned int) len, NULL, 0, NULL, 0);
+    CHECK(ps != NULL);
+
+    // A different constant in each, so they don't intern to one shader.
+    for (i = 0; i < BUDGET_PAIRS; i++)
+    {
+        unsigned int body[] =
+        {
+            OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+            OP_MUL, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0), 0,
+            OP_END
+        };
+        body[6] = SRC(REG_CONST, i);  // mul oPos, v0, c(i)
+        len = stub_build_shader(buf, VERSION_VS_2_0, NULL, 0, body,
+                                sizeof (body));
+        vs[i] = MOJOSHADER_glCompileShader((const unsigned char *) buf,
+                                           (unsigned int) len, NULL, 0,
+                                           NULL, 0);
+        CHECK(vs[i] != NULL);
+    } // for
+
+    MOJOSHADER_glSetLinkerCacheBudget(2, 0);
+    MOJOSHADER_glResetStats();
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    for (i = 0; i < BUDGET_PAIRS; i++)
+    {
+        MOJOSHADER_glBindShaders(vs[i], ps);
+        MOJOSHADER_glProgramReady();
+    } // for
+    CHECK_NO_ERROR();
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stub_calls[CALL_glLinkProgram] == BUDGET_PAIRS);
+    CHECK(stats.linker_cache_evictions == BUDGET_PAIRS - 2);
+    CHECK(stats.linker_cache_programs == 2);
+
+    // The newest pairs are still linked...
+    links = stub_calls[CALL_glLinkProgram];
+    MOJOSHADER_glBindShaders(vs[BUDGET_PAIRS - 2], ps);
+    MOJOSHADER_glBindShaders(vs[BUDGET_PAIRS - 1], ps);
+    CHECK(stub_calls[CALL_glLinkProgram] == links);
+
+    // ...and the oldest links again, pushing out the next oldest.
+    MOJOSHADER_glBindShaders(vs[0], ps);
+    MOJOSHADER_glProgramReady();
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stub_calls[CALL_glLinkProgram] == links + 1);
+    CHECK(stats.linker_cache_evictions == BUDGET_PAIRS - 1);
+    CHECK(stats.linker_cache_programs == 2);
+
+    // No program fits in a byte, but the bound one stays anyway.
+    MOJOSHADER_glSetLinkerCacheBudget(0, 1);
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stats.linker_cache_evictions == BUDGET_PAIRS);
+    CHECK(stats.linker_cache_programs == 1);
+    links = stub_calls[CALL_glLinkProgram];
+    MOJOSHADER_glBindShaders(vs[0], ps);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[CALL_glLinkProgram] == links);
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glBindShaders(NULL, NULL);
+    for (i = 0; i < BUDGET_PAIRS; i++)
+        MOJOSHADER_glDeleteShader(vs[i]);
+    MOJOSHADER_glDeleteShader(ps);
+    destroy_context(ctx);
+    CHECK(stub_live_shaders() == 0);
+    return 1;
+} // test_linker_budget
+
+
+// Set up the sprite effect's attributes the way one vertex declaration
+//  would: (stride) apart, in buffer (buffer).
+static void set_sprite_attributes(const unsigned long long decl,
+                                  const unsigned int buffer,
+                                  const unsigned int stride)
+{
+    const char *vertices = (const char *) 0;
+    MOJOSHADER_glSetVertexDeclaration(decl);
+    MOJOSHADER_glSetVertexBuffer(buffer);
+    MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_POSITION, 0, 3,
+                                    MOJOSHADER_ATTRIBUTE_FLOAT, 0,
+                                    stride, vertices);
+    MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_TEXCOORD, 0, 2,
+                                    MOJOSHADER_ATTRIBUTE_FLOAT, 0,
+                                    stride, vertices + 12);
+    MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_COLOR, 0, 4,
+                                    MOJOSHADER_ATTRIBUTE_UBYTE, 1,
+                                    stride, vertices + 20);
+    MOJOSHADER_glProgramReady();
+} // set_sprite_attributes
+
+// With the vertex array cache on, going back to a declaration we've seen
+//  is one glBindVertexArray(), with no attribute calls at all.
+static int test_vertex_arrays(void)
+{
+    const StubConfig *cfg = &stub_configs[1];  // GL 3.3, has VAOs.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect;
+    MOJOSHADER_effectStateChanges changes;
+    MOJOSHADER_glStats stats;
+    unsigned int passes = 0;
+    StubEffect *fx;
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+    CHECK(MOJOSHADER_glSetVertexArrayCache(1));
+
+    MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+    MOJOSHADER_glEffectBeginPass(glEffect, 0);
+
+    // The first visit to each sets up a new vertex array.
+    set_sprite_attributes(1, 1, 24);
+    set_sprite_attributes(2, 2, 32);
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[CALL_glVertexAttribPointer] == 6);
+
+    MOJOSHADER_glResetStats();
+    for (i = 0; i < 4; i++)
+    {
+        memset(stub_calls, '\0', sizeof (stub_calls));
+        if (i & 1)
+            set_sprite_attributes(2, 2, 32);
+        else
+            set_sprite_attributes(1, 1, 24);
+        CHECK(stub_calls[CALL_glBindVertexArray] == 1);
+        CHECK(stub_calls[CALL_glVertexAttribPointer] == 0);
+        CHECK(stub_calls[CALL_glEnableVertexAttribArray] == 0);
+        CHECK(stub_calls[CALL_glDisableVertexAttribArray] == 0);
+    } // for
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stats.vertex_array_binds == 4);
+    CHECK(stats.vertex_array_objects == 2);
+
+    // Same declaration again: already bound, nothing to do.
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    set_sprite_attributes(2, 2, 32);
+    CHECK(stub_calls[CALL_glBindVertexArray] == 0);
+    CHECK(stub_calls[CALL_glVertexAttribPointer] == 0);
+
+    MOJOSHADER_glEffectEndPass(glEffect);
+    MOJOSHADER_glEffectEnd(glEffect);
+    CHECK(!MOJOSHADER_glSetVertexArrayCache(0));
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stats.vertex_array_objects == 0);
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    return 1;
+} // test_vertex_arrays
+
+
+// A static pass whose link fails is only linked once, not on every
+//  BeginPass.
+static int test_failed_pass(void)
+{
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glEffect *glEffect;
+    StubEffect *fx;
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+
+    stub_fail_links = 1;
+    for (i = 0; i < 3; i++)
+        draw_pass(glEffect, 0);
+    CHECK(stub_calls[CALL_glLinkProgram] == 1);
+    CHECK(stub_calls[CALL_glUseProgram] == 0);
+    CHECK(*MOJOSHADER_glGetError() != '\0');
+
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    CHECK(stub_live_shaders() == 0);
+    return 1;
+} // test_failed_pass
+
+
+// MOJOSHADER_glEffectPrewarm() links every pairing a pass can bind, shader
+//  arrays included, stops when it's out of time, and leaves nothing for
+//  BeginPass to link. The sprite effect gets a third technique: a static
+//  pass, then a pass whose pixel shader a preshader picks from the tinted
+//  shader and one no other pass uses.
+static int test_prewarm(void)
+{
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_effectObject objects[OBJ_COUNT + 2];
+    MOJOSHADER_effectParam params[PARAM_COUNT + 2];
+    MOJOSHADER_effectTechnique techniques[3];
+    MOJOSHADER_effectPass passes[2];
+    MOJOSHADER_effectState states[3];
+    MOJOSHADER_preshader preshader;
+    MOJOSHADER_preshaderInstruction inst;
+    MOJOSHADER_symbol symbol;
+    MOJOSHADER_glEffectPrewarmProgress progress;
+    MOJOSHADER_glEffect *glEffect;
+    const MOJOSHADER_parseData *pd;
+    StubEffect *fx;
+    unsigned int ps[256];
+    const size_t pslen = stub_build_shader(ps, VERSION_PS_2_0, NULL, 0,
+                                           ps_passthrough_body,
+                                           sizeof (ps_passthrough_body));
+    int object_index[3] = { OBJ_VS, OBJ_PS, OBJ_COUNT + 1 };
+    int choices[2] = { OBJ_PS_TINT, OBJ_COUNT };
+    unsigned int array_param = PARAM_COUNT;
+    unsigned int select_param = PARAM_COUNT + 1;
+    float preshader_regs[4];
+    float select[4];
+    int i;
+
+    CHECK(ctx != NULL);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    pd = test_parse(cfg->profile, ps, pslen);
+    CHECK(pd != NULL);
+
+    // select.x is the index into choices.
+    memset(select, '\0', sizeof (select));
+    memset(params, '\0', sizeof (params));
+    memcpy(params, fx->params, sizeof (fx->params));
+    params[array_param].value.name = "Shaders";
+    params[array_param].value.type.parameter_class = MOJOSHADER_SYMCLASS_OBJECT;
+    params[array_param].value.type.parameter_type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    params[array_param].value.value_count = 2;
+    params[array_param].value.valuesI = choices;
+    params[select_param].value.name = "Select";
+    params[select_param].value.type.parameter_class = MOJOSHADER_SYMCLASS_SCALAR;
+    params[select_param].value.type.parameter_type = MOJOSHADER_SYMTYPE_FLOAT;
+    params[select_param].value.type.rows = 1;
+    params[select_param].value.type.columns = 1;
+    params[select_param].value.value_count = 4;
+    params[select_param].value.valuesF = select;
+
+    // mov o0.x, Select.x
+    memset(&inst, '\0', sizeof (inst));
+    inst.opcode = MOJOSHADER_PRESHADEROP_MOV;
+    inst.element_count = 1;
+    inst.operand_count = 2;
+    inst.operands[0].type = MOJOSHADER_PRESHADEROPERAND_INPUT;
+    inst.operands[1].type = MOJOSHADER_PRESHADEROPERAND_OUTPUT;
+    memset(&symbol, '\0', sizeof (symbol));
+    symbol.name = "Select";
+    symbol.register_set = MOJOSHADER_SYMREGSET_FLOAT4;
+    symbol.register_count = 1;
+    memset(&preshader, '\0', sizeof (preshader));
+    preshader.symbol_count = 1;
+    preshader.symbols = &symbol;
+    preshader.instruction_count = 1;
+    preshader.instructions = &inst;
+    preshader.register_count = 1;
+    preshader.registers = preshader_regs;
+
+    memset(objects, '\0', sizeof (objects));
+    memcpy(objects, fx->objects, sizeof (fx->objects));
+    objects[OBJ_COUNT].type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    objects[OBJ_COUNT].shader.type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    objects[OBJ_COUNT].shader.shader = pd;
+    objects[OBJ_COUNT + 1].type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    objects[OBJ_COUNT + 1].shader.type = MOJOSHADER_SYMTYPE_PIXELSHADER;
+    objects[OBJ_COUNT + 1].shader.is_preshader = 1;
+    objects[OBJ_COUNT + 1].shader.param_count = 1;
+    objects[OBJ_COUNT + 1].shader.params = &array_param;
+    objects[OBJ_COUNT + 1].shader.preshader_param_count = 1;
+    objects[OBJ_COUNT + 1].shader.preshader_params = &select_param;
+    objects[OBJ_COUNT + 1].shader.preshader = &preshader;
+
+    memset(states, '\0', sizeof (states));
+    states[0].type = MOJOSHADER_RS_VERTEXSHADER;
+    states[0].value.valuesI = &object_index[0];
+    states[1].type = MOJOSHADER_RS_PIXELSHADER;
+    states[1].value.valuesI = &object_index[1];
+    states[2].type = MOJOSHADER_RS_PIXELSHADER;
+    states[2].value.valuesI = &object_index[2];
+    memset(passes, '\0', sizeof (passes));
+    passes[0].name = "Static";
+    passes[0].state_count = 2;
+    passes[0].states = &states[0];
+    passes[1].name = "Selected";  // keeps the vertex shader from "Static".
+    passes[1].state_count = 1;
+    passes[1].states = &states[2];
+    memcpy(techniques, fx->techniques, sizeof (fx->techniques));
+    memset(&techniques[2], '\0', sizeof (techniques[2]));
+    techniques[2].name = "Selected";
+    techniques[2].pass_count = 2;
+    techniques[2].passes = passes;
+
+    fx->effect.param_count = PARAM_COUNT + 2;
+    fx->effect.params = params;
+    fx->effect.object_count = OBJ_COUNT + 2;
+    fx->effect.objects = objects;
+    fx->effect.technique_count = 3;
+    fx->effect.techniques = techniques;
+    fx->effect.current_technique = &techniques[2];
+
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[CALL_glLinkProgram] == 0);
+
+    // Sprite, TintedSprite, and the shader only the array has. Each link
+    //  outlasts the budget, so each call gets through one of them.
+    stub_link_usecs = 2000;
+    for (i = 1; i <= 3; i++)
+    {
+        CHECK(MOJOSHADER_glEffectPrewarm(glEffect, 1000, &progress) == 3 - i);
+        CHECK(progress.programs_total == 3);
+        CHECK(progress.programs_linked == (unsigned int) i);
+        CHECK(progress.programs_failed == 0);
+        CHECK(stub_calls[CALL_glLinkProgram] == (unsigned long long) i);
+    } // for
+    CHECK(progress.usecs >= 3 * 2000);
+    stub_link_usecs = 0;
+    CHECK(MOJOSHADER_glEffectPrewarm(glEffect, 0, &progress) == 0);
+    CHECK(progress.programs_linked == 3);
+    CHECK_NO_ERROR();
+
+    // Every pass binds a program, none of which needs linking.
+    for (i = 0; i < 2; i++)
+    {
+        select[0] = (float) i;
+        fx->effect.current_technique = &techniques[2];
+        draw_pass(glEffect, 0);
+        draw_pass(glEffect, 1);
+        fx->effect.current_technique = &techniques[i];
+        draw_pass(glEffect, 0);
+    } // for
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[CALL_glLinkProgram] == 3);
+    CHECK(stub_calls[CALL_glUseProgram] >= 3);
+
+    MOJOSHADER_glDeleteEffect(glEffect);
+    MOJOSHADER_freeParseData(pd);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    CHECK(stub_live_shaders() == 0);
+    return 1;
+} // test_prewarm
+
+
+// The same bytecode compiled twice, and two copies of the same effect, get
+//  one GL shader each, whichever owner is deleted first.
+static int test_interning(void)
+{
+    static const unsigned int ps_other_body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_TEXTURE, 1, 0xF),  // dcl t1
+        OP_MOV, DST(REG_COLOROUT, 0, 0xF), SRC(REG_TEXTURE, 1),
+        OP_END
+    };
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glShader *a, *b, *other;
+    MOJOSHADER_glEffect *glEffects[2];
+    StubEffect *fxs[2];
+    unsigned int ps[256], ps_other[256];
+    const size_t pslen = stub_build_shader(ps, VERSION_PS_2_0, NULL, 0,
+                                           ps_passthrough_body,
+                                           sizeof (ps_passthrough_body));
+    const size_t ps_otherlen = stub_build_shader(ps_other, VERSION_PS_2_0,
+                                                 NULL, 0, ps_other_body,
+                                                 sizeof (ps_other_body));
+    unsigned long long compiles, links;
+    int order, i;
+
+    CHECK(ctx != NULL);
+    CHECK(pslen == ps_otherlen);  // so only the bytes tell them apart.
+
+    for (order = 0; order < 2; order++)
+    {
+        compiles = stub_calls[CALL_glCompileShader];
+        a = MOJOSHADER_glCompileShader((const unsigned char *) ps,
+                                       (unsigned int) pslen,
+                                       NULL, 0, NULL, 0);
+        b = MOJOSHADER_glCompileShader((const unsigned char *) ps,
+                                       (unsigned int) pslen,
+                                       NULL, 0, NULL, 0);
+        other = MOJOSHADER_glCompileShader((const unsigned char *) ps_other,
+                                           (unsigned int) ps_otherlen,
+                                           NULL, 0, NULL, 0);
+        CHECK((a != NULL) && (a == b));
+        CHECK((other != NULL) && (other != a));
+        CHECK(stub_calls[CALL_glCompileShader] == compiles + 2);
+
+        MOJOSHADER_glDeleteShader(order ? b : a);
+        CHECK(stub_live_shaders() == 2);
+        CHECK(MOJOSHADER_glGetShaderParseData(order ? a : b) != NULL);
+        MOJOSHADER_glDeleteShader(order ? a : b);
+        MOJOSHADER_glDeleteShader(other);
+        CHECK(stub_live_shaders() == 0);
+    } // for
+
+    for (order = 0; order < 2; order++)
+    {
+        compiles = stub_calls[CALL_glCompileShader];
+        links = stub_calls[CALL_glLinkProgram];
+        for (i = 0; i < 2; i++)
+        {
+            fxs[i] = stub_create_effect(cfg->profile);
+            CHECK(fxs[i] != NULL);
+            glEffects[i] = MOJOSHADER_glCompileEffect(&fxs[i]->effect);
+            CHECK(glEffects[i] != NULL);
+            draw_pass(glEffects[i], 0);
+        } // for
+        CHECK_NO_ERROR();
+        CHECK(stub_calls[CALL_glCompileShader] == compiles + OBJ_COUNT);
+        CHECK(stub_calls[CALL_glLinkProgram] == links + 1);
+
+        // The survivor keeps its shaders, even though the parse data they
+        //  were made from went with the other effect.
+        MOJOSHADER_glDeleteEffect(glEffects[order]);
+        stub_destroy_effect(fxs[order]);
+        draw_pass(glEffects[!order], 0);
+        CHECK_NO_ERROR();
+        CHECK(stub_calls[CALL_glCompileShader] == compiles + OBJ_COUNT);
+        CHECK(stub_calls[CALL_glLinkProgram] == links + 1);
+        CHECK(stub_live_shaders() == OBJ_COUNT);
+
+        MOJOSHADER_glBindProgram(NULL);
+        MOJOSHADER_glDeleteEffect(glEffects[!order]);
+        stub_destroy_effect(fxs[!order]);
+        CHECK(stub_live_shaders() == 0);
+    } // for
+
+    destroy_context(ctx);
+    return 1;
+} // test_interning
+
+
+// Async compiles stay pending until the driver says they're done, and a
+//  program that failed to link is never bound.
+static int test_async_compile(void)
+{
+    static const StubConfig cfg =
+    {
+        "GL 2.1", MOJOSHADER_PROFILE_GLSL, "2.1 MojoShader stub", "1.20",
+        "GL_ARB_shader_objects GL_ARB_vertex_shader GL_ARB_fragment_shader "
+        "GL_ARB_shading_language_100 GL_KHR_parallel_shader_compile"
+    };
+    static const unsigned int vs_body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+        OP_MOV, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0),
+        OP_END
+    };
+    // Identical bytecode would get us the same shader back, so this one
+    //  also writes oD0.
+    static const unsigned int vs_broken_body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+        OP_MOV, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0),
+        OP_MOV, DST(REG_ATTROUT, 0, 0xF), SRC(REG_INPUT, 0),
+        OP_END
+    };
+    MOJOSHADER_glContext *ctx = create_context(&cfg);
+    MOJOSHADER_glShader *vs, *vs_broken, *ps;
+    MOJOSHADER_glProgram *program;
+    MOJOSHADER_glStats before, after;
+    unsigned int vsbuf[64], vsbuf_broken[64], psbuf[64];
+    size_t vslen, vslen_broken, pslen;
+    int i;
+
+    CHECK(ctx != NULL);
+    CHECK(MOJOSHADER_glSetAsyncCompile(1));
+    vslen = stub_build_shader(vsbuf, VERSION_VS_2_0, NULL, 0,
+                              vs_body, sizeof (vs_body));
+    vslen_broken = stub_build_shader(vsbuf_broken, VERSION_VS_2_0, NULL, 0,
+                                     vs_broken_body, sizeof (vs_broken_body));
+    pslen = stub_build_shader(psbuf, VERSION_PS_2_0, NULL, 0,
+                              ps_passthrough_body,
+                              sizeof (ps_passthrough_body));
+
+    // Pending until the third completion query says it's done.
+    stub_compile_polls = 3;
+    vs = MOJOSHADER_glCompileShader((const unsigned char *) vsbuf,
+                                    (unsigned int) vslen, NULL, 0, NULL, 0);
+    ps = MOJOSHADER_glCompileShader((const unsigned char *) psbuf,
+                                    (unsigned int) pslen, NULL, 0, NULL, 0);
+    CHECK((vs != NULL) && (ps != NULL));
+    for (i = 0; i < 3; i++)
+        CHECK(MOJOSHADER_glShaderStatus(vs, 0) == MOJOSHADER_GLSTATUS_PENDING);
+    CHECK(MOJOSHADER_glShaderStatus(vs, 0) == MOJOSHADER_GLSTATUS_READY);
+    CHECK(MOJOSHADER_glShaderStatus(vs, 0) == MOJOSHADER_GLSTATUS_READY);
+    CHECK(MOJOSHADER_glShaderStatus(ps, 1) == MOJOSHADER_GLSTATUS_READY);
+
+    // The link is pending the same way, and nothing is bound until it's done.
+    MOJOSHADER_glGetStats(&before);
+    for (i = 0; i < 3; i++)
+        CHECK(MOJOSHADER_glBindShadersAsync(vs, ps) == MOJOSHADER_GLSTATUS_PENDING);
+    MOJOSHADER_glGetStats(&after);
+    CHECK(after.program_links - before.program_links == 1);
+    CHECK(after.program_binds == before.program_binds);
+    CHECK(stub_calls[CALL_glUseProgram] == 0);
+    CHECK(MOJOSHADER_glBindShadersAsync(vs, ps) == MOJOSHADER_GLSTATUS_READY);
+    CHECK(stub_calls[CALL_glUseProgram] == 1);
+    MOJOSHADER_glProgramReady();
+    CHECK_NO_ERROR();
+
+    // A failed link is reported, and neither kind of bind will use it.
+    stub_fail_links = 1;
+    vs_broken = MOJOSHADER_glCompileShader((const unsigned char *) vsbuf_broken,
+                                           (unsigned int) vslen_broken,
+                                           NULL, 0, NULL, 0);
+    CHECK(vs_broken != NULL);
+    program = MOJOSHADER_glLinkProgram(vs_broken, ps);
+    CHECK(program != NULL);
+    CHECK(MOJOSHADER_glProgramStatus(program, 0) == MOJOSHADER_GLSTATUS_PENDING);
+    MOJOSHADER_glGetStats(&before);
+    MOJOSHADER_glBindProgram(program);  // waits, then refuses.
+    MOJOSHADER_glGetStats(&after);
+    CHECK(after.program_binds == before.program_binds);
+    CHECK(stub_calls[CALL_glUseProgram] == 1);
+    CHECK(*MOJOSHADER_glGetError() != '\0');
+    CHECK(MOJOSHADER_glProgramStatus(program, 0) == MOJOSHADER_GLSTATUS_FAILED);
+    for (i = 0; i < 3; i++)  // the pair gets its own link.
+        CHECK(MOJOSHADER_glBindShadersAsync(vs_broken, ps) == MOJOSHADER_GLSTATUS_PENDING);
+    CHECK(MOJOSHADER_glBindShadersAsync(vs_broken, ps) == MOJOSHADER_GLSTATUS_FAILED);
+    MOJOSHADER_glBindShaders(vs_broken, ps);
+    CHECK(stub_calls[CALL_glUseProgram] == 1);
+    MOJOSHADER_glProgramReady();
+
+    MOJOSHADER_glDeleteProgram(program);
+    MOJOSHADER_glBindShaders(NULL, NULL);
+    MOJOSHADER_glDeleteShader(vs_broken);
+    MOJOSHADER_glDeleteShader(vs);
+    MOJOSHADER_glDeleteShader(ps);
+    destroy_context(ctx);
+    CHECK(stub_live_shaders() == 0);
+    return 1;
+} // test_async_compile
+
+
+// Find (name) in a trace report, or NULL if it was never called.
+static const MOJOSHADER_glTraceFunctionReport *trace_function(
+                                    const MOJOSHADER_glTraceReport *report,
+                                    const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < report->function_count; i++)
+    {
+        if (strcmp(report->functions[i].name, name) == 0)
+            return &report->functions[i];
+    } // for
+    return NULL;
+} // trace_function
+
+// The same vertex array set every frame is redundant until MojoShader
+//  knows the buffer bindings, and the analyzer should say exactly that.
+static int test_trace(void)
+{
+    #define TRACE_FRAMES 4
+    const StubConfig *cfg = &stub_configs[0];  // GL 2.1, GLSL.
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    const MOJOSHADER_glTraceFunctionReport *func;
+    static MOJOSHADER_glTraceCall calls[4096];
+    static MOJOSHADER_glTraceReport report;
+    MOJOSHADER_effectStateChanges changes;
+    MOJOSHADER_glEffect *glEffect;
+    MOJOSHADER_glStats stats;
+    unsigned int passes = 0;
+    unsigned int count;
+    StubEffect *fx;
+    int frame;
+
+    CHECK(ctx != NULL);
+    fx = stub_create_effect(cfg->profile);
+    CHECK(fx != NULL);
+    glEffect = MOJOSHADER_glCompileEffect(&fx->effect);
+    CHECK(glEffect != NULL);
+
+    // With tracing off, there's nothing to get, whatever we ask for.
+    CHECK(MOJOSHADER_glGetTrace(NULL, 0) == 0);
+    CHECK(MOJOSHADER_glGetTrace(calls, 4096) == 0);
+
+    CHECK(MOJOSHADER_glSetTrace(4096));
+
+    for (frame = 0; frame < TRACE_FRAMES * 2; frame++)
+    {
+        // Halfway through, tell MojoShader what's bound, so it can skip
+        //  the calls that don't change anything.
+        if (frame == TRACE_FRAMES)
+            MOJOSHADER_glSetVertexBuffer(1);
+        MOJOSHADER_glEffectBegin(glEffect, &passes, 0, &changes);
+        MOJOSHADER_glEffectBeginPass(glEffect, 0);
+        MOJOSHADER_glSetVertexAttribute(MOJOSHADER_USAGE_POSITION, 0, 2,
+                                        MOJOSHADER_ATTRIBUTE_FLOAT, 0, 32,
+                                        (const void *) 0);
+        MOJOSHADER_glProgramReady();
+        MOJOSHADER_glEffectEndPass(glEffect);
+        MOJOSHADER_glEffectEnd(glEffect);
+        MOJOSHADER_glTraceFrame();
+    } // for
+    CHECK_NO_ERROR();
+
+    count = MOJOSHADER_glGetTrace(calls, 4096);
+    CHECK((count > 0) && (count < 4096));
+    CHECK(MOJOSHADER_glAnalyzeTrace(calls, count, &report, NULL, NULL, NULL));
+    CHECK(report.frames == (TRACE_FRAMES * 2) - 1);
+
+    // Every frame before SetVertexBuffer() repeats the first one's call.
+    //  The buffer change gets one more through, which looks redundant too,
+    //  as the analyzer never sees the app bind the buffer. After that,
+    //  MojoShader skips them.
+    func = trace_function(&report, "glVertexAttribPointer");
+    CHECK(func != NULL);
+    CHECK(func->calls == TRACE_FRAMES + 1);
+    CHECK(func->redundant == TRACE_FRAMES);
+    MOJOSHADER_glGetStats(&stats);
+    CHECK(stats.vertex_attribs_elided == TRACE_FRAMES - 1);
+
+    // Nothing else MojoShader did was redundant.
+    CHECK(report.redundant == func->redundant);
+    func = trace_function(&report, "glUseProgram");
+    CHECK((func != NULL) && (func->redundant == 0));
+
+    // Turning it off again drops what was recorded.
+    CHECK(MOJOSHADER_glGetTrace(NULL, 0) == count);
+    MOJOSHADER_glSetTrace(0);
+    CHECK(MOJOSHADER_glGetTrace(NULL, 0) == 0);
+    CHECK(MOJOSHADER_glGetTrace(calls, 4096) == 0);
+
+    MOJOSHADER_glDeleteEffect(glEffect);
+    stub_destroy_effect(fx);
+    destroy_context(ctx);
+    #undef TRACE_FRAMES
+    return 1;
+} // test_trace
+
+
+// ARB1 uploads each run of dirty registers with one
+//  glProgramLocalParameters4fvEXT() call, or one call per register without
+//  GL_EXT_gpu_program_parameters.
+static int run_arb1_batch(const StubConfig *cfg, const int batched)
+{
+    static const unsigned int vs_body[] =
+    {
+        OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+        OP_MOV, DST(REG_TEMP, 0, 0xF), SRC(REG_CONST, 0),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 1),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 2),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 3),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 4),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 5),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 6),
+        OP_ADD, DST(REG_TEMP, 0, 0xF), SRC(REG_TEMP, 0), SRC(REG_CONST, 7),
+        OP_MUL, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0), SRC(REG_TEMP, 0),
+        OP_END
+    };
+    const StubFunction batch_call = CALL_glProgramLocalParameters4fvEXT;
+    const StubFunction single_call = CALL_glProgramLocalParameter4fvARB;
+    MOJOSHADER_glContext *ctx = create_context(cfg);
+    MOJOSHADER_glShader *vs, *ps;
+    MOJOSHADER_glProgram *program;
+    unsigned int vsbuf[128], psbuf[64];
+    size_t vslen, pslen;
+    float regs[8 * 4];
+    int i;
+
+    CHECK(ctx != NULL);
+    vslen = stub_build_shader(vsbuf, VERSION_VS_2_0, NULL, 0,
+                              vs_body, sizeof (vs_body));
+    pslen = stub_build_shader(psbuf, VERSION_PS_2_0, NULL, 0,
+                              ps_passthrough_body,
+                              sizeof (ps_passthrough_body));
+    vs = MOJOSHADER_glCompileShader((const unsigned char *) vsbuf,
+                                    (unsigned int) vslen, NULL, 0, NULL, 0);
+    ps = MOJOSHADER_glCompileShader((const unsigned char *) psbuf,
+                                    (unsigned int) pslen, NULL, 0, NULL, 0);
+    CHECK((vs != NULL) && (ps != NULL));
+    program = MOJOSHADER_glLinkProgram(vs, ps);
+    CHECK(program != NULL);
+    MOJOSHADER_glBindProgram(program);
+
+    // Everything is dirty the first time: one run of eight.
+    for (i = 0; i < 8 * 4; i++)
+        regs[i] = (float) (i + 1);
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(0, regs, 8);
+    MOJOSHADER_glProgramReady();
+    CHECK_NO_ERROR();
+    CHECK(stub_calls[batch_call] == (batched ? 1 : 0));
+    CHECK(stub_calls[single_call] == (batched ? 0 : 8));
+    for (i = 0; i < 8; i++)
+        CHECK(memcmp(stub_local_params[0][i].f, regs + (i * 4), 16) == 0);
+
+    // Registers 2 and 5: the dirty range covers 2 through 5, one run.
+    regs[2 * 4] = 100.0f;
+    regs[5 * 4] = 200.0f;
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(0, regs, 8);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[batch_call] == (batched ? 1 : 0));
+    CHECK(stub_calls[single_call] == (batched ? 0 : 4));
+    for (i = 0; i < 8; i++)
+        CHECK(memcmp(stub_local_params[0][i].f, regs + (i * 4), 16) == 0);
+
+    // Nothing changed, nothing sent.
+    memset(stub_calls, '\0', sizeof (stub_calls));
+    MOJOSHADER_glSetVertexShaderUniformF(0, regs, 8);
+    MOJOSHADER_glProgramReady();
+    CHECK(stub_calls[batch_call] + stub_calls[single_call] == 0);
+
+    MOJOSHADER_glBindProgram(NULL);
+    MOJOSHADER_glDeleteProgram(program);
+    MOJOSHADER_glDeleteShader(vs);
+    MOJOSHADER_glDeleteShader(ps);
+    destroy_context(ctx);
+    return 1;
+} // run_arb1_batch
+
+static int test_arb1_batch(void)
+{
+    static const StubConfig unbatched =
+    {
+        "GL 2.1", MOJOSHADER_PROFILE_ARB1, "2.1 MojoShader stub", "1.20",
+        "GL_ARB_vertex_program GL_ARB_fragment_program "
+        "GL_ARB_instanced_arrays"
+    };
+    CHECK(strcmp(stub_configs[6].profile, MOJOSHADER_PROFILE_ARB1) == 0);
+    CHECK(run_arb1_batch(&stub_configs[6], 1));
+    CHECK(run_arb1_batch(&unbatched, 0));
+    return 1;
+} // test_arb1_batch
+
+
+// Shared contexts: a loader thread compiles and queues shaders in one
+//  context while workers translate, then two render threads use them in two
+//  more at once. This is mostly here for the sanitizers to look at.
+#define THREAD_SHADERS 16
+#define THREAD_DRAWS 2000
+typedef struct ThreadTest
+{
+    MOJOSHADER_glContext *loader;
+    MOJOSHADER_glContext *render[2];
+    MOJOSHADER_glContext *unshared;
+    MOJOSHADER_glShader *vs[THREAD_SHADERS];
+    MOJOSHADER_glShader *ps[THREAD_SHADERS];
+} ThreadTest;
+
+static int thread_translate(void *data)
+{
+    ThreadTest *test = (ThreadTest *) data;
+    while (MOJOSHADER_glTranslateQueuedShaders(test->loader, 1) > 0)
+        continue;
+    return 1;
+} // thread_translate
+
+static int thread_load(void *data)
+{
+    ThreadTest *test = (ThreadTest *) data;
+    unsigned int vsbuf[64], psbuf[64];
+    size_t vslen, pslen;
+    TestThread workers[2];
+    int i;
+
+    MOJOSHADER_glMakeContextCurrent(test->loader);
+    pslen = stub_build_shader(psbuf, VERSION_PS_2_0, NULL, 0,
+                              ps_passthrough_body,
+                              sizeof (ps_passthrough_body));
+
+    // Half compiled here, half queued for the workers. Each vertex shader
+    //  reads a different register, so none of them are interned together.
+    for (i = 0; i < THREAD_SHADERS; i++)
+    {
+        const unsigned int vs_body[] =
+        {
+            OP_DCL, 0x80000000, DST(REG_INPUT, 0, 0xF),  // dcl_position v0
+            OP_MUL, DST(REG_RASTOUT, 0, 0xF), SRC(REG_INPUT, 0),
+                    SRC(REG_CONST, (unsigned int) i),
+            OP_END
+        };
+        vslen = stub_build_shader(vsbuf, VERSION_VS_2_0, NULL, 0,
+                                  vs_body, sizeof (vs_body));
+        if (i % 2)
+        {
+            test->vs[i] = MOJOSHADER_glQueueShader(test->loader,
+                                    (const unsigned char *) vsbuf,
+                                    (unsigned int) vslen, NULL, 0, NULL, 0);
+            test->ps[i] = MOJOSHADER_glQueueShader(test->loader,
+                                    (const unsigned char *) psbuf,
+                                    (unsigned int) pslen, NULL, 0, NULL, 0);
+        } // if
+        else
+        {
+            test->vs[i] = MOJOSHADER_glCompileShader(
+                                    (const unsigned char *) vsbuf,
+                                    (unsigned int) vslen, NULL, 0, NULL, 0);
+            test->ps[i] = MOJOSHADER_glCompileShader(
+                                    (const unsigned char *) psbuf,
+                                    (unsigned int) pslen, NULL, 0, NULL, 0);
+        } // else
+        CHECK((test->vs[i] != NULL) && (test->ps[i] != NULL));
+    } // for
+
+    CHECK(start_thread(&workers[0], thread_translate, test));
+    if (!start_thread(&workers[1], thread_translate, test))
+    {
+        join_thread(&workers[0]);
+        return 0;
+    } // if
+    while (MOJOSHADER_glCompileQueuedShaders(0) > 0)
+        yield_thread();
+    join_thread(&workers[0]);
+    join_thread(&workers[1]);
+
+    for (i = 0; i < THREAD_SHADERS; i++)
+    {
+        CHECK(MOJOSHADER_glShaderStatus(test->vs[i], 0) == MOJOSHADER_GLSTATUS_READY);
+        CHECK(MOJOSHADER_glShaderStatus(test->ps[i], 0) == MOJOSHADER_GLSTATUS_READY);
+    } // for
+    CHECK_NO_ERROR();
+
+    MOJOSHADER_glMakeContextCurrent(NULL);
+    return 1;
+} // thread_load
+
+// The first render context is current on its thread, the second is only
+//  used through the MOJOSHADER_glContext*() calls.
+static int thread_render(void *data, const int which)
+{
+    ThreadTest *test = (ThreadTest *) data;
+    MOJOSHADER_glContext *ctx = test->render[which];
+    GLint loc = -1;
+    float v[4];
+    int i, j;
+
+    if (which == 0)
+        MOJOSHADER_glMakeContextCurrent(ctx);
+
+    for (j = 0; j < THREAD_DRAWS; j++)
+    {
+        i = j % THREAD_SHADERS;
+        v[0] = v[1] = v[2] = v[3] = (float) (j + which);
+        MOJOSHADER_glContextBindShaders(ctx, test->vs[i], test->ps[i]);
+        MOJOSHADER_glContextSetVertexShaderUniformF(ctx, i, v, 1);
+        MOJOSHADER_glContextProgramReady(ctx);
+
+        // Uniforms land per thread in the stub, so this was our upload.
+        //  Each shader only uses c(i), so it's the array's first element.
+        if (loc < 0)
+            loc = stub_uniform_location("vs_uniforms_vec4");
+        CHECK(loc >= 0);
+        CHECK(memcmp(stub_uniforms[loc].f, v, sizeof (v)) == 0);
+    } // for
+    CHECK_NO_ERROR();
+
+    // An unshared context won't take them, and only this thread hears.
+    if (which == 1)
+    {
+        MOJOSHADER_glContextBindShaders(test->unshared, test->vs[0],
+                                        test->ps[0]);
+        CHECK(strstr(MOJOSHADER_glGetError(), "share group") != NULL);
+    } // if
+
+    MOJOSHADER_glContextBindShaders(ctx, NULL, NULL);
+    if (which == 0)
+        MOJOSHADER_glMakeContextCurrent(NULL);
+    stub_quit();
+    return 1;
+} // thread_render
+
+static int thread_render0(void *data) { return thread_render(data, 0); }
+static int thread_render1(void *data) { return thread_render(data, 1); }
+
+static int run_threads(const StubConfig *cfg)
+{
+    static ThreadTest test;
+    TestThread threads[2];
+    int ok0, ok1;
+    int i;
+
+    memset(&test, '\0', sizeof (test));
+    test.render[0] = create_context(cfg);
+    CHECK(test.render[0] != NULL);
+    test.loader = MOJOSHADER_glCreateSharedContext(test.render[0],
+                                                   stub_lookup, NULL);
+    test.render[1] = MOJOSHADER_glCreateSharedContext(test.render[0],
+                                                      stub_lookup, NULL);
+    test.unshared = MOJOSHADER_glCreateContext(cfg->profile, stub_lookup,
+                                               NULL, NULL, NULL, NULL);
+    CHECK((test.loader != NULL) && (test.render[1] != NULL));
+    CHECK(test.unshared != NULL);
+    MOJOSHADER_glMakeContextCurrent(NULL);
+
+    CHECK(start_thread(&threads[0], thread_load, &test));
+    CHECK(join_thread(&threads[0]));
+    CHECK(start_thread(&threads[0], thread_render0, &test));
+    CHECK(start_thread(&threads[1], thread_render1, &test));
+    ok0 = join_thread(&threads[0]);
+    ok1 = join_thread(&threads[1]);
+    CHECK(ok0 && ok1);
+    CHECK(stub_live_shaders() > 0);
+
+    // Delete them from the loader; the programs the render contexts linked
+    //  keep the GL shaders until those contexts go away, in any order.
+    MOJOSHADER_glMakeContextCurrent(test.loader);
+    for (i = 0; i < THREAD_SHADERS; i++)
+    {
+        MOJOSHADER_glDeleteShader(test.vs[i]);
+        MOJOSHADER_glDeleteShader(test.ps[i]);
+    } // for
+    MOJOSHADER_glMakeContextCurrent(NULL);
+    MOJOSHADER_glDestroyContext(test.loader);
+    CHECK(stub_live_shaders() > 0);
+    MOJOSHADER_glDestroyContext(test.render[0]);
+    MOJOSHADER_glDestroyContext(test.render[1]);
+    MOJOSHADER_glDestroyContext(test.unshared);
+    stub_quit();
+    CHECK(stub_live_shaders() == 0);
+    return 1;
+} // run_threads
+
+static int test_threads(void)
+{
+    CHECK(run_threads(&stub_configs[0]));  // GL 2.1: one program per pair.
+    CHECK(run_threads(&stub_configs[2]));  // GL 4.5: separable programs.
+    return 1;
+} // test_threads
+
+
+typedef struct TestCase
+{
+    const char *name;
+    int (*fn)(void);
+} TestCase;
+
+static const TestCase tests[] =
+{
+    { "contexts", test_contexts },
+    { "copy_plan", test_copy_plan },
+    { "binary_cache", test_binary_cache },
+    { "uniform_blocks", test_uniform_blocks },
+    { "uniform_block_changes", test_uniform_block_changes },
+    { "program_ready", test_program_ready },
+    { "param_blocks", test_param_blocks },
+    { "linker_budget", test_linker_budget },
+    { "vertex_arrays", test_vertex_arrays },
+    { "trace", test_trace },
+    { "threads", test_threads },
+    { "arb1_batch", test_arb1_batch },
+    { "async_compile", test_async_compile },
+    { "failed_pass", test_failed_pass },
+    { "prewarm", test_prewarm },
+    { "interning", test_interning },
+};
+
+// MOJOSHADER_glGetError() and the stub's counts are per thread, so each
+//  test gets a thread of its own, and no test sees another's leftovers.
+static int run_test(void *data)
+{
+    return ((const TestCase *) data)->fn();
+} // run_test
+
+int main(int argc, char **argv)
+{
+    const int count = (int) (sizeof (tests) / sizeof (tests[0]));
+    TestThread thread;
+    int retval = 0;
+    int found = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if ((argc > 1) && (strcmp(argv[1], tests[i].name) != 0))
+            continue;
+        found = 1;
+        if ( (start_thread(&thread, run_test, (void *) &tests[i])) &&
+             (join_thread(&thread)) )
+            printf("%s: ok\n", tests[i].name);
+        else
+        {
+            printf("%s: FAILED\n", tests[i].name);
+            retval = 1;
+        } // else
+    } // for
+
+    if (!found)
+    {
+        fprintf(stderr, "USAGE: %s [test name]\n", argv[0]);
+        return 1;
+    } // if
+
+    return retval;
+} // main
+
+// end of gltest.c ...
+